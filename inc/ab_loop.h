@@ -0,0 +1,36 @@
+#ifndef _AB_LOOP_H
+#define _AB_LOOP_H
+#include <gst/gst.h>
+
+#include "seek_scheduler.h"
+
+/* A-B loop markers on top of the seek scheduler's segment loop, and a measurement of
+   the discontinuity at each wrap: on every watched sink, the running time between the
+   end of the last buffer before the wrap and the start of the first one after it
+   (0 is seamless, positive a gap, negative an overlap), and the wall clock time
+   between their arrivals */
+typedef struct _AbLoop AbLoop;
+
+/* The wraps themselves are seek_scheduler_segment_done's, on SEGMENT_DONE */
+AbLoop *ab_loop_new (GstElement *pipeline, SeekScheduler *seeker);
+void ab_loop_free (AbLoop *loop);
+
+/* Marks the current position as A, then as B which starts the loop, then ends it */
+void ab_loop_mark (AbLoop *loop);
+/* Loops start to stop (ns) right away */
+void ab_loop_set (AbLoop *loop, gint64 start, gint64 stop);
+
+/* Marks positions of another pipeline from now on; wraps are still measured on the
+   watched sinks only */
+void ab_loop_set_pipeline (AbLoop *loop, GstElement *pipeline);
+
+/* Measures wraps on the buffers reaching this sink */
+void ab_loop_watch_sink (AbLoop *loop, GstElement *sink, const char *name);
+
+/* Wraps measured on the first watched sink so far */
+guint ab_loop_get_wraps (AbLoop *loop);
+
+/* BenchSectionFunc appending gap statistics per watched sink, in ms */
+void ab_loop_append_json (GString *out, gdouble wall, AbLoop *loop);
+
+#endif //_AB_LOOP_H
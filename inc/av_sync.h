@@ -0,0 +1,41 @@
+#ifndef _AV_SYNC_H
+#define _AV_SYNC_H
+#include <gst/gst.h>
+
+/* Drift samples are taken at most this often */
+#define AV_SYNC_SAMPLE_MS 100
+/* Audio and video are back in sync after a seek once they drift less than this */
+#define AV_SYNC_TOLERANCE (20 * GST_MSECOND)
+/* A flash and a beep further apart than this aren't the same sync mark */
+#define AV_SYNC_MARK_WINDOW (500 * GST_MSECOND)
+
+/* A/V sync monitor on the audio and video sink pads, fed from their streaming threads.
+   A synchronising sink should present a buffer at its running time plus the sink's
+   ts-offset and the pipeline latency; lateness is how far off it really is, negative
+   when early. It is taken when the buffer is presented: from the QoS event a
+   GstBaseSink sends after each clock wait (QoS is turned on for sinks without it), or
+   for a GstAudioBaseSink, from the samples its ring buffer and device hold ahead of
+   the buffer. The drift is how much later the audio sink presents than the video
+   sink (positive: audio behind); the ts-offset playsink sets from av-offset is left
+   out. Sinks given as bins are watched through the first base sink inside. After
+   every flushing seek while playing, the recovery time
+   is how long it takes from the flush until both sinks get buffers again within
+   AV_SYNC_TOLERANCE of each other.
+
+   Sync marks in the media itself, a bright frame and the onset of a loud sound after
+   a dark and a quiet stretch, are paired up and their offset taken at presentation,
+   ts-offsets included, which is what av-offset corrects. Marks are found in 8 bit
+   video and S16/F32 audio; other formats only get drift samples */
+typedef struct _AvSync AvSync;
+
+AvSync *av_sync_new (void);
+void av_sync_free (AvSync *sync);
+
+/* Probes the sink pad of the first audio and the first video sink */
+void av_sync_watch_sink (AvSync *sync, GstElement *sink, gboolean audio);
+
+/* BenchSectionFunc appending drift statistics, a drift timeline of one second
+   averages, seek recovery times and sync mark offsets, in ms */
+void av_sync_append_json (GString *out, gdouble wall, AvSync *sync);
+
+#endif //_AV_SYNC_H
@@ -0,0 +1,52 @@
+#ifndef _BENCH_H
+#define _BENCH_H
+#include <gst/gst.h>
+
+/* Collects decode throughput numbers for --bench runs and prints them as JSON */
+typedef struct _BenchData BenchData;
+
+/* Appends the JSON value of an extra report section; wall is the measured time in seconds */
+typedef void (*BenchSectionFunc) (GString *out, gdouble wall, gpointer user_data);
+
+BenchData *bench_new (const char *uri);
+void bench_free (BenchData *bench);
+
+/* Creates a "fakesink sync=false" used in place of the real sinks in headless mode */
+GstElement *bench_make_fakesink (const char *name);
+
+/* Counts every buffer reaching the sink pad of the given video sink */
+void bench_watch_video_sink (BenchData *bench, GstElement *sink);
+
+/* Counts on another video sink from now on, e.g. after a pooled input switch; frame
+   counts, intervals and drops go on adding up */
+void bench_set_video_sink (BenchData *bench, GstElement *sink);
+
+/* Frames counted on the video sink so far */
+gint bench_get_frames (BenchData *bench);
+
+/* Tracks streaming thread ownership (for per-element CPU time) through stream-status messages */
+void bench_watch_bus (BenchData *bench, GstBus *bus);
+
+/* Marks the start of the measured interval, called when playback actually starts */
+void bench_start (BenchData *bench);
+
+/* Keeps this many threads spinning until bench_free, as synthetic CPU pressure */
+void bench_start_cpu_load (BenchData *bench, guint threads);
+
+/* CPU time of the process so far in seconds, without the bench_start_cpu_load threads */
+gdouble bench_get_cpu_time (BenchData *bench);
+
+/* Records one seek-to-display time (flushing seek to ASYNC_DONE), in microseconds */
+void bench_add_seek_latency (BenchData *bench, gint64 latency);
+guint bench_seek_count (BenchData *bench);
+
+/* Adds a "name": value section, produced by func, to the report */
+void bench_add_section (BenchData *bench, const char *name, BenchSectionFunc func, gpointer user_data);
+
+/* Appends str as a JSON string literal */
+void bench_json_append_string (GString *out, const char *str);
+
+/* Prints the JSON report to stdout */
+void bench_report (BenchData *bench);
+
+#endif //_BENCH_H
@@ -0,0 +1,46 @@
+#ifndef _BUFFERING_H
+#define _BUFFERING_H
+#include <gst/gst.h>
+
+#define BUFFERING_RING_SIZE (64 * 1024 * 1024)    /* Progressive download ring file bound */
+#define BUFFERING_LOW_WATERMARK 0.10              /* queue2 fill that pauses playback */
+#define BUFFERING_HIGH_WATERMARK 0.60             /* ...and the fill that resumes it */
+#define BUFFERING_READ_AHEAD_S 10                 /* Read-ahead window, in seconds of media */
+#define BUFFERING_MIN_READ_AHEAD (2 * 1024 * 1024)
+#define BUFFERING_MAX_READ_AHEAD (64 * 1024 * 1024)
+#define BUFFERING_PERIOD_MS 1000                  /* Bitrate is measured this often */
+#define BUFFERING_SEEK_PREFETCH 3                 /* Read-ahead window multiplier after a seek */
+
+/* Buffering for network and slow storage sources: progressive download into a bounded
+   ring file, pausing on the low watermark and resuming on the high one, and a
+   read-ahead window sized from the measured bitrate. After a seek the window is
+   BUFFERING_SEEK_PREFETCH times as deep for BUFFERING_READ_AHEAD_S seconds of playback,
+   so the queues fetch further ahead of the target without resuming any later. A stall
+   right after a seek is counted as a seek fill rather than a rebuffer */
+typedef struct _Buffering Buffering;
+
+/* Sets playbin's download/buffering flags and ring size, listens to BUFFERING messages */
+Buffering *buffering_new (GstElement *playbin, GstBus *bus);
+/* Logs rebuffer counts and stall times */
+void buffering_free (Buffering *buffering);
+
+/* Sets the watermarks of queue2 elements and resizes them with the bitrate; others
+   are ignored */
+void buffering_watch_element (Buffering *buffering, GstElement *element);
+
+/* The state the user wants. Returns FALSE when going to PLAYING has to wait for
+   the queues to fill; playback then resumes by itself. NULL buffering always
+   returns TRUE */
+gboolean buffering_request_state (Buffering *buffering, GstState state);
+
+/* A flushing seek was requested: widens the read-ahead window, and the next fill is
+   counted as a seek fill */
+void buffering_seek_started (Buffering *buffering);
+
+/* TRUE while playback is paused for buffering only: the user wants it playing */
+gboolean buffering_holds_playback (Buffering *buffering);
+
+/* BenchSectionFunc appending rebuffer count, stall time and measured rates */
+void buffering_append_json (GString *out, gdouble wall, Buffering *buffering);
+
+#endif //_BUFFERING_H
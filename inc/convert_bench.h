@@ -0,0 +1,9 @@
+#ifndef _CONVERT_BENCH_H
+#define _CONVERT_BENCH_H
+
+/* Checks every vd_scaler kernel against GstVideoConverter (what videoconvert and
+   videoscale use) on synthetic I420/NV12 frames, measures output MPixels/s for
+   each, and prints the results as JSON. Returns 0 when all kernels match */
+int convert_bench_run (void);
+
+#endif //_CONVERT_BENCH_H
@@ -0,0 +1,27 @@
+#ifndef _COPY_STATS_H
+#define _COPY_STATS_H
+#include <gst/gst.h>
+
+/* Debug counters for how many bytes each displayed frame costs in colour conversion,
+   scaling and copies into sink memory on the way to the screen */
+typedef struct _CopyStats CopyStats;
+
+CopyStats *copy_stats_new (void);
+/* Logs the per frame numbers */
+void copy_stats_free (CopyStats *stats);
+
+/* Counts output bytes of videoconvert/videoscale/vdconvert elements while they are not in
+   passthrough; other elements are ignored */
+void copy_stats_watch_element (CopyStats *stats, GstElement *element);
+
+/* Counts displayed frames, and the bytes an X sink has to copy because the buffer
+   is plain system memory rather than one from its own (XShm/Xv) pool */
+void copy_stats_watch_video_sink (CopyStats *stats, GstElement *sink);
+
+/* Counts the frames of another video sink from now on, adding up */
+void copy_stats_set_video_sink (CopyStats *stats, GstElement *sink);
+
+/* BenchSectionFunc appending the per frame byte counts */
+void copy_stats_append_json (GString *out, gdouble wall, CopyStats *stats);
+
+#endif //_COPY_STATS_H
@@ -0,0 +1,25 @@
+#ifndef _FRAME_EXTRACT_H
+#define _FRAME_EXTRACT_H
+#include <gst/gst.h>
+
+#define FRAME_EXTRACT_DEFAULT_INTERVAL (10 * GST_SECOND)
+#define FRAME_EXTRACT_JPEG_QUALITY "90"
+
+/* What to pull out of every input */
+typedef struct _FrameExtractOptions {
+  const char *outDir;
+  gint64 interval;                /* ns between frames, from 0 to the duration; used without times */
+  GArray *times;                  /* gint64 positions in ns, or NULL */
+  gboolean png;                   /* PNG rather than JPEG */
+  gboolean accurate;              /* Frame accurate seeks rather than to the nearest keyframe */
+  guint workers;                  /* Inputs decoded at once, 0 for one per core */
+} FrameExtractOptions;
+
+/* Batch frame extraction. Worker threads take the inputs one at a time, each into an
+   appsink pipeline of its own, seek to every position and hand the frames over to
+   encoder threads writing DIR/NNNNNN-NAME-MS.jpg (or .png): the input's number and
+   name and the requested position in ms. Prints files/s and frames/s as JSON. Returns
+   0 when every input gave all its frames */
+int frame_extract_run (const char * const *uris, guint count, const FrameExtractOptions *options);
+
+#endif //_FRAME_EXTRACT_H
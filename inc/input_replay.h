@@ -0,0 +1,70 @@
+#ifndef _INPUT_REPLAY_H
+#define _INPUT_REPLAY_H
+#include <gst/gst.h>
+
+#define INPUT_REPLAY_TICK_MS 5                        /* Dispatch and timeout check period */
+#define INPUT_REPLAY_TIMEOUT (2 * G_TIME_SPAN_SECOND) /* A response taking longer counts as this, and as a timeout */
+
+/* Recording and replay of user input, for interaction latency benchmarks. Events are
+   text lines, "<ms since playback started> <event> [args]":
+     key <keyval name>, click <button> <1|2>, slider-press, slider <seconds>, slider-release */
+typedef enum {
+  INPUT_KEY,
+  INPUT_CLICK,
+  INPUT_SLIDER_PRESS,
+  INPUT_SLIDER,
+  INPUT_SLIDER_RELEASE
+} InputType;
+
+typedef struct _InputEvent {
+  gint64 time;                    /* Since playback started, in microseconds */
+  InputType type;
+  guint keyval;                   /* INPUT_KEY */
+  guint button;                   /* INPUT_CLICK */
+  gboolean doubleClick;
+  gdouble value;                  /* INPUT_SLIDER, in seconds */
+} InputEvent;
+
+/* What completes an event, for its latency */
+typedef enum {
+  INPUT_RESPONSE_NONE,            /* Nothing to wait for: the handler's own time */
+  INPUT_RESPONSE_STATE,           /* The pipeline's next state change */
+  INPUT_RESPONSE_SEEK,            /* ASYNC_DONE of a seek issued after the event */
+  INPUT_RESPONSE_FRAME            /* The next frame reaching the video sink */
+} InputResponse;
+
+typedef struct _InputRecorder InputRecorder;
+
+/* Appends to path; NULL if it can't be opened */
+InputRecorder *input_recorder_new (const char *path);
+void input_recorder_free (InputRecorder *recorder);
+
+/* Sets time 0, when playback starts; events before are recorded at 0 */
+void input_recorder_start (InputRecorder *recorder);
+void input_recorder_add (InputRecorder *recorder, const InputEvent *event);
+
+typedef struct _InputReplay InputReplay;
+
+/* Runs the same handler as the live event would; called from the main loop */
+typedef InputResponse (*InputDispatchFunc) (const InputEvent *event, gpointer user_data);
+/* Called from the main loop once every event is answered (or timed out) */
+typedef void (*InputReplayDoneFunc) (gpointer user_data);
+
+/* Loads the events; NULL if the file can't be read */
+InputReplay *input_replay_new (const char *path, InputDispatchFunc dispatch, InputReplayDoneFunc done,
+    gpointer user_data);
+void input_replay_free (InputReplay *replay);
+
+/* Starts dispatching at the recorded times, once playback starts; later calls do nothing */
+void input_replay_start (InputReplay *replay);
+
+/* Response sources */
+void input_replay_watch_video_sink (InputReplay *replay, GstElement *sink);
+void input_replay_state_changed (InputReplay *replay);
+/* latency is what seek_scheduler_async_done returned: the seek was issued that long ago */
+void input_replay_seek_done (InputReplay *replay, gint64 latency);
+
+/* Prints p50/p99/max latency, overall and per event type, as JSON on stdout */
+void input_replay_report (InputReplay *replay);
+
+#endif //_INPUT_REPLAY_H
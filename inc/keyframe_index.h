@@ -0,0 +1,39 @@
+#ifndef _KEYFRAME_INDEX_H
+#define _KEYFRAME_INDEX_H
+#include <gst/gst.h>
+
+/* Longest stretch we are willing to decode forward before showing a seek's result.
+   Targets further away from their keyframe show the keyframe first */
+#define KEYFRAME_INDEX_MAX_DECODE (1 * GST_SECOND)
+/* Most of the file an accurate seek following the keyframe may read and decode; past it
+   seeks stay on the nearest keyframe */
+#define KEYFRAME_INDEX_MAX_REFINE_BYTES (8 * 1024 * 1024)
+
+/* Sorted keyframe timestamp -> byte offset table of a local file. It is built in
+   the background on first open and cached in a memory-mapped sidecar file in
+   $XDG_CACHE_HOME/vd_player, keyed by a hash of the file */
+typedef struct _KeyframeIndex KeyframeIndex;
+
+/* Returns NULL for anything but file:// uris */
+KeyframeIndex *keyframe_index_open (const char *uri);
+/* Returns at once; a build still running stops and frees the rest */
+void keyframe_index_free (KeyframeIndex *index);
+
+gboolean keyframe_index_is_ready (KeyframeIndex *index);
+
+/* Blocks until the background build (or cache load) has finished */
+void keyframe_index_wait (KeyframeIndex *index);
+
+/* Finds the keyframes around position. Either output may be NULL; returns
+   FALSE when the index is not ready or position is before the first keyframe */
+gboolean keyframe_index_lookup (KeyframeIndex *index, gint64 position, gint64 *before, gint64 *after);
+
+/* Picks the seek flags for a flushing seek to *position. Accurate when the
+   preceding keyframe is within KEYFRAME_INDEX_MAX_DECODE. Else, with refine, a key
+   unit seek to that keyframe, and *refine is set to the target for an accurate seek
+   once it is shown, as long as that decodes no more than KEYFRAME_INDEX_MAX_REFINE_BYTES
+   of the file. Otherwise *position snaps to the nearest keyframe. Without a ready
+   index this is a plain key unit seek */
+GstSeekFlags keyframe_index_seek_flags (KeyframeIndex *index, gint64 *position, gint64 *refine);
+
+#endif //_KEYFRAME_INDEX_H
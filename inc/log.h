@@ -1,11 +1,60 @@
 #ifndef _LOG_H
 #define _LOG_H
-#include <stdio.h>
+#include <glib.h>
 
-//TODO add log dumping into file
 #define LOG_FILE "/tmp/vd_player.log"
 #define LOG_TAG "vd_player"
 
-#define LOGD(fmt, args...) printf("%s::%s:%d " fmt "\n",LOG_TAG,__func__,__LINE__, ##args)
+#define LOG_LEVEL_ERROR 0
+#define LOG_LEVEL_WARN 1
+#define LOG_LEVEL_INFO 2
+#define LOG_LEVEL_DEBUG 3
+
+/* Levels above this are compiled out, arguments included: -DLOG_LEVEL=LOG_LEVEL_INFO */
+#ifndef LOG_LEVEL
+#define LOG_LEVEL LOG_LEVEL_DEBUG
+#endif
+#define LOG_CONSOLE_LEVEL LOG_LEVEL_WARN     /* ...and these also go to stderr */
+
+#define LOG_RING_SIZE 4096                   /* Records in flight, a power of two */
+#define LOG_MESSAGE_MAX 232                  /* Longer messages are truncated */
+#define LOG_FILE_MAX_SIZE (4 * 1024 * 1024)  /* Rotated to LOG_FILE.1 ... beyond this */
+#define LOG_FILE_KEEP 3
+
+/* Callers only format the message into a slot of a lock-free ring; a writer thread
+   adds time, level and thread id and appends it to LOG_FILE. The writer sleeps while
+   the ring is empty and the first record after that wakes it. When the ring is full
+   the record is dropped and counted rather than blocking the caller */
+#if LOG_LEVEL >= LOG_LEVEL_ERROR
+#define LOGE(fmt, args...) log_write (LOG_LEVEL_ERROR, __func__, __LINE__, fmt, ##args)
+#else
+#define LOGE(fmt, args...) do { } while (0)
+#endif
+#if LOG_LEVEL >= LOG_LEVEL_WARN
+#define LOGW(fmt, args...) log_write (LOG_LEVEL_WARN, __func__, __LINE__, fmt, ##args)
+#else
+#define LOGW(fmt, args...) do { } while (0)
+#endif
+#if LOG_LEVEL >= LOG_LEVEL_INFO
+#define LOGI(fmt, args...) log_write (LOG_LEVEL_INFO, __func__, __LINE__, fmt, ##args)
+#else
+#define LOGI(fmt, args...) do { } while (0)
+#endif
+#if LOG_LEVEL >= LOG_LEVEL_DEBUG
+#define LOGD(fmt, args...) log_write (LOG_LEVEL_DEBUG, __func__, __LINE__, fmt, ##args)
+#else
+#define LOGD(fmt, args...) do { } while (0)
+#endif
+
+/* Starts the writer thread; records logged before are kept until it runs. Pending
+   records are flushed at exit */
+void log_init (void);
+/* Flushes and stops the writer thread, safe to call more than once */
+void log_shutdown (void);
+
+void log_write (int level, const char *func, int line, const char *fmt, ...) G_GNUC_PRINTF (4, 5);
+
+/* Records lost to a full ring so far */
+guint64 log_get_dropped (void);
 
 #endif //_LOG_H
@@ -0,0 +1,8 @@
+#ifndef _LOG_BENCH_H
+#define _LOG_BENCH_H
+
+/* Measures ns per log call of the ring logger, from one and from several threads,
+   against the printf macro LOGD used to be, and prints the results as JSON */
+int log_bench_run (void);
+
+#endif //_LOG_BENCH_H
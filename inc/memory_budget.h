@@ -0,0 +1,34 @@
+#ifndef _MEMORY_BUDGET_H
+#define _MEMORY_BUDGET_H
+#include <gst/gst.h>
+
+/* How the budget is shared out, in percent */
+#define MEMORY_BUDGET_QUEUE_SHARE 40    /* Demuxer and download queues */
+#define MEMORY_BUDGET_POOL_SHARE 40     /* Decoded video frames, decoders' reference frames included */
+#define MEMORY_BUDGET_THREAD_SHARE 20   /* Frames libav frame threads hold on their own */
+#define MEMORY_BUDGET_DOWNLOAD_SHARE 25 /* Of the queue share, for queue2 and downloadbuffer; decodebin gets the rest */
+#define MEMORY_BUDGET_THREAD_BYTES (24 * 1024 * 1024) /* One frame thread: about two 4K 4:2:0 frames */
+#define MEMORY_BUDGET_MAX_DPB 16        /* Reference frames a decoder may hold when its level doesn't say */
+#define MEMORY_BUDGET_SPARE_FRAMES 2    /* In flight downstream of the decoder */
+
+/* A hard memory budget for the elements of one playback pipeline, applied as they are
+   set up. Queues get byte limits on top of their time and buffer limits. Video decoders
+   get a frame thread per MEMORY_BUDGET_THREAD_BYTES of theirs, and the buffer pools
+   they negotiate are capped to the frames that fit the pool share, but never below
+   the pool's minimum plus the reference frames the stream's H.264/H.265 level allows
+   at its size (else MEMORY_BUDGET_MAX_DPB), a frame per decoder thread and
+   MEMORY_BUDGET_SPARE_FRAMES; frames allowed over the share for that are warned
+   about and reported.
+   Applied after profiles, it lowers their limits but never raises them */
+typedef struct _MemoryBudget MemoryBudget;
+
+MemoryBudget *memory_budget_new (gsize bytes);
+void memory_budget_free (MemoryBudget *budget);
+
+/* Called for every element playbin sets up */
+void memory_budget_apply (MemoryBudget *budget, GstElement *element);
+
+/* BenchSectionFunc appending the shares and what was capped, in KB */
+void memory_budget_append_json (GString *out, gdouble wall, MemoryBudget *budget);
+
+#endif //_MEMORY_BUDGET_H
@@ -0,0 +1,35 @@
+#ifndef _METRICS_H
+#define _METRICS_H
+#include <gst/gst.h>
+
+#define METRICS_PREFIX "vd_player_"
+#define METRICS_BACKLOG 8
+#define METRICS_POLL_MS 200             /* How often the server thread checks for shutdown */
+#define METRICS_READ_TIMEOUT_MS 100     /* Longest wait for a request line */
+
+/* Live metrics in Prometheus text format on a Unix domain socket. Playback feeds
+   atomic counters and gauges, from streaming threads through sync bus handlers and
+   probes; a server thread of its own answers each connection (HTTP GET or a bare
+   connect) with the current values, reading sink stats, queue levels, position and
+   process CPU/RSS itself. A scrape never runs on, or waits for, the GTK main loop */
+typedef struct _Metrics Metrics;
+
+/* Listens on path (replacing a stale socket); NULL on failure */
+Metrics *metrics_new (GstElement *pipeline, GstBus *bus, const char *path);
+/* Stops the server thread and removes the socket */
+void metrics_free (Metrics *metrics);
+
+/* Reports the fill level of queue, queue2 and multiqueue elements; others are ignored */
+void metrics_watch_element (Metrics *metrics, GstElement *element);
+
+/* Frames rendered and dropped come from this sink's stats */
+void metrics_watch_video_sink (Metrics *metrics, GstElement *sink);
+
+/* Reports on another pipeline from now on, e.g. after a switch to a pooled one; its
+   video sink replaces the watched one */
+void metrics_set_pipeline (Metrics *metrics, GstElement *pipeline, GstElement *sink);
+
+/* Adds a seek-to-display time, in microseconds, to the histogram */
+void metrics_observe_seek (Metrics *metrics, gint64 latency);
+
+#endif //_METRICS_H
@@ -0,0 +1,27 @@
+#ifndef _MOSAIC_H
+#define _MOSAIC_H
+#include <gst/gst.h>
+
+/* Size of the composited frame; the grid divides it evenly between the tiles */
+#define MOSAIC_WIDTH 1920
+#define MOSAIC_HEIGHT 1080
+/* Inputs starting with this are gst-launch descriptions of a test source,
+   e.g. "videotestsrc num-buffers=600 pattern=ball" */
+#define MOSAIC_TEST_SOURCE "videotestsrc"
+
+/* Grid of N inputs blended by one compositor into a single video sink. Every input
+   decodes in its own streaming threads and is scaled down to its tile size before
+   it reaches the compositor, so full resolution frames are never blended */
+typedef struct _Mosaic Mosaic;
+
+/* inputs are uris or MOSAIC_TEST_SOURCE descriptions; takes a reference on videoSink */
+Mosaic *mosaic_new (const char * const *inputs, guint count, GstElement *videoSink);
+void mosaic_free (Mosaic *mosaic);
+
+/* The pipeline, owned by the mosaic */
+GstElement *mosaic_get_pipeline (Mosaic *mosaic);
+
+/* BenchSectionFunc appending per tile frame counts and fps */
+void mosaic_append_json (GString *out, gdouble wall, Mosaic *mosaic);
+
+#endif //_MOSAIC_H
@@ -0,0 +1,47 @@
+#ifndef _PIPELINE_POOL_H
+#define _PIPELINE_POOL_H
+#include <gst/gst.h>
+
+/* Demuxer queue limits of standby pipelines; prerolled they hold no more than this
+   plus the decoders' reference frames and the frame at the sink */
+#define PIPELINE_POOL_QUEUE_BYTES (1024 * 1024)
+#define PIPELINE_POOL_QUEUE_BUFFERS 5
+#define PIPELINE_POOL_QUEUE_TIME (500 * GST_MSECOND)
+
+/* Standby pipelines for switching between inputs. Each holds one uri prerolled in
+   PAUSED, with its video sink neither showing the preroll frame nor handling window
+   events, so every member can be handed the window up front. Switching to a pooled
+   uri only takes the pipeline to PLAYING; others are built cold. Members share one bus;
+   messages can be told apart by their source. The time from the switch to the first
+   frame shown is measured either way */
+typedef struct _PipelinePool PipelinePool;
+
+/* Builds a playbin with its sinks set, uri and state untouched */
+typedef GstElement *(*PipelineMakeFunc) (gpointer user_data);
+
+/* Keeps up to size standby pipelines, 0 builds every switch cold */
+PipelinePool *pipeline_pool_new (guint size, GstBus *bus, PipelineMakeFunc make, gpointer user_data);
+/* Stops and frees the standby pipelines; those taken out are the caller's */
+void pipeline_pool_free (PipelinePool *pool);
+
+/* Prerolls uri in a standby pipeline unless one has it, replacing the least recently
+   used one when the pool is full */
+void pipeline_pool_prepare (PipelinePool *pool, const char *uri);
+
+/* The pipeline to switch to uri: the standby one when there is, else a new one
+   starting from NULL. Starts timing the switch, the caller sets it to PLAYING */
+GstElement *pipeline_pool_take (PipelinePool *pool, const char *uri);
+
+/* Takes over the caller's reference to a pipeline switched away from, which keeps uri
+   prerolled where it was paused, its demuxer queues capped to the standby limits;
+   evicts the least recently used one when full */
+void pipeline_pool_put (PipelinePool *pool, GstElement *pipeline, const char *uri);
+
+/* The video sink of a pipeline the pool made or was given, NULL if unknown */
+GstElement *pipeline_pool_get_video_sink (PipelinePool *pool, GstElement *pipeline);
+
+/* BenchSectionFunc appending switch to first frame times, pooled and cold, and the
+   memory standby pipelines took */
+void pipeline_pool_append_json (GString *out, gdouble wall, PipelinePool *pool);
+
+#endif //_PIPELINE_POOL_H
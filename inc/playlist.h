@@ -0,0 +1,30 @@
+#ifndef _PLAYLIST_H
+#define _PLAYLIST_H
+#include <gst/gst.h>
+
+#include "uri_resolver.h"
+
+/* List of inputs played back to back without going through READY. Item uris are
+   resolved ahead so playbin's about-to-finish handler can queue the next one
+   straight away from the streaming thread */
+typedef struct _Playlist Playlist;
+
+Playlist *playlist_new (UriResolver *resolver);
+void playlist_free (Playlist *playlist);
+
+/* Appends an input; .m3u/.m3u8 files are expanded into their entries */
+void playlist_add (Playlist *playlist, const char *input);
+guint playlist_length (Playlist *playlist);
+const char *playlist_get_input (Playlist *playlist, guint index);
+
+/* Starts resolving item index in the background if it isn't yet */
+void playlist_prepare (Playlist *playlist, guint index);
+
+/* Resolved uri of item index, NULL when not (yet) available. Thread safe */
+gchar *playlist_get_uri (Playlist *playlist, guint index);
+
+/* Measures the gap between the last frame of an item and the first frame of the
+   next one on the sink pad of the video sink, and logs it on every transition */
+void playlist_watch_video_sink (Playlist *playlist, GstElement *sink);
+
+#endif //_PLAYLIST_H
@@ -0,0 +1,28 @@
+#ifndef _POWER_MANAGER_H
+#define _POWER_MANAGER_H
+#include <glib.h>
+
+#define SESSION_MANAGER_DBUS "org.gnome.SessionManager"
+#define SESSION_MANAGER_DBUS_PATH "/org/gnome/SessionManager"
+#define SESSION_MANAGER_DBUS_INTERFACE "org.gnome.SessionManager"
+#define SESSION_MANAGER_INHIBIT "Inhibit"
+#define SESSION_MANAGER_UNINHIBIT "Uninhibit"
+
+/* Rapid PLAYING<->PAUSED flips within this window only send their net result */
+#define POWER_MANAGER_DEBOUNCE_MS 500
+
+/* Sleep inhibition through the session manager. The session bus connection is
+   driven by the GLib main loop and replies are handled in callbacks, so nothing
+   here ever blocks the caller on a D-Bus round trip */
+typedef struct _PowerManager PowerManager;
+
+/* Connects to the session bus; NULL if there is none */
+PowerManager *power_manager_new (const char *appName);
+void power_manager_free (PowerManager *pm);
+
+/* Requests sleep to be inhibited or allowed again. Debounced: the request goes
+   out on the bus POWER_MANAGER_DEBOUNCE_MS after the last change, and only if it
+   differs from what the session manager already has */
+void power_manager_set_inhibited (PowerManager *pm, gboolean inhibit);
+
+#endif //_POWER_MANAGER_H
@@ -0,0 +1,27 @@
+#ifndef _PROFILE_H
+#define _PROFILE_H
+#include <gst/gst.h>
+
+/* Element tuning profiles. A profile is a key file whose groups are element factory
+   name globs (comma separated) and whose keys are properties to set, with values
+   parsed like gst-launch does:
+
+     [avdec_*]
+     max-threads=0
+     thread-type=frame
+
+     [xvimagesink,ximagesink]
+     max-lateness=5000000
+
+   Built-in presets: throughput, low-latency, low-latency-audio and low-memory */
+typedef struct _Profile Profile;
+
+/* Starts from the preset, if any, then applies the file on top; NULL when neither
+   is given or one can't be loaded */
+Profile *profile_new (const char *preset, const char *path);
+void profile_free (Profile *profile);
+
+/* Sets the properties of every group matching the element's factory name */
+void profile_apply (Profile *profile, GstElement *element);
+
+#endif //_PROFILE_H
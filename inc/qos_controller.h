@@ -0,0 +1,43 @@
+#ifndef _QOS_CONTROLLER_H
+#define _QOS_CONTROLLER_H
+#include <gst/gst.h>
+
+#include "seek_scheduler.h"
+
+#define QOS_CONTROLLER_PERIOD_MS 500             /* Lateness is judged per period */
+#define QOS_CONTROLLER_LATE_JITTER (20 * GST_MSECOND) /* A QoS report this late counts as lateness */
+#define QOS_CONTROLLER_STEP_DOWN_PERIODS 2       /* Late periods in a row before degrading a level */
+#define QOS_CONTROLLER_STEP_UP_PERIODS 10        /* Clean periods in a row before recovering a level */
+#define QOS_CONTROLLER_MAX_STEP_UP_PERIODS 160   /* Step up backoff limit, 80 s */
+#define QOS_CONTROLLER_REENTER_WINDOW (30 * G_TIME_SPAN_SECOND) /* Re-entering a level this soon backs off */
+
+/* Degradation levels, each one includes the previous ones */
+typedef enum {
+  QOS_LEVEL_FULL,             /* Everything decoded and scaled at full quality */
+  QOS_LEVEL_SKIP_NONREF,      /* Decoders skip non-reference (B) frames */
+  QOS_LEVEL_LOWRES,           /* Decoders decode at reduced resolution where the codec can */
+  QOS_LEVEL_FAST_SCALING,     /* Scalers use nearest neighbour */
+  QOS_LEVEL_KEYFRAMES_ONLY,   /* Keyframe only trick mode playback */
+  QOS_LEVEL_COUNT
+} QosLevel;
+
+/* Listens to QoS messages of the pipeline, keeps jitter/proportion/drop counts per
+   element, and steps the degradation level down under sustained lateness and back
+   up, more slowly, once the sinks keep up again. A level re-entered shortly after
+   recovering from it doubles the clean periods needed to recover */
+typedef struct _QosController QosController;
+
+/* Keyframe only playback goes through the seek scheduler */
+QosController *qos_controller_new (GstElement *pipeline, GstBus *bus, SeekScheduler *seeker);
+/* Logs the per element statistics */
+void qos_controller_free (QosController *qos);
+
+/* Controls another pipeline from now on, starting over at full quality */
+void qos_controller_set_pipeline (QosController *qos, GstElement *pipeline);
+
+QosLevel qos_controller_get_level (QosController *qos);
+
+/* BenchSectionFunc appending level changes and per element QoS statistics */
+void qos_controller_append_json (GString *out, gdouble wall, QosController *qos);
+
+#endif //_QOS_CONTROLLER_H
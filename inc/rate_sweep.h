@@ -0,0 +1,30 @@
+#ifndef _RATE_SWEEP_H
+#define _RATE_SWEEP_H
+#include <gst/gst.h>
+
+#include "bench.h"
+#include "seek_scheduler.h"
+
+#define RATE_SWEEP_SETTLE_MS 500        /* Left out of the measurement after each rate change */
+#define RATE_SWEEP_PERIOD_MS 3000       /* Measured time at each rate */
+
+/* Plays the clip at each rate of a fixed ladder (forward from the start, reverse from
+   the end) and measures displayed frames per second, CPU use and the media time
+   covered per second at each. For --bench-rates; the clip should last a couple of
+   minutes so 32x doesn't reach its end */
+typedef struct _RateSweep RateSweep;
+
+/* Called from the main loop once every rate is measured */
+typedef void (*RateSweepDoneFunc) (gpointer user_data);
+
+RateSweep *rate_sweep_new (GstElement *pipeline, SeekScheduler *seeker, BenchData *bench,
+    RateSweepDoneFunc done, gpointer user_data);
+void rate_sweep_free (RateSweep *sweep);
+
+/* Starts with the first rate, once the pipeline is playing; later calls do nothing */
+void rate_sweep_start (RateSweep *sweep);
+
+/* BenchSectionFunc appending one entry per measured rate */
+void rate_sweep_append_json (GString *out, gdouble wall, RateSweep *sweep);
+
+#endif //_RATE_SWEEP_H
@@ -0,0 +1,74 @@
+#ifndef _SEEK_SCHEDULER_H
+#define _SEEK_SCHEDULER_H
+#include <gst/gst.h>
+
+/* A seek in flight that hasn't completed after this long is considered lost */
+#define SEEK_SCHEDULER_TIMEOUT (2 * G_TIME_SPAN_SECOND)
+/* Faster than this (either direction) only keyframes are decoded and audio is dropped */
+#define SEEK_SCHEDULER_TRICKMODE_RATE 2.0
+
+/* Sits between the UI callbacks and the pipeline. At most one flushing seek is in
+   flight; requests arriving meanwhile collapse into a single pending target which
+   is issued once the pipeline has prerolled (ASYNC_DONE) on the previous one */
+typedef struct _SeekScheduler SeekScheduler;
+
+/* Picks flags for an accurate (non scrubbing) seek, may move *position. Setting
+   *refine (-1 on entry) makes an accurate seek there follow once this one is
+   displayed, unless a newer request replaces it */
+typedef GstSeekFlags (*SeekFlagsFunc) (gint64 *position, gint64 *refine, gpointer user_data);
+
+SeekScheduler *seek_scheduler_new (GstElement *pipeline, SeekFlagsFunc flagsFunc, gpointer user_data);
+void seek_scheduler_free (SeekScheduler *sched);
+
+/* Absolute seek to position (ns). Scrubbing seeks (slider drag) are keyframe only */
+void seek_scheduler_seek (SeekScheduler *sched, gint64 position, gboolean scrubbing);
+
+/* Seek by delta from the latest requested target, or from the current position
+   when no seek is outstanding */
+void seek_scheduler_seek_relative (SeekScheduler *sched, gint64 delta);
+
+/* End of a slider drag: issues the final accurate seek to the last target */
+void seek_scheduler_scrub_end (SeekScheduler *sched);
+
+/* To be called on ASYNC_DONE from the pipeline. Returns the latency of the
+   completed seek in microseconds, or -1 if no seek was in flight */
+gint64 seek_scheduler_async_done (SeekScheduler *sched);
+
+/* Latest requested target (ns), or -1 when nothing is outstanding. An in flight seek
+   older than SEEK_SCHEDULER_TIMEOUT is dropped here too, issuing the pending one if any */
+gint64 seek_scheduler_get_target (SeekScheduler *sched);
+
+/* Playback rate, negative for reverse. Changes that keep the direction and trick mode
+   are instant rate changes where GStreamer supports them (1.18), anything else is a
+   flushing seek from the current position. Seeks afterwards keep the rate */
+void seek_scheduler_set_rate (SeekScheduler *sched, gdouble rate);
+gdouble seek_scheduler_get_rate (SeekScheduler *sched);
+
+/* Keyframe only playback for the QoS controller: while held every seek, the user's
+   included, is a keyframe trick mode one. Holding or releasing it seeks to the
+   current position */
+void seek_scheduler_set_keyframes_only (SeekScheduler *sched, gboolean keyframesOnly);
+
+/* Steps frames (negative: backwards) with a step event, for a paused pipeline.
+   Going against the playback direction first seeks at rate 1.0 in the other one */
+void seek_scheduler_step (SeekScheduler *sched, gint frames);
+
+/* Plays [start, stop] (ns) over and over: every seek becomes a segment seek ending at
+   a loop bound, starting with a flushing one into the loop. A negative start ends the
+   loop, seeking on from the current position */
+void seek_scheduler_set_loop (SeekScheduler *sched, gint64 start, gint64 stop);
+gboolean seek_scheduler_get_loop (SeekScheduler *sched, gint64 *start, gint64 *stop);
+
+/* To be called on SEGMENT_DONE from the pipeline: wraps around the loop with a
+   non-flushing segment seek, queued behind the data still in the pipeline so
+   running time goes on without a gap. Returns FALSE when not looping */
+gboolean seek_scheduler_segment_done (SeekScheduler *sched);
+
+/* Seeks another pipeline from now on, at rate 1.0, without a loop and without keyframe
+   only playback; requests for the old one are dropped */
+void seek_scheduler_set_pipeline (SeekScheduler *sched, GstElement *pipeline);
+
+/* Logs requested/issued/coalesced counts and latency */
+void seek_scheduler_log_stats (SeekScheduler *sched);
+
+#endif //_SEEK_SCHEDULER_H
@@ -0,0 +1,22 @@
+#ifndef _STARTUP_TRACE_H
+#define _STARTUP_TRACE_H
+#include <gst/gst.h>
+
+/* Timestamps the startup phases up to the first frame reaching the video sink,
+   relative to the start of main(). Phases can be marked from any thread; only the
+   first mark of a phase counts */
+typedef struct _StartupTrace StartupTrace;
+
+/* With print set, the trace is printed as JSON on stdout once the first frame is in */
+StartupTrace *startup_trace_new (gint64 startTime, gboolean print);
+void startup_trace_free (StartupTrace *trace);
+
+void startup_trace_mark (StartupTrace *trace, const char *phase);
+
+/* Marks "first_frame" when the first buffer arrives at the sink */
+void startup_trace_watch_video_sink (StartupTrace *trace, GstElement *sink);
+
+/* BenchSectionFunc appending the phases, in ms */
+void startup_trace_append_json (GString *out, gdouble wall, StartupTrace *trace);
+
+#endif //_STARTUP_TRACE_H
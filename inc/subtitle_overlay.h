@@ -0,0 +1,32 @@
+#ifndef _SUBTITLE_OVERLAY_H
+#define _SUBTITLE_OVERLAY_H
+#include <gst/gst.h>
+
+#define SUBTITLE_OVERLAY_FONT "Sans Bold"
+#define SUBTITLE_OVERLAY_FONT_SCALE 0.05      /* Font height, relative to the output height */
+#define SUBTITLE_OVERLAY_MARGIN 0.05          /* Space below the text, relative to the output height */
+#define SUBTITLE_OVERLAY_DEFAULT_DURATION (5 * GST_SECOND)   /* For cues without a duration */
+
+/* Subtitles without playsink's text renderer: cues go to a text sink of our own and
+   each one is rasterized once, text on a shaded box, into a cached ARGB bitmap. Frames
+   showing it get that bitmap as a GstVideoOverlayCompositionMeta when the video sink
+   says (ALLOCATION query) it composites those itself; otherwise only the box is blended
+   into the frame. The bitmap is redrawn when the cue, the video size or, for sinks
+   taking the meta, the window size changes */
+typedef struct _SubtitleOverlay SubtitleOverlay;
+
+/* Sets playbin's text-sink */
+SubtitleOverlay *subtitle_overlay_new (GstElement *playbin);
+/* Logs the cache numbers */
+void subtitle_overlay_free (SubtitleOverlay *overlay);
+
+/* Attaches (or blends) the subtitle of the moment to the frames reaching this sink */
+void subtitle_overlay_watch_video_sink (SubtitleOverlay *overlay, GstElement *sink);
+
+/* Size of the video area in device pixels, from the GTK thread */
+void subtitle_overlay_set_window_size (SubtitleOverlay *overlay, gint width, gint height);
+
+/* BenchSectionFunc appending cue, render and frame counts */
+void subtitle_overlay_append_json (GString *out, gdouble wall, SubtitleOverlay *overlay);
+
+#endif //_SUBTITLE_OVERLAY_H
@@ -0,0 +1,29 @@
+#ifndef _THUMBNAILER_H
+#define _THUMBNAILER_H
+#include <gst/gst.h>
+#include <gdk-pixbuf/gdk-pixbuf.h>
+
+#define THUMBNAIL_WIDTH 160
+#define THUMBNAIL_INTERVAL (5 * GST_SECOND)             /* One thumbnail slot every 5s of media */
+#define THUMBNAIL_DEFAULT_BUDGET (8 * 1024 * 1024)      /* Default cache size, in bytes */
+
+/* Scrub previews for the slider. A secondary low priority pipeline decodes
+   keyframes only, scaled down to THUMBNAIL_WIDTH, prefetching outward from the
+   playback position into an LRU cache bounded by a byte budget */
+typedef struct _Thumbnailer Thumbnailer;
+
+Thumbnailer *thumbnailer_new (const char *uri, gsize budget);
+/* Returns at once; the worker finishes what it is decoding and frees the rest */
+void thumbnailer_free (Thumbnailer *thumbs);
+
+/* Re-centres prefetching on the playback position (ns) */
+void thumbnailer_set_position (Thumbnailer *thumbs, gint64 position);
+
+/* Returns a new reference to the thumbnail for position, or to the nearest cached
+   neighbour when that slot isn't decoded yet. NULL when nothing is cached nearby */
+GdkPixbuf *thumbnailer_lookup (Thumbnailer *thumbs, gint64 position);
+
+/* Logs hit rate and memory use */
+void thumbnailer_log_stats (Thumbnailer *thumbs);
+
+#endif //_THUMBNAILER_H
@@ -0,0 +1,30 @@
+#ifndef _URI_RESOLVER_H
+#define _URI_RESOLVER_H
+#include <glib.h>
+
+/* Default resolver for youtube links; the input url is appended as last argument */
+#define URI_RESOLVER_DEFAULT_COMMAND "youtube-dl --format best[ext=mp4] --get-url"
+/* Resolved urls are signed and expire; cached ones are used for this long, in seconds */
+#define URI_RESOLVER_TTL (60 * 60)
+
+/* Turns user input (file names, uris, youtube links) into uris playbin can play.
+   Links needing an external resolver run it through a pipe without blocking the
+   main loop, and results go to a small on-disk cache with a TTL */
+typedef struct _UriResolver UriResolver;
+
+/* uri is NULL when resolution failed */
+typedef void (*UriResolvedFunc) (const char *input, const char *uri, gpointer user_data);
+
+/* command NULL means URI_RESOLVER_DEFAULT_COMMAND; it is split like a shell would */
+UriResolver *uri_resolver_new (const char *command);
+void uri_resolver_free (UriResolver *resolver);
+
+/* Non-blocking fast path. Returns a newly allocated uri when no external
+   resolution is needed or the cache has a fresh entry, NULL otherwise */
+gchar *uri_resolver_lookup (UriResolver *resolver, const char *input);
+
+/* Runs the resolver; callback is invoked from the main loop */
+void uri_resolver_resolve_async (UriResolver *resolver, const char *input,
+    UriResolvedFunc callback, gpointer user_data);
+
+#endif //_URI_RESOLVER_H
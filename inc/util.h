@@ -0,0 +1,13 @@
+#ifndef _UTIL_H
+#define _UTIL_H
+#include <gst/gst.h>
+
+/* Lowers an int, uint or uint64 property of element to cap, if it has one. A current
+   value of 0 is taken as unlimited and capped too, unless zeroDisables (0 turns the
+   feature off there). Returns TRUE when the property was changed */
+gboolean util_cap_property (GstElement *element, const char *name, guint64 cap, gboolean zeroDisables);
+
+/* Resident set size of the process in kB, 0 when it can't be read */
+glong util_current_rss_kb (void);
+
+#endif //_UTIL_H
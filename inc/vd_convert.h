@@ -0,0 +1,13 @@
+#ifndef _VD_CONVERT_H
+#define _VD_CONVERT_H
+#include <gst/gst.h>
+
+#define VD_CONVERT_ELEMENT "vdconvert"
+
+/* Registers "vdconvert" with this process (no plugin file): fused I420/NV12 -> BGRx
+   conversion with bilinear scaling, using the fastest vd_scaler kernel of the CPU.
+   The output is scaled to fit inside the fit-width x fit-height box keeping the
+   display aspect ratio; 0 keeps the input size */
+gboolean vd_convert_register (void);
+
+#endif //_VD_CONVERT_H
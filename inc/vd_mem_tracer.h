@@ -0,0 +1,22 @@
+#ifndef _VD_MEM_TRACER_H
+#define _VD_MEM_TRACER_H
+#include <gst/gst.h>
+
+#define VD_MEM_TRACER_TOP 10      /* Elements listed in the report, most memory first */
+
+/* A GstTracer attached to this process's tracing hooks directly, without GST_TRACERS
+   or a plugin file. It counts every GstMemory allocated from then on against the
+   element whose code allocated it, until the memory is freed: pad push and pull hooks
+   track, per thread, which element's chain or getrange function is running, or else
+   whose streaming task the thread runs. Shared sub-memories and read-only wrapped
+   memory (vdmmapsrc's file mapping) aren't allocations and aren't counted. Needs
+   GStreamer 1.18 for the memory hooks. Hooks can't be removed, so the tracer stays
+   for the rest of the process */
+typedef struct _VdMemTracer VdMemTracer;
+
+VdMemTracer *vd_mem_tracer_new (void);
+
+/* BenchSectionFunc appending live and peak bytes in total and per element, in KB */
+void vd_mem_tracer_append_json (GString *out, gdouble wall, VdMemTracer *tracer);
+
+#endif //_VD_MEM_TRACER_H
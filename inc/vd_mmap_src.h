@@ -0,0 +1,18 @@
+#ifndef _VD_MMAP_SRC_H
+#define _VD_MMAP_SRC_H
+#include <gst/gst.h>
+
+#define VD_MMAP_SRC_ELEMENT "vdmmapsrc"
+#define VD_MMAP_SRC_BLOCKSIZE (256 * 1024)       /* Default push mode buffer size, costs nothing to make bigger */
+#define VD_MMAP_SRC_READ_AHEAD (8 * 1024 * 1024) /* madvise(WILLNEED) window ahead of the reads */
+
+/* Registers "vdmmapsrc" with this process (no plugin file): a file:// source mapping the
+   whole file and handing out read-only GstMemory slices of the mapping, so no byte is
+   copied on the way to the demuxer. Its rank is above filesrc, so playbin picks it for
+   local regular files; anything else (pipes, devices) still goes to filesrc. A read at
+   a new offset, i.e. a seek, moves the read-ahead window there. The file's size is
+   checked before every slice: once it has shrunk, reads are read() copies as with
+   filesrc, since mapped pages past the new end would raise SIGBUS */
+gboolean vd_mmap_src_register (void);
+
+#endif //_VD_MMAP_SRC_H
@@ -0,0 +1,45 @@
+#ifndef _VD_SCALER_H
+#define _VD_SCALER_H
+#include <gst/gst.h>
+#include <gst/video/video.h>
+
+/* Temporary rows are padded by this many bytes so vector loads may run over their end */
+#define VD_SCALER_ROW_PADDING 64
+
+/* Fixed point (x256) YUV -> RGB coefficients for limited range input */
+typedef struct _VdScalerMatrix {
+  gint32 y;
+  gint32 rv;
+  gint32 gu;
+  gint32 gv;
+  gint32 bu;
+} VdScalerMatrix;
+
+/* One implementation of the row operations. All kernels give bit identical results */
+typedef struct _VdScalerKernel {
+  const char *name;
+  /* dst[i] = row0[i] blended with row1[i], weight/256 of row1 */
+  void (*blend_rows) (guint8 *dst, const guint8 *row0, const guint8 *row1, gint width, gint weight);
+  /* dst[i] = src[index[i]] blended with src[index[i] + stride], weight[i]/256 of the latter.
+     src is a padded temporary row */
+  void (*sample_row) (guint8 *dst, const guint8 *src, const gint32 *index, const guint16 *weight, gint width, gint stride);
+  /* Converts width pixels of full resolution Y, U and V rows to BGRx */
+  void (*yuv_to_bgrx) (guint8 *dst, const guint8 *y, const guint8 *u, const guint8 *v, gint width,
+      const VdScalerMatrix *matrix);
+} VdScalerKernel;
+
+/* Kernels this CPU can run, NULL terminated, scalar first and fastest last */
+const VdScalerKernel * const *vd_scaler_kernels (void);
+const VdScalerKernel *vd_scaler_best_kernel (void);
+
+/* Fused I420/NV12 -> BGRx conversion with bilinear scaling. Rows are scaled vertically,
+   then horizontally straight to the output width (chroma upsampling included), then
+   converted, so only one output row worth of intermediate data is touched */
+typedef struct _VdScaler VdScaler;
+
+/* NULL when the formats aren't I420/NV12 -> BGRx */
+VdScaler *vd_scaler_new (const GstVideoInfo *in, const GstVideoInfo *out, const VdScalerKernel *kernel);
+void vd_scaler_free (VdScaler *scaler);
+void vd_scaler_process (VdScaler *scaler, const GstVideoFrame *in, GstVideoFrame *out);
+
+#endif //_VD_SCALER_H
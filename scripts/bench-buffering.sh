@@ -0,0 +1,27 @@
+#!/bin/bash
+# Plays FILE from a local HTTP server throttled to RATE KB/s, in real time on an
+# Xvfb server, with and without the buffering subsystem. The JSON reports carry
+# "buffering" (rebuffers, stall_ms, measured bitrate) and "frame_interval_ms".
+# Pick a rate a bit below the clip's bitrate to force rebuffers.
+#
+#   scripts/bench-buffering.sh FILE [RATE_KBPS] [PORT]
+
+PLAYER=${PLAYER:-./vd_player}
+RATE=${2:-500}
+PORT=${3:-8765}
+
+if [ -z "$1" ]; then
+  echo "usage: $0 FILE [RATE_KBPS] [PORT]" >&2
+  exit 1
+fi
+
+python3 "$(dirname "$0")/throttled-http.py" --port "$PORT" --rate "$RATE" --root "$(dirname "$1")" &
+SERVER=$!
+trap 'kill $SERVER' EXIT
+sleep 1
+
+URI="http://127.0.0.1:$PORT/$(basename "$1")"
+for buffering in --no-buffering ""; do
+  echo "== ${buffering:-with buffering}, $RATE KB/s"
+  xvfb-run -a -s "-screen 0 1920x1080x24" "$PLAYER" --bench --video-sink=x $buffering "$URI"
+done
@@ -0,0 +1,38 @@
+#!/bin/bash
+# Batch frame extraction scaling: extracts from the given inputs with 1, 2, 4... workers
+# up to the core count and prints each report ("extract") followed by the speedup in
+# frames/s over one worker. Local media should come out close to linear.
+#
+#   scripts/bench-extract.sh FILE... [-- EXTRACT ARGS...]
+#
+# e.g. scripts/bench-extract.sh *.mp4 -- --extract-interval=30 --extract-format=png
+
+PLAYER=${PLAYER:-./vd_player}
+OUT=$(mktemp -d)
+trap 'rm -rf "$OUT"' EXIT
+
+inputs=()
+while [ $# -gt 0 ] && [ "$1" != "--" ]; do
+  inputs+=("$1")
+  shift
+done
+[ "$1" = "--" ] && shift
+if [ ${#inputs[@]} -eq 0 ]; then
+  echo "usage: $0 FILE... [-- EXTRACT ARGS...]" >&2
+  exit 1
+fi
+
+cores=$(nproc)
+base=
+workers=1
+while [ $workers -le "$cores" ]; do
+  echo "== $workers workers"
+  rm -rf "${OUT:?}"/*
+  report=$("$PLAYER" --extract-frames="$OUT" --extract-workers=$workers "$@" "${inputs[@]}")
+  echo "$report"
+  fps=$(echo "$report" | python3 -c 'import json, sys; print(json.load(sys.stdin)["extract"]["frames_per_sec"])')
+  base=${base:-$fps}
+  python3 -c "print('speedup %.2fx on %d workers' % ($fps / $base if $base > 0 else 0, $workers))"
+  [ $workers -eq "$cores" ] && break
+  workers=$(( workers * 2 > cores ? cores : workers * 2 ))
+done
@@ -0,0 +1,23 @@
+#!/bin/bash
+# Discontinuity at the A-B loop point ("loop"): running time gap and wall clock gap
+# per wrap on the video and audio sinks. Runs headless on FILE and on test sources,
+# then on FILE in real time in a window on an Xvfb server.
+#
+#   scripts/bench-loop.sh FILE [START:END] [WRAPS]
+
+PLAYER=${PLAYER:-./vd_player}
+LOOP=${2:-2:5}
+WRAPS=${3:-20}
+
+if [ -z "$1" ]; then
+  echo "usage: $0 FILE [START:END] [WRAPS]" >&2
+  exit 1
+fi
+
+echo "== $1, headless"
+"$PLAYER" --headless --bench --loop="$LOOP" --bench-loops="$WRAPS" "$1"
+echo "== test sources, headless"
+"$PLAYER" --headless --bench --loop="$LOOP" --bench-loops="$WRAPS" \
+  "testbin://audio,num-buffers=3000+video,num-buffers=1800"
+echo "== $1, in a window"
+xvfb-run -a -s "-screen 0 1920x1080x24" "$PLAYER" --bench --loop="$LOOP" --bench-loops="$WRAPS" "$1"
@@ -0,0 +1,42 @@
+#!/bin/bash
+# Bounded memory playback: plays a 4K clip headless in real time with the default
+# configuration and with --memory-budget=MB, and compares peak RSS, frame stalls and
+# the GstMemory each element held at its peak ("memory"). Without FILE a 20s 4K HEVC
+# level 5.1 clip using as many reference frames and B-frames as the level allows is
+# made with ffmpeg, so the decoder's DPB is as large as the level lets it be and a
+# pool capped below it would stall. Extra arguments go to
+# both runs, e.g. --profile=low-memory.
+#
+#   scripts/bench-memory.sh [FILE] [MB] [PLAYER ARGS...]
+
+PLAYER=${PLAYER:-./vd_player}
+CLIP=$1
+BUDGET=${2:-64}
+shift $(( $# < 2 ? $# : 2 ))
+
+if [ -z "$CLIP" ]; then
+  CLIP=$(mktemp --suffix=.mkv)
+  trap 'rm -f "$CLIP"' EXIT
+  ffmpeg -loglevel error -y -f lavfi -i "testsrc2=s=3840x2160:r=30:d=20" \
+    -c:v libx265 -preset fast -pix_fmt yuv420p -x265-params "log-level=error:level-idc=5.1:ref=5:bframes=4:b-pyramid=1" \
+    "$CLIP" || exit 1
+fi
+
+run () {
+  "$PLAYER" --headless --bench --memory-trace "$@" "$CLIP" | python3 -c '
+import json, sys
+text = sys.stdin.read()
+report = json.loads(text[text.find("{"):])
+memory = report["memory"]
+print("  peak_rss_kb %d, stalls %d, dropped %d, traced peak_kb %d" % (report["peak_rss_kb"],
+    report.get("frame_interval_ms", {}).get("stalls", 0), report["dropped_frames"], memory["peak_kb"]))
+for name, element in list(memory["elements"].items())[:5]:
+    print("    %-24s peak_kb %d" % (name, element["peak_kb"]))
+if "memory_budget" in report:
+    print("  budget", json.dumps(report["memory_budget"]))'
+}
+
+echo "== default"
+run "$@"
+echo "== --memory-budget=$BUDGET"
+run --memory-budget="$BUDGET" "$@"
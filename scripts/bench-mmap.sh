@@ -0,0 +1,21 @@
+#!/bin/bash
+# Reads FILE through vdmmapsrc and through filesrc (--no-mmap), headless as fast as it
+# decodes, and prints the JSON reports ("io", "cpu_time_s", "element_cpu_time_s").
+# Each source runs twice: the first run may fetch from storage, the second reads the
+# page cache. Use a large file to see the copies.
+#
+#   scripts/bench-mmap.sh FILE
+
+PLAYER=${PLAYER:-./vd_player}
+
+if [ -z "$1" ]; then
+  echo "usage: $0 FILE" >&2
+  exit 1
+fi
+
+for source in --no-mmap ""; do
+  for run in 1 2; do
+    echo "== ${source:-vdmmapsrc}, run $run"
+    "$PLAYER" --headless --bench $source "$1"
+  done
+done
@@ -0,0 +1,23 @@
+#!/bin/bash
+# Mosaic stress benchmark: composites 4, 9 and 16 inputs headless and prints one
+# JSON report per grid size (per tile fps in "tiles", total CPU in "cpu_percent").
+#
+#   scripts/bench-mosaic.sh [FILE]
+#
+# Without FILE every tile is a 1080p videotestsrc, else every tile plays FILE.
+
+PLAYER=${PLAYER:-./vd_player}
+FRAMES=${FRAMES:-600}
+
+for n in 4 9 16; do
+  inputs=()
+  for ((i = 0; i < n; i++)); do
+    if [ -n "$1" ]; then
+      inputs+=("$1")
+    else
+      inputs+=("videotestsrc num-buffers=$FRAMES pattern=$((i % 20)) ! video/x-raw,width=1920,height=1080")
+    fi
+  done
+  echo "== $n tiles"
+  "$PLAYER" --headless --bench --mosaic "${inputs[@]}"
+done
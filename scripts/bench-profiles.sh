@@ -0,0 +1,24 @@
+#!/bin/bash
+# Compares the built-in element tuning profiles on one clip. Each profile is run
+# twice: headless as fast as it decodes ("fps", "cpu_percent", "peak_rss_kb") and in
+# real time on an Xvfb server ("frame_interval_ms", "dropped_frames").
+#
+#   scripts/bench-profiles.sh FILE
+
+PLAYER=${PLAYER:-./vd_player}
+
+if [ -z "$1" ]; then
+  echo "usage: $0 FILE" >&2
+  exit 1
+fi
+
+for profile in default throughput low-latency low-memory; do
+  args=""
+  if [ "$profile" != "default" ]; then
+    args="--profile=$profile"
+  fi
+  echo "== $profile, headless"
+  "$PLAYER" --headless --bench $args "$1"
+  echo "== $profile, real time"
+  xvfb-run -a -s "-screen 0 1920x1080x24" "$PLAYER" --bench --video-sink=x $args "$1"
+done
@@ -0,0 +1,19 @@
+#!/bin/bash
+# Playback cadence under synthetic CPU pressure, with and without the QoS controller.
+# Plays FILE in real time on an Xvfb server while busy loops pin every core, and
+# prints the JSON reports ("frame_interval_ms", "dropped_frames", "qos").
+#
+#   scripts/bench-qos.sh FILE [LOAD_THREADS]
+
+PLAYER=${PLAYER:-./vd_player}
+LOAD=${2:-$(nproc)}
+
+if [ -z "$1" ]; then
+  echo "usage: $0 FILE [LOAD_THREADS]" >&2
+  exit 1
+fi
+
+for qos in --no-qos ""; do
+  echo "== ${qos:-with QoS controller}, $LOAD load threads"
+  xvfb-run -a -s "-screen 0 1920x1080x24" "$PLAYER" --bench --bench-cpu-load=$LOAD --video-sink=x $qos "$1"
+done
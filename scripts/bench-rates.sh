@@ -0,0 +1,15 @@
+#!/bin/bash
+# Displayed fps and CPU use at each playback rate ("rates"), in a window on an Xvfb
+# server so frames are really shown. FILE should last a couple of minutes.
+#
+#   scripts/bench-rates.sh FILE [SINK]
+
+PLAYER=${PLAYER:-./vd_player}
+SINK=${2:-auto}
+
+if [ -z "$1" ]; then
+  echo "usage: $0 FILE [SINK]" >&2
+  exit 1
+fi
+
+xvfb-run -a -s "-screen 0 1920x1080x24" "$PLAYER" --bench --bench-rates --video-sink="$SINK" "$1"
@@ -0,0 +1,19 @@
+#!/bin/bash
+# CPU per video output path on a software only box: plays FILE once per sink on an
+# Xvfb server and prints the JSON reports ("cpu_time_s", "copies").
+#
+#   scripts/bench-sinks.sh FILE
+#
+# Xvfb has no Xv extension, so the xv run is expected to fail there.
+
+PLAYER=${PLAYER:-./vd_player}
+
+if [ -z "$1" ]; then
+  echo "usage: $0 FILE" >&2
+  exit 1
+fi
+
+for sink in xv x gtk auto; do
+  echo "== $sink"
+  xvfb-run -a -s "-screen 0 1920x1080x24" "$PLAYER" --bench --video-sink=$sink "$1"
+done
@@ -0,0 +1,34 @@
+#!/bin/bash
+# Time to first frame on FILE, startup phase by phase ("startup_ms"), with the pipeline
+# prerolling while the window is built (default) and with --serial-startup. Runs in a
+# window on an Xvfb server. Cold runs drop the page cache first, which needs root;
+# without it only warm runs are made.
+#
+#   scripts/bench-startup.sh FILE [RUNS]
+
+PLAYER=${PLAYER:-./vd_player}
+RUNS=${2:-3}
+
+if [ -z "$1" ]; then
+  echo "usage: $0 FILE [RUNS]" >&2
+  exit 1
+fi
+
+run () {
+  # Only the trace is wanted; the player is stopped once it is printed
+  timeout 10 xvfb-run -a -s "-screen 0 1920x1080x24" "$PLAYER" --startup-trace "$@" | grep -m 1 startup_ms
+}
+
+for startup in --serial-startup ""; do
+  if [ -w /proc/sys/vm/drop_caches ]; then
+    for i in $(seq "$RUNS"); do
+      sync && echo 3 > /proc/sys/vm/drop_caches
+      echo "== ${startup:-parallel startup}, cold run $i"
+      run $startup "$1"
+    done
+  fi
+  for i in $(seq "$RUNS"); do
+    echo "== ${startup:-parallel startup}, warm run $i"
+    run $startup "$1"
+  done
+done
@@ -0,0 +1,31 @@
+#!/bin/bash
+# CPU per displayed frame ("cpu_ms_per_frame") without subtitles, with playsink's text
+# renderer and with the cached subtitle bitmaps, on each video sink. Runs in real time
+# in a window on an Xvfb server.
+#
+#   scripts/bench-subtitles.sh FILE SUBS [SINK...]
+
+PLAYER=${PLAYER:-./vd_player}
+
+if [ -z "$2" ]; then
+  echo "usage: $0 FILE SUBS [SINK...]" >&2
+  exit 1
+fi
+FILE=$1
+SUBS=$2
+shift 2
+SINKS=${*:-auto x xv}
+
+run () {
+  xvfb-run -a -s "-screen 0 1920x1080x24" "$PLAYER" --bench "$@" "$FILE" |
+    grep -E '"(fps|cpu_percent|cpu_ms_per_frame)"|"subtitles"'
+}
+
+for sink in $SINKS; do
+  echo "== $sink, no subtitles"
+  run --video-sink="$sink"
+  echo "== $sink, text renderer"
+  run --video-sink="$sink" --sub-file="$SUBS" --no-cached-subtitles
+  echo "== $sink, cached bitmaps"
+  run --video-sink="$sink" --sub-file="$SUBS"
+done
@@ -0,0 +1,24 @@
+#!/bin/bash
+# Input switching benchmark: switches round the given inputs every 2s and prints one
+# JSON report per pool size, switch to first frame times under "switches" ("pooled"
+# out of standby pipelines, "cold" built on the switch) and the memory a standby
+# pipeline took. Runs headless, and in a window too when DISPLAY is set.
+#
+#   scripts/bench-switch.sh FILE FILE...
+
+PLAYER=${PLAYER:-./vd_player}
+SWITCHES=${SWITCHES:-20}
+
+if [ $# -lt 2 ]; then
+  echo "usage: $0 FILE FILE..." >&2
+  exit 1
+fi
+
+for pool in 0 2; do
+  echo "== headless, --pool=$pool"
+  "$PLAYER" --headless --bench --pool=$pool --bench-switches="$SWITCHES" "$@"
+  if [ -n "$DISPLAY" ]; then
+    echo "== --video-sink=xv, --pool=$pool"
+    "$PLAYER" --video-sink=xv --bench --pool=$pool --bench-switches="$SWITCHES" "$@"
+  fi
+done
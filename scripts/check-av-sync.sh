@@ -0,0 +1,76 @@
+#!/bin/bash
+# A/V sync checks ("av_sync"), headless in real time:
+#  - test sources with the seeks of EVENTS replayed: drift stays within the tolerance
+#    and every seek while playing recovers (the last may be cut short by the exit);
+#    lateness is measured at presentation, so it is never exactly 0 throughout;
+#  - a 4K clip (made with ffmpeg) with busy loop threads on every core: video presents
+#    late and the drift goes negative beyond the tolerance;
+#  - a clip with a white flash and a beep every second, the beep DELAY_MS late (made
+#    with ffmpeg): the sync mark offset comes out as DELAY_MS, and as 0 with
+#    --av-offset=-DELAY_MS.
+# Extra arguments go to the player, e.g. --profile=low-latency-audio.
+#
+#   scripts/check-av-sync.sh [DELAY_MS] [EVENTS] [PLAYER ARGS...]
+
+PLAYER=${PLAYER:-./vd_player}
+DELAY=${1:-40}
+EVENTS=${2:-$(dirname "$0")/held-arrow.events}
+shift $(( $# < 2 ? $# : 2 ))
+CLIP=$(mktemp --suffix=.mkv)
+BIG_CLIP=$(mktemp --suffix=.mkv)
+trap 'rm -f "$CLIP" "$BIG_CLIP"' EXIT
+
+# Prints the report and checks KEY against EXPECTED within TOLERANCE (ms)
+check () {
+  python3 -c '
+import json, sys
+text = sys.stdin.read()
+print(text)
+# The bench report, after the input latency one when replaying
+decoder, pos, report = json.JSONDecoder(), 0, None
+while text.find("{", pos) >= 0:
+    obj, pos = decoder.raw_decode(text, text.find("{", pos))
+    report = obj.get("av_sync", report)
+if report is None:
+    sys.exit("no av_sync report")
+key, expected, tolerance = sys.argv[1], float(sys.argv[2]), float(sys.argv[3])
+if key == "min_drift_ms" and expected < 0:
+    # Only the direction and that it is beyond the tolerance are known under load
+    ok = report[key] <= expected and report["max_video_late_ms"] > tolerance
+else:
+    ok = abs(report[key] - expected) <= tolerance
+if key == "max_drift_ms":
+    ok = ok and abs(report["min_drift_ms"] - expected) <= tolerance and report["recovered"] >= report["seeks"] - 1
+    # Clock wake-ups are never exact; all zeroes means nothing was measured
+    ok = ok and report["samples"] > 0 and (report["max_video_late_ms"] != 0 or report["max_audio_late_ms"] != 0)
+print("%s %.2f ms, expected %.2f +- %.2f: %s" % (key, report[key], expected, tolerance, "OK" if ok else "FAIL"))
+sys.exit(0 if ok else 1)' "$@"
+}
+
+status=0
+
+echo "== test sources, seeks from $EVENTS"
+"$PLAYER" --headless --bench --av-sync --replay="$EVENTS" "$@" \
+  "testbin://audio,num-buffers=3000+video,num-buffers=1800" | check max_drift_ms 0 20 || status=1
+
+if ! command -v ffmpeg > /dev/null; then
+  echo "ffmpeg not found, load and sync mark clips skipped" >&2
+  exit $status
+fi
+ffmpeg -loglevel error -y -f lavfi -i "testsrc2=s=3840x2160:r=60:d=10" -f lavfi -i "sine=f=440:d=10" \
+  -c:v libx264 -preset ultrafast -pix_fmt yuv420p -c:a pcm_s16le "$BIG_CLIP" || exit 1
+
+echo "== 4K clip under CPU load"
+"$PLAYER" --headless --bench --av-sync --bench-cpu-load=$((2 * $(nproc))) "$@" "$BIG_CLIP" \
+  | check min_drift_ms -20 20 || status=1
+
+ffmpeg -loglevel error -y \
+  -f lavfi -i "color=c=black:s=320x240:r=30:d=10,drawbox=w=iw:h=ih:c=white:t=fill:enable='lt(mod(t,1),0.1)'" \
+  -f lavfi -i "aevalsrc='sin(2*PI*1000*t)*gte(t,$DELAY/1000)*lt(mod(t-$DELAY/1000,1),0.1)':s=48000:d=10" \
+  -c:v mpeg4 -q:v 2 -c:a pcm_s16le "$CLIP" || exit 1
+
+echo "== sync marks, audio ${DELAY} ms late"
+"$PLAYER" --headless --bench --av-sync "$@" "$CLIP" | check avg_mark_offset_ms "$DELAY" 5 || status=1
+echo "== sync marks, --av-offset=-$DELAY"
+"$PLAYER" --headless --bench --av-sync --av-offset=-"$DELAY" "$@" "$CLIP" | check avg_mark_offset_ms 0 5 || status=1
+exit $status
@@ -0,0 +1,31 @@
+#!/bin/bash
+# Plays a videotestsrc stream in real time in a window on an Xvfb server with
+# --metrics-socket, scrapes it a few times while it plays and checks the metrics are
+# there and frames are being counted.
+#
+#   scripts/check-metrics.sh
+
+PLAYER=${PLAYER:-./vd_player}
+SOCKET=$(mktemp -u /tmp/vd_player-metrics.XXXXXX)
+
+xvfb-run -a -s "-screen 0 1920x1080x24" "$PLAYER" --metrics-socket="$SOCKET" \
+  "testbin://video,num-buffers=300" > /dev/null &
+PID=$!
+trap 'kill $PID 2> /dev/null; wait $PID 2> /dev/null' EXIT
+
+for i in $(seq 50); do
+  [ -S "$SOCKET" ] && break
+  sleep 0.1
+done
+sleep 2
+
+"$(dirname "$0")/scrape-metrics.py" "$SOCKET" --count 3 --interval 1 --expect \
+  vd_player_frames_rendered_total vd_player_frames_dropped_total vd_player_qos_jitter_seconds \
+  vd_player_buffering_percent vd_player_seek_latency_seconds_bucket \
+  vd_player_bitrate_bits vd_player_cpu_seconds_total vd_player_resident_memory_bytes \
+  vd_player_state vd_player_position_seconds | tee /tmp/vd_player-metrics.txt || exit 1
+
+# Frames must keep coming while it plays
+awk '/^== scrape/ { n++ } /^vd_player_frames_rendered_total / { v[n] = $2 }
+  END { if (v[n] > v[1] && v[1] > 0) { print "OK: frames rendered " v[1] " -> " v[n]; exit 0 }
+        print "FAIL: frames rendered " v[1] " -> " v[n]; exit 1 }' /tmp/vd_player-metrics.txt
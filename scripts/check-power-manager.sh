@@ -0,0 +1,113 @@
+#!/bin/bash
+# Checks sleep inhibition against a private session bus. A stub
+# org.gnome.SessionManager answers Inhibit and Uninhibit DELAY_MS late while the
+# player replays pause/play toggles and seeks on FILE in a window on an Xvfb server:
+# the calls must not hold up the main loop, so the input latency p99 has to stay
+# under MAX_P99_MS. Then the stub fails every call at once, and the player must not
+# send a failed call again until pause/play changes what it asks for.
+#
+#   scripts/check-power-manager.sh FILE [DELAY_MS] [MAX_P99_MS]
+
+PLAYER=${PLAYER:-./vd_player}
+DELAY=${2:-2000}
+MAX_P99=${3:-500}
+TOGGLES=8
+
+if [ -z "$1" ]; then
+  echo "usage: $0 FILE [DELAY_MS] [MAX_P99_MS]" >&2
+  exit 1
+fi
+
+DIR=$(mktemp -d)
+cleanup () {
+  [ -n "$STUB" ] && kill "$STUB" 2>/dev/null
+  [ -n "$DAEMON" ] && kill "$DAEMON" 2>/dev/null
+  rm -rf "$DIR"
+}
+trap cleanup EXIT
+
+dbus-daemon --session --nofork --print-address=3 3>"$DIR/address" &
+DAEMON=$!
+for i in $(seq 50); do
+  [ -s "$DIR/address" ] && break
+  sleep 0.1
+done
+export DBUS_SESSION_BUS_ADDRESS=$(head -n 1 "$DIR/address")
+[ -n "$DBUS_SESSION_BUS_ADDRESS" ] || { echo "dbus-daemon didn't start" >&2; exit 1; }
+
+cat > "$DIR/stub.py" <<'EOF'
+import sys, time
+from gi.repository import Gio, GLib
+
+delay, fail, log = float(sys.argv[1]) / 1000, sys.argv[2] == "fail", open(sys.argv[3], "a", buffering=1)
+XML = """<node><interface name="org.gnome.SessionManager">
+  <method name="Inhibit"><arg type="s" direction="in"/><arg type="u" direction="in"/>
+    <arg type="s" direction="in"/><arg type="u" direction="in"/><arg type="u" direction="out"/></method>
+  <method name="Uninhibit"><arg type="u" direction="in"/></method>
+</interface></node>"""
+cookie = 0
+
+def call(conn, sender, path, iface, method, params, invocation):
+    global cookie
+    log.write(method + "\n")
+    # Blocks the stub the way a busy session manager would
+    time.sleep(delay)
+    if fail:
+        invocation.return_dbus_error("org.freedesktop.DBus.Error.ServiceUnknown", "stub failure")
+    elif method == "Inhibit":
+        cookie += 1
+        invocation.return_value(GLib.Variant("(u)", (cookie,)))
+    else:
+        invocation.return_value(None)
+
+def bus_acquired(conn, name):
+    conn.register_object("/org/gnome/SessionManager", Gio.DBusNodeInfo.new_for_xml(XML).interfaces[0], call, None, None)
+
+Gio.bus_own_name(Gio.BusType.SESSION, "org.gnome.SessionManager", Gio.BusNameOwnerFlags.NONE, bus_acquired,
+    lambda conn, name: log.write("ready\n"), None)
+GLib.MainLoop().run()
+EOF
+
+# Pause/play toggles far enough apart for the 500ms debounce to let each one through,
+# with a seek in between to be answered while a call is out
+for i in $(seq 0 $((TOGGLES - 1))); do
+  echo "$((1000 + i * 1500)) key space"
+  echo "$((1700 + i * 1500)) key Right"
+done > "$DIR/toggles.events"
+
+# run MODE DELAY_MS: the replay report; the stub's calls are left in $DIR/calls
+run () {
+  : > "$DIR/calls"
+  python3 "$DIR/stub.py" "$2" "$1" "$DIR/calls" &
+  STUB=$!
+  for i in $(seq 50); do
+    grep -q ready "$DIR/calls" && break
+    sleep 0.1
+  done
+  grep -q ready "$DIR/calls" || { echo "stub session manager didn't start" >&2; exit 1; }
+  xvfb-run -a -s "-screen 0 1920x1080x24" "$PLAYER" --replay="$DIR/toggles.events" "$FILE"
+  kill "$STUB" 2>/dev/null
+  wait "$STUB" 2>/dev/null
+  STUB=
+}
+FILE=$1
+
+REPORT=$(run ok "$DELAY") || exit 1
+CALLS=$(grep -c -v ready "$DIR/calls")
+echo "$REPORT" | python3 -c '
+import json, sys
+latency = json.load(sys.stdin)["input_latency_ms"]
+limit, calls = float(sys.argv[1]), int(sys.argv[2])
+ok = latency["all"]["p99"] <= limit and latency["handler"]["p99"] <= limit and calls > 0
+print("%s ms replies: p99 %.2f ms, handlers p99 %.2f ms, limit %.2f ms, %d calls: %s" % (sys.argv[3],
+    latency["all"]["p99"], latency["handler"]["p99"], limit, calls, "OK" if ok else "FAIL"))
+sys.exit(0 if ok else 1)' "$MAX_P99" "$CALLS" "$DELAY" || exit 1
+
+run fail 0 > /dev/null || exit 1
+CALLS=$(grep -c -v ready "$DIR/calls")
+# One Inhibit or Uninhibit per toggle at most, and the first Inhibit on playing
+if [ "$CALLS" -gt $((TOGGLES + 1)) ]; then
+  echo "failing session manager: $CALLS calls for $TOGGLES toggles: FAIL"
+  exit 1
+fi
+echo "failing session manager: $CALLS calls for $TOGGLES toggles: OK"
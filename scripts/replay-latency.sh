@@ -0,0 +1,26 @@
+#!/bin/bash
+# Replays recorded input (--record) against FILE in a window on an Xvfb server and
+# prints the input latency percentiles. With MAX_P99_MS, fails when the overall p99 is
+# above it, for gating releases.
+#
+#   scripts/replay-latency.sh FILE [EVENTS] [MAX_P99_MS]
+
+PLAYER=${PLAYER:-./vd_player}
+EVENTS=${2:-$(dirname "$0")/held-arrow.events}
+MAX_P99=$3
+
+if [ -z "$1" ]; then
+  echo "usage: $0 FILE [EVENTS] [MAX_P99_MS]" >&2
+  exit 1
+fi
+
+REPORT=$(xvfb-run -a -s "-screen 0 1920x1080x24" "$PLAYER" --replay="$EVENTS" "$1") || exit 1
+echo "$REPORT"
+[ -z "$MAX_P99" ] && exit 0
+
+echo "$REPORT" | python3 -c '
+import json, sys
+p99 = json.load(sys.stdin)["input_latency_ms"]["all"]["p99"]
+limit = float(sys.argv[1])
+print("p99 %.2f ms, limit %.2f ms: %s" % (p99, limit, "OK" if p99 <= limit else "FAIL"))
+sys.exit(0 if p99 <= limit else 1)' "$MAX_P99"
@@ -0,0 +1,66 @@
+#!/usr/bin/env python3
+"""Scrapes the player's metrics socket (--metrics-socket) like Prometheus would, over
+HTTP on a Unix socket, and prints the samples. With --expect, exits non-zero unless
+every named metric is present.
+
+    scripts/scrape-metrics.py SOCKET [--expect NAME...] [--count N] [--interval S]
+"""
+import argparse
+import socket
+import sys
+import time
+
+
+def scrape(path):
+    with socket.socket(socket.AF_UNIX, socket.SOCK_STREAM) as sock:
+        sock.settimeout(5)
+        sock.connect(path)
+        sock.sendall(b"GET /metrics HTTP/1.0\r\n\r\n")
+        data = b""
+        while True:
+            chunk = sock.recv(65536)
+            if not chunk:
+                break
+            data += chunk
+    header, _, body = data.decode().partition("\r\n\r\n")
+    if not header.startswith("HTTP/1.0 200"):
+        raise RuntimeError("bad response: " + header.splitlines()[0] if header else "empty response")
+    return body
+
+
+def samples(body):
+    result = {}
+    for line in body.splitlines():
+        if line and not line.startswith("#"):
+            name, _, value = line.rpartition(" ")
+            result[name] = float(value)
+    return result
+
+
+def main():
+    parser = argparse.ArgumentParser()
+    parser.add_argument("socket")
+    parser.add_argument("--expect", nargs="*", default=[])
+    parser.add_argument("--count", type=int, default=1)
+    parser.add_argument("--interval", type=float, default=1.0)
+    args = parser.parse_args()
+
+    missing = set()
+    for i in range(args.count):
+        if i:
+            time.sleep(args.interval)
+        start = time.monotonic()
+        values = samples(scrape(args.socket))
+        print("== scrape %d, %.1f ms" % (i + 1, (time.monotonic() - start) * 1000))
+        for name in sorted(values):
+            print("%s %g" % (name, values[name]))
+        names = {name.partition("{")[0] for name in values}
+        missing = {name for name in args.expect if name not in names}
+    if missing:
+        print("missing: " + ", ".join(sorted(missing)), file=sys.stderr)
+        return 1
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
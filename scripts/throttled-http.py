@@ -0,0 +1,86 @@
+#!/usr/bin/env python3
+"""Serves files over HTTP at a limited rate, with Range support so players can seek.
+Stands in for a slow network or storage when testing buffering.
+
+    scripts/throttled-http.py [--port 8000] [--rate KBPS] [--root DIR]
+"""
+import argparse
+import http.server
+import os
+import time
+
+CHUNK = 16 * 1024
+
+
+class ThrottledHandler(http.server.SimpleHTTPRequestHandler):
+    rate = 0  # bytes/s, 0 for unlimited
+
+    def send_head(self):
+        path = self.translate_path(self.path)
+        if not os.path.isfile(path):
+            self.send_error(404)
+            return None
+        size = os.path.getsize(path)
+        start, end = 0, size - 1
+        ranged = self.headers.get("Range", "").startswith("bytes=")
+        if ranged:
+            first, _, last = self.headers["Range"][6:].split(",")[0].partition("-")
+            if first:
+                start = int(first)
+                end = int(last) if last else end
+            else:
+                start = max(0, size - int(last))
+            if start >= size:
+                self.send_error(416)
+                return None
+            end = min(end, size - 1)
+        self.send_response(206 if ranged else 200)
+        self.send_header("Content-Type", self.guess_type(path))
+        self.send_header("Accept-Ranges", "bytes")
+        self.send_header("Content-Length", str(end - start + 1))
+        if ranged:
+            self.send_header("Content-Range", "bytes %d-%d/%d" % (start, end, size))
+        self.end_headers()
+        f = open(path, "rb")
+        f.seek(start)
+        self.remaining = end - start + 1
+        return f
+
+    def copyfile(self, source, outputfile):
+        began = time.monotonic()
+        sent = 0
+        while self.remaining > 0:
+            data = source.read(min(CHUNK, self.remaining))
+            if not data:
+                break
+            try:
+                outputfile.write(data)
+            except (BrokenPipeError, ConnectionResetError):
+                # The player seeked elsewhere and dropped the connection
+                break
+            sent += len(data)
+            self.remaining -= len(data)
+            if self.rate:
+                ahead = sent / self.rate - (time.monotonic() - began)
+                if ahead > 0:
+                    time.sleep(ahead)
+
+    def log_message(self, fmt, *args):
+        pass
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__)
+    parser.add_argument("--port", type=int, default=8000)
+    parser.add_argument("--rate", type=int, default=0, help="KB/s per connection, 0 for unlimited")
+    parser.add_argument("--root", default=".")
+    args = parser.parse_args()
+
+    ThrottledHandler.rate = args.rate * 1024
+    os.chdir(args.root)
+    server = http.server.ThreadingHTTPServer(("127.0.0.1", args.port), ThrottledHandler)
+    server.serve_forever()
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,240 @@
+#include <gst/gst.h>
+
+#include "ab_loop.h"
+#include "log.h"
+
+/* Wrap measurement on one sink pad, updated from its streaming thread */
+typedef struct _LoopSink {
+  AbLoop *loop;
+  gchar *name;
+  GstPad *pad;
+  GstSegment segment;
+  gboolean flushed;               /* A flush came since the last segment: a seek, not a wrap */
+  gboolean wrapPending;           /* A segment continuing without a flush, measured on the next buffer */
+  GstClockTime lastEnd;           /* Running time the previous buffer ended at */
+  gint64 lastArrival;             /* Monotonic time the previous buffer came in */
+
+  guint wraps;
+  gdouble gapSum;                 /* Running time discontinuities, in ns */
+  gint64 gapMax;                  /* Largest one, by magnitude */
+  gint64 wallMax;                 /* Largest arrival interval across a wrap, in microseconds */
+} LoopSink;
+
+struct _AbLoop {
+  GstElement *pipeline;
+  SeekScheduler *seeker;
+
+  gint64 markA;                   /* First marker, -1 before ab_loop_mark */
+
+  GMutex lock;                    /* Protects sinks and their statistics */
+  GPtrArray *sinks;               /* LoopSink */
+};
+
+static void loop_sink_free (LoopSink *sink) {
+  g_free (sink->name);
+  gst_object_unref (sink->pad);
+  g_free (sink);
+}
+
+AbLoop *ab_loop_new (GstElement *pipeline, SeekScheduler *seeker) {
+  AbLoop *loop = g_new0 (AbLoop, 1);
+
+  loop->pipeline = gst_object_ref (pipeline);
+  loop->seeker = seeker;
+  loop->markA = -1;
+  g_mutex_init (&loop->lock);
+  loop->sinks = g_ptr_array_new_with_free_func ((GDestroyNotify)loop_sink_free);
+  return loop;
+}
+
+void ab_loop_free (AbLoop *loop) {
+  guint i;
+
+  if (NULL == loop)
+    return;
+  for (i = 0; i < loop->sinks->len; i++) {
+    LoopSink *sink = g_ptr_array_index (loop->sinks, i);
+
+    LOGD ("%s: %u loop wraps, max gap %.2f ms", sink->name, sink->wraps, sink->gapMax / 1e6);
+  }
+  /* The probes are gone with the pipeline, which is stopped by now */
+  g_ptr_array_free (loop->sinks, TRUE);
+  g_mutex_clear (&loop->lock);
+  gst_object_unref (loop->pipeline);
+  g_free (loop);
+}
+
+void ab_loop_set_pipeline (AbLoop *loop, GstElement *pipeline) {
+  /* A marker on the old source means nothing on the new one */
+  loop->markA = -1;
+  gst_object_replace ((GstObject **)&loop->pipeline, GST_OBJECT (pipeline));
+}
+
+void ab_loop_set (AbLoop *loop, gint64 start, gint64 stop) {
+  loop->markA = -1;
+  seek_scheduler_set_loop (loop->seeker, start, stop);
+}
+
+void ab_loop_mark (AbLoop *loop) {
+  gint64 start, stop, position;
+
+  if (seek_scheduler_get_loop (loop->seeker, &start, &stop)) {
+    LOGI ("A-B loop off");
+    seek_scheduler_set_loop (loop->seeker, -1, -1);
+    return;
+  }
+  position = seek_scheduler_get_target (loop->seeker);
+  if (position < 0 && !gst_element_query_position (loop->pipeline, GST_FORMAT_TIME, &position)) {
+    LOGD ("Failed to get position");
+    return;
+  }
+
+  if (loop->markA < 0) {
+    loop->markA = position;
+    LOGI ("A-B loop: A at %" GST_TIME_FORMAT, GST_TIME_ARGS (position));
+    return;
+  }
+  /* Marked backwards (or in reverse playback): still the range between the two */
+  start = MIN (loop->markA, position);
+  stop = MAX (loop->markA, position);
+  LOGI ("A-B loop: %" GST_TIME_FORMAT " - %" GST_TIME_FORMAT, GST_TIME_ARGS (start), GST_TIME_ARGS (stop));
+  ab_loop_set (loop, start, stop);
+}
+
+static void record_wrap (LoopSink *sink, GstClockTime start, gint64 now) {
+  AbLoop *loop = sink->loop;
+  gint64 gap = (gint64)start - (gint64)sink->lastEnd;
+
+  g_mutex_lock (&loop->lock);
+  sink->wraps++;
+  sink->gapSum += gap;
+  if (ABS (gap) > ABS (sink->gapMax))
+    sink->gapMax = gap;
+  sink->wallMax = MAX (sink->wallMax, now - sink->lastArrival);
+  g_mutex_unlock (&loop->lock);
+  LOGD ("%s: loop wrap, %.2f ms running time gap, %.2f ms between buffers", sink->name, gap / 1e6,
+      (now - sink->lastArrival) / 1000.0);
+}
+
+/* Running time a buffer starts and ends at; in reverse playback it starts at its end */
+static gboolean buffer_running_time (GstSegment *segment, GstBuffer *buffer, GstClockTime *start, GstClockTime *end) {
+  GstClockTime first = GST_BUFFER_PTS (buffer);
+  GstClockTime last = first + (GST_BUFFER_DURATION_IS_VALID (buffer) ? GST_BUFFER_DURATION (buffer) : 0);
+
+  if (segment->rate < 0) {
+    GstClockTime tmp = first;
+
+    first = last;
+    last = tmp;
+  }
+  *start = gst_segment_to_running_time (segment, GST_FORMAT_TIME, first);
+  *end = gst_segment_to_running_time (segment, GST_FORMAT_TIME, last);
+  if (!GST_CLOCK_TIME_IS_VALID (*end))
+    *end = *start;
+  return GST_CLOCK_TIME_IS_VALID (*start);
+}
+
+static GstPadProbeReturn sink_probe_cb (GstPad *pad, GstPadProbeInfo *info, LoopSink *sink) {
+  GstBuffer *buffer;
+  GstClockTime start, end;
+  gint64 now;
+
+  if (GST_IS_EVENT (GST_PAD_PROBE_INFO_DATA (info))) {
+    GstEvent *event = GST_PAD_PROBE_INFO_EVENT (info);
+
+    switch (GST_EVENT_TYPE (event)) {
+      case GST_EVENT_FLUSH_STOP:
+        sink->flushed = TRUE;
+        sink->wrapPending = FALSE;
+        break;
+      case GST_EVENT_SEGMENT:
+        gst_event_copy_segment (event, &sink->segment);
+        /* Non-flushing segment seeks are the loop wrapping around */
+        sink->wrapPending = !sink->flushed && GST_CLOCK_TIME_IS_VALID (sink->lastEnd);
+        sink->flushed = FALSE;
+        break;
+      default:
+        break;
+    }
+    return GST_PAD_PROBE_OK;
+  }
+
+  buffer = GST_PAD_PROBE_INFO_BUFFER (info);
+  if (GST_FORMAT_TIME != sink->segment.format || !GST_BUFFER_PTS_IS_VALID (buffer))
+    return GST_PAD_PROBE_OK;
+  if (!buffer_running_time (&sink->segment, buffer, &start, &end))
+    return GST_PAD_PROBE_OK;
+
+  now = g_get_monotonic_time ();
+  if (sink->wrapPending) {
+    record_wrap (sink, start, now);
+    sink->wrapPending = FALSE;
+  }
+  sink->lastEnd = end;
+  sink->lastArrival = now;
+  return GST_PAD_PROBE_OK;
+}
+
+void ab_loop_watch_sink (AbLoop *loop, GstElement *element, const char *name) {
+  LoopSink *sink;
+  GstPad *pad;
+  guint i;
+
+  if (NULL == loop)
+    return;
+  pad = gst_element_get_static_pad (element, "sink");
+  if (NULL == pad) {
+    LOGD ("%s has no sink pad, loop wraps not measured", GST_OBJECT_NAME (element));
+    return;
+  }
+
+  /* Only the first sink of each kind */
+  g_mutex_lock (&loop->lock);
+  for (i = 0; i < loop->sinks->len; i++) {
+    if (!g_strcmp0 (((LoopSink *)g_ptr_array_index (loop->sinks, i))->name, name)) {
+      g_mutex_unlock (&loop->lock);
+      gst_object_unref (pad);
+      return;
+    }
+  }
+  g_mutex_unlock (&loop->lock);
+
+  sink = g_new0 (LoopSink, 1);
+  sink->loop = loop;
+  sink->name = g_strdup (name);
+  sink->pad = pad;
+  gst_segment_init (&sink->segment, GST_FORMAT_UNDEFINED);
+  sink->lastEnd = GST_CLOCK_TIME_NONE;
+  /* Sinks are added from streaming threads while others may already be probing */
+  g_mutex_lock (&loop->lock);
+  g_ptr_array_add (loop->sinks, sink);
+  g_mutex_unlock (&loop->lock);
+  gst_pad_add_probe (pad, GST_PAD_PROBE_TYPE_BUFFER | GST_PAD_PROBE_TYPE_EVENT_DOWNSTREAM | GST_PAD_PROBE_TYPE_EVENT_FLUSH,
+      (GstPadProbeCallback)sink_probe_cb, sink, NULL);
+}
+
+guint ab_loop_get_wraps (AbLoop *loop) {
+  guint wraps = 0;
+
+  g_mutex_lock (&loop->lock);
+  if (loop->sinks->len > 0)
+    wraps = ((LoopSink *)g_ptr_array_index (loop->sinks, 0))->wraps;
+  g_mutex_unlock (&loop->lock);
+  return wraps;
+}
+
+void ab_loop_append_json (GString *out, gdouble wall, AbLoop *loop) {
+  guint i;
+
+  g_string_append_c (out, '{');
+  g_mutex_lock (&loop->lock);
+  for (i = 0; i < loop->sinks->len; i++) {
+    LoopSink *sink = g_ptr_array_index (loop->sinks, i);
+
+    g_string_append_printf (out, "%s\n    \"%s\": { \"wraps\": %u, \"avg_gap_ms\": %.3f, \"max_gap_ms\": %.3f, "
+        "\"max_wall_gap_ms\": %.2f }", i ? "," : "", sink->name, sink->wraps,
+        sink->wraps ? sink->gapSum / sink->wraps / 1e6 : 0.0, sink->gapMax / 1e6, sink->wallMax / 1000.0);
+  }
+  g_mutex_unlock (&loop->lock);
+  g_string_append (out, loop->sinks->len ? "\n  }" : "}");
+}
@@ -0,0 +1,509 @@
+#include <gst/gst.h>
+#include <gst/base/gstbasesink.h>
+#include <gst/audio/audio.h>
+#include <gst/video/video.h>
+
+#include "av_sync.h"
+#include "log.h"
+
+/* Mark detection thresholds with hysteresis: mean of the first video component out
+   of 255, peak audio level out of full scale */
+#define MARK_BRIGHT 160
+#define MARK_DARK 96
+#define MARK_LOUD 0.25
+#define MARK_QUIET 0.05
+/* Every MARK_STEP-th pixel of every MARK_STEP-th row is enough for a flash */
+#define MARK_STEP 8
+
+typedef enum {
+  SAMPLE_NONE,
+  SAMPLE_S16,
+  SAMPLE_F32
+} SampleFormat;
+
+/* One watched sink pad, its caps and segment only touched from its streaming thread */
+typedef struct _SyncSink {
+  AvSync *sync;
+  GstElement *element;            /* The GstBaseSink itself, inside the bin when given one */
+  GstPad *pad;
+  gboolean audio;
+  gboolean ringBuffer;            /* A GstAudioBaseSink, timed by what its ring buffer holds */
+  GstSegment segment;
+
+  gboolean videoValid;            /* Frames can be searched for marks */
+  GstVideoInfo videoInfo;
+  SampleFormat sampleFormat;
+  gint channels;
+  gint rate;
+  gboolean interleaved;
+  gboolean markOn;                /* Bright or loud right now, a mark is the rising edge */
+
+  /* The buffer being rendered, until its QoS event tells how late that was */
+  GstClockTime pendingRunning;    /* NONE when there is none */
+  gboolean pendingMark;
+  GstClockTime pendingOffset;
+
+  /* Under the AvSync lock */
+  gboolean fresh;                 /* A buffer came since the last flush */
+  GstClockTimeDiff late;          /* How late the latest buffer was presented, negative when early */
+  GstClockTimeDiff maxLate;       /* G_MININT64 until the first one */
+  GstClockTime markTime;          /* Presentation running time of an unpaired mark, or NONE */
+} SyncSink;
+
+typedef struct _DriftSample {
+  gint64 time;                    /* Microseconds since the first sample */
+  gint64 drift;                   /* ns, positive when audio is behind */
+} DriftSample;
+
+struct _AvSync {
+  GMutex lock;
+  SyncSink *sinks[2];             /* Video, audio */
+
+  gint64 firstSample;             /* Monotonic times */
+  gint64 lastSample;
+  GArray *samples;                /* DriftSample */
+
+  guint32 flushSeqnum;            /* Seek the sinks are flushing for, both see its FLUSH_STOP */
+  gint64 flushTime;               /* When it flushed while playing, 0 when in sync */
+  guint seeks;
+  GArray *recoveries;             /* gint64 microseconds */
+
+  GArray *markOffsets;            /* gint64 ns, audio mark minus video mark */
+};
+
+AvSync *av_sync_new (void) {
+  AvSync *sync = g_new0 (AvSync, 1);
+
+  g_mutex_init (&sync->lock);
+  sync->samples = g_array_new (FALSE, FALSE, sizeof (DriftSample));
+  sync->recoveries = g_array_new (FALSE, FALSE, sizeof (gint64));
+  sync->markOffsets = g_array_new (FALSE, FALSE, sizeof (gint64));
+  sync->flushSeqnum = GST_SEQNUM_INVALID;
+  return sync;
+}
+
+static void sync_sink_free (SyncSink *sink) {
+  if (NULL == sink)
+    return;
+  gst_object_unref (sink->pad);
+  gst_object_unref (sink->element);
+  g_free (sink);
+}
+
+void av_sync_free (AvSync *sync) {
+  if (NULL == sync)
+    return;
+  LOGD ("A/V sync: %u drift samples, %u of %u seeks recovered, %u sync marks", sync->samples->len,
+      sync->recoveries->len, sync->seeks, sync->markOffsets->len);
+  /* The probes are gone with the pipeline, which is stopped by now */
+  sync_sink_free (sync->sinks[0]);
+  sync_sink_free (sync->sinks[1]);
+  g_array_free (sync->samples, TRUE);
+  g_array_free (sync->recoveries, TRUE);
+  g_array_free (sync->markOffsets, TRUE);
+  g_mutex_clear (&sync->lock);
+  g_free (sync);
+}
+
+static void parse_caps (SyncSink *sink, GstCaps *caps) {
+  GstAudioInfo audioInfo;
+
+  if (!sink->audio) {
+    sink->videoValid = gst_video_info_from_caps (&sink->videoInfo, caps) &&
+        8 == GST_VIDEO_FORMAT_INFO_DEPTH (sink->videoInfo.finfo, 0);
+    return;
+  }
+
+  sink->sampleFormat = SAMPLE_NONE;
+  if (!gst_audio_info_from_caps (&audioInfo, caps) || GST_AUDIO_INFO_CHANNELS (&audioInfo) <= 0 ||
+      GST_AUDIO_INFO_RATE (&audioInfo) <= 0)
+    return;
+  sink->channels = GST_AUDIO_INFO_CHANNELS (&audioInfo);
+  sink->rate = GST_AUDIO_INFO_RATE (&audioInfo);
+  sink->interleaved = GST_AUDIO_LAYOUT_INTERLEAVED == GST_AUDIO_INFO_LAYOUT (&audioInfo);
+  if (GST_AUDIO_FORMAT_S16 == GST_AUDIO_INFO_FORMAT (&audioInfo)) {
+    sink->sampleFormat = SAMPLE_S16;
+  } else if (GST_AUDIO_FORMAT_F32 == GST_AUDIO_INFO_FORMAT (&audioInfo)) {
+    sink->sampleFormat = SAMPLE_F32;
+  }
+}
+
+/* Rising edge of the mean brightness; *offset is 0, the whole frame is the mark */
+static gboolean find_video_mark (SyncSink *sink, GstBuffer *buffer, GstClockTime *offset) {
+  GstVideoFrame frame;
+  const guint8 *data;
+  gint stride, pstride, width, height, x, y;
+  guint64 sum = 0;
+  guint n = 0;
+  gboolean mark = FALSE;
+  guint mean;
+
+  if (!sink->videoValid || !gst_video_frame_map (&frame, &sink->videoInfo, buffer, GST_MAP_READ))
+    return FALSE;
+  data = GST_VIDEO_FRAME_COMP_DATA (&frame, 0);
+  stride = GST_VIDEO_FRAME_COMP_STRIDE (&frame, 0);
+  pstride = GST_VIDEO_FRAME_COMP_PSTRIDE (&frame, 0);
+  width = GST_VIDEO_FRAME_COMP_WIDTH (&frame, 0);
+  height = GST_VIDEO_FRAME_COMP_HEIGHT (&frame, 0);
+  for (y = 0; y < height; y += MARK_STEP) {
+    for (x = 0; x < width; x += MARK_STEP) {
+      sum += data[y * stride + x * pstride];
+      n++;
+    }
+  }
+  gst_video_frame_unmap (&frame);
+
+  mean = n ? (guint)(sum / n) : 0;
+  if (!sink->markOn && mean >= MARK_BRIGHT) {
+    sink->markOn = mark = TRUE;
+    *offset = 0;
+  } else if (sink->markOn && mean < MARK_DARK) {
+    sink->markOn = FALSE;
+  }
+  return mark;
+}
+
+/* Onset of a loud stretch after a quiet one; *offset is that of the first loud sample */
+static gboolean find_audio_mark (SyncSink *sink, GstBuffer *buffer, GstClockTime *offset) {
+  GstMapInfo map;
+  gsize count, i, first = G_MAXSIZE;
+  gdouble level, peak = 0.0;
+  gboolean mark = FALSE;
+
+  if (SAMPLE_NONE == sink->sampleFormat || !gst_buffer_map (buffer, &map, GST_MAP_READ))
+    return FALSE;
+  count = map.size / (SAMPLE_S16 == sink->sampleFormat ? sizeof (gint16) : sizeof (gfloat));
+  for (i = 0; i < count; i++) {
+    if (SAMPLE_S16 == sink->sampleFormat) {
+      level = ABS (((const gint16 *)map.data)[i]) / 32768.0;
+    } else {
+      level = ABS (((const gfloat *)map.data)[i]);
+    }
+    if (level >= MARK_LOUD && G_MAXSIZE == first)
+      first = i;
+    peak = MAX (peak, level);
+  }
+  gst_buffer_unmap (buffer, &map);
+
+  if (!sink->markOn && G_MAXSIZE != first) {
+    gsize frames = count / sink->channels;
+
+    sink->markOn = mark = TRUE;
+    /* Planar buffers hold each channel's frames one after the other */
+    first = sink->interleaved ? first / sink->channels : first % MAX (frames, 1);
+    *offset = gst_util_uint64_scale_int (first, GST_SECOND, sink->rate);
+  } else if (sink->markOn && peak < MARK_QUIET) {
+    sink->markOn = FALSE;
+  }
+  return mark;
+}
+
+static void record_flush (SyncSink *sink, GstEvent *event) {
+  AvSync *sync = sink->sync;
+  guint32 seqnum = gst_event_get_seqnum (event);
+
+  sink->pendingRunning = GST_CLOCK_TIME_NONE;
+  g_mutex_lock (&sync->lock);
+  sink->fresh = FALSE;
+  sink->markTime = GST_CLOCK_TIME_NONE;
+  /* Both sinks flush for every seek, it counts once */
+  if (seqnum != sync->flushSeqnum) {
+    sync->flushSeqnum = seqnum;
+    if (sync->flushTime) {
+      LOGD ("A/V sync: seek before the previous one recovered");
+    }
+    sync->flushTime = 0;
+    /* Paused seeks and frame steps have nothing to catch up with */
+    if (GST_STATE_PLAYING == GST_STATE_TARGET (sink->element)) {
+      sync->flushTime = g_get_monotonic_time ();
+      sync->seeks++;
+    }
+  }
+  g_mutex_unlock (&sync->lock);
+}
+
+static void record_buffer (SyncSink *sink, GstClockTimeDiff late, gboolean mark, GstClockTime markTime) {
+  AvSync *sync = sink->sync;
+  SyncSink *video, *audio, *other;
+  gint64 now = g_get_monotonic_time ();
+  GstClockTimeDiff drift;
+  DriftSample sample;
+
+  g_mutex_lock (&sync->lock);
+  video = sync->sinks[0];
+  audio = sync->sinks[1];
+  other = sink->audio ? video : audio;
+  sink->fresh = TRUE;
+  sink->late = late;
+  sink->maxLate = MAX (sink->maxLate, late);
+
+  if (other && other->fresh) {
+    drift = GST_CLOCK_DIFF (video->late, audio->late);
+    if (sync->flushTime && ABS (drift) <= AV_SYNC_TOLERANCE) {
+      gint64 recovery = now - sync->flushTime;
+
+      g_array_append_val (sync->recoveries, recovery);
+      sync->flushTime = 0;
+      LOGD ("A/V sync: recovered %.1f ms after the seek", recovery / 1000.0);
+    }
+    if (now - sync->lastSample >= AV_SYNC_SAMPLE_MS * 1000) {
+      if (0 == sync->samples->len)
+        sync->firstSample = now;
+      sample.time = now - sync->firstSample;
+      sample.drift = drift;
+      g_array_append_val (sync->samples, sample);
+      sync->lastSample = now;
+    }
+  }
+
+  if (mark) {
+    sink->markTime = markTime;
+    if (other && GST_CLOCK_TIME_IS_VALID (other->markTime) &&
+        ABS (GST_CLOCK_DIFF (other->markTime, markTime)) <= AV_SYNC_MARK_WINDOW) {
+      gint64 offset = GST_CLOCK_DIFF (video->markTime, audio->markTime);
+
+      g_array_append_val (sync->markOffsets, offset);
+      video->markTime = audio->markTime = GST_CLOCK_TIME_NONE;
+      LOGD ("A/V sync: mark offset %.1f ms", offset / 1e6);
+    }
+  }
+  g_mutex_unlock (&sync->lock);
+}
+
+/* How long until a sample written now is heard: what the ring buffer holds beyond
+   the write position plus what the device holds. FALSE while that isn't known */
+static gboolean ring_buffer_ahead (GstAudioBaseSink *sink, GstClockTime *ahead) {
+  GstAudioRingBuffer *ring = sink->ringbuffer;
+  guint64 written = sink->next_sample, queued;
+  guint64 done;
+  gint rate;
+
+  if (NULL == ring || (guint64)-1 == written || !gst_audio_ring_buffer_is_acquired (ring) ||
+      (rate = GST_AUDIO_INFO_RATE (&ring->spec.info)) <= 0)
+    return FALSE;
+  done = gst_audio_ring_buffer_samples_done (ring);
+  queued = (written > done ? written - done : 0) + gst_audio_ring_buffer_delay (ring);
+  *ahead = gst_util_uint64_scale_int (queued, GST_SECOND, rate);
+  return TRUE;
+}
+
+/* A GstBaseSink reports how late it rendered each buffer, measured when its clock wait
+   returns, in the QoS event it sends upstream right after */
+static void record_qos (SyncSink *sink, GstEvent *event) {
+  GstClockTimeDiff jitter, tsOffset;
+  GstClockTime running = sink->pendingRunning;
+
+  if (!GST_CLOCK_TIME_IS_VALID (running))
+    return;
+  sink->pendingRunning = GST_CLOCK_TIME_NONE;
+  gst_event_parse_qos (event, NULL, NULL, &jitter, NULL);
+  tsOffset = gst_base_sink_get_ts_offset (GST_BASE_SINK (sink->element));
+  record_buffer (sink, jitter, sink->pendingMark, running + sink->pendingOffset + tsOffset + jitter);
+}
+
+static GstPadProbeReturn sink_probe_cb (GstPad *pad, GstPadProbeInfo *info, SyncSink *sink) {
+  GstBuffer *buffer;
+  GstClock *clock;
+  GstClockTime running, now, ahead, offset = 0;
+  GstClockTimeDiff tsOffset, late;
+  gboolean mark;
+
+  if (GST_IS_EVENT (GST_PAD_PROBE_INFO_DATA (info))) {
+    GstEvent *event = GST_PAD_PROBE_INFO_EVENT (info);
+    GstCaps *caps;
+
+    switch (GST_EVENT_TYPE (event)) {
+      case GST_EVENT_QOS:
+        record_qos (sink, event);
+        break;
+      case GST_EVENT_FLUSH_STOP:
+        sink->markOn = FALSE;
+        record_flush (sink, event);
+        break;
+      case GST_EVENT_SEGMENT:
+        gst_event_copy_segment (event, &sink->segment);
+        break;
+      case GST_EVENT_CAPS:
+        gst_event_parse_caps (event, &caps);
+        parse_caps (sink, caps);
+        break;
+      default:
+        break;
+    }
+    return GST_PAD_PROBE_OK;
+  }
+
+  buffer = GST_PAD_PROBE_INFO_BUFFER (info);
+  if (GST_FORMAT_TIME != sink->segment.format || !GST_BUFFER_PTS_IS_VALID (buffer))
+    return GST_PAD_PROBE_OK;
+  running = GST_BUFFER_PTS (buffer);
+  if (sink->segment.rate < 0 && GST_BUFFER_DURATION_IS_VALID (buffer))
+    running += GST_BUFFER_DURATION (buffer);
+  running = gst_segment_to_running_time (&sink->segment, GST_FORMAT_TIME, running);
+  if (!GST_CLOCK_TIME_IS_VALID (running))
+    return GST_PAD_PROBE_OK;
+
+  /* Marks only make sense played forwards at normal speed */
+  mark = sink->segment.rate == 1.0 &&
+      (sink->audio ? find_audio_mark (sink, buffer, &offset) : find_video_mark (sink, buffer, &offset));
+
+  if (!sink->ringBuffer) {
+    /* Rendered, prerolled ones included, once the clock gets there; the QoS event
+     * for it comes before the next buffer */
+    sink->pendingRunning = running;
+    sink->pendingMark = mark;
+    sink->pendingOffset = offset;
+    return GST_PAD_PROBE_OK;
+  }
+
+  /* The ring buffer is only drained while playing */
+  if (GST_STATE_PLAYING != GST_STATE (sink->element) ||
+      !ring_buffer_ahead (GST_AUDIO_BASE_SINK (sink->element), &ahead) ||
+      NULL == (clock = gst_element_get_clock (sink->element)))
+    return GST_PAD_PROBE_OK;
+  now = gst_clock_get_time (clock) - gst_element_get_base_time (sink->element);
+  gst_object_unref (clock);
+
+  tsOffset = gst_base_sink_get_ts_offset (GST_BASE_SINK (sink->element));
+  late = GST_CLOCK_DIFF (running + tsOffset + gst_base_sink_get_latency (GST_BASE_SINK (sink->element)), now + ahead);
+  record_buffer (sink, late, mark, running + offset + tsOffset + late);
+  return GST_PAD_PROBE_OK;
+}
+
+/* The GstBaseSink doing the rendering, element itself or the first one inside it */
+static GstElement *find_base_sink (GstElement *element) {
+  GstIterator *it;
+  GValue item = G_VALUE_INIT;
+  GstElement *found = NULL;
+
+  if (GST_IS_BASE_SINK (element))
+    return gst_object_ref (element);
+  if (!GST_IS_BIN (element))
+    return NULL;
+  it = gst_bin_iterate_sinks (GST_BIN (element));
+  while (NULL == found && GST_ITERATOR_OK == gst_iterator_next (it, &item)) {
+    found = find_base_sink (g_value_get_object (&item));
+    g_value_reset (&item);
+  }
+  g_value_unset (&item);
+  gst_iterator_free (it);
+  return found;
+}
+
+void av_sync_watch_sink (AvSync *sync, GstElement *element, gboolean audio) {
+  SyncSink *sink;
+  GstElement *baseSink;
+  GstPad *pad;
+
+  if (NULL == sync)
+    return;
+  baseSink = find_base_sink (element);
+  pad = baseSink ? gst_element_get_static_pad (baseSink, "sink") : NULL;
+  if (NULL == pad) {
+    LOGD ("%s has no base sink, A/V sync not measured", GST_OBJECT_NAME (element));
+    if (baseSink)
+      gst_object_unref (baseSink);
+    return;
+  }
+
+  sink = g_new0 (SyncSink, 1);
+  sink->sync = sync;
+  sink->element = baseSink;
+  sink->pad = pad;
+  sink->audio = audio;
+  sink->ringBuffer = GST_IS_AUDIO_BASE_SINK (baseSink);
+  gst_segment_init (&sink->segment, GST_FORMAT_UNDEFINED);
+  sink->pendingRunning = GST_CLOCK_TIME_NONE;
+  sink->maxLate = G_MININT64;
+  sink->markTime = GST_CLOCK_TIME_NONE;
+
+  /* Only the first sink of each kind; the other one may already be probing */
+  g_mutex_lock (&sync->lock);
+  if (sync->sinks[audio]) {
+    g_mutex_unlock (&sync->lock);
+    sync_sink_free (sink);
+    return;
+  }
+  sync->sinks[audio] = sink;
+  g_mutex_unlock (&sync->lock);
+  /* Video sinks have QoS on already; fakesinks and the like need it for their reports */
+  if (!sink->ringBuffer && !gst_base_sink_is_qos_enabled (GST_BASE_SINK (baseSink))) {
+    LOGD ("A/V sync: QoS turned on for %s to measure its lateness", GST_OBJECT_NAME (baseSink));
+    gst_base_sink_set_qos_enabled (GST_BASE_SINK (baseSink), TRUE);
+  }
+  gst_pad_add_probe (pad, GST_PAD_PROBE_TYPE_BUFFER | GST_PAD_PROBE_TYPE_EVENT_DOWNSTREAM |
+      GST_PAD_PROBE_TYPE_EVENT_UPSTREAM | GST_PAD_PROBE_TYPE_EVENT_FLUSH, (GstPadProbeCallback)sink_probe_cb, sink, NULL);
+}
+
+/* min, avg and max of an array of gint64 as JSON fields, in ms */
+static void append_range (GString *out, const char *name, GArray *values, gdouble unit) {
+  gint64 min = G_MAXINT64, max = G_MININT64;
+  gdouble sum = 0;
+  guint i;
+
+  for (i = 0; i < values->len; i++) {
+    gint64 value = g_array_index (values, gint64, i);
+
+    min = MIN (min, value);
+    max = MAX (max, value);
+    sum += value;
+  }
+  if (0 == values->len) {
+    min = max = 0;
+  }
+  g_string_append_printf (out, "\"min_%s_ms\": %.2f, \"avg_%s_ms\": %.2f, \"max_%s_ms\": %.2f", name, min / unit,
+      name, values->len ? sum / values->len / unit : 0.0, name, max / unit);
+}
+
+static void append_average (GString *out, gint64 index, gdouble sum, guint n) {
+  g_string_append (out, index ? ", " : "");
+  if (n > 0) {
+    g_string_append_printf (out, "%.2f", sum / n / 1e6);
+  } else {
+    g_string_append (out, "null");
+  }
+}
+
+/* 0 without a sink or before its first buffer. Lock held */
+static gdouble max_late_ms (SyncSink *sink) {
+  return (NULL == sink || G_MININT64 == sink->maxLate) ? 0.0 : sink->maxLate / 1e6;
+}
+
+void av_sync_append_json (GString *out, gdouble wall, AvSync *sync) {
+  GArray *drifts = g_array_new (FALSE, FALSE, sizeof (gint64));
+  gdouble sum = 0;
+  gint64 second = 0;
+  guint i, n = 0;
+
+  g_mutex_lock (&sync->lock);
+  for (i = 0; i < sync->samples->len; i++) {
+    g_array_append_val (drifts, g_array_index (sync->samples, DriftSample, i).drift);
+  }
+  g_string_append_printf (out, "{\n    \"samples\": %u, ", sync->samples->len);
+  append_range (out, "drift", drifts, 1e6);
+  g_string_append_printf (out, ",\n    \"max_video_late_ms\": %.2f, \"max_audio_late_ms\": %.2f,\n    \"timeline_ms\": [",
+      max_late_ms (sync->sinks[0]), max_late_ms (sync->sinks[1]));
+  /* Average drift of each second since the first sample; null for seconds without
+     samples, paused or with a stream missing */
+  for (i = 0; i < sync->samples->len; i++) {
+    DriftSample *sample = &g_array_index (sync->samples, DriftSample, i);
+
+    for (; second < sample->time / G_USEC_PER_SEC; second++) {
+      append_average (out, second, sum, n);
+      sum = 0;
+      n = 0;
+    }
+    sum += sample->drift;
+    n++;
+  }
+  if (n > 0) {
+    append_average (out, second, sum, n);
+  }
+  g_string_append_printf (out, "],\n    \"seeks\": %u, \"recovered\": %u, ", sync->seeks, sync->recoveries->len);
+  append_range (out, "recovery", sync->recoveries, 1000.0);
+  g_string_append_printf (out, ",\n    \"marks\": %u, ", sync->markOffsets->len);
+  append_range (out, "mark_offset", sync->markOffsets, 1e6);
+  g_mutex_unlock (&sync->lock);
+  g_string_append (out, "\n  }");
+  g_array_free (drifts, TRUE);
+}
@@ -0,0 +1,460 @@
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+
+#include <gst/gst.h>
+
+#include "bench.h"
+#include "log.h"
+
+/* A frame arriving this long after the previous one is a stall: with a 4K stream,
+ * a decoder or queue waiting on memory rather than a late frame or two */
+#define BENCH_STALL_INTERVAL (100 * G_TIME_SPAN_MILLISECOND)
+
+struct _BenchData {
+  gchar *uri;                     /* Input being measured, echoed in the report */
+  GstElement *videoSink;          /* Sink whose sink pad counts the frames */
+  gulong frameProbe;              /* On its sink pad */
+  guint64 droppedBefore;          /* Dropped by the sinks counted before this one */
+  gint frames;                    /* Buffers seen on the video sink pad (atomic) */
+
+  gint64 startTime;               /* Monotonic time playback started, in microseconds */
+  gint64 endTime;                 /* Monotonic time the report was taken, in microseconds */
+
+  GMutex lock;                    /* Protects threads and the cadence, filled from streaming threads */
+  GHashTable *threads;            /* Thread id -> name of the element owning that thread */
+
+  gint64 lastFrameTime;           /* Monotonic arrival time of the previous frame */
+  guint intervals;                /* Frame arrival intervals since bench_start, in microseconds */
+  gdouble intervalSum;
+  gdouble intervalSumSq;
+  gint64 maxInterval;
+  guint stalls;                   /* Intervals above BENCH_STALL_INTERVAL */
+
+  GPtrArray *loadThreads;         /* Busy loops of bench_start_cpu_load */
+  GArray *loadThreadIds;          /* ...their pid_t thread ids, under lock */
+  gint stopLoad;                  /* Tells them to quit (atomic) */
+
+  guint64 ioStart[3];             /* /proc/self/io syscr, rchar and read_bytes at bench_new */
+
+  GArray *seekLatencies;          /* Seek-to-display times, in microseconds */
+  GPtrArray *sections;            /* BenchSection added by other modules */
+};
+
+typedef struct _BenchSection {
+  gchar *name;
+  BenchSectionFunc func;
+  gpointer userData;
+} BenchSection;
+
+static void section_free (BenchSection *section) {
+  g_free (section->name);
+  g_free (section);
+}
+
+void bench_json_append_string (GString *out, const char *str) {
+  const char *p;
+
+  g_string_append_c (out, '"');
+  for (p = str ? str : ""; *p; p++) {
+    if (*p == '"' || *p == '\\') {
+      g_string_append_c (out, '\\');
+      g_string_append_c (out, *p);
+    } else if ((unsigned char)*p < 0x20) {
+      g_string_append_printf (out, "\\u%04x", (unsigned char)*p);
+    } else {
+      g_string_append_c (out, *p);
+    }
+  }
+  g_string_append_c (out, '"');
+}
+
+static pid_t get_thread_id (void) {
+  return (pid_t)syscall (SYS_gettid);
+}
+
+/* Reads utime + stime of one thread of this process, in seconds */
+static gdouble thread_cpu_time (pid_t tid) {
+  gchar *path = g_strdup_printf ("/proc/self/task/%d/stat", tid);
+  gchar *contents = NULL;
+  gchar *p;
+  unsigned long utime = 0, stime = 0;
+  gdouble seconds = 0;
+
+  if (g_file_get_contents (path, &contents, NULL, NULL)) {
+    /* The command name may contain spaces; fields are counted after its closing paren */
+    p = strrchr (contents, ')');
+    if (p && sscanf (p + 2, "%*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %lu %lu", &utime, &stime) == 2) {
+      seconds = (gdouble)(utime + stime) / sysconf (_SC_CLK_TCK);
+    }
+  }
+  g_free (contents);
+  g_free (path);
+  return seconds;
+}
+
+/* Read syscalls, bytes they copied out of the kernel (page cache hits included) and
+ * bytes actually fetched from storage, for the whole process */
+static gboolean read_proc_io (guint64 io[3]) {
+  static const char *keys[3] = { "syscr: ", "rchar: ", "read_bytes: " };
+  gchar *contents, **lines;
+  guint i, k;
+
+  if (!g_file_get_contents ("/proc/self/io", &contents, NULL, NULL))
+    return FALSE;
+  lines = g_strsplit (contents, "\n", -1);
+  for (i = 0; lines[i]; i++) {
+    for (k = 0; k < G_N_ELEMENTS (keys); k++) {
+      if (g_str_has_prefix (lines[i], keys[k]))
+        io[k] = g_ascii_strtoull (lines[i] + strlen (keys[k]), NULL, 10);
+    }
+  }
+  g_strfreev (lines);
+  g_free (contents);
+  return TRUE;
+}
+
+BenchData *bench_new (const char *uri) {
+  BenchData *bench = g_new0 (BenchData, 1);
+
+  bench->uri = g_strdup (uri);
+  g_mutex_init (&bench->lock);
+  bench->threads = g_hash_table_new_full (g_direct_hash, g_direct_equal, NULL, g_free);
+  /* Bus callbacks, and so the messages handling, run on this thread */
+  g_hash_table_insert (bench->threads, GINT_TO_POINTER (get_thread_id ()), g_strdup ("main"));
+  bench->seekLatencies = g_array_new (FALSE, FALSE, sizeof (gint64));
+  bench->sections = g_ptr_array_new_with_free_func ((GDestroyNotify)section_free);
+  bench->loadThreads = g_ptr_array_new ();
+  bench->loadThreadIds = g_array_new (FALSE, FALSE, sizeof (pid_t));
+  read_proc_io (bench->ioStart);
+  return bench;
+}
+
+void bench_free (BenchData *bench) {
+  guint i;
+
+  if (NULL == bench)
+    return;
+  g_atomic_int_set (&bench->stopLoad, 1);
+  for (i = 0; i < bench->loadThreads->len; i++)
+    g_thread_join (g_ptr_array_index (bench->loadThreads, i));
+  g_ptr_array_free (bench->loadThreads, TRUE);
+  g_array_free (bench->loadThreadIds, TRUE);
+  if (bench->videoSink)
+    gst_object_unref (bench->videoSink);
+  g_hash_table_destroy (bench->threads);
+  g_array_free (bench->seekLatencies, TRUE);
+  g_ptr_array_free (bench->sections, TRUE);
+  g_mutex_clear (&bench->lock);
+  g_free (bench->uri);
+  g_free (bench);
+}
+
+GstElement *bench_make_fakesink (const char *name) {
+  GstElement *sink = gst_element_factory_make ("fakesink", name);
+
+  if (sink) {
+    /* Render as fast as the pipeline can decode, so the numbers measure throughput */
+    g_object_set (sink, "sync", FALSE, NULL);
+  }
+  return sink;
+}
+
+/* Arrival intervals on the sink pad; with a synchronising sink their spread is the
+ * cadence the viewer sees */
+static void record_interval (BenchData *bench) {
+  gint64 now = g_get_monotonic_time ();
+  gint64 interval;
+
+  g_mutex_lock (&bench->lock);
+  if (bench->startTime && bench->lastFrameTime) {
+    interval = now - bench->lastFrameTime;
+    bench->intervals++;
+    bench->intervalSum += interval;
+    bench->intervalSumSq += (gdouble)interval * interval;
+    if (interval > bench->maxInterval)
+      bench->maxInterval = interval;
+    if (interval > BENCH_STALL_INTERVAL)
+      bench->stalls++;
+  }
+  bench->lastFrameTime = now;
+  g_mutex_unlock (&bench->lock);
+}
+
+static GstPadProbeReturn frame_probe_cb (GstPad *pad, GstPadProbeInfo *info, BenchData *bench) {
+  if (GST_PAD_PROBE_INFO_TYPE (info) & GST_PAD_PROBE_TYPE_BUFFER_LIST) {
+    g_atomic_int_add (&bench->frames, gst_buffer_list_length (GST_PAD_PROBE_INFO_BUFFER_LIST (info)));
+  } else {
+    g_atomic_int_inc (&bench->frames);
+  }
+  record_interval (bench);
+  return GST_PAD_PROBE_OK;
+}
+
+void bench_watch_video_sink (BenchData *bench, GstElement *sink) {
+  GstPad *pad;
+
+  if (bench->videoSink) {
+    /* Only the first video sink is counted */
+    return;
+  }
+
+  pad = gst_element_get_static_pad (sink, "sink");
+  if (NULL == pad) {
+    LOGD ("Video sink %s has no sink pad, frames will not be counted", GST_OBJECT_NAME (sink));
+    return;
+  }
+  bench->frameProbe = gst_pad_add_probe (pad, GST_PAD_PROBE_TYPE_BUFFER | GST_PAD_PROBE_TYPE_BUFFER_LIST,
+      (GstPadProbeCallback)frame_probe_cb, bench, NULL);
+  gst_object_unref (pad);
+  bench->videoSink = gst_object_ref (sink);
+  LOGD ("Counting frames on %s", GST_OBJECT_NAME (sink));
+}
+
+/* basesink's own dropped count, 0 for sinks without one */
+static guint64 sink_dropped (GstElement *sink) {
+  GstStructure *stats = NULL;
+  guint64 dropped = 0;
+
+  if (sink && g_object_class_find_property (G_OBJECT_GET_CLASS (sink), "stats")) {
+    g_object_get (sink, "stats", &stats, NULL);
+    if (stats) {
+      gst_structure_get_uint64 (stats, "dropped", &dropped);
+      gst_structure_free (stats);
+    }
+  }
+  return dropped;
+}
+
+void bench_set_video_sink (BenchData *bench, GstElement *sink) {
+  GstPad *pad;
+
+  if (bench->videoSink) {
+    bench->droppedBefore += sink_dropped (bench->videoSink);
+    if (NULL != (pad = gst_element_get_static_pad (bench->videoSink, "sink"))) {
+      gst_pad_remove_probe (pad, bench->frameProbe);
+      gst_object_unref (pad);
+    }
+    gst_clear_object (&bench->videoSink);
+    bench->frameProbe = 0;
+  }
+  if (sink) {
+    bench_watch_video_sink (bench, sink);
+  }
+}
+
+gint bench_get_frames (BenchData *bench) {
+  return g_atomic_int_get (&bench->frames);
+}
+
+/* Called synchronously from the thread which posts the message. ENTER is posted by
+ * the streaming thread itself right after it starts, so its thread id is ours */
+static void stream_status_cb (GstBus *bus, GstMessage *msg, BenchData *bench) {
+  GstStreamStatusType type;
+  GstElement *owner;
+
+  gst_message_parse_stream_status (msg, &type, &owner);
+  if (GST_STREAM_STATUS_TYPE_ENTER != type)
+    return;
+
+  g_mutex_lock (&bench->lock);
+  g_hash_table_insert (bench->threads, GINT_TO_POINTER (get_thread_id ()),
+      g_strdup (GST_OBJECT_NAME (owner)));
+  g_mutex_unlock (&bench->lock);
+}
+
+void bench_watch_bus (BenchData *bench, GstBus *bus) {
+  gst_bus_enable_sync_message_emission (bus);
+  g_signal_connect (G_OBJECT (bus), "sync-message::stream-status", (GCallback)stream_status_cb, bench);
+}
+
+void bench_start (BenchData *bench) {
+  g_mutex_lock (&bench->lock);
+  if (0 == bench->startTime) {
+    bench->startTime = g_get_monotonic_time ();
+  }
+  g_mutex_unlock (&bench->lock);
+}
+
+static gpointer load_thread (BenchData *bench) {
+  volatile guint64 spins = 0;
+  pid_t tid = get_thread_id ();
+
+  g_mutex_lock (&bench->lock);
+  g_array_append_val (bench->loadThreadIds, tid);
+  g_mutex_unlock (&bench->lock);
+  while (!g_atomic_int_get (&bench->stopLoad))
+    spins++;
+  return NULL;
+}
+
+void bench_start_cpu_load (BenchData *bench, guint threads) {
+  guint i;
+
+  LOGD ("Starting %u busy loop threads", threads);
+  for (i = 0; i < threads; i++)
+    g_ptr_array_add (bench->loadThreads, g_thread_new ("cpu-load", (GThreadFunc)load_thread, bench));
+}
+
+gdouble bench_get_cpu_time (BenchData *bench) {
+  struct rusage usage;
+  gdouble cpuTime;
+  guint i;
+
+  getrusage (RUSAGE_SELF, &usage);
+  cpuTime = usage.ru_utime.tv_sec + usage.ru_utime.tv_usec / 1e6 + usage.ru_stime.tv_sec + usage.ru_stime.tv_usec / 1e6;
+  /* The synthetic load is not the player's */
+  g_mutex_lock (&bench->lock);
+  for (i = 0; i < bench->loadThreadIds->len; i++)
+    cpuTime -= thread_cpu_time (g_array_index (bench->loadThreadIds, pid_t, i));
+  g_mutex_unlock (&bench->lock);
+  return MAX (cpuTime, 0.0);
+}
+
+void bench_add_seek_latency (BenchData *bench, gint64 latency) {
+  g_array_append_val (bench->seekLatencies, latency);
+}
+
+guint bench_seek_count (BenchData *bench) {
+  return bench->seekLatencies->len;
+}
+
+static gint compare_int64 (gconstpointer a, gconstpointer b) {
+  gint64 va = *(const gint64 *)a, vb = *(const gint64 *)b;
+
+  return (va > vb) - (va < vb);
+}
+
+/* Latency in ms at percentile p of the sorted array */
+static gdouble percentile_ms (GArray *sorted, gdouble p) {
+  guint i = (guint)(p * (sorted->len - 1) + 0.5);
+
+  return g_array_index (sorted, gint64, i) / 1000.0;
+}
+
+static void append_seek_latencies (BenchData *bench, GString *out) {
+  GArray *sorted = bench->seekLatencies;
+  gint64 total = 0;
+  guint i;
+
+  g_array_sort (sorted, compare_int64);
+  for (i = 0; i < sorted->len; i++) {
+    total += g_array_index (sorted, gint64, i);
+  }
+  g_string_append_printf (out, ",\n  \"seeks\": %u", sorted->len);
+  g_string_append_printf (out, ",\n  \"seek_to_display_ms\": { \"avg\": %.2f, \"p50\": %.2f, \"p95\": %.2f, \"max\": %.2f }",
+      total / 1000.0 / sorted->len, percentile_ms (sorted, 0.5), percentile_ms (sorted, 0.95),
+      percentile_ms (sorted, 1.0));
+}
+
+void bench_add_section (BenchData *bench, const char *name, BenchSectionFunc func, gpointer user_data) {
+  BenchSection *section = g_new0 (BenchSection, 1);
+
+  section->name = g_strdup (name);
+  section->func = func;
+  section->userData = user_data;
+  g_ptr_array_add (bench->sections, section);
+}
+
+/* Sums CPU time of all threads owned by the same element */
+static GHashTable *collect_element_cpu (BenchData *bench) {
+  GHashTable *cpu = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_free);
+  GHashTableIter iter;
+  gpointer key, value;
+
+  g_mutex_lock (&bench->lock);
+  g_hash_table_iter_init (&iter, bench->threads);
+  while (g_hash_table_iter_next (&iter, &key, &value)) {
+    gdouble *total = g_hash_table_lookup (cpu, value);
+
+    if (NULL == total) {
+      total = g_new0 (gdouble, 1);
+      g_hash_table_insert (cpu, g_strdup (value), total);
+    }
+    *total += thread_cpu_time ((pid_t)GPOINTER_TO_INT (key));
+  }
+  g_mutex_unlock (&bench->lock);
+  return cpu;
+}
+
+void bench_report (BenchData *bench) {
+  GString *out = g_string_new (NULL);
+  struct rusage usage;
+  GHashTable *cpu;
+  GHashTableIter iter;
+  gpointer key, value;
+  guint64 dropped;
+  gdouble wall;
+  gint frames = g_atomic_int_get (&bench->frames);
+  gboolean first = TRUE;
+  gdouble cpuTime;
+  guint64 io[3] = { 0 };
+  guint i;
+
+  bench->endTime = g_get_monotonic_time ();
+  if (0 == bench->startTime) {
+    bench->startTime = bench->endTime;
+  }
+  wall = (gdouble)(bench->endTime - bench->startTime) / G_USEC_PER_SEC;
+
+  /* basesink keeps rendered/dropped counters of its own */
+  dropped = bench->droppedBefore + sink_dropped (bench->videoSink);
+
+  getrusage (RUSAGE_SELF, &usage);
+  cpuTime = bench_get_cpu_time (bench);
+
+  g_string_append (out, "{\n  \"uri\": ");
+  bench_json_append_string (out, bench->uri);
+  g_string_append_printf (out, ",\n  \"frames\": %d", frames);
+  g_string_append_printf (out, ",\n  \"wall_time_s\": %.3f", wall);
+  g_string_append_printf (out, ",\n  \"fps\": %.2f", wall > 0 ? frames / wall : 0.0);
+  g_string_append_printf (out, ",\n  \"dropped_frames\": %" G_GUINT64_FORMAT, dropped);
+  g_string_append_printf (out, ",\n  \"cpu_time_s\": %.3f", cpuTime);
+  g_string_append_printf (out, ",\n  \"cpu_percent\": %.1f", wall > 0 ? 100.0 * cpuTime / wall : 0.0);
+  g_string_append_printf (out, ",\n  \"cpu_ms_per_frame\": %.3f", frames > 0 ? 1000.0 * cpuTime / frames : 0.0);
+  g_string_append_printf (out, ",\n  \"peak_rss_kb\": %ld", usage.ru_maxrss);
+  if (read_proc_io (io)) {
+    g_string_append_printf (out, ",\n  \"io\": { \"read_syscalls\": %" G_GUINT64_FORMAT ", \"read_copied_kb\": %"
+        G_GUINT64_FORMAT ", \"storage_read_kb\": %" G_GUINT64_FORMAT " }", io[0] - bench->ioStart[0],
+        (io[1] - bench->ioStart[1]) / 1024, (io[2] - bench->ioStart[2]) / 1024);
+  }
+  if (bench->seekLatencies->len > 0) {
+    append_seek_latencies (bench, out);
+  }
+  g_mutex_lock (&bench->lock);
+  if (bench->intervals > 0) {
+    gdouble mean = bench->intervalSum / bench->intervals;
+
+    g_string_append_printf (out, ",\n  \"frame_interval_ms\": { \"avg\": %.2f, \"jitter\": %.2f, \"max\": %.2f, "
+        "\"stalls\": %u }", mean / 1000.0, sqrt (MAX (0.0, bench->intervalSumSq / bench->intervals - mean * mean)) / 1000.0,
+        bench->maxInterval / 1000.0, bench->stalls);
+  }
+  g_mutex_unlock (&bench->lock);
+  for (i = 0; i < bench->sections->len; i++) {
+    BenchSection *section = g_ptr_array_index (bench->sections, i);
+
+    g_string_append (out, ",\n  ");
+    bench_json_append_string (out, section->name);
+    g_string_append (out, ": ");
+    section->func (out, wall, section->userData);
+  }
+
+  g_string_append (out, ",\n  \"element_cpu_time_s\": {");
+  cpu = collect_element_cpu (bench);
+  g_hash_table_iter_init (&iter, cpu);
+  while (g_hash_table_iter_next (&iter, &key, &value)) {
+    g_string_append (out, first ? "\n    " : ",\n    ");
+    bench_json_append_string (out, key);
+    g_string_append_printf (out, ": %.3f", *(gdouble *)value);
+    first = FALSE;
+  }
+  g_hash_table_destroy (cpu);
+  g_string_append (out, "\n  }\n}\n");
+
+  fputs (out->str, stdout);
+  fflush (stdout);
+  g_string_free (out, TRUE);
+}
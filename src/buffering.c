@@ -0,0 +1,288 @@
+#include <string.h>
+
+#include <gst/gst.h>
+
+#include "buffering.h"
+#include "bench.h"
+#include "log.h"
+
+#define PLAY_FLAG_DOWNLOAD (1 << 7)      /* GstPlayFlags isn't public: progressive download */
+#define PLAY_FLAG_BUFFERING (1 << 8)     /* ...and buffering messages from queue2 */
+
+/* Why playback is waiting for data */
+typedef enum {
+  FILL_INITIAL,                   /* Before playback first started */
+  FILL_SEEK,                      /* Prefetching the target of a seek */
+  FILL_REBUFFER                   /* The queues ran dry during playback */
+} FillKind;
+
+struct _Buffering {
+  GstElement *playbin;
+  GstBus *bus;
+  gulong bufferingHandlerId;
+  guint timerId;
+
+  GMutex lock;                    /* Protects queues, elements are set up in streaming threads */
+  GPtrArray *queues;              /* queue2 elements, sized by the read-ahead */
+
+  GstState wantedState;           /* What the user asked for */
+  gboolean played;                /* Playback has started at least once */
+  gboolean seekPending;           /* A seek was requested since the last fill */
+  gboolean stalled;               /* Below the low watermark, waiting for the high one */
+  FillKind fillKind;
+  gint64 stallStart;              /* Monotonic time the current fill started */
+
+  guint rebuffers;
+  gint64 rebufferUs;              /* Total stall time during playback */
+  guint seekFills;
+  gint64 seekFillUs;
+  gint64 initialFillUs;
+  gint avgIn;                     /* Latest measured download rate, bytes/s */
+  gint avgOut;                    /* Latest measured consumption rate (the bitrate), bytes/s */
+  guint64 readAhead;              /* Read-ahead sized from the bitrate, 0 until measured */
+  gint64 prefetchEnd;             /* Monotonic time the wider window after a seek ends, 0 when off */
+};
+
+static void set_flags (GstElement *playbin, guint flag) {
+  guint flags;
+
+  g_object_get (playbin, "flags", &flags, NULL);
+  g_object_set (playbin, "flags", flags | flag, NULL);
+}
+
+static void fill_started (Buffering *buffering) {
+  buffering->stalled = TRUE;
+  buffering->stallStart = g_get_monotonic_time ();
+  if (GST_STATE_PLAYING == GST_STATE (buffering->playbin))
+    buffering->played = TRUE;
+  if (!buffering->played) {
+    buffering->fillKind = FILL_INITIAL;
+  } else if (buffering->seekPending) {
+    buffering->fillKind = FILL_SEEK;
+  } else {
+    buffering->fillKind = FILL_REBUFFER;
+  }
+  buffering->seekPending = FALSE;
+
+  /* Pause cleanly instead of letting the sinks run dry frame by frame */
+  if (GST_STATE_PLAYING == buffering->wantedState) {
+    gst_element_set_state (buffering->playbin, GST_STATE_PAUSED);
+  }
+}
+
+static void fill_done (Buffering *buffering) {
+  gint64 stall = g_get_monotonic_time () - buffering->stallStart;
+
+  buffering->stalled = FALSE;
+  switch (buffering->fillKind) {
+    case FILL_INITIAL:
+      buffering->initialFillUs += stall;
+      LOGD ("Initial fill took %" G_GINT64_FORMAT " ms", stall / 1000);
+      break;
+    case FILL_SEEK:
+      buffering->seekFills++;
+      buffering->seekFillUs += stall;
+      LOGD ("Seek fill took %" G_GINT64_FORMAT " ms", stall / 1000);
+      /* The wider window stays while playback gets going from the target */
+      if (buffering->prefetchEnd)
+        buffering->prefetchEnd = g_get_monotonic_time () + BUFFERING_READ_AHEAD_S * G_TIME_SPAN_SECOND;
+      break;
+    case FILL_REBUFFER:
+      buffering->rebuffers++;
+      buffering->rebufferUs += stall;
+      LOGD ("Rebuffer #%u took %" G_GINT64_FORMAT " ms", buffering->rebuffers, stall / 1000);
+      break;
+  }
+
+  if (GST_STATE_PLAYING == buffering->wantedState) {
+    buffering->played = TRUE;
+    gst_element_set_state (buffering->playbin, GST_STATE_PLAYING);
+  }
+}
+
+/* queue2 posts the percentage of its high watermark it holds: below 100 from the low
+   watermark on, and 100 again once the high watermark is reached */
+static void buffering_cb (GstBus *bus, GstMessage *msg, Buffering *buffering) {
+  GstBufferingMode mode;
+  gint percent, avgIn, avgOut;
+  gint64 left;
+
+  gst_message_parse_buffering (msg, &percent);
+  gst_message_parse_buffering_stats (msg, &mode, &avgIn, &avgOut, &left);
+  /* Live sources can't be paused to catch up */
+  if (GST_BUFFERING_LIVE == mode)
+    return;
+
+  if (percent < 100 && !buffering->stalled) {
+    fill_started (buffering);
+  } else if (percent >= 100 && buffering->stalled) {
+    fill_done (buffering);
+  }
+}
+
+/* After a seek the window is BUFFERING_SEEK_PREFETCH times as deep, so the queue keeps
+   fetching past the target once playback resumes. The watermarks shrink by as much:
+   resuming still waits for the same number of bytes, not for the deeper window */
+static void resize_queue (GstElement *queue, Buffering *buffering) {
+  guint factor = buffering->prefetchEnd ? BUFFERING_SEEK_PREFETCH : 1;
+  guint64 bytes = buffering->readAhead ? buffering->readAhead : BUFFERING_MIN_READ_AHEAD;
+
+  g_object_set (queue, "max-size-bytes", (guint)MIN (bytes * factor, G_MAXUINT),
+      "max-size-time", (guint64)BUFFERING_READ_AHEAD_S * factor * GST_SECOND,
+      "low-watermark", BUFFERING_LOW_WATERMARK / factor, "high-watermark", BUFFERING_HIGH_WATERMARK / factor, NULL);
+}
+
+/* Queues of earlier playlist items are gone from the pipeline by now. Lock held */
+static void resize_queues (Buffering *buffering) {
+  guint i;
+
+  for (i = buffering->queues->len; i > 0; i--) {
+    GstElement *queue = g_ptr_array_index (buffering->queues, i - 1);
+
+    if (NULL == GST_OBJECT_PARENT (queue)) {
+      g_ptr_array_remove_index_fast (buffering->queues, i - 1);
+    }
+  }
+  g_ptr_array_foreach (buffering->queues, (GFunc)resize_queue, buffering);
+}
+
+static void set_prefetch (Buffering *buffering, gint64 end) {
+  gboolean changed = (0 == end) != (0 == buffering->prefetchEnd);
+
+  buffering->prefetchEnd = end;
+  if (!changed)
+    return;
+  LOGD ("Seek prefetch window %s", end ? "on" : "off");
+  g_mutex_lock (&buffering->lock);
+  resize_queues (buffering);
+  g_mutex_unlock (&buffering->lock);
+}
+
+/* Measures download and consumption rates and sizes the read-ahead as
+   BUFFERING_READ_AHEAD_S seconds of the stream's bitrate */
+static gboolean tick_cb (Buffering *buffering) {
+  GstQuery *query = gst_query_new_buffering (GST_FORMAT_TIME);
+  GstBufferingMode mode;
+  gint avgIn, avgOut;
+  gint64 left;
+  guint64 readAhead;
+
+  if (buffering->prefetchEnd && !buffering->stalled && g_get_monotonic_time () > buffering->prefetchEnd)
+    set_prefetch (buffering, 0);
+
+  if (!gst_element_query (buffering->playbin, query)) {
+    gst_query_unref (query);
+    return TRUE;
+  }
+  gst_query_parse_buffering_stats (query, &mode, &avgIn, &avgOut, &left);
+  gst_query_unref (query);
+  if (avgIn > 0)
+    buffering->avgIn = avgIn;
+  /* The output rate only says what the stream needs while it plays */
+  if (avgOut <= 0 || GST_STATE_PLAYING != GST_STATE (buffering->playbin))
+    return TRUE;
+  buffering->avgOut = avgOut;
+
+  readAhead = CLAMP ((guint64)avgOut * BUFFERING_READ_AHEAD_S, BUFFERING_MIN_READ_AHEAD, BUFFERING_MAX_READ_AHEAD);
+  /* Small wobbles in the rate aren't worth touching the queues */
+  if (buffering->readAhead && readAhead > buffering->readAhead * 3 / 4 && readAhead < buffering->readAhead * 5 / 4)
+    return TRUE;
+
+  LOGD ("Bitrate %d kbit/s, download %d kbit/s: read-ahead %" G_GUINT64_FORMAT " KB", avgOut * 8 / 1000,
+      buffering->avgIn * 8 / 1000, readAhead / 1024);
+  buffering->readAhead = readAhead;
+  g_mutex_lock (&buffering->lock);
+  resize_queues (buffering);
+  g_mutex_unlock (&buffering->lock);
+  return TRUE;
+}
+
+Buffering *buffering_new (GstElement *playbin, GstBus *bus) {
+  Buffering *buffering = g_new0 (Buffering, 1);
+
+  buffering->playbin = gst_object_ref (playbin);
+  buffering->bus = gst_object_ref (bus);
+  buffering->wantedState = GST_STATE_PLAYING;
+  g_mutex_init (&buffering->lock);
+  buffering->queues = g_ptr_array_new_with_free_func (gst_object_unref);
+
+  /* Formats that allow it (mp4, flv, ...) are downloaded into a temporary ring file,
+   * so seeks back into what was already fetched don't go to the network again */
+  set_flags (playbin, PLAY_FLAG_DOWNLOAD | PLAY_FLAG_BUFFERING);
+  g_object_set (playbin, "ring-buffer-max-size", (guint64)BUFFERING_RING_SIZE,
+      "buffer-duration", (gint64)BUFFERING_READ_AHEAD_S * GST_SECOND, NULL);
+
+  /* The bus already has a signal watch */
+  buffering->bufferingHandlerId = g_signal_connect (bus, "message::buffering", G_CALLBACK (buffering_cb), buffering);
+  buffering->timerId = g_timeout_add (BUFFERING_PERIOD_MS, (GSourceFunc)tick_cb, buffering);
+  return buffering;
+}
+
+void buffering_free (Buffering *buffering) {
+  if (NULL == buffering)
+    return;
+
+  LOGD ("Buffering: %u rebuffers stalled %" G_GINT64_FORMAT " ms, %u seek fills took %" G_GINT64_FORMAT
+      " ms, initial fill %" G_GINT64_FORMAT " ms", buffering->rebuffers, buffering->rebufferUs / 1000,
+      buffering->seekFills, buffering->seekFillUs / 1000, buffering->initialFillUs / 1000);
+
+  g_source_remove (buffering->timerId);
+  g_signal_handler_disconnect (buffering->bus, buffering->bufferingHandlerId);
+  g_ptr_array_free (buffering->queues, TRUE);
+  g_mutex_clear (&buffering->lock);
+  gst_object_unref (buffering->bus);
+  gst_object_unref (buffering->playbin);
+  g_free (buffering);
+}
+
+void buffering_watch_element (Buffering *buffering, GstElement *element) {
+  GstElementFactory *factory = gst_element_get_factory (element);
+
+  if (NULL == buffering || NULL == factory || strcmp (GST_OBJECT_NAME (factory), "queue2"))
+    return;
+
+  g_object_set (element, "low-watermark", BUFFERING_LOW_WATERMARK, "high-watermark", BUFFERING_HIGH_WATERMARK, NULL);
+  g_mutex_lock (&buffering->lock);
+  if (buffering->readAhead || buffering->prefetchEnd) {
+    resize_queue (element, buffering);
+  }
+  g_ptr_array_add (buffering->queues, gst_object_ref (element));
+  g_mutex_unlock (&buffering->lock);
+}
+
+gboolean buffering_request_state (Buffering *buffering, GstState state) {
+  if (NULL == buffering)
+    return TRUE;
+
+  buffering->wantedState = state;
+  if (GST_STATE_PLAYING == state && buffering->stalled) {
+    LOGD ("Still buffering, playback starts once the queues are full");
+    return FALSE;
+  }
+  return TRUE;
+}
+
+void buffering_seek_started (Buffering *buffering) {
+  if (NULL == buffering)
+    return;
+  buffering->seekPending = TRUE;
+  /* Ends on its own if the target was buffered already and no fill follows */
+  set_prefetch (buffering, g_get_monotonic_time () + BUFFERING_READ_AHEAD_S * G_TIME_SPAN_SECOND);
+}
+
+gboolean buffering_holds_playback (Buffering *buffering) {
+  return NULL != buffering && buffering->stalled && GST_STATE_PLAYING == buffering->wantedState;
+}
+
+void buffering_append_json (GString *out, gdouble wall, Buffering *buffering) {
+  gint64 stalled = buffering->rebufferUs;
+
+  /* A fill still in progress at the end counts too */
+  if (buffering->stalled && FILL_REBUFFER == buffering->fillKind)
+    stalled += g_get_monotonic_time () - buffering->stallStart;
+  g_string_append_printf (out, "{ \"rebuffers\": %u, \"stall_ms\": %" G_GINT64_FORMAT ", \"seek_fills\": %u, "
+      "\"seek_fill_ms\": %" G_GINT64_FORMAT ", \"initial_fill_ms\": %" G_GINT64_FORMAT ", \"bitrate_kbps\": %d, "
+      "\"download_kbps\": %d, \"read_ahead_kb\": %" G_GUINT64_FORMAT " }", buffering->rebuffers, stalled / 1000,
+      buffering->seekFills, buffering->seekFillUs / 1000, buffering->initialFillUs / 1000,
+      buffering->avgOut * 8 / 1000, buffering->avgIn * 8 / 1000, buffering->readAhead / 1024);
+}
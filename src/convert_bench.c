@@ -0,0 +1,195 @@
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <gst/gst.h>
+#include <gst/video/video.h>
+
+#include "convert_bench.h"
+#include "vd_scaler.h"
+#include "log.h"
+
+#define CONVERT_BENCH_TIME (G_USEC_PER_SEC / 2)  /* Time spent measuring each converter */
+/* videoconvert sites chroma a little differently, so outputs aren't bit identical;
+   mean absolute difference allowed per colour channel */
+#define CONVERT_BENCH_MAX_MEAN_DIFF 2.0
+
+typedef struct _ConvertCase {
+  GstVideoFormat format;
+  gint inWidth, inHeight;
+  gint outWidth, outHeight;
+} ConvertCase;
+
+static const ConvertCase cases[] = {
+  { GST_VIDEO_FORMAT_I420, 1920, 1080, 1920, 1080 },
+  { GST_VIDEO_FORMAT_I420, 1920, 1080, 1280, 720 },
+  { GST_VIDEO_FORMAT_I420, 1920, 1080, 2560, 1440 },
+  { GST_VIDEO_FORMAT_NV12, 1920, 1080, 1920, 1080 },
+  { GST_VIDEO_FORMAT_NV12, 1920, 1080, 1280, 720 },
+  { GST_VIDEO_FORMAT_NV12, 1920, 1080, 2560, 1440 },
+};
+
+/* Smooth synthetic picture; noise would make any two bilinear scalers disagree */
+static void fill_frame (GstVideoFrame *frame) {
+  guint comp;
+  gint x, y;
+
+  for (comp = 0; comp < 3; comp++) {
+    guint8 *data = GST_VIDEO_FRAME_COMP_DATA (frame, comp);
+    gint stride = GST_VIDEO_FRAME_COMP_STRIDE (frame, comp);
+    gint pstride = GST_VIDEO_FRAME_COMP_PSTRIDE (frame, comp);
+
+    for (y = 0; y < GST_VIDEO_FRAME_COMP_HEIGHT (frame, comp); y++) {
+      for (x = 0; x < GST_VIDEO_FRAME_COMP_WIDTH (frame, comp); x++) {
+        gdouble value = 0 == comp ? 126 + 90 * sin (x * 0.05) * cos (y * 0.07) :
+            (1 == comp ? 128 + 60 * sin (x * 0.03 + y * 0.02) : 128 + 60 * cos (x * 0.025 - y * 0.03));
+        data[y * stride + x * pstride] = (guint8)value;
+      }
+    }
+  }
+}
+
+static gboolean map_new_frame (GstVideoInfo *info, GstVideoFrame *frame, GstMapFlags flags) {
+  GstBuffer *buffer = gst_buffer_new_allocate (NULL, GST_VIDEO_INFO_SIZE (info), NULL);
+  gboolean ret = gst_video_frame_map (frame, info, buffer, flags);
+
+  /* The frame holds its own reference */
+  gst_buffer_unref (buffer);
+  return ret;
+}
+
+/* Compares the colour channels of two BGRx frames */
+static void compare_frames (GstVideoFrame *a, GstVideoFrame *b, gint *maxDiff, gdouble *meanDiff) {
+  gint width = GST_VIDEO_FRAME_WIDTH (a), height = GST_VIDEO_FRAME_HEIGHT (a);
+  gint strideA = GST_VIDEO_FRAME_PLANE_STRIDE (a, 0), strideB = GST_VIDEO_FRAME_PLANE_STRIDE (b, 0);
+  const guint8 *rowA, *rowB;
+  guint64 total = 0;
+  gint x, y, c, diff;
+
+  *maxDiff = 0;
+  for (y = 0; y < height; y++) {
+    rowA = (const guint8 *)GST_VIDEO_FRAME_PLANE_DATA (a, 0) + y * strideA;
+    rowB = (const guint8 *)GST_VIDEO_FRAME_PLANE_DATA (b, 0) + y * strideB;
+    for (x = 0; x < width; x++) {
+      for (c = 0; c < 3; c++) {
+        diff = abs (rowA[4 * x + c] - rowB[4 * x + c]);
+        total += diff;
+        if (diff > *maxDiff)
+          *maxDiff = diff;
+      }
+    }
+  }
+  *meanDiff = (gdouble)total / ((gdouble)width * height * 3);
+}
+
+static gboolean frames_equal (GstVideoFrame *a, GstVideoFrame *b) {
+  gint maxDiff;
+  gdouble meanDiff;
+
+  compare_frames (a, b, &maxDiff, &meanDiff);
+  return 0 == maxDiff;
+}
+
+/* The reference path: what videoconvert/videoscale do, bilinear and single threaded */
+static GstVideoConverter *make_reference (GstVideoInfo *in, GstVideoInfo *out) {
+  return gst_video_converter_new (in, out, gst_structure_new ("options",
+      GST_VIDEO_CONVERTER_OPT_RESAMPLER_METHOD, GST_TYPE_VIDEO_RESAMPLER_METHOD, GST_VIDEO_RESAMPLER_METHOD_LINEAR,
+      GST_VIDEO_CONVERTER_OPT_CHROMA_RESAMPLER_METHOD, GST_TYPE_VIDEO_RESAMPLER_METHOD, GST_VIDEO_RESAMPLER_METHOD_LINEAR,
+      GST_VIDEO_CONVERTER_OPT_DITHER_METHOD, GST_TYPE_VIDEO_DITHER_METHOD, GST_VIDEO_DITHER_NONE,
+      GST_VIDEO_CONVERTER_OPT_THREADS, G_TYPE_UINT, 1, NULL));
+}
+
+static gdouble reference_mpixels (GstVideoConverter *converter, GstVideoFrame *in, GstVideoFrame *out) {
+  gint64 start = g_get_monotonic_time ();
+  gint64 elapsed;
+  guint frames = 0;
+
+  do {
+    gst_video_converter_frame (converter, in, out);
+    frames++;
+  } while ((elapsed = g_get_monotonic_time () - start) < CONVERT_BENCH_TIME);
+  return (gdouble)frames * GST_VIDEO_FRAME_WIDTH (out) * GST_VIDEO_FRAME_HEIGHT (out) / elapsed;
+}
+
+static gdouble scaler_mpixels (VdScaler *scaler, GstVideoFrame *in, GstVideoFrame *out) {
+  gint64 start = g_get_monotonic_time ();
+  gint64 elapsed;
+  guint frames = 0;
+
+  do {
+    vd_scaler_process (scaler, in, out);
+    frames++;
+  } while ((elapsed = g_get_monotonic_time () - start) < CONVERT_BENCH_TIME);
+  return (gdouble)frames * GST_VIDEO_FRAME_WIDTH (out) * GST_VIDEO_FRAME_HEIGHT (out) / elapsed;
+}
+
+/* Runs one case for all kernels, appending its JSON object. Returns FALSE on a mismatch */
+static gboolean run_case (const ConvertCase *test, GString *out) {
+  const VdScalerKernel * const *kernels = vd_scaler_kernels ();
+  GstVideoInfo inInfo, outInfo;
+  GstVideoFrame in, reference, scalar, result;
+  GstVideoConverter *converter;
+  VdScaler *scaler;
+  gboolean passed = TRUE, exact;
+  gint maxDiff, i;
+  gdouble meanDiff, mpixels;
+
+  gst_video_info_set_format (&inInfo, test->format, test->inWidth, test->inHeight);
+  gst_video_info_set_format (&outInfo, GST_VIDEO_FORMAT_BGRx, test->outWidth, test->outHeight);
+  map_new_frame (&inInfo, &in, GST_MAP_READWRITE);
+  map_new_frame (&outInfo, &reference, GST_MAP_READWRITE);
+  map_new_frame (&outInfo, &scalar, GST_MAP_READWRITE);
+  map_new_frame (&outInfo, &result, GST_MAP_READWRITE);
+  fill_frame (&in);
+
+  converter = make_reference (&inInfo, &outInfo);
+  mpixels = reference_mpixels (converter, &in, &reference);
+  g_string_append_printf (out, "    { \"format\": \"%s\", \"input\": \"%dx%d\", \"output\": \"%dx%d\", "
+      "\"videoconvert_mpix_s\": %.1f, \"kernels\": [", GST_VIDEO_INFO_NAME (&inInfo),
+      test->inWidth, test->inHeight, test->outWidth, test->outHeight, mpixels);
+
+  for (i = 0; kernels[i]; i++) {
+    scaler = vd_scaler_new (&inInfo, &outInfo, kernels[i]);
+    vd_scaler_process (scaler, &in, 0 == i ? &scalar : &result);
+    /* Vector kernels must give exactly what the scalar one gives */
+    exact = 0 == i || frames_equal (&scalar, &result);
+    compare_frames (&reference, 0 == i ? &scalar : &result, &maxDiff, &meanDiff);
+    mpixels = scaler_mpixels (scaler, &in, &result);
+    vd_scaler_free (scaler);
+
+    if (!exact || meanDiff > CONVERT_BENCH_MAX_MEAN_DIFF) {
+      LOGD ("%s kernel mismatch on %s %dx%d -> %dx%d (exact %d, mean diff %.2f)", kernels[i]->name,
+          GST_VIDEO_INFO_NAME (&inInfo), test->inWidth, test->inHeight, test->outWidth, test->outHeight, exact, meanDiff);
+      passed = FALSE;
+    }
+    g_string_append_printf (out, "%s\n      { \"name\": \"%s\", \"mpix_s\": %.1f, \"max_diff\": %d, "
+        "\"mean_diff\": %.3f, \"exact\": %s }", i ? "," : "", kernels[i]->name, mpixels, maxDiff, meanDiff,
+        exact ? "true" : "false");
+  }
+  g_string_append (out, " ] }");
+
+  gst_video_converter_free (converter);
+  gst_video_frame_unmap (&in);
+  gst_video_frame_unmap (&reference);
+  gst_video_frame_unmap (&scalar);
+  gst_video_frame_unmap (&result);
+  return passed;
+}
+
+int convert_bench_run (void) {
+  GString *out = g_string_new ("{\n  \"cases\": [\n");
+  gboolean passed = TRUE;
+  guint i;
+
+  for (i = 0; i < G_N_ELEMENTS (cases); i++) {
+    if (i)
+      g_string_append (out, ",\n");
+    passed &= run_case (&cases[i], out);
+  }
+  g_string_append_printf (out, "\n  ],\n  \"best_kernel\": \"%s\",\n  \"passed\": %s\n}\n",
+      vd_scaler_best_kernel ()->name, passed ? "true" : "false");
+  printf ("%s", out->str);
+  fflush (stdout);
+  g_string_free (out, TRUE);
+  return passed ? 0 : -1;
+}
@@ -0,0 +1,134 @@
+#include <string.h>
+
+#include <gst/gst.h>
+#include <gst/base/gstbasetransform.h>
+
+#include "copy_stats.h"
+#include "vd_convert.h"
+#include "log.h"
+
+struct _CopyStats {
+  GstElement *sink;               /* Video sink whose frames are counted */
+  gulong sinkProbe;               /* On its sink pad */
+  gboolean sinkCopies;            /* The sink copies buffers that aren't its own memory */
+
+  gint transforms;                /* Converting/scaling elements watched (atomic) */
+  gint frames;                    /* Frames that reached the video sink (atomic) */
+  guint64 convertBytes;           /* Bytes produced by non-passthrough converters (atomic) */
+  guint64 sinkCopyBytes;          /* Bytes the sink copied into its own memory (atomic) */
+};
+
+CopyStats *copy_stats_new (void) {
+  return g_new0 (CopyStats, 1);
+}
+
+static gdouble per_frame (CopyStats *stats, guint64 bytes) {
+  gint frames = g_atomic_int_get (&stats->frames);
+
+  return frames > 0 ? (gdouble)bytes / frames : 0.0;
+}
+
+void copy_stats_free (CopyStats *stats) {
+  if (NULL == stats)
+    return;
+  LOGD ("%d frames displayed; per frame: %.0f bytes converted/scaled by %d elements, %.0f bytes copied by the sink",
+      g_atomic_int_get (&stats->frames), per_frame (stats, __atomic_load_n (&stats->convertBytes, __ATOMIC_RELAXED)),
+      g_atomic_int_get (&stats->transforms), per_frame (stats, __atomic_load_n (&stats->sinkCopyBytes, __ATOMIC_RELAXED)));
+  if (stats->sink)
+    gst_object_unref (stats->sink);
+  g_free (stats);
+}
+
+static GstPadProbeReturn convert_probe_cb (GstPad *pad, GstPadProbeInfo *info, CopyStats *stats) {
+  GstElement *element = GST_PAD_PARENT (pad);
+
+  /* In passthrough the input buffer goes out untouched */
+  if (!gst_base_transform_is_passthrough (GST_BASE_TRANSFORM (element))) {
+    __atomic_fetch_add (&stats->convertBytes, gst_buffer_get_size (GST_PAD_PROBE_INFO_BUFFER (info)), __ATOMIC_RELAXED);
+  }
+  return GST_PAD_PROBE_OK;
+}
+
+void copy_stats_watch_element (CopyStats *stats, GstElement *element) {
+  GstElementFactory *factory = gst_element_get_factory (element);
+  const gchar *name;
+  GstPad *pad;
+
+  if (NULL == stats || NULL == factory || !GST_IS_BASE_TRANSFORM (element))
+    return;
+  name = GST_OBJECT_NAME (factory);
+  if (!g_str_has_prefix (name, "videoconvert") && strcmp (name, "videoscale") && strcmp (name, VD_CONVERT_ELEMENT))
+    return;
+  /* Watched once, however many times it is reported */
+  if (g_object_get_data (G_OBJECT (element), "copy-stats"))
+    return;
+  g_object_set_data (G_OBJECT (element), "copy-stats", stats);
+
+  pad = gst_element_get_static_pad (element, "src");
+  if (NULL == pad)
+    return;
+  g_atomic_int_inc (&stats->transforms);
+  gst_pad_add_probe (pad, GST_PAD_PROBE_TYPE_BUFFER, (GstPadProbeCallback)convert_probe_cb, stats, NULL);
+  gst_object_unref (pad);
+}
+
+static GstPadProbeReturn sink_probe_cb (GstPad *pad, GstPadProbeInfo *info, CopyStats *stats) {
+  GstBuffer *buffer = GST_PAD_PROBE_INFO_BUFFER (info);
+  guint i, n;
+
+  g_atomic_int_inc (&stats->frames);
+  if (!stats->sinkCopies)
+    return GST_PAD_PROBE_OK;
+
+  /* Xv and X sinks can only put their own shared memory images on screen */
+  n = gst_buffer_n_memory (buffer);
+  for (i = 0; i < n; i++) {
+    GstMemory *memory = gst_buffer_peek_memory (buffer, i);
+
+    if (gst_memory_is_type (memory, GST_ALLOCATOR_SYSMEM)) {
+      __atomic_fetch_add (&stats->sinkCopyBytes, gst_memory_get_sizes (memory, NULL, NULL), __ATOMIC_RELAXED);
+    }
+  }
+  return GST_PAD_PROBE_OK;
+}
+
+void copy_stats_watch_video_sink (CopyStats *stats, GstElement *sink) {
+  GstElementFactory *factory = gst_element_get_factory (sink);
+  GstPad *pad;
+
+  if (NULL == stats || NULL != stats->sink)
+    return;
+  pad = gst_element_get_static_pad (sink, "sink");
+  if (NULL == pad)
+    return;
+
+  stats->sink = gst_object_ref (sink);
+  stats->sinkCopies = factory && (!strcmp (GST_OBJECT_NAME (factory), "xvimagesink") ||
+      !strcmp (GST_OBJECT_NAME (factory), "ximagesink"));
+  stats->sinkProbe = gst_pad_add_probe (pad, GST_PAD_PROBE_TYPE_BUFFER, (GstPadProbeCallback)sink_probe_cb, stats, NULL);
+  gst_object_unref (pad);
+}
+
+void copy_stats_set_video_sink (CopyStats *stats, GstElement *sink) {
+  GstPad *pad;
+
+  if (NULL == stats)
+    return;
+  if (stats->sink) {
+    if (NULL != (pad = gst_element_get_static_pad (stats->sink, "sink"))) {
+      gst_pad_remove_probe (pad, stats->sinkProbe);
+      gst_object_unref (pad);
+    }
+    gst_clear_object (&stats->sink);
+    stats->sinkProbe = 0;
+  }
+  if (sink) {
+    copy_stats_watch_video_sink (stats, sink);
+  }
+}
+
+void copy_stats_append_json (GString *out, gdouble wall, CopyStats *stats) {
+  g_string_append_printf (out, "{ \"transforms\": %d, \"convert_bytes_per_frame\": %.0f, \"sink_copy_bytes_per_frame\": %.0f }",
+      g_atomic_int_get (&stats->transforms), per_frame (stats, __atomic_load_n (&stats->convertBytes, __ATOMIC_RELAXED)),
+      per_frame (stats, __atomic_load_n (&stats->sinkCopyBytes, __ATOMIC_RELAXED)));
+}
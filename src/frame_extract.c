@@ -0,0 +1,326 @@
+#include <stdio.h>
+#include <string.h>
+
+#include <gst/gst.h>
+#include <gst/app/gstappsink.h>
+#include <gst/video/video.h>
+#include <gdk-pixbuf/gdk-pixbuf.h>
+
+#include "frame_extract.h"
+#include "log.h"
+
+#define FRAME_EXTRACT_TIMEOUT (10 * GST_SECOND)  /* Longest a preroll may take */
+#define FRAME_EXTRACT_QUEUED_PER_WORKER 4       /* Frames waiting for an encoder, per worker, before it blocks */
+
+typedef struct _ExtractRun {
+  const char * const *uris;
+  guint count;
+  const FrameExtractOptions *options;
+  guint workers;
+  gint decoderThreads;            /* max-threads given to each libav decoder */
+  gint next;                      /* Next input to take, atomic */
+  GThreadPool *encoders;
+
+  GMutex lock;                    /* Protects everything below */
+  GCond cond;                     /* An encoder finished a frame */
+  guint queued;                   /* Frames handed to the encoders, not written yet */
+  guint files;                    /* Inputs that gave all their frames */
+  guint failedFiles;
+  guint frames;                   /* Frames written */
+  guint failedFrames;
+  gint64 decodeTime;              /* Microseconds from seek to frame, over all workers */
+  gint64 encodeTime;              /* Microseconds encoding and writing, over all encoders */
+} ExtractRun;
+
+typedef struct _EncodeJob {
+  GdkPixbuf *pixbuf;
+  gchar *path;
+} EncodeJob;
+
+/* Audio is never decoded */
+static gboolean autoplug_continue_cb (GstElement *bin, GstPad *pad, GstCaps *caps, ExtractRun *run) {
+  return !g_str_has_prefix (gst_structure_get_name (gst_caps_get_structure (caps, 0)), "audio/");
+}
+
+/* Each worker already decodes in its own streaming thread; libav frame threads on top
+   would oversubscribe the cores, so the cores are shared out between the workers */
+static void deep_element_added_cb (GstBin *bin, GstBin *subBin, GstElement *element, ExtractRun *run) {
+  GstElementFactory *factory = gst_element_get_factory (element);
+
+  if (NULL == factory || !g_str_has_prefix (GST_OBJECT_NAME (factory), "avdec_"))
+    return;
+  if (g_object_class_find_property (G_OBJECT_GET_CLASS (element), "max-threads")) {
+    g_object_set (element, "max-threads", run->decoderThreads, NULL);
+  }
+}
+
+static GstElement *create_pipeline (ExtractRun *run, const char *uri, GstAppSink **sink) {
+  GError *err = NULL;
+  GstElement *pipeline = gst_parse_launch ("uridecodebin name=src ! videoconvert ! video/x-raw,format=RGB,pixel-aspect-ratio=1/1 ! "
+      "appsink name=sink sync=false max-buffers=1 enable-last-sample=false", &err);
+  GstElement *src;
+
+  if (NULL == pipeline) {
+    LOGE ("Could not create the extraction pipeline: %s", err ? err->message : "unknown");
+    g_clear_error (&err);
+    return NULL;
+  }
+  src = gst_bin_get_by_name (GST_BIN (pipeline), "src");
+  g_object_set (src, "uri", uri, NULL);
+  g_signal_connect (src, "autoplug-continue", G_CALLBACK (autoplug_continue_cb), run);
+  gst_object_unref (src);
+  g_signal_connect (pipeline, "deep-element-added", G_CALLBACK (deep_element_added_cb), run);
+  *sink = GST_APP_SINK (gst_bin_get_by_name (GST_BIN (pipeline), "sink"));
+  return pipeline;
+}
+
+/* Waits for the pipeline to preroll, after a state change or a flushing seek */
+static gboolean wait_preroll (GstElement *pipeline) {
+  GstBus *bus = gst_element_get_bus (pipeline);
+  GstMessage *msg = gst_bus_timed_pop_filtered (bus, FRAME_EXTRACT_TIMEOUT, GST_MESSAGE_ASYNC_DONE | GST_MESSAGE_ERROR);
+  gboolean ret = (NULL != msg && GST_MESSAGE_ASYNC_DONE == GST_MESSAGE_TYPE (msg));
+
+  if (msg)
+    gst_message_unref (msg);
+  gst_object_unref (bus);
+  return ret;
+}
+
+static GdkPixbuf *sample_to_pixbuf (GstSample *sample) {
+  GstVideoInfo info;
+  GstVideoFrame frame;
+  GdkPixbuf *pixbuf;
+  guint8 *dest;
+  gint row, destStride;
+
+  if (!gst_video_info_from_caps (&info, gst_sample_get_caps (sample)) ||
+      !gst_video_frame_map (&frame, &info, gst_sample_get_buffer (sample), GST_MAP_READ))
+    return NULL;
+
+  pixbuf = gdk_pixbuf_new (GDK_COLORSPACE_RGB, FALSE, 8, GST_VIDEO_INFO_WIDTH (&info), GST_VIDEO_INFO_HEIGHT (&info));
+  dest = gdk_pixbuf_get_pixels (pixbuf);
+  destStride = gdk_pixbuf_get_rowstride (pixbuf);
+  for (row = 0; row < GST_VIDEO_INFO_HEIGHT (&info); row++) {
+    memcpy (dest + row * destStride,
+        (guint8 *)GST_VIDEO_FRAME_PLANE_DATA (&frame, 0) + row * GST_VIDEO_FRAME_PLANE_STRIDE (&frame, 0),
+        GST_VIDEO_INFO_WIDTH (&info) * 3);
+  }
+  gst_video_frame_unmap (&frame);
+  return pixbuf;
+}
+
+/* GThreadPool function of the encoders */
+static void encode_job (EncodeJob *job, ExtractRun *run) {
+  gint64 start = g_get_monotonic_time ();
+  GError *err = NULL;
+  gboolean ok;
+
+  if (run->options->png) {
+    ok = gdk_pixbuf_save (job->pixbuf, job->path, "png", &err, NULL);
+  } else {
+    ok = gdk_pixbuf_save (job->pixbuf, job->path, "jpeg", &err, "quality", FRAME_EXTRACT_JPEG_QUALITY, NULL);
+  }
+  if (!ok) {
+    LOGE ("Could not write %s: %s", job->path, err ? err->message : "unknown");
+    g_clear_error (&err);
+  }
+
+  g_mutex_lock (&run->lock);
+  run->encodeTime += g_get_monotonic_time () - start;
+  if (ok) {
+    run->frames++;
+  } else {
+    run->failedFrames++;
+  }
+  run->queued--;
+  g_cond_signal (&run->cond);
+  g_mutex_unlock (&run->lock);
+
+  g_object_unref (job->pixbuf);
+  g_free (job->path);
+  g_free (job);
+}
+
+/* Hands a frame over to the encoders; blocks while they are behind, so decoded frames
+   can't pile up in memory */
+static void queue_frame (ExtractRun *run, GdkPixbuf *pixbuf, guint index, const char *name, gint64 position) {
+  EncodeJob *job = g_new0 (EncodeJob, 1);
+
+  job->pixbuf = pixbuf;
+  job->path = g_strdup_printf ("%s/%06u-%s-%09" G_GINT64_FORMAT ".%s", run->options->outDir, index, name,
+      position / GST_MSECOND, run->options->png ? "png" : "jpg");
+
+  g_mutex_lock (&run->lock);
+  while (run->queued >= run->workers * FRAME_EXTRACT_QUEUED_PER_WORKER) {
+    g_cond_wait (&run->cond, &run->lock);
+  }
+  run->queued++;
+  g_mutex_unlock (&run->lock);
+  g_thread_pool_push (run->encoders, job, NULL);
+}
+
+/* The positions to extract from an input of duration ns, -1 when unknown */
+static GArray *positions_for (ExtractRun *run, gint64 duration) {
+  GArray *positions = g_array_new (FALSE, FALSE, sizeof (gint64));
+  gint64 position;
+  guint i;
+
+  if (run->options->times) {
+    for (i = 0; i < run->options->times->len; i++) {
+      position = g_array_index (run->options->times, gint64, i);
+      if (duration < 0 || position < duration)
+        g_array_append_val (positions, position);
+    }
+  } else {
+    /* Without a duration, only the first frame */
+    for (position = 0; 0 == position || position < duration; position += run->options->interval) {
+      g_array_append_val (positions, position);
+    }
+  }
+  return positions;
+}
+
+/* File name part of the input, without the extension */
+static gchar *input_name (const char *uri) {
+  gchar *name = g_path_get_basename (uri);
+  gchar *dot = strrchr (name, '.');
+
+  if (dot && dot != name)
+    *dot = '\0';
+  return name;
+}
+
+static void extract_input (ExtractRun *run, guint index) {
+  const char *uri = run->uris[index];
+  GstSeekFlags flags = GST_SEEK_FLAG_FLUSH |
+      (run->options->accurate ? GST_SEEK_FLAG_ACCURATE : GST_SEEK_FLAG_KEY_UNIT | GST_SEEK_FLAG_SNAP_NEAREST);
+  GstAppSink *sink = NULL;
+  GstElement *pipeline = create_pipeline (run, uri, &sink);
+  GArray *positions = NULL;
+  gint64 duration = -1, position, start, decodeTime = 0;
+  gchar *name = input_name (uri);
+  GstSample *sample;
+  GdkPixbuf *pixbuf;
+  guint i, extracted = 0;
+
+  if (NULL == pipeline)
+    goto Exit;
+  gst_element_set_state (pipeline, GST_STATE_PAUSED);
+  if (!wait_preroll (pipeline)) {
+    LOGE ("Could not open %s", uri);
+    goto Exit;
+  }
+  gst_element_query_duration (pipeline, GST_FORMAT_TIME, &duration);
+  positions = positions_for (run, duration);
+
+  for (i = 0; i < positions->len; i++) {
+    position = g_array_index (positions, gint64, i);
+    start = g_get_monotonic_time ();
+    /* The preroll frame is the first one already */
+    if ((i > 0 || position > 0) &&
+        (!gst_element_seek_simple (pipeline, GST_FORMAT_TIME, flags, position) || !wait_preroll (pipeline))) {
+      LOGD ("Seek to %" GST_TIME_FORMAT " in %s failed", GST_TIME_ARGS (position), uri);
+      continue;
+    }
+    sample = gst_app_sink_try_pull_preroll (sink, FRAME_EXTRACT_TIMEOUT);
+    if (NULL == sample)
+      continue;
+    pixbuf = sample_to_pixbuf (sample);
+    gst_sample_unref (sample);
+    decodeTime += g_get_monotonic_time () - start;
+    if (pixbuf) {
+      queue_frame (run, pixbuf, index, name, position);
+      extracted++;
+    }
+  }
+
+Exit:
+  g_mutex_lock (&run->lock);
+  run->decodeTime += decodeTime;
+  if (positions && extracted == positions->len) {
+    run->files++;
+  } else {
+    run->failedFiles++;
+  }
+  g_mutex_unlock (&run->lock);
+  LOGD ("%s: %u of %u frames", uri, extracted, positions ? positions->len : 0);
+
+  if (pipeline) {
+    gst_element_set_state (pipeline, GST_STATE_NULL);
+    gst_object_unref (sink);
+    gst_object_unref (pipeline);
+  }
+  if (positions)
+    g_array_free (positions, TRUE);
+  g_free (name);
+}
+
+static gpointer worker_thread (ExtractRun *run) {
+  gint index;
+
+  while ((index = g_atomic_int_add (&run->next, 1)) < (gint)run->count) {
+    extract_input (run, (guint)index);
+  }
+  return NULL;
+}
+
+int frame_extract_run (const char * const *uris, guint count, const FrameExtractOptions *options) {
+  ExtractRun run;
+  GThread **workers;
+  GError *err = NULL;
+  gint64 start;
+  gdouble wall;
+  guint i, cores = (guint)g_get_num_processors ();
+  int ret;
+
+  if (g_mkdir_with_parents (options->outDir, 0755) < 0) {
+    LOGE ("Could not create %s", options->outDir);
+    return -1;
+  }
+
+  memset (&run, 0, sizeof (run));
+  run.uris = uris;
+  run.count = count;
+  run.options = options;
+  run.workers = MAX (1, MIN (options->workers ? options->workers : cores, count));
+  run.decoderThreads = MAX (1, (gint)(cores / run.workers));
+  g_mutex_init (&run.lock);
+  g_cond_init (&run.cond);
+  /* As many encoders as workers; a frame costs about as much to encode as to decode */
+  run.encoders = g_thread_pool_new ((GFunc)encode_job, &run, (gint)run.workers, FALSE, &err);
+  if (NULL == run.encoders) {
+    LOGE ("Could not start the encoders: %s", err->message);
+    g_clear_error (&err);
+    return -1;
+  }
+  LOGD ("Extracting from %u inputs with %u workers, %d decoder threads each", count, run.workers, run.decoderThreads);
+
+  start = g_get_monotonic_time ();
+  workers = g_new0 (GThread *, run.workers);
+  for (i = 0; i < run.workers; i++) {
+    workers[i] = g_thread_new ("extract", (GThreadFunc)worker_thread, &run);
+  }
+  for (i = 0; i < run.workers; i++) {
+    g_thread_join (workers[i]);
+  }
+  /* Waits for the frames still queued */
+  g_thread_pool_free (run.encoders, FALSE, TRUE);
+  wall = (g_get_monotonic_time () - start) / (gdouble)G_USEC_PER_SEC;
+  g_free (workers);
+
+  printf ("{\n  \"extract\": {\n    \"files\": %u, \"failed_files\": %u, \"frames\": %u, \"failed_frames\": %u,\n"
+      "    \"workers\": %u, \"decoder_threads\": %d, \"format\": \"%s\", \"seeks\": \"%s\",\n"
+      "    \"wall_s\": %.3f, \"files_per_sec\": %.2f, \"frames_per_sec\": %.2f,\n"
+      "    \"avg_decode_ms\": %.2f, \"avg_encode_ms\": %.2f\n  }\n}\n",
+      run.files, run.failedFiles, run.frames, run.failedFrames,
+      run.workers, run.decoderThreads, options->png ? "png" : "jpeg", options->accurate ? "accurate" : "keyframe",
+      wall, wall > 0 ? (run.files + run.failedFiles) / wall : 0.0, wall > 0 ? run.frames / wall : 0.0,
+      run.frames ? run.decodeTime / 1000.0 / run.frames : 0.0,
+      run.frames + run.failedFrames ? run.encodeTime / 1000.0 / (run.frames + run.failedFrames) : 0.0);
+  fflush (stdout);
+
+  ret = (0 == run.failedFiles && 0 == run.failedFrames) ? 0 : -1;
+  g_mutex_clear (&run.lock);
+  g_cond_clear (&run.cond);
+  return ret;
+}
@@ -0,0 +1,366 @@
+#include <stdio.h>
+#include <string.h>
+
+#include <gst/gst.h>
+#include <gdk/gdk.h>
+
+#include "input_replay.h"
+#include "bench.h"
+#include "log.h"
+
+static const char *typeNames[] = { "key", "click", "slider-press", "slider", "slider-release" };
+
+struct _InputRecorder {
+  FILE *file;
+  gint64 startTime;               /* Monotonic time playback started, 0 before */
+};
+
+InputRecorder *input_recorder_new (const char *path) {
+  InputRecorder *recorder;
+  FILE *file = fopen (path, "a");
+
+  if (NULL == file) {
+    LOGE ("Could not open %s for recording input", path);
+    return NULL;
+  }
+  recorder = g_new0 (InputRecorder, 1);
+  recorder->file = file;
+  fprintf (file, "# vd_player input, ms since playback started\n");
+  return recorder;
+}
+
+void input_recorder_free (InputRecorder *recorder) {
+  if (NULL == recorder)
+    return;
+  fclose (recorder->file);
+  g_free (recorder);
+}
+
+void input_recorder_start (InputRecorder *recorder) {
+  if (recorder && 0 == recorder->startTime)
+    recorder->startTime = g_get_monotonic_time ();
+}
+
+void input_recorder_add (InputRecorder *recorder, const InputEvent *event) {
+  gint64 time;
+
+  if (NULL == recorder)
+    return;
+  time = recorder->startTime ? (g_get_monotonic_time () - recorder->startTime) / 1000 : 0;
+  fprintf (recorder->file, "%" G_GINT64_FORMAT " %s", time, typeNames[event->type]);
+  switch (event->type) {
+    case INPUT_KEY:
+      fprintf (recorder->file, " %s", gdk_keyval_name (event->keyval));
+      break;
+    case INPUT_CLICK:
+      fprintf (recorder->file, " %u %d", event->button, event->doubleClick ? 2 : 1);
+      break;
+    case INPUT_SLIDER:
+      fprintf (recorder->file, " %.3f", event->value);
+      break;
+    default:
+      break;
+  }
+  fputc ('\n', recorder->file);
+  /* A session often ends in a crash or a kill */
+  fflush (recorder->file);
+}
+
+/* An event waiting for its response */
+typedef struct _Pending {
+  const InputEvent *event;
+  InputResponse response;
+  gint64 dispatchTime;            /* Monotonic */
+} Pending;
+
+struct _InputReplay {
+  InputDispatchFunc dispatch;
+  InputReplayDoneFunc done;
+  gpointer userData;
+
+  GArray *events;                 /* InputEvent, in time order */
+  guint next;                     /* First event not dispatched yet */
+  gint64 startTime;               /* Monotonic time playback started, 0 before */
+  guint timeoutId;
+
+  GMutex lock;                    /* Protects pending and the latencies, completed from streaming threads */
+  GQueue pending;                 /* Pending, in dispatch order */
+  GArray *latencies[G_N_ELEMENTS (typeNames)];  /* Input to response, in microseconds, per type */
+  GArray *handlerTimes;           /* Time spent in the handler itself */
+  guint timeouts;
+};
+
+static gboolean parse_line (gchar *line, InputEvent *event) {
+  gchar **fields;
+  gint64 time;
+  guint n, i;
+  gboolean ok = FALSE;
+
+  g_strstrip (line);
+  if ('\0' == *line || '#' == *line)
+    return FALSE;
+  fields = g_strsplit_set (line, " \t", -1);
+  n = g_strv_length (fields);
+  memset (event, 0, sizeof (*event));
+  for (i = 0; n >= 2 && i < G_N_ELEMENTS (typeNames); i++) {
+    if (strcmp (fields[1], typeNames[i]))
+      continue;
+    time = g_ascii_strtoll (fields[0], NULL, 10);
+    event->time = time * 1000;
+    event->type = (InputType)i;
+    switch (event->type) {
+      case INPUT_KEY:
+        ok = n >= 3 && GDK_KEY_VoidSymbol != (event->keyval = gdk_keyval_from_name (fields[2]));
+        break;
+      case INPUT_CLICK:
+        ok = n >= 4;
+        if (ok) {
+          event->button = (guint)g_ascii_strtoull (fields[2], NULL, 10);
+          event->doubleClick = 2 == g_ascii_strtoull (fields[3], NULL, 10);
+        }
+        break;
+      case INPUT_SLIDER:
+        ok = n >= 3;
+        if (ok)
+          event->value = g_ascii_strtod (fields[2], NULL);
+        break;
+      default:
+        ok = TRUE;
+        break;
+    }
+  }
+  g_strfreev (fields);
+  return ok;
+}
+
+static gint compare_events (gconstpointer a, gconstpointer b) {
+  gint64 ta = ((const InputEvent *)a)->time, tb = ((const InputEvent *)b)->time;
+
+  return ta < tb ? -1 : ta > tb;
+}
+
+InputReplay *input_replay_new (const char *path, InputDispatchFunc dispatch, InputReplayDoneFunc done,
+    gpointer user_data) {
+  InputReplay *replay;
+  gchar *contents = NULL;
+  gchar **lines;
+  InputEvent event;
+  GError *err = NULL;
+  guint i;
+
+  if (!g_file_get_contents (path, &contents, NULL, &err)) {
+    LOGE ("Could not read %s: %s", path, err->message);
+    g_clear_error (&err);
+    return NULL;
+  }
+
+  replay = g_new0 (InputReplay, 1);
+  replay->dispatch = dispatch;
+  replay->done = done;
+  replay->userData = user_data;
+  replay->events = g_array_new (FALSE, FALSE, sizeof (InputEvent));
+  lines = g_strsplit (contents, "\n", -1);
+  for (i = 0; lines[i]; i++) {
+    if (parse_line (lines[i], &event)) {
+      g_array_append_val (replay->events, event);
+    } else if (lines[i][0] && '#' != lines[i][0]) {
+      LOGW ("%s:%u: bad input event \"%s\", skipped", path, i + 1, lines[i]);
+    }
+  }
+  g_strfreev (lines);
+  g_free (contents);
+  /* Stable enough: recordings are in order already */
+  g_array_sort (replay->events, compare_events);
+
+  g_mutex_init (&replay->lock);
+  g_queue_init (&replay->pending);
+  for (i = 0; i < G_N_ELEMENTS (replay->latencies); i++)
+    replay->latencies[i] = g_array_new (FALSE, FALSE, sizeof (gint64));
+  replay->handlerTimes = g_array_new (FALSE, FALSE, sizeof (gint64));
+  LOGD ("Loaded %u input events from %s", replay->events->len, path);
+  return replay;
+}
+
+void input_replay_free (InputReplay *replay) {
+  guint i;
+
+  if (NULL == replay)
+    return;
+  if (replay->timeoutId)
+    g_source_remove (replay->timeoutId);
+  g_queue_clear_full (&replay->pending, g_free);
+  for (i = 0; i < G_N_ELEMENTS (replay->latencies); i++)
+    g_array_free (replay->latencies[i], TRUE);
+  g_array_free (replay->handlerTimes, TRUE);
+  g_array_free (replay->events, TRUE);
+  g_mutex_clear (&replay->lock);
+  g_free (replay);
+}
+
+/* With the lock held */
+static void complete (InputReplay *replay, GList *link, gint64 now) {
+  Pending *pending = link->data;
+  gint64 latency = MIN (now - pending->dispatchTime, INPUT_REPLAY_TIMEOUT);
+
+  g_array_append_val (replay->latencies[pending->event->type], latency);
+  g_queue_delete_link (&replay->pending, link);
+  g_free (pending);
+}
+
+/* Completes the pending events waiting for response that were dispatched up to before */
+static void complete_responses (InputReplay *replay, InputResponse response, gint64 before) {
+  gint64 now = g_get_monotonic_time ();
+  GList *l, *next;
+
+  g_mutex_lock (&replay->lock);
+  for (l = replay->pending.head; l; l = next) {
+    Pending *pending = l->data;
+
+    next = l->next;
+    if (pending->dispatchTime > before)
+      break;
+    if (pending->response == response)
+      complete (replay, l, now);
+  }
+  g_mutex_unlock (&replay->lock);
+}
+
+void input_replay_state_changed (InputReplay *replay) {
+  if (replay)
+    complete_responses (replay, INPUT_RESPONSE_STATE, G_MAXINT64);
+}
+
+void input_replay_seek_done (InputReplay *replay, gint64 latency) {
+  /* Events that came while the seek was in flight were coalesced into the next one */
+  if (replay && latency >= 0)
+    complete_responses (replay, INPUT_RESPONSE_SEEK, g_get_monotonic_time () - latency);
+}
+
+static GstPadProbeReturn frame_probe_cb (GstPad *pad, GstPadProbeInfo *info, InputReplay *replay) {
+  complete_responses (replay, INPUT_RESPONSE_FRAME, G_MAXINT64);
+  return GST_PAD_PROBE_OK;
+}
+
+void input_replay_watch_video_sink (InputReplay *replay, GstElement *sink) {
+  GstPad *pad;
+
+  if (NULL == replay || NULL == (pad = gst_element_get_static_pad (sink, "sink")))
+    return;
+  gst_pad_add_probe (pad, GST_PAD_PROBE_TYPE_BUFFER, (GstPadProbeCallback)frame_probe_cb, replay, NULL);
+  gst_object_unref (pad);
+}
+
+static gboolean tick_cb (InputReplay *replay) {
+  gint64 now = g_get_monotonic_time ();
+  gint64 start, handlerTime;
+  const InputEvent *event;
+  InputResponse response;
+  Pending *pending;
+  GList *l, *next;
+  gboolean finished;
+
+  /* Every event that is due, in order; a slow handler delays the ones after it, as it would live */
+  while (replay->next < replay->events->len &&
+      (event = &g_array_index (replay->events, InputEvent, replay->next))->time <= now - replay->startTime) {
+    replay->next++;
+    start = g_get_monotonic_time ();
+    g_mutex_lock (&replay->lock);
+    /* Queued before dispatching: responses may come from other threads during the handler */
+    pending = g_new0 (Pending, 1);
+    pending->event = event;
+    pending->dispatchTime = start;
+    pending->response = INPUT_RESPONSE_NONE;
+    g_queue_push_tail (&replay->pending, pending);
+    g_mutex_unlock (&replay->lock);
+
+    response = replay->dispatch (event, replay->userData);
+    handlerTime = g_get_monotonic_time () - start;
+
+    g_mutex_lock (&replay->lock);
+    g_array_append_val (replay->handlerTimes, handlerTime);
+    pending->response = response;
+    if (INPUT_RESPONSE_NONE == response)
+      complete (replay, g_queue_find (&replay->pending, pending), g_get_monotonic_time ());
+    g_mutex_unlock (&replay->lock);
+    now = g_get_monotonic_time ();
+  }
+
+  g_mutex_lock (&replay->lock);
+  for (l = replay->pending.head; l; l = next) {
+    next = l->next;
+    pending = l->data;
+    if (INPUT_RESPONSE_NONE != pending->response && now - pending->dispatchTime >= INPUT_REPLAY_TIMEOUT) {
+      LOGW ("No response to %s event at %" G_GINT64_FORMAT " ms", typeNames[pending->event->type],
+          pending->event->time / 1000);
+      replay->timeouts++;
+      complete (replay, l, now);
+    }
+  }
+  finished = replay->next == replay->events->len && g_queue_is_empty (&replay->pending);
+  g_mutex_unlock (&replay->lock);
+
+  if (!finished)
+    return G_SOURCE_CONTINUE;
+  replay->timeoutId = 0;
+  replay->done (replay->userData);
+  return G_SOURCE_REMOVE;
+}
+
+void input_replay_start (InputReplay *replay) {
+  if (NULL == replay || replay->startTime)
+    return;
+  replay->startTime = g_get_monotonic_time ();
+  replay->timeoutId = g_timeout_add (INPUT_REPLAY_TICK_MS, (GSourceFunc)tick_cb, replay);
+}
+
+static gint compare_int64 (gconstpointer a, gconstpointer b) {
+  gint64 va = *(const gint64 *)a, vb = *(const gint64 *)b;
+
+  return va < vb ? -1 : va > vb;
+}
+
+static void append_percentiles (GString *out, const char *name, GArray *values) {
+  GArray *sorted = g_array_sized_new (FALSE, FALSE, sizeof (gint64), values->len);
+  guint n = values->len;
+
+  g_array_append_vals (sorted, values->data, n);
+  g_array_sort (sorted, compare_int64);
+  g_string_append (out, "    ");
+  bench_json_append_string (out, name);
+  if (0 == n) {
+    g_string_append (out, ": { \"count\": 0 }");
+  } else {
+    g_string_append_printf (out, ": { \"count\": %u, \"p50\": %.2f, \"p99\": %.2f, \"max\": %.2f }", n,
+        g_array_index (sorted, gint64, (guint)(0.50 * (n - 1) + 0.5)) / 1000.0,
+        g_array_index (sorted, gint64, (guint)(0.99 * (n - 1) + 0.5)) / 1000.0,
+        g_array_index (sorted, gint64, n - 1) / 1000.0);
+  }
+  g_array_free (sorted, TRUE);
+}
+
+void input_replay_report (InputReplay *replay) {
+  GString *out = g_string_new ("{\n  \"input_latency_ms\": {\n");
+  GArray *all = g_array_new (FALSE, FALSE, sizeof (gint64));
+  guint i;
+
+  g_mutex_lock (&replay->lock);
+  for (i = 0; i < G_N_ELEMENTS (typeNames); i++) {
+    g_array_append_vals (all, replay->latencies[i]->data, replay->latencies[i]->len);
+  }
+  append_percentiles (out, "all", all);
+  for (i = 0; i < G_N_ELEMENTS (typeNames); i++) {
+    if (replay->latencies[i]->len > 0) {
+      g_string_append (out, ",\n");
+      append_percentiles (out, typeNames[i], replay->latencies[i]);
+    }
+  }
+  g_string_append (out, ",\n");
+  append_percentiles (out, "handler", replay->handlerTimes);
+  g_string_append_printf (out, "\n  },\n  \"events\": %u,\n  \"timeouts\": %u\n}\n", replay->next, replay->timeouts);
+  g_mutex_unlock (&replay->lock);
+
+  fputs (out->str, stdout);
+  fflush (stdout);
+  g_string_free (out, TRUE);
+  g_array_free (all, TRUE);
+}
@@ -0,0 +1,431 @@
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include <gst/gst.h>
+
+#include "keyframe_index.h"
+#include "log.h"
+
+#define KEYFRAME_INDEX_MAGIC "VDKI"
+#define KEYFRAME_INDEX_VERSION 3
+#define KEYFRAME_INDEX_HASH_BLOCK (64 * 1024)  /* Bytes hashed at the head and the tail of the file */
+
+/* Sidecar file layout: header followed by count entries, sorted by timestamp */
+typedef struct _KeyframeIndexHeader {
+  char magic[4];
+  guint32 version;
+  guint64 count;
+} KeyframeIndexHeader;
+
+typedef struct _KeyframeIndexEntry {
+  gint64 timestamp;               /* Stream time of the keyframe, in nanoseconds */
+  guint64 offset;                 /* Byte offset of the last read before the keyframe came out of the demuxer */
+} KeyframeIndexEntry;
+
+struct _KeyframeIndex {
+  gchar *location;                /* Local file name */
+  gint refs;                      /* The owner's and the build thread's (atomic); the last one frees */
+  gint cancelled;                 /* Set to stop the build early (atomic) */
+  guint64 fileSize;
+
+  GMutex lock;
+  GCond cond;                     /* Signalled when the thread is finished */
+  gboolean finished;              /* Thread is done, with or without an index */
+  gint ready;                     /* entries can be used (atomic) */
+  GMappedFile *mapping;           /* Mapped sidecar file */
+  const KeyframeIndexEntry *entries;
+  guint64 count;
+
+  /* Only used by the build thread */
+  GArray *building;               /* KeyframeIndexEntry being collected */
+  guint64 lastReadOffset;         /* Offset of the last buffer read by filesrc (atomic) */
+  gboolean haveVideo;             /* A video stream has been hooked already */
+};
+
+/* Hashes size, head and tail of the file, which is enough to tell files apart
+   without reading gigabytes on every open */
+static gchar *hash_file (const char *location) {
+  GChecksum *checksum;
+  struct stat st;
+  FILE *file;
+  guchar *block;
+  size_t len;
+  gchar *hash = NULL;
+
+  if (0 != stat (location, &st) || NULL == (file = fopen (location, "rb")))
+    return NULL;
+
+  checksum = g_checksum_new (G_CHECKSUM_SHA1);
+  g_checksum_update (checksum, (const guchar *)&st.st_size, sizeof (st.st_size));
+
+  block = g_malloc (KEYFRAME_INDEX_HASH_BLOCK);
+  len = fread (block, 1, KEYFRAME_INDEX_HASH_BLOCK, file);
+  g_checksum_update (checksum, block, len);
+  if (st.st_size > 2 * KEYFRAME_INDEX_HASH_BLOCK && 0 == fseeko (file, -KEYFRAME_INDEX_HASH_BLOCK, SEEK_END)) {
+    len = fread (block, 1, KEYFRAME_INDEX_HASH_BLOCK, file);
+    g_checksum_update (checksum, block, len);
+  }
+  fclose (file);
+  g_free (block);
+
+  hash = g_strdup (g_checksum_get_string (checksum));
+  g_checksum_free (checksum);
+  return hash;
+}
+
+/* Maps the sidecar file and checks that it is complete */
+static gboolean load_cache (KeyframeIndex *index, const char *cachePath) {
+  GMappedFile *mapping = g_mapped_file_new (cachePath, FALSE, NULL);
+  const KeyframeIndexHeader *header;
+  gsize size;
+
+  if (NULL == mapping)
+    return FALSE;
+
+  size = g_mapped_file_get_length (mapping);
+  header = (const KeyframeIndexHeader *)g_mapped_file_get_contents (mapping);
+  if (size < sizeof (*header) || memcmp (header->magic, KEYFRAME_INDEX_MAGIC, 4) ||
+      KEYFRAME_INDEX_VERSION != header->version ||
+      size != sizeof (*header) + header->count * sizeof (KeyframeIndexEntry)) {
+    LOGD ("Ignoring stale keyframe index %s", cachePath);
+    g_mapped_file_unref (mapping);
+    return FALSE;
+  }
+
+  index->mapping = mapping;
+  index->entries = (const KeyframeIndexEntry *)(header + 1);
+  index->count = header->count;
+  return TRUE;
+}
+
+static gboolean save_cache (KeyframeIndex *index, const char *cachePath) {
+  KeyframeIndexHeader header;
+  GByteArray *bytes = g_byte_array_new ();
+  GError *err = NULL;
+  gboolean ret;
+
+  memset (&header, 0, sizeof (header));
+  memcpy (header.magic, KEYFRAME_INDEX_MAGIC, 4);
+  header.version = KEYFRAME_INDEX_VERSION;
+  header.count = index->building->len;
+  g_byte_array_append (bytes, (const guint8 *)&header, sizeof (header));
+  g_byte_array_append (bytes, (const guint8 *)index->building->data,
+      index->building->len * sizeof (KeyframeIndexEntry));
+
+  /* Written to a temporary file and renamed, so readers never map half a file */
+  ret = g_file_set_contents (cachePath, (const gchar *)bytes->data, bytes->len, &err);
+  if (!ret) {
+    LOGD ("Could not write keyframe index: %s", err->message);
+    g_clear_error (&err);
+  }
+  g_byte_array_unref (bytes);
+  return ret;
+}
+
+static GstPadProbeReturn read_probe_cb (GstPad *pad, GstPadProbeInfo *info, KeyframeIndex *index) {
+  GstBuffer *buffer = GST_PAD_PROBE_INFO_BUFFER (info);
+
+  if (GST_BUFFER_OFFSET_IS_VALID (buffer)) {
+    __atomic_store_n (&index->lastReadOffset, GST_BUFFER_OFFSET (buffer), __ATOMIC_RELAXED);
+  }
+  return GST_PAD_PROBE_OK;
+}
+
+static GstPadProbeReturn keyframe_probe_cb (GstPad *pad, GstPadProbeInfo *info, KeyframeIndex *index) {
+  GstBuffer *buffer = GST_PAD_PROBE_INFO_BUFFER (info);
+  KeyframeIndexEntry entry;
+  GstEvent *event;
+  const GstSegment *segment;
+
+  if (GST_BUFFER_FLAG_IS_SET (buffer, GST_BUFFER_FLAG_DELTA_UNIT) || !GST_BUFFER_PTS_IS_VALID (buffer))
+    return GST_PAD_PROBE_OK;
+
+  entry.timestamp = GST_BUFFER_PTS (buffer);
+  event = gst_pad_get_sticky_event (pad, GST_EVENT_SEGMENT, 0);
+  if (event) {
+    gst_event_parse_segment (event, &segment);
+    entry.timestamp = gst_segment_to_stream_time (segment, GST_FORMAT_TIME, GST_BUFFER_PTS (buffer));
+    gst_event_unref (event);
+  }
+  entry.offset = GST_BUFFER_OFFSET_IS_VALID (buffer) ? GST_BUFFER_OFFSET (buffer) :
+      __atomic_load_n (&index->lastReadOffset, __ATOMIC_RELAXED);
+  g_array_append_val (index->building, entry);
+  return GST_PAD_PROBE_OK;
+}
+
+/* Every parsed stream goes into a fakesink; keyframes of the first video stream are recorded */
+static void pad_added_cb (GstElement *parsebin, GstPad *pad, KeyframeIndex *index) {
+  GstElement *pipeline = GST_ELEMENT (gst_element_get_parent (parsebin));
+  GstElement *sink = gst_element_factory_make ("fakesink", NULL);
+  GstPad *sinkPad;
+  GstCaps *caps = gst_pad_get_current_caps (pad);
+
+  if (NULL == caps)
+    caps = gst_pad_query_caps (pad, NULL);
+
+  g_object_set (sink, "sync", FALSE, NULL);
+  gst_bin_add (GST_BIN (pipeline), sink);
+  gst_element_sync_state_with_parent (sink);
+  sinkPad = gst_element_get_static_pad (sink, "sink");
+  if (GST_PAD_LINK_OK != gst_pad_link (pad, sinkPad)) {
+    LOGD ("Could not link %s", GST_OBJECT_NAME (pad));
+  }
+  gst_object_unref (sinkPad);
+
+  if (!index->haveVideo && caps && !gst_caps_is_empty (caps) &&
+      g_str_has_prefix (gst_structure_get_name (gst_caps_get_structure (caps, 0)), "video/")) {
+    index->haveVideo = TRUE;
+    gst_pad_add_probe (pad, GST_PAD_PROBE_TYPE_BUFFER, (GstPadProbeCallback)keyframe_probe_cb, index, NULL);
+  }
+
+  if (caps)
+    gst_caps_unref (caps);
+  gst_object_unref (pipeline);
+}
+
+static gint compare_entries (gconstpointer a, gconstpointer b) {
+  gint64 ta = ((const KeyframeIndexEntry *)a)->timestamp;
+  gint64 tb = ((const KeyframeIndexEntry *)b)->timestamp;
+
+  return (ta > tb) - (ta < tb);
+}
+
+/* Demuxes (without decoding) the whole file as fast as possible */
+static gboolean build_index (KeyframeIndex *index) {
+  GstElement *pipeline = gst_pipeline_new ("keyframe-index");
+  GstElement *src = gst_element_factory_make ("filesrc", NULL);
+  GstElement *parse = gst_element_factory_make ("parsebin", NULL);
+  GstBus *bus;
+  GstMessage *msg;
+  GstPad *srcPad;
+  gboolean done = FALSE, ok = FALSE;
+
+  if (!src || !parse) {
+    LOGD ("filesrc/parsebin missing, no keyframe index");
+    gst_object_unref (pipeline);
+    if (src)
+      gst_object_unref (src);
+    if (parse)
+      gst_object_unref (parse);
+    return FALSE;
+  }
+
+  g_object_set (src, "location", index->location, NULL);
+  gst_bin_add_many (GST_BIN (pipeline), src, parse, NULL);
+  gst_element_link (src, parse);
+  g_signal_connect (parse, "pad-added", G_CALLBACK (pad_added_cb), index);
+
+  srcPad = gst_element_get_static_pad (src, "src");
+  gst_pad_add_probe (srcPad, GST_PAD_PROBE_TYPE_BUFFER, (GstPadProbeCallback)read_probe_cb, index, NULL);
+  gst_object_unref (srcPad);
+
+  index->building = g_array_new (FALSE, FALSE, sizeof (KeyframeIndexEntry));
+  gst_element_set_state (pipeline, GST_STATE_PLAYING);
+
+  bus = gst_element_get_bus (pipeline);
+  while (!done && !g_atomic_int_get (&index->cancelled)) {
+    msg = gst_bus_timed_pop_filtered (bus, 100 * GST_MSECOND, GST_MESSAGE_EOS | GST_MESSAGE_ERROR);
+    if (NULL == msg)
+      continue;
+    if (GST_MESSAGE_EOS == GST_MESSAGE_TYPE (msg)) {
+      ok = index->haveVideo;
+    } else {
+      LOGD ("Keyframe index build failed in %s", GST_OBJECT_NAME (msg->src));
+    }
+    gst_message_unref (msg);
+    done = TRUE;
+  }
+  gst_object_unref (bus);
+  gst_element_set_state (pipeline, GST_STATE_NULL);
+  gst_object_unref (pipeline);
+
+  g_array_sort (index->building, compare_entries);
+  return ok;
+}
+
+static void keyframe_index_unref (KeyframeIndex *index) {
+  if (!g_atomic_int_dec_and_test (&index->refs))
+    return;
+  if (index->mapping)
+    g_mapped_file_unref (index->mapping);
+  if (index->building)
+    g_array_free (index->building, TRUE);
+  g_mutex_clear (&index->lock);
+  g_cond_clear (&index->cond);
+  g_free (index->location);
+  g_free (index);
+}
+
+static gpointer index_thread (KeyframeIndex *index) {
+  gchar *hash = hash_file (index->location);
+  gchar *cacheDir = g_build_filename (g_get_user_cache_dir (), "vd_player", NULL);
+  gchar *cacheName = NULL, *cachePath = NULL;
+  gint64 start = g_get_monotonic_time ();
+  gboolean loaded = FALSE;
+
+  if (hash) {
+    cacheName = g_strdup_printf ("%s.kfi", hash);
+    cachePath = g_build_filename (cacheDir, cacheName, NULL);
+    loaded = load_cache (index, cachePath);
+  }
+
+  if (loaded) {
+    LOGD ("Loaded %" G_GUINT64_FORMAT " keyframes from %s", index->count, cachePath);
+  } else if (build_index (index)) {
+    LOGD ("Indexed %u keyframes in %" G_GINT64_FORMAT " ms", index->building->len,
+        (g_get_monotonic_time () - start) / 1000);
+    /* Prefer serving from the mapped cache; keep the array if it can't be written */
+    if (cachePath && 0 == g_mkdir_with_parents (cacheDir, 0755) && save_cache (index, cachePath) &&
+        load_cache (index, cachePath)) {
+      g_array_free (index->building, TRUE);
+      index->building = NULL;
+    } else {
+      index->entries = (const KeyframeIndexEntry *)index->building->data;
+      index->count = index->building->len;
+    }
+    loaded = TRUE;
+  }
+
+  /* Waiters are woken up without an index too, they fall back to key unit seeks */
+  g_mutex_lock (&index->lock);
+  g_atomic_int_set (&index->ready, loaded);
+  index->finished = TRUE;
+  g_cond_broadcast (&index->cond);
+  g_mutex_unlock (&index->lock);
+
+  g_free (hash);
+  g_free (cacheDir);
+  g_free (cacheName);
+  g_free (cachePath);
+  keyframe_index_unref (index);
+  return NULL;
+}
+
+KeyframeIndex *keyframe_index_open (const char *uri) {
+  KeyframeIndex *index;
+  gchar *location;
+  struct stat st;
+
+  if (NULL == uri || !gst_uri_has_protocol (uri, "file"))
+    return NULL;
+  location = gst_uri_get_location (uri);
+  if (NULL == location)
+    return NULL;
+
+  index = g_new0 (KeyframeIndex, 1);
+  index->location = location;
+  if (0 == stat (location, &st))
+    index->fileSize = st.st_size;
+  g_mutex_init (&index->lock);
+  g_cond_init (&index->cond);
+  index->refs = 2;
+  /* Detached: the thread drops its reference when it is done */
+  g_thread_unref (g_thread_new ("keyframe-index", (GThreadFunc)index_thread, index));
+  return index;
+}
+
+void keyframe_index_free (KeyframeIndex *index) {
+  if (NULL == index)
+    return;
+  /* Not joined, this runs on the UI thread: the build notices within one bus poll
+   * (100 ms) and the thread frees the index if it is last */
+  g_atomic_int_set (&index->cancelled, TRUE);
+  keyframe_index_unref (index);
+}
+
+gboolean keyframe_index_is_ready (KeyframeIndex *index) {
+  return (NULL != index && g_atomic_int_get (&index->ready));
+}
+
+void keyframe_index_wait (KeyframeIndex *index) {
+  if (NULL == index)
+    return;
+  g_mutex_lock (&index->lock);
+  while (!index->finished) {
+    g_cond_wait (&index->cond, &index->lock);
+  }
+  g_mutex_unlock (&index->lock);
+}
+
+/* Last entry with timestamp <= position, FALSE when there is none or no index */
+static gboolean find_entry (KeyframeIndex *index, gint64 position, guint64 *found) {
+  guint64 low = 0, high;
+
+  if (!keyframe_index_is_ready (index) || 0 == index->count || position < index->entries[0].timestamp)
+    return FALSE;
+
+  high = index->count;
+  while (high - low > 1) {
+    guint64 mid = low + (high - low) / 2;
+
+    if (index->entries[mid].timestamp <= position)
+      low = mid;
+    else
+      high = mid;
+  }
+  *found = low;
+  return TRUE;
+}
+
+gboolean keyframe_index_lookup (KeyframeIndex *index, gint64 position, gint64 *before, gint64 *after) {
+  guint64 low;
+
+  if (!find_entry (index, position, &low))
+    return FALSE;
+  if (before)
+    *before = index->entries[low].timestamp;
+  if (after)
+    *after = (low + 1 < index->count) ? index->entries[low + 1].timestamp : GST_CLOCK_TIME_NONE;
+  return TRUE;
+}
+
+/* Bytes of the file read and decoded from the keyframe of entry up to position,
+   interpolated between it and the next keyframe. After the last one, all the rest */
+static guint64 decode_bytes (KeyframeIndex *index, guint64 entry, gint64 position) {
+  const KeyframeIndexEntry *key = &index->entries[entry], *next;
+
+  if (entry + 1 >= index->count)
+    return index->fileSize > key->offset ? index->fileSize - key->offset : 0;
+  next = key + 1;
+  if (next->offset <= key->offset || next->timestamp <= key->timestamp)
+    return 0;
+  return (guint64)((next->offset - key->offset) * ((gdouble)(position - key->timestamp) /
+      (next->timestamp - key->timestamp)));
+}
+
+GstSeekFlags keyframe_index_seek_flags (KeyframeIndex *index, gint64 *position, gint64 *refine) {
+  gint64 before, after;
+  guint64 entry, bytes;
+
+  if (!find_entry (index, *position, &entry))
+    return GST_SEEK_FLAG_FLUSH | GST_SEEK_FLAG_KEY_UNIT;
+  before = index->entries[entry].timestamp;
+  after = (entry + 1 < index->count) ? index->entries[entry + 1].timestamp : GST_CLOCK_TIME_NONE;
+
+  if (*position - before <= KEYFRAME_INDEX_MAX_DECODE)
+    return GST_SEEK_FLAG_FLUSH | GST_SEEK_FLAG_ACCURATE;
+
+  /* The accurate seek decodes the GOP up to the target, so its latency is bounded by
+   * the bytes in between rather than left to the GOP length */
+  bytes = decode_bytes (index, entry, *position);
+  if (refine && bytes > KEYFRAME_INDEX_MAX_REFINE_BYTES) {
+    LOGD ("%" G_GUINT64_FORMAT " bytes to decode for an accurate seek, staying on a keyframe", bytes);
+    refine = NULL;
+  }
+
+  if (refine) {
+    /* Too much to decode for this GOP: show its keyframe, which only costs that one
+     * frame, and decode up to the target afterwards unless another seek comes first */
+    *refine = *position;
+    *position = before;
+    return GST_SEEK_FLAG_FLUSH | GST_SEEK_FLAG_KEY_UNIT;
+  }
+
+  /* Snapping asked for: land exactly on the closest keyframe and stay there */
+  if (GST_CLOCK_TIME_IS_VALID (after) && after - *position < *position - before)
+    *position = after;
+  else
+    *position = before;
+  return GST_SEEK_FLAG_FLUSH | GST_SEEK_FLAG_KEY_UNIT;
+}
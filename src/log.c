@@ -0,0 +1,238 @@
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+
+#include <glib.h>
+
+#include "log.h"
+
+#define LOG_RING_MASK (LOG_RING_SIZE - 1)
+
+/* Binary record; the writer thread turns it into a line */
+typedef struct _LogRecord {
+  gint64 time;                    /* Wall clock, in microseconds */
+  const char *func;               /* __func__, static storage */
+  gint line;
+  gint level;
+  gint tid;
+  gchar message[LOG_MESSAGE_MAX];
+} LogRecord;
+
+/* A slot is free for position pos while seq is the start of pos's lap round the
+   ring, and holds pos's record once seq is one more. Zeroed static storage is
+   therefore an empty ring, usable before log_init */
+typedef struct _LogSlot {
+  guint64 seq;
+  LogRecord record;
+} __attribute__((aligned (64))) LogSlot;
+
+static LogSlot ring[LOG_RING_SIZE];
+static guint64 tail __attribute__((aligned (64)));   /* Next position to claim, shared by producers */
+static guint64 head __attribute__((aligned (64)));   /* Next position to read, writer thread only */
+static guint64 dropped;
+
+static GThread *writer;
+static gint stopWriter;
+static GMutex wakeLock;                  /* Statically allocated, needs no init */
+static GCond wakeCond;
+static gint writerIdle;                  /* The writer found the ring empty and waits (atomic) */
+static FILE *logFile;
+static gsize logFileSize;
+static guint64 droppedReported;
+
+static const char levelChars[] = "EWID";
+
+static gint thread_id (void) {
+  static __thread gint tid;
+
+  if (0 == tid)
+    tid = (gint)syscall (SYS_gettid);
+  return tid;
+}
+
+void log_write (int level, const char *func, int line, const char *fmt, ...) {
+  guint64 pos = __atomic_load_n (&tail, __ATOMIC_RELAXED);
+  guint64 lap, seq;
+  LogSlot *slot;
+  va_list args;
+
+  for (;;) {
+    slot = &ring[pos & LOG_RING_MASK];
+    lap = pos & ~(guint64)LOG_RING_MASK;
+    seq = __atomic_load_n (&slot->seq, __ATOMIC_ACQUIRE);
+    if (seq == lap) {
+      /* Free: claim it, or retry with the position another producer left */
+      if (__atomic_compare_exchange_n (&tail, &pos, pos + 1, TRUE, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+        break;
+    } else if (seq < lap) {
+      /* Still holds the record of the previous lap: the writer is behind */
+      __atomic_fetch_add (&dropped, 1, __ATOMIC_RELAXED);
+      return;
+    } else {
+      pos = __atomic_load_n (&tail, __ATOMIC_RELAXED);
+    }
+  }
+
+  slot->record.time = g_get_real_time ();
+  slot->record.func = func;
+  slot->record.line = line;
+  slot->record.level = level;
+  slot->record.tid = thread_id ();
+  va_start (args, fmt);
+  vsnprintf (slot->record.message, sizeof (slot->record.message), fmt, args);
+  va_end (args);
+  __atomic_store_n (&slot->seq, lap + 1, __ATOMIC_RELEASE);
+
+  /* Only the record that ends the writer's wait takes the lock. The fence pairs with
+   * the writer's: either it sees this record before waiting, or this sees it idle */
+  __atomic_thread_fence (__ATOMIC_SEQ_CST);
+  if (__atomic_load_n (&writerIdle, __ATOMIC_RELAXED)) {
+    g_mutex_lock (&wakeLock);
+    __atomic_store_n (&writerIdle, 0, __ATOMIC_RELAXED);
+    g_cond_signal (&wakeCond);
+    g_mutex_unlock (&wakeLock);
+  }
+}
+
+guint64 log_get_dropped (void) {
+  return __atomic_load_n (&dropped, __ATOMIC_RELAXED);
+}
+
+static void open_log_file (void) {
+  logFile = fopen (LOG_FILE, "a");
+  logFileSize = logFile ? (gsize)ftell (logFile) : 0;
+}
+
+/* LOG_FILE -> LOG_FILE.1 -> ... -> LOG_FILE.<LOG_FILE_KEEP>, the oldest is lost */
+static void rotate (void) {
+  gchar *from, *to;
+  gint i;
+
+  fclose (logFile);
+  for (i = LOG_FILE_KEEP; i > 0; i--) {
+    from = i > 1 ? g_strdup_printf ("%s.%d", LOG_FILE, i - 1) : g_strdup (LOG_FILE);
+    to = g_strdup_printf ("%s.%d", LOG_FILE, i);
+    rename (from, to);
+    g_free (from);
+    g_free (to);
+  }
+  open_log_file ();
+}
+
+static void emit (const char *line, gint length, gint level) {
+  if (level <= LOG_CONSOLE_LEVEL)
+    fputs (line, stderr);
+  if (NULL == logFile)
+    return;
+  fwrite (line, 1, length, logFile);
+  logFileSize += length;
+  if (logFileSize >= LOG_FILE_MAX_SIZE)
+    rotate ();
+}
+
+static void format_record (const LogRecord *record) {
+  static time_t lastSeconds = -1;
+  static struct tm tm;
+  gchar line[LOG_MESSAGE_MAX + 128];
+  time_t seconds = record->time / G_USEC_PER_SEC;
+  gint length;
+
+  /* Records come in bursts within the same second */
+  if (seconds != lastSeconds) {
+    localtime_r (&seconds, &tm);
+    lastSeconds = seconds;
+  }
+  length = snprintf (line, sizeof (line), "%02d:%02d:%02d.%06d %c %5d %s::%s:%d %s\n", tm.tm_hour, tm.tm_min,
+      tm.tm_sec, (gint)(record->time % G_USEC_PER_SEC), levelChars[record->level], record->tid, LOG_TAG,
+      record->func, record->line, record->message);
+  emit (line, MIN (length, (gint)sizeof (line) - 1), record->level);
+}
+
+/* Writes out everything published so far; returns the number of records */
+static guint drain (void) {
+  guint count = 0;
+  guint64 lap, lost;
+  LogSlot *slot;
+  gchar line[128];
+  gint length;
+
+  for (;;) {
+    slot = &ring[head & LOG_RING_MASK];
+    lap = head & ~(guint64)LOG_RING_MASK;
+    if (__atomic_load_n (&slot->seq, __ATOMIC_ACQUIRE) != lap + 1)
+      break;
+    format_record (&slot->record);
+    /* Free for the next lap */
+    __atomic_store_n (&slot->seq, lap + LOG_RING_SIZE, __ATOMIC_RELEASE);
+    head++;
+    count++;
+  }
+
+  lost = log_get_dropped ();
+  if (lost != droppedReported) {
+    length = snprintf (line, sizeof (line), "%s: %" G_GUINT64_FORMAT " log records dropped, ring full\n", LOG_TAG,
+        lost - droppedReported);
+    emit (line, length, LOG_LEVEL_WARN);
+    droppedReported = lost;
+  }
+  if (count > 0 && logFile)
+    fflush (logFile);
+  return count;
+}
+
+static gboolean record_ready (void) {
+  LogSlot *slot = &ring[head & LOG_RING_MASK];
+
+  return __atomic_load_n (&slot->seq, __ATOMIC_ACQUIRE) == (head & ~(guint64)LOG_RING_MASK) + 1;
+}
+
+/* Sleeps until a producer publishes a record or log_shutdown, without waking up
+   while the player logs nothing */
+static void wait_for_records (void) {
+  g_mutex_lock (&wakeLock);
+  __atomic_store_n (&writerIdle, 1, __ATOMIC_RELAXED);
+  __atomic_thread_fence (__ATOMIC_SEQ_CST);
+  if (record_ready ())
+    __atomic_store_n (&writerIdle, 0, __ATOMIC_RELAXED);
+  while (__atomic_load_n (&writerIdle, __ATOMIC_RELAXED) && !g_atomic_int_get (&stopWriter))
+    g_cond_wait (&wakeCond, &wakeLock);
+  __atomic_store_n (&writerIdle, 0, __ATOMIC_RELAXED);
+  g_mutex_unlock (&wakeLock);
+}
+
+static gpointer writer_thread (gpointer unused) {
+  while (!g_atomic_int_get (&stopWriter)) {
+    if (0 == drain ())
+      wait_for_records ();
+  }
+  drain ();
+  return NULL;
+}
+
+void log_init (void) {
+  if (writer)
+    return;
+  open_log_file ();
+  writer = g_thread_new ("log-writer", writer_thread, NULL);
+  /* main() has many early returns; none of them should lose the log */
+  atexit (log_shutdown);
+}
+
+void log_shutdown (void) {
+  if (NULL == writer)
+    return;
+  g_mutex_lock (&wakeLock);
+  g_atomic_int_set (&stopWriter, 1);
+  g_cond_signal (&wakeCond);
+  g_mutex_unlock (&wakeLock);
+  g_thread_join (writer);
+  writer = NULL;
+  if (logFile) {
+    fclose (logFile);
+    logFile = NULL;
+  }
+}
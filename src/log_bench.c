@@ -0,0 +1,86 @@
+#include <stdio.h>
+
+#include <glib.h>
+
+#include "log_bench.h"
+#include "log.h"
+
+#define LOG_BENCH_CALLS 20480        /* Calls per thread */
+#define LOG_BENCH_THREADS 4
+#define LOG_BENCH_BURST (LOG_RING_SIZE / (2 * LOG_BENCH_THREADS))
+#define LOG_BENCH_PAUSE_US 40000     /* Between bursts, for the writer to drain them */
+
+/* What LOGD expanded to before the ring logger */
+#define LEGACY_LOGD(out, fmt, args...) fprintf (out, "%s::%s:%d " fmt "\n", LOG_TAG, __func__, __LINE__, ##args)
+
+/* Line buffered like stdout on a terminal: one write() per call. /dev/null keeps the
+   terminal's own cost out of it, so this is a lower bound */
+static gdouble legacy_ns (FILE *out) {
+  gint64 start = g_get_monotonic_time ();
+  gint i;
+
+  for (i = 0; i < LOG_BENCH_CALLS; i++)
+    LEGACY_LOGD (out, "Got keypress event %d", i);
+  return (g_get_monotonic_time () - start) * 1000.0 / LOG_BENCH_CALLS;
+}
+
+/* Called directly rather than through LOGD, so it is measured whatever LOG_LEVEL is.
+ * Calls go in bursts that fit the ring together with the other threads' bursts, and
+ * the writer drains it in between, so they measure the accepted path; with flood
+ * the ring overflows and most calls take the drop path */
+static gpointer ring_thread (gpointer flood) {
+  gint64 elapsed = 0, start;
+  gint i, j;
+
+  for (i = 0; i < LOG_BENCH_CALLS; i += LOG_BENCH_BURST) {
+    start = g_get_monotonic_time ();
+    for (j = 0; j < LOG_BENCH_BURST; j++)
+      log_write (LOG_LEVEL_DEBUG, __func__, __LINE__, "Got keypress event %d", i + j);
+    elapsed += g_get_monotonic_time () - start;
+    if (!flood)
+      g_usleep (LOG_BENCH_PAUSE_US);
+  }
+  return GSIZE_TO_POINTER (elapsed);
+}
+
+static gdouble ring_ns (guint threads, gboolean flood) {
+  GThread *thread[LOG_BENCH_THREADS];
+  gint64 elapsed = 0;
+  guint i;
+
+  for (i = 0; i < threads; i++)
+    thread[i] = g_thread_new ("log-bench", ring_thread, GINT_TO_POINTER (flood));
+  for (i = 0; i < threads; i++)
+    elapsed += GPOINTER_TO_SIZE (g_thread_join (thread[i]));
+  /* Start the next run on an empty ring */
+  g_usleep (G_USEC_PER_SEC / 2);
+  return elapsed * 1000.0 / ((gdouble)LOG_BENCH_CALLS * threads);
+}
+
+int log_bench_run (void) {
+  FILE *null = fopen ("/dev/null", "w");
+  gdouble lineBuffered, fullyBuffered, single, multi, full;
+  guint64 dropped;
+
+  if (NULL == null)
+    return -1;
+  setvbuf (null, NULL, _IOLBF, 0);
+  lineBuffered = legacy_ns (null);
+  /* ...and fully buffered like stdout into a pipe */
+  setvbuf (null, NULL, _IOFBF, BUFSIZ);
+  fullyBuffered = legacy_ns (null);
+  fclose (null);
+
+  dropped = log_get_dropped ();
+  single = ring_ns (1, FALSE);
+  multi = ring_ns (LOG_BENCH_THREADS, FALSE);
+  dropped = log_get_dropped () - dropped;
+  full = ring_ns (LOG_BENCH_THREADS, TRUE);
+
+  printf ("{\n  \"calls_per_thread\": %d,\n  \"printf_line_buffered_ns\": %.1f,\n  \"printf_fully_buffered_ns\": %.1f,\n"
+      "  \"ring_ns\": %.1f,\n  \"ring_%d_threads_ns\": %.1f,\n  \"ring_dropped\": %" G_GUINT64_FORMAT ",\n"
+      "  \"ring_overflow_%d_threads_ns\": %.1f\n}\n", LOG_BENCH_CALLS, lineBuffered, fullyBuffered, single,
+      LOG_BENCH_THREADS, multi, dropped, LOG_BENCH_THREADS, full);
+  fflush (stdout);
+  return 0;
+}
@@ -0,0 +1,225 @@
+#include <string.h>
+
+#include <gst/gst.h>
+#include <gst/video/video.h>
+
+#include "memory_budget.h"
+#include "util.h"
+#include "log.h"
+
+struct _MemoryBudget {
+  gsize bytes;
+  guint64 demuxerQueueBytes;      /* decodebin's max-size-bytes */
+  guint64 downloadBytes;          /* queue2 and downloadbuffer max-size-bytes */
+  guint64 poolBytes;              /* Per video decoder */
+  gint decoderThreads;
+
+  GMutex lock;                    /* Protects the counts below; queries come from streaming threads */
+  guint queues;                   /* Queues given a byte limit */
+  guint decoders;                 /* Video decoders given a thread count or a pool limit */
+  guint pools;                    /* Allocation answers capped */
+  guint poolBuffers;              /* Frames the last capped pool may hold */
+  gsize frameBytes;               /* ...of this size */
+  guint overBudget;               /* Frames allowed above the share to keep decoders from starving */
+};
+
+typedef struct _LevelLimit {
+  const char *level;
+  guint64 limit;
+} LevelLimit;
+
+/* H.264 table A-1 MaxDpbMbs */
+static const LevelLimit h264Levels[] = {
+  { "1", 396 }, { "1b", 396 }, { "1.1", 900 }, { "1.2", 2376 }, { "1.3", 2376 }, { "2", 2376 },
+  { "2.1", 4752 }, { "2.2", 8100 }, { "3", 8100 }, { "3.1", 18000 }, { "3.2", 20480 }, { "4", 32768 },
+  { "4.1", 32768 }, { "4.2", 34816 }, { "5", 110400 }, { "5.1", 184320 }, { "5.2", 184320 },
+  { "6", 696320 }, { "6.1", 696320 }, { "6.2", 696320 }, { NULL, 0 }
+};
+
+/* H.265 table A.8 MaxLumaPs */
+static const LevelLimit h265Levels[] = {
+  { "1", 36864 }, { "2", 122880 }, { "2.1", 245760 }, { "3", 552960 }, { "3.1", 983040 },
+  { "4", 2228224 }, { "4.1", 2228224 }, { "5", 8912896 }, { "5.1", 8912896 }, { "5.2", 8912896 },
+  { "6", 35651584 }, { "6.1", 35651584 }, { "6.2", 35651584 }, { NULL, 0 }
+};
+
+static guint64 level_limit (const LevelLimit *levels, const gchar *level) {
+  for (; level && levels->level; levels++) {
+    if (!strcmp (levels->level, level))
+      return levels->limit;
+  }
+  return 0;
+}
+
+/* Reference frames the decoder may hold for pictures of this size, from the level in
+   its input caps (H.264 A.3.1, H.265 A.4.2); MEMORY_BUDGET_MAX_DPB for other codecs
+   or without a known level */
+static guint max_dpb_frames (GstElement *decoder, const GstVideoInfo *videoInfo) {
+  GstPad *pad = gst_element_get_static_pad (decoder, "sink");
+  GstCaps *caps = pad ? gst_pad_get_current_caps (pad) : NULL;
+  GstStructure *s;
+  guint64 limit, picture;
+  guint frames = MEMORY_BUDGET_MAX_DPB;
+
+  if (pad)
+    gst_object_unref (pad);
+  if (NULL == caps)
+    return frames;
+  s = gst_caps_get_structure (caps, 0);
+  if (gst_structure_has_name (s, "video/x-h264") &&
+      (limit = level_limit (h264Levels, gst_structure_get_string (s, "level")))) {
+    picture = (guint64)((GST_VIDEO_INFO_WIDTH (videoInfo) + 15) / 16) * ((GST_VIDEO_INFO_HEIGHT (videoInfo) + 15) / 16);
+    frames = (guint)CLAMP (limit / MAX (picture, 1), 1, MEMORY_BUDGET_MAX_DPB);
+  } else if (gst_structure_has_name (s, "video/x-h265") &&
+      (limit = level_limit (h265Levels, gst_structure_get_string (s, "level")))) {
+    picture = (guint64)GST_VIDEO_INFO_WIDTH (videoInfo) * GST_VIDEO_INFO_HEIGHT (videoInfo);
+    if (picture <= limit / 4)
+      frames = 16;
+    else if (picture <= limit / 2)
+      frames = 12;
+    else if (picture <= limit * 3 / 4)
+      frames = 8;
+    else
+      frames = 6;
+  }
+  gst_caps_unref (caps);
+  return frames;
+}
+
+/* Downstream has answered the decoder's ALLOCATION query and the decoder hasn't
+   configured its pool yet: cap the pools on offer, or offer a capped one when there
+   are none so the decoder's own pool is bounded too. The decoder adds its DPB and a
+   frame per thread on top of min only afterwards, so the cap never goes below what
+   the stream's level lets it hold, or a decoder waiting for a free frame would wait
+   forever */
+static GstPadProbeReturn allocation_probe_cb (GstPad *pad, GstPadProbeInfo *info, MemoryBudget *budget) {
+  GstQuery *query = GST_PAD_PROBE_INFO_QUERY (info);
+  GstBufferPool *pool;
+  GstVideoInfo videoInfo;
+  GstCaps *caps;
+  guint size, min, max, cap, safe, dpb, i, over = 0;
+
+  if (GST_QUERY_ALLOCATION != GST_QUERY_TYPE (query) || !(GST_PAD_PROBE_INFO_TYPE (info) & GST_PAD_PROBE_TYPE_PULL))
+    return GST_PAD_PROBE_OK;
+  gst_query_parse_allocation (query, &caps, NULL);
+  if (NULL == caps || !gst_video_info_from_caps (&videoInfo, caps) || 0 == GST_VIDEO_INFO_SIZE (&videoInfo))
+    return GST_PAD_PROBE_OK;
+  cap = (guint)MAX (1, budget->poolBytes / GST_VIDEO_INFO_SIZE (&videoInfo));
+  dpb = max_dpb_frames (GST_ELEMENT (GST_OBJECT_PARENT (pad)), &videoInfo);
+
+  if (0 == gst_query_get_n_allocation_pools (query)) {
+    gst_query_add_allocation_pool (query, NULL, (guint)GST_VIDEO_INFO_SIZE (&videoInfo), 0, cap);
+  }
+  for (i = 0; i < gst_query_get_n_allocation_pools (query); i++) {
+    gst_query_parse_nth_allocation_pool (query, i, &pool, &size, &min, &max);
+    safe = min + dpb + (guint)budget->decoderThreads + MEMORY_BUDGET_SPARE_FRAMES;
+    if (0 == max || max > MAX (cap, safe)) {
+      if (safe > cap)
+        over = MAX (over, safe - cap);
+      max = MAX (cap, safe);
+      gst_query_set_nth_allocation_pool (query, i, pool, size, min, max);
+    }
+    if (pool)
+      gst_object_unref (pool);
+  }
+
+  g_mutex_lock (&budget->lock);
+  budget->pools++;
+  budget->poolBuffers = cap + over;
+  budget->frameBytes = GST_VIDEO_INFO_SIZE (&videoInfo);
+  budget->overBudget += over;
+  g_mutex_unlock (&budget->lock);
+  if (over) {
+    LOGW ("Memory budget too small: %s needs %u frames of %" G_GSIZE_FORMAT " KB (%u reference frames), "
+        "the budget has room for %u", GST_OBJECT_NAME (GST_OBJECT_PARENT (pad)), cap + over,
+        GST_VIDEO_INFO_SIZE (&videoInfo) / 1024, dpb, cap);
+  } else {
+    LOGD ("Memory budget: %s pool capped at %u frames of %" G_GSIZE_FORMAT " KB", GST_OBJECT_NAME (GST_OBJECT_PARENT (pad)),
+        cap, GST_VIDEO_INFO_SIZE (&videoInfo) / 1024);
+  }
+  return GST_PAD_PROBE_OK;
+}
+
+static gboolean is_video_decoder (GstElement *element) {
+  GstElementFactory *factory = gst_element_get_factory (element);
+  const gchar *klass;
+
+  if (NULL == factory)
+    return FALSE;
+  klass = gst_element_factory_get_metadata (factory, GST_ELEMENT_METADATA_KLASS);
+  return NULL != klass && NULL != strstr (klass, "Decoder") && NULL != strstr (klass, "Video");
+}
+
+MemoryBudget *memory_budget_new (gsize bytes) {
+  MemoryBudget *budget = g_new0 (MemoryBudget, 1);
+  guint64 queueBytes = (guint64)bytes * MEMORY_BUDGET_QUEUE_SHARE / 100;
+
+  budget->bytes = bytes;
+  budget->downloadBytes = queueBytes * MEMORY_BUDGET_DOWNLOAD_SHARE / 100;
+  budget->demuxerQueueBytes = queueBytes - budget->downloadBytes;
+  budget->poolBytes = (guint64)bytes * MEMORY_BUDGET_POOL_SHARE / 100;
+  budget->decoderThreads = (gint)CLAMP ((guint64)bytes * MEMORY_BUDGET_THREAD_SHARE / 100 / MEMORY_BUDGET_THREAD_BYTES,
+      1, (guint64)g_get_num_processors ());
+  g_mutex_init (&budget->lock);
+  LOGD ("Memory budget of %" G_GSIZE_FORMAT " KB: %" G_GUINT64_FORMAT " KB demuxer queues, %" G_GUINT64_FORMAT
+      " KB download, %" G_GUINT64_FORMAT " KB frames, %d decoder threads", bytes / 1024, budget->demuxerQueueBytes / 1024,
+      budget->downloadBytes / 1024, budget->poolBytes / 1024, budget->decoderThreads);
+  return budget;
+}
+
+void memory_budget_free (MemoryBudget *budget) {
+  if (NULL == budget)
+    return;
+  g_mutex_clear (&budget->lock);
+  g_free (budget);
+}
+
+void memory_budget_apply (MemoryBudget *budget, GstElement *element) {
+  GstElementFactory *factory;
+  const gchar *name;
+  GstPad *pad;
+  gboolean capped = FALSE;
+
+  if (NULL == budget || NULL == (factory = gst_element_get_factory (element)))
+    return;
+  name = GST_OBJECT_NAME (factory);
+
+  /* decodebin sizes its multiqueue from these whenever the group changes */
+  if (!strcmp (name, "decodebin")) {
+    capped = util_cap_property (element, "max-size-bytes", budget->demuxerQueueBytes, FALSE);
+  } else if (!strcmp (name, "queue2") || !strcmp (name, "downloadbuffer")) {
+    capped = util_cap_property (element, "max-size-bytes", budget->downloadBytes, FALSE);
+    /* Only when buffering is on; 0 there means no ring buffer rather than no limit */
+    capped |= util_cap_property (element, "ring-buffer-max-size", budget->downloadBytes, TRUE);
+  }
+  if (capped) {
+    g_mutex_lock (&budget->lock);
+    budget->queues++;
+    g_mutex_unlock (&budget->lock);
+    return;
+  }
+  if (!is_video_decoder (element))
+    return;
+
+  /* Every libav frame thread holds reference frames of its own; 0 is one per core */
+  util_cap_property (element, "max-threads", (guint64)budget->decoderThreads, FALSE);
+  if (NULL != (pad = gst_element_get_static_pad (element, "src"))) {
+    gst_pad_add_probe (pad, GST_PAD_PROBE_TYPE_QUERY_DOWNSTREAM | GST_PAD_PROBE_TYPE_PULL,
+        (GstPadProbeCallback)allocation_probe_cb, budget, NULL);
+    gst_object_unref (pad);
+  }
+  g_mutex_lock (&budget->lock);
+  budget->decoders++;
+  g_mutex_unlock (&budget->lock);
+}
+
+void memory_budget_append_json (GString *out, gdouble wall, MemoryBudget *budget) {
+  g_mutex_lock (&budget->lock);
+  g_string_append_printf (out, "{\n    \"budget_kb\": %" G_GSIZE_FORMAT ", \"demuxer_queue_kb\": %" G_GUINT64_FORMAT
+      ", \"download_kb\": %" G_GUINT64_FORMAT ", \"frame_pool_kb\": %" G_GUINT64_FORMAT ", \"decoder_threads\": %d,\n"
+      "    \"queues\": %u, \"decoders\": %u, \"pools\": %u, \"pool_frames\": %u, \"frame_kb\": %" G_GSIZE_FORMAT
+      ", \"over_budget\": %u\n  }", budget->bytes / 1024, budget->demuxerQueueBytes / 1024, budget->downloadBytes / 1024,
+      budget->poolBytes / 1024, budget->decoderThreads, budget->queues, budget->decoders, budget->pools,
+      budget->poolBuffers, budget->frameBytes / 1024, budget->overBudget);
+  g_mutex_unlock (&budget->lock);
+}
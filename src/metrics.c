@@ -0,0 +1,400 @@
+#include <errno.h>
+#include <poll.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+#include <gst/gst.h>
+
+#include "metrics.h"
+#include "util.h"
+#include "log.h"
+
+/* Seek latency histogram bucket bounds, in ms; one more bucket for +Inf */
+static const gint seekBuckets[] = { 10, 25, 50, 100, 250, 500, 1000, 2500 };
+
+struct _Metrics {
+  GstElement *pipeline;
+  GstBus *bus;
+  gulong syncHandlerId;
+  gchar *path;
+  int listenFd;
+  GThread *server;
+  gint stop;                      /* Tells the server thread to quit (atomic) */
+
+  /* Written from any thread, read by the server: atomics only */
+  gint64 jitter;                  /* Latest QoS jitter, in ns */
+  guint64 qosEvents;
+  gint bufferingPercent;
+  guint bitrate;                  /* Latest bitrate tag, in bits/s */
+  guint64 errors;
+  guint64 warnings;
+  guint64 seekCounts[G_N_ELEMENTS (seekBuckets) + 1];   /* Per bucket, not cumulative */
+  guint64 seekSum;                /* In microseconds */
+
+  GMutex lock;                    /* Protects the watched elements, only taken on add and scrape */
+  GstElement *videoSink;
+  GPtrArray *queues;
+};
+
+/* Called from the thread posting the message, usually a streaming thread */
+static void sync_message_cb (GstBus *bus, GstMessage *msg, Metrics *metrics) {
+  GstTagList *tags;
+  gint64 jitter;
+  gint percent;
+  guint bitrate;
+
+  switch (GST_MESSAGE_TYPE (msg)) {
+    case GST_MESSAGE_QOS:
+      gst_message_parse_qos_values (msg, &jitter, NULL, NULL);
+      __atomic_store_n (&metrics->jitter, jitter, __ATOMIC_RELAXED);
+      __atomic_fetch_add (&metrics->qosEvents, 1, __ATOMIC_RELAXED);
+      break;
+    case GST_MESSAGE_BUFFERING:
+      gst_message_parse_buffering (msg, &percent);
+      g_atomic_int_set (&metrics->bufferingPercent, percent);
+      break;
+    case GST_MESSAGE_TAG:
+      gst_message_parse_tag (msg, &tags);
+      if (gst_tag_list_get_uint (tags, GST_TAG_BITRATE, &bitrate) ||
+          gst_tag_list_get_uint (tags, GST_TAG_NOMINAL_BITRATE, &bitrate)) {
+        g_atomic_int_set ((gint *)&metrics->bitrate, (gint)bitrate);
+      }
+      gst_tag_list_unref (tags);
+      break;
+    case GST_MESSAGE_ERROR:
+      __atomic_fetch_add (&metrics->errors, 1, __ATOMIC_RELAXED);
+      break;
+    case GST_MESSAGE_WARNING:
+      __atomic_fetch_add (&metrics->warnings, 1, __ATOMIC_RELAXED);
+      break;
+    default:
+      break;
+  }
+}
+
+void metrics_observe_seek (Metrics *metrics, gint64 latency) {
+  guint i;
+
+  if (NULL == metrics || latency < 0)
+    return;
+  for (i = 0; i < G_N_ELEMENTS (seekBuckets) && latency > seekBuckets[i] * 1000; i++)
+    ;
+  __atomic_fetch_add (&metrics->seekCounts[i], 1, __ATOMIC_RELAXED);
+  __atomic_fetch_add (&metrics->seekSum, (guint64)latency, __ATOMIC_RELAXED);
+}
+
+void metrics_watch_video_sink (Metrics *metrics, GstElement *sink) {
+  if (NULL == metrics)
+    return;
+  g_mutex_lock (&metrics->lock);
+  if (NULL == metrics->videoSink)
+    metrics->videoSink = gst_object_ref (sink);
+  g_mutex_unlock (&metrics->lock);
+}
+
+void metrics_set_pipeline (Metrics *metrics, GstElement *pipeline, GstElement *sink) {
+  if (NULL == metrics)
+    return;
+  g_mutex_lock (&metrics->lock);
+  gst_object_replace ((GstObject **)&metrics->pipeline, GST_OBJECT (pipeline));
+  gst_object_replace ((GstObject **)&metrics->videoSink, sink ? GST_OBJECT (sink) : NULL);
+  g_mutex_unlock (&metrics->lock);
+}
+
+void metrics_watch_element (Metrics *metrics, GstElement *element) {
+  GstElementFactory *factory = gst_element_get_factory (element);
+  const gchar *name;
+
+  if (NULL == metrics || NULL == factory)
+    return;
+  name = GST_OBJECT_NAME (factory);
+  if (strcmp (name, "queue") && strcmp (name, "queue2") && strcmp (name, "multiqueue"))
+    return;
+  g_mutex_lock (&metrics->lock);
+  g_ptr_array_add (metrics->queues, gst_object_ref (element));
+  g_mutex_unlock (&metrics->lock);
+}
+
+static void append_metric (GString *out, const char *name, const char *type, const char *help) {
+  g_string_append_printf (out, "# HELP " METRICS_PREFIX "%s %s\n# TYPE " METRICS_PREFIX "%s %s\n", name, help,
+      name, type);
+}
+
+typedef struct _QueueLevel {
+  guint bytes;
+  guint buffers;
+  guint64 time;
+} QueueLevel;
+
+/* multiqueue has its levels on the pads (GStreamer 1.18 and newer) */
+static gboolean add_pad_level (GstElement *queue, GstPad *pad, QueueLevel *total) {
+  QueueLevel level;
+
+  if (g_object_class_find_property (G_OBJECT_GET_CLASS (pad), "current-level-bytes")) {
+    g_object_get (pad, "current-level-bytes", &level.bytes, "current-level-buffers", &level.buffers,
+        "current-level-time", &level.time, NULL);
+    total->bytes += level.bytes;
+    total->buffers += level.buffers;
+    total->time = MAX (total->time, level.time);
+  }
+  return TRUE;
+}
+
+/* One sample per queue; multiqueue levels are summed over its pads */
+static void append_queue_levels (GString *out, GstElement *queue) {
+  QueueLevel level = { 0, 0, 0 };
+
+  if (g_object_class_find_property (G_OBJECT_GET_CLASS (queue), "current-level-bytes")) {
+    g_object_get (queue, "current-level-bytes", &level.bytes, "current-level-buffers", &level.buffers,
+        "current-level-time", &level.time, NULL);
+  } else {
+    gst_element_foreach_src_pad (queue, (GstElementForeachPadFunc)add_pad_level, &level);
+  }
+  g_string_append_printf (out, METRICS_PREFIX "queue_level_bytes{queue=\"%s\"} %u\n", GST_OBJECT_NAME (queue),
+      level.bytes);
+  g_string_append_printf (out, METRICS_PREFIX "queue_level_buffers{queue=\"%s\"} %u\n", GST_OBJECT_NAME (queue),
+      level.buffers);
+  g_string_append_printf (out, METRICS_PREFIX "queue_level_seconds{queue=\"%s\"} %.3f\n", GST_OBJECT_NAME (queue),
+      (gdouble)level.time / GST_SECOND);
+}
+
+static GString *scrape (Metrics *metrics) {
+  GString *out = g_string_new (NULL);
+  GstStructure *stats = NULL;
+  guint64 rendered = 0, dropped = 0, cumulative = 0, count;
+  gint64 position = -1, duration = -1;
+  struct rusage usage;
+  GstElement *pipeline;
+  guint i;
+
+  g_mutex_lock (&metrics->lock);
+  pipeline = gst_object_ref (metrics->pipeline);
+  /* basesink keeps these under its own lock */
+  if (metrics->videoSink && g_object_class_find_property (G_OBJECT_GET_CLASS (metrics->videoSink), "stats")) {
+    g_object_get (metrics->videoSink, "stats", &stats, NULL);
+  }
+  if (stats) {
+    gst_structure_get_uint64 (stats, "rendered", &rendered);
+    gst_structure_get_uint64 (stats, "dropped", &dropped);
+    gst_structure_free (stats);
+  }
+  append_metric (out, "frames_rendered_total", "counter", "Frames rendered by the video sink.");
+  g_string_append_printf (out, METRICS_PREFIX "frames_rendered_total %" G_GUINT64_FORMAT "\n", rendered);
+  append_metric (out, "frames_dropped_total", "counter", "Frames the video sink dropped as late.");
+  g_string_append_printf (out, METRICS_PREFIX "frames_dropped_total %" G_GUINT64_FORMAT "\n", dropped);
+
+  append_metric (out, "queue_level_bytes", "gauge", "Bytes queued, per queue element.");
+  append_metric (out, "queue_level_buffers", "gauge", "Buffers queued, per queue element.");
+  append_metric (out, "queue_level_seconds", "gauge", "Media time queued, per queue element.");
+  for (i = 0; i < metrics->queues->len; ) {
+    GstElement *queue = g_ptr_array_index (metrics->queues, i);
+
+    /* Gone with the decodebin of a previous playlist item */
+    if (NULL == GST_OBJECT_PARENT (queue)) {
+      g_ptr_array_remove_index_fast (metrics->queues, i);
+      continue;
+    }
+    append_queue_levels (out, queue);
+    i++;
+  }
+  g_mutex_unlock (&metrics->lock);
+
+  append_metric (out, "qos_jitter_seconds", "gauge", "Lateness of the latest QoS event, negative when early.");
+  g_string_append_printf (out, METRICS_PREFIX "qos_jitter_seconds %.6f\n",
+      __atomic_load_n (&metrics->jitter, __ATOMIC_RELAXED) / (gdouble)GST_SECOND);
+  append_metric (out, "qos_events_total", "counter", "QoS messages posted by the pipeline.");
+  g_string_append_printf (out, METRICS_PREFIX "qos_events_total %" G_GUINT64_FORMAT "\n",
+      __atomic_load_n (&metrics->qosEvents, __ATOMIC_RELAXED));
+  append_metric (out, "buffering_percent", "gauge", "Fill of the buffering queue.");
+  g_string_append_printf (out, METRICS_PREFIX "buffering_percent %d\n", g_atomic_int_get (&metrics->bufferingPercent));
+  append_metric (out, "bitrate_bits", "gauge", "Stream bitrate from the tags, in bits per second.");
+  g_string_append_printf (out, METRICS_PREFIX "bitrate_bits %u\n", (guint)g_atomic_int_get ((gint *)&metrics->bitrate));
+  append_metric (out, "errors_total", "counter", "Error messages posted by the pipeline.");
+  g_string_append_printf (out, METRICS_PREFIX "errors_total %" G_GUINT64_FORMAT "\n",
+      __atomic_load_n (&metrics->errors, __ATOMIC_RELAXED));
+  append_metric (out, "warnings_total", "counter", "Warning messages posted by the pipeline.");
+  g_string_append_printf (out, METRICS_PREFIX "warnings_total %" G_GUINT64_FORMAT "\n",
+      __atomic_load_n (&metrics->warnings, __ATOMIC_RELAXED));
+
+  append_metric (out, "seek_latency_seconds", "histogram", "Time from a flushing seek to the pipeline prerolling.");
+  for (i = 0; i <= G_N_ELEMENTS (seekBuckets); i++) {
+    cumulative += __atomic_load_n (&metrics->seekCounts[i], __ATOMIC_RELAXED);
+    if (i < G_N_ELEMENTS (seekBuckets)) {
+      g_string_append_printf (out, METRICS_PREFIX "seek_latency_seconds_bucket{le=\"%.3f\"} %" G_GUINT64_FORMAT "\n",
+          seekBuckets[i] / 1000.0, cumulative);
+    } else {
+      g_string_append_printf (out, METRICS_PREFIX "seek_latency_seconds_bucket{le=\"+Inf\"} %" G_GUINT64_FORMAT "\n",
+          cumulative);
+    }
+  }
+  count = cumulative;
+  g_string_append_printf (out, METRICS_PREFIX "seek_latency_seconds_sum %.6f\n",
+      __atomic_load_n (&metrics->seekSum, __ATOMIC_RELAXED) / (gdouble)G_USEC_PER_SEC);
+  g_string_append_printf (out, METRICS_PREFIX "seek_latency_seconds_count %" G_GUINT64_FORMAT "\n", count);
+
+  /* Queries and the state are thread safe; no main loop involved */
+  append_metric (out, "state", "gauge", "Pipeline state: 1 NULL, 2 READY, 3 PAUSED, 4 PLAYING.");
+  g_string_append_printf (out, METRICS_PREFIX "state %d\n", GST_STATE (pipeline));
+  gst_element_query_position (pipeline, GST_FORMAT_TIME, &position);
+  gst_element_query_duration (pipeline, GST_FORMAT_TIME, &duration);
+  gst_object_unref (pipeline);
+  append_metric (out, "position_seconds", "gauge", "Playback position.");
+  g_string_append_printf (out, METRICS_PREFIX "position_seconds %.3f\n",
+      position >= 0 ? (gdouble)position / GST_SECOND : 0.0);
+  append_metric (out, "duration_seconds", "gauge", "Duration of the current item, 0 when unknown.");
+  g_string_append_printf (out, METRICS_PREFIX "duration_seconds %.3f\n",
+      duration >= 0 ? (gdouble)duration / GST_SECOND : 0.0);
+
+  getrusage (RUSAGE_SELF, &usage);
+  append_metric (out, "cpu_seconds_total", "counter", "User and system CPU time of the process.");
+  g_string_append_printf (out, METRICS_PREFIX "cpu_seconds_total %.3f\n", usage.ru_utime.tv_sec +
+      usage.ru_utime.tv_usec / 1e6 + usage.ru_stime.tv_sec + usage.ru_stime.tv_usec / 1e6);
+  append_metric (out, "resident_memory_bytes", "gauge", "Resident set size of the process.");
+  g_string_append_printf (out, METRICS_PREFIX "resident_memory_bytes %ld\n", util_current_rss_kb () * 1024);
+  append_metric (out, "peak_resident_memory_bytes", "gauge", "Largest resident set size so far.");
+  g_string_append_printf (out, METRICS_PREFIX "peak_resident_memory_bytes %ld\n", usage.ru_maxrss * 1024);
+  return out;
+}
+
+static void write_all (int fd, const char *data, gsize length) {
+  gssize written;
+
+  while (length > 0) {
+    written = send (fd, data, length, MSG_NOSIGNAL);
+    if (written < 0 && EINTR == errno)
+      continue;
+    if (written <= 0)
+      return;
+    data += written;
+    length -= written;
+  }
+}
+
+/* HTTP clients (curl --unix-socket, a Prometheus proxy) send a GET first; a bare
+ * connection that sends nothing just gets the text */
+static void serve (Metrics *metrics, int fd) {
+  struct pollfd pfd = { fd, POLLIN, 0 };
+  gchar request[1024];
+  gssize length = 0;
+  gchar *header;
+  GString *body;
+
+  if (poll (&pfd, 1, METRICS_READ_TIMEOUT_MS) > 0) {
+    length = recv (fd, request, sizeof (request) - 1, 0);
+  }
+  body = scrape (metrics);
+  if (length >= 4 && !strncmp (request, "GET ", 4)) {
+    header = g_strdup_printf ("HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\n"
+        "Content-Length: %" G_GSIZE_FORMAT "\r\nConnection: close\r\n\r\n", body->len);
+    write_all (fd, header, strlen (header));
+    g_free (header);
+  }
+  write_all (fd, body->str, body->len);
+  g_string_free (body, TRUE);
+}
+
+static gpointer server_thread (Metrics *metrics) {
+  struct pollfd pfd = { metrics->listenFd, POLLIN, 0 };
+  int fd;
+
+  while (!g_atomic_int_get (&metrics->stop)) {
+    if (poll (&pfd, 1, METRICS_POLL_MS) <= 0)
+      continue;
+    fd = accept (metrics->listenFd, NULL, NULL);
+    if (fd < 0)
+      continue;
+    serve (metrics, fd);
+    close (fd);
+  }
+  return NULL;
+}
+
+static int listen_unix (const char *path) {
+  struct sockaddr_un addr;
+  struct stat st;
+  int fd, err;
+
+  if (strlen (path) >= sizeof (addr.sun_path)) {
+    LOGE ("Metrics socket path %s is too long", path);
+    return -1;
+  }
+  memset (&addr, 0, sizeof (addr));
+  addr.sun_family = AF_UNIX;
+  strcpy (addr.sun_path, path);
+
+  /* A socket left behind by a player that didn't exit cleanly refuses connections and
+     is replaced. One still listened on, or anything else at the path, is not ours */
+  if (0 == lstat (path, &st)) {
+    if (!S_ISSOCK (st.st_mode)) {
+      LOGE ("Metrics socket path %s exists and is not a socket", path);
+      return -1;
+    }
+    fd = socket (AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    err = (fd < 0 || 0 == connect (fd, (struct sockaddr *)&addr, sizeof (addr))) ? 0 : errno;
+    if (fd >= 0)
+      close (fd);
+    if (ECONNREFUSED != err) {
+      LOGE ("Could not listen on %s: %s", path, g_strerror (EADDRINUSE));
+      return -1;
+    }
+    unlink (path);
+  }
+
+  fd = socket (AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (fd < 0) {
+    LOGE ("Could not create the metrics socket: %s", g_strerror (errno));
+    return -1;
+  }
+  if (bind (fd, (struct sockaddr *)&addr, sizeof (addr)) < 0 || listen (fd, METRICS_BACKLOG) < 0) {
+    LOGE ("Could not listen on %s: %s", path, g_strerror (errno));
+    close (fd);
+    return -1;
+  }
+  return fd;
+}
+
+Metrics *metrics_new (GstElement *pipeline, GstBus *bus, const char *path) {
+  Metrics *metrics;
+  int fd = listen_unix (path);
+
+  if (fd < 0)
+    return NULL;
+
+  metrics = g_new0 (Metrics, 1);
+  metrics->pipeline = gst_object_ref (pipeline);
+  metrics->bus = gst_object_ref (bus);
+  metrics->path = g_strdup (path);
+  metrics->listenFd = fd;
+  g_mutex_init (&metrics->lock);
+  metrics->queues = g_ptr_array_new_with_free_func (gst_object_unref);
+
+  gst_bus_enable_sync_message_emission (bus);
+  metrics->syncHandlerId = g_signal_connect (bus, "sync-message", G_CALLBACK (sync_message_cb), metrics);
+  metrics->server = g_thread_new ("metrics", (GThreadFunc)server_thread, metrics);
+  LOGI ("Serving metrics on %s", path);
+  return metrics;
+}
+
+void metrics_free (Metrics *metrics) {
+  if (NULL == metrics)
+    return;
+  g_atomic_int_set (&metrics->stop, 1);
+  g_thread_join (metrics->server);
+  close (metrics->listenFd);
+  unlink (metrics->path);
+
+  g_signal_handler_disconnect (metrics->bus, metrics->syncHandlerId);
+  gst_bus_disable_sync_message_emission (metrics->bus);
+  g_ptr_array_free (metrics->queues, TRUE);
+  if (metrics->videoSink)
+    gst_object_unref (metrics->videoSink);
+  g_mutex_clear (&metrics->lock);
+  g_free (metrics->path);
+  gst_object_unref (metrics->bus);
+  gst_object_unref (metrics->pipeline);
+  g_free (metrics);
+}
@@ -0,0 +1,302 @@
+#include <math.h>
+#include <string.h>
+
+#include <gst/gst.h>
+
+#include "mosaic.h"
+#include "bench.h"
+#include "log.h"
+
+/* Frames queued between a decoder and its scaler. Small, the queue is only there to
+   give scaling a thread of its own */
+#define MOSAIC_QUEUE_BUFFERS 3
+
+typedef struct _MosaicTile {
+  struct _Mosaic *mosaic;
+  guint index;
+  gchar *input;
+  GstElement *head;               /* Queue at the start of the tile chain, decoded video links here */
+  GstPad *mixerPad;               /* Compositor sink pad of this tile */
+
+  gint frames;                    /* Buffers handed to the compositor (atomic) */
+  gint64 firstTime;               /* Monotonic time of the first and last of them */
+  gint64 lastTime;
+} MosaicTile;
+
+struct _Mosaic {
+  GstElement *pipeline;
+  GstElement *mixer;
+  GPtrArray *tiles;               /* MosaicTile */
+  guint columns;
+  guint rows;
+  gint tileWidth;
+  gint tileHeight;
+  gint decoderThreads;            /* max-threads given to each libav decoder */
+};
+
+static void tile_free (MosaicTile *tile) {
+  if (tile->mixerPad) {
+    gst_element_release_request_pad (tile->mosaic->mixer, tile->mixerPad);
+    gst_object_unref (tile->mixerPad);
+  }
+  g_free (tile->input);
+  g_free (tile);
+}
+
+static GstPadProbeReturn tile_probe_cb (GstPad *pad, GstPadProbeInfo *info, MosaicTile *tile) {
+  gint64 now = g_get_monotonic_time ();
+
+  /* Only this tile's streaming thread writes, the report reads */
+  if (0 == g_atomic_int_get (&tile->frames))
+    __atomic_store_n (&tile->firstTime, now, __ATOMIC_RELAXED);
+  __atomic_store_n (&tile->lastTime, now, __ATOMIC_RELAXED);
+  g_atomic_int_inc (&tile->frames);
+  return GST_PAD_PROBE_OK;
+}
+
+/* Sustained rate between the first and the last frame of a tile */
+static gdouble tile_fps (MosaicTile *tile) {
+  gint frames = g_atomic_int_get (&tile->frames);
+  gint64 span = __atomic_load_n (&tile->lastTime, __ATOMIC_RELAXED) - __atomic_load_n (&tile->firstTime, __ATOMIC_RELAXED);
+
+  if (frames < 2 || span <= 0)
+    return 0.0;
+  return (frames - 1) * (gdouble)G_USEC_PER_SEC / span;
+}
+
+/* Builds queue ! videoscale ! videoconvert ! capsfilter into the tile's compositor pad.
+   Scaling runs first so the conversion only touches tile sized frames */
+static gboolean add_tile_chain (Mosaic *mosaic, MosaicTile *tile) {
+  GstElement *queue = gst_element_factory_make ("queue", NULL);
+  GstElement *scale = gst_element_factory_make ("videoscale", NULL);
+  GstElement *convert = gst_element_factory_make ("videoconvert", NULL);
+  GstElement *filter = gst_element_factory_make ("capsfilter", NULL);
+  GstCaps *caps;
+  GstPad *srcPad;
+  gboolean linked;
+
+  if (!queue || !scale || !convert || !filter) {
+    LOGD ("Not all tile elements could be created");
+    /* Never added, so still floating */
+    if (queue)
+      gst_object_unref (queue);
+    if (scale)
+      gst_object_unref (scale);
+    if (convert)
+      gst_object_unref (convert);
+    if (filter)
+      gst_object_unref (filter);
+    return FALSE;
+  }
+
+  g_object_set (queue, "max-size-buffers", MOSAIC_QUEUE_BUFFERS, "max-size-bytes", 0, "max-size-time", (guint64)0, NULL);
+  /* Letterbox instead of stretching inputs with another aspect ratio */
+  g_object_set (scale, "add-borders", TRUE, NULL);
+  caps = gst_caps_new_simple ("video/x-raw", "width", G_TYPE_INT, mosaic->tileWidth,
+      "height", G_TYPE_INT, mosaic->tileHeight, "pixel-aspect-ratio", GST_TYPE_FRACTION, 1, 1, NULL);
+  g_object_set (filter, "caps", caps, NULL);
+  gst_caps_unref (caps);
+
+  gst_bin_add_many (GST_BIN (mosaic->pipeline), queue, scale, convert, filter, NULL);
+  if (!gst_element_link_many (queue, scale, convert, filter, NULL)) {
+    LOGD ("Could not link tile %u", tile->index);
+    goto Fail;
+  }
+
+#if GST_CHECK_VERSION (1, 20, 0)
+  tile->mixerPad = gst_element_request_pad_simple (mosaic->mixer, "sink_%u");
+#else
+  tile->mixerPad = gst_element_get_request_pad (mosaic->mixer, "sink_%u");
+#endif
+  if (NULL == tile->mixerPad) {
+    LOGD ("No mixer pad for tile %u", tile->index);
+    goto Fail;
+  }
+  g_object_set (tile->mixerPad, "xpos", (gint)(tile->index % mosaic->columns) * mosaic->tileWidth,
+      "ypos", (gint)(tile->index / mosaic->columns) * mosaic->tileHeight, NULL);
+  srcPad = gst_element_get_static_pad (filter, "src");
+  linked = GST_PAD_LINK_OK == gst_pad_link (srcPad, tile->mixerPad);
+  gst_object_unref (srcPad);
+  if (!linked) {
+    LOGD ("Could not link tile %u to the mixer", tile->index);
+    goto Fail;
+  }
+  gst_pad_add_probe (tile->mixerPad, GST_PAD_PROBE_TYPE_BUFFER, (GstPadProbeCallback)tile_probe_cb, tile, NULL);
+
+  tile->head = queue;
+  return TRUE;
+
+Fail:
+  /* Nothing of a tile that failed stays in the pipeline */
+  if (tile->mixerPad) {
+    gst_element_release_request_pad (mosaic->mixer, tile->mixerPad);
+    gst_object_unref (tile->mixerPad);
+    tile->mixerPad = NULL;
+  }
+  gst_bin_remove_many (GST_BIN (mosaic->pipeline), queue, scale, convert, filter, NULL);
+  return FALSE;
+}
+
+/* Audio is never decoded for a tile */
+static gboolean autoplug_continue_cb (GstElement *bin, GstPad *pad, GstCaps *caps, MosaicTile *tile) {
+  return !g_str_has_prefix (gst_structure_get_name (gst_caps_get_structure (caps, 0)), "audio/");
+}
+
+/* Links the first decoded video pad of uridecodebin to the tile chain */
+static void pad_added_cb (GstElement *decodebin, GstPad *pad, MosaicTile *tile) {
+  GstCaps *caps = gst_pad_get_current_caps (pad);
+  GstPad *sinkPad;
+
+  if (NULL == caps)
+    caps = gst_pad_query_caps (pad, NULL);
+  if (g_str_has_prefix (gst_structure_get_name (gst_caps_get_structure (caps, 0)), "video/x-raw")) {
+    sinkPad = gst_element_get_static_pad (tile->head, "sink");
+    if (!gst_pad_is_linked (sinkPad) && GST_PAD_LINK_OK != gst_pad_link (pad, sinkPad)) {
+      LOGD ("Could not link the video of %s", tile->input);
+    }
+    gst_object_unref (sinkPad);
+  }
+  gst_caps_unref (caps);
+}
+
+static gboolean add_tile_source (Mosaic *mosaic, MosaicTile *tile) {
+  GstElement *source;
+  GError *err = NULL;
+
+  if (g_str_has_prefix (tile->input, MOSAIC_TEST_SOURCE)) {
+    source = gst_parse_bin_from_description (tile->input, TRUE, &err);
+    if (NULL == source) {
+      LOGD ("Bad test source '%s': %s", tile->input, err->message);
+      g_clear_error (&err);
+      return FALSE;
+    }
+    gst_bin_add (GST_BIN (mosaic->pipeline), source);
+    if (!gst_element_link (source, tile->head)) {
+      LOGD ("Could not link test source '%s'", tile->input);
+      gst_bin_remove (GST_BIN (mosaic->pipeline), source);
+      return FALSE;
+    }
+    return TRUE;
+  }
+
+  source = gst_element_factory_make ("uridecodebin", NULL);
+  if (NULL == source)
+    return FALSE;
+  g_object_set (source, "uri", tile->input, NULL);
+  g_signal_connect (source, "autoplug-continue", G_CALLBACK (autoplug_continue_cb), tile);
+  g_signal_connect (source, "pad-added", G_CALLBACK (pad_added_cb), tile);
+  gst_bin_add (GST_BIN (mosaic->pipeline), source);
+  return TRUE;
+}
+
+/* Every tile already decodes in its own streaming thread. libav decoders add frame
+   threads on top, which would oversubscribe the cores N times over, so the cores are
+   shared out between the tiles instead */
+static void deep_element_added_cb (GstBin *bin, GstBin *subBin, GstElement *element, Mosaic *mosaic) {
+  GstElementFactory *factory = gst_element_get_factory (element);
+
+  if (NULL == factory || !g_str_has_prefix (GST_OBJECT_NAME (factory), "avdec_"))
+    return;
+  if (g_object_class_find_property (G_OBJECT_GET_CLASS (element), "max-threads")) {
+    g_object_set (element, "max-threads", mosaic->decoderThreads, NULL);
+  }
+}
+
+Mosaic *mosaic_new (const char * const *inputs, guint count, GstElement *videoSink) {
+  Mosaic *mosaic;
+  GstElement *filter, *convert;
+  GstCaps *caps;
+  MosaicTile *tile;
+  guint i;
+
+  if (0 == count)
+    return NULL;
+
+  mosaic = g_new0 (Mosaic, 1);
+  mosaic->tiles = g_ptr_array_new_with_free_func ((GDestroyNotify)tile_free);
+  mosaic->columns = (guint)ceil (sqrt (count));
+  mosaic->rows = (count + mosaic->columns - 1) / mosaic->columns;
+  /* Even sizes keep chroma subsampled formats aligned */
+  mosaic->tileWidth = (MOSAIC_WIDTH / mosaic->columns) & ~1;
+  mosaic->tileHeight = (MOSAIC_HEIGHT / mosaic->rows) & ~1;
+  mosaic->decoderThreads = MAX (1, g_get_num_processors () / (gint)count);
+
+  mosaic->pipeline = gst_pipeline_new ("mosaic");
+  mosaic->mixer = gst_element_factory_make ("compositor", "mixer");
+  filter = gst_element_factory_make ("capsfilter", NULL);
+  convert = gst_element_factory_make ("videoconvert", NULL);
+  if (!mosaic->mixer || !filter || !convert) {
+    LOGD ("Not all mosaic elements could be created");
+    if (mosaic->mixer)
+      gst_object_unref (mosaic->mixer);
+    if (filter)
+      gst_object_unref (filter);
+    if (convert)
+      gst_object_unref (convert);
+    mosaic->mixer = NULL;
+    mosaic_free (mosaic);
+    return NULL;
+  }
+
+  g_object_set (mosaic->mixer, "background", 1 /* black */, NULL);
+  caps = gst_caps_new_simple ("video/x-raw", "width", G_TYPE_INT, mosaic->columns * mosaic->tileWidth,
+      "height", G_TYPE_INT, mosaic->rows * mosaic->tileHeight, NULL);
+  g_object_set (filter, "caps", caps, NULL);
+  gst_caps_unref (caps);
+
+  gst_bin_add_many (GST_BIN (mosaic->pipeline), mosaic->mixer, filter, convert, gst_object_ref (videoSink), NULL);
+  gst_element_link_many (mosaic->mixer, filter, convert, videoSink, NULL);
+  g_signal_connect (mosaic->pipeline, "deep-element-added", G_CALLBACK (deep_element_added_cb), mosaic);
+
+  for (i = 0; i < count; i++) {
+    tile = g_new0 (MosaicTile, 1);
+    tile->mosaic = mosaic;
+    tile->index = i;
+    tile->input = g_strdup (inputs[i]);
+    g_ptr_array_add (mosaic->tiles, tile);
+    if (!add_tile_chain (mosaic, tile) || !add_tile_source (mosaic, tile)) {
+      LOGD ("Could not add %s to the mosaic", tile->input);
+      mosaic_free (mosaic);
+      return NULL;
+    }
+  }
+
+  LOGD ("Mosaic of %u inputs, %ux%u grid of %dx%d tiles, %d decoder threads each", count,
+      mosaic->columns, mosaic->rows, mosaic->tileWidth, mosaic->tileHeight, mosaic->decoderThreads);
+  return mosaic;
+}
+
+void mosaic_free (Mosaic *mosaic) {
+  MosaicTile *tile;
+  guint i;
+
+  if (NULL == mosaic)
+    return;
+
+  for (i = 0; i < mosaic->tiles->len; i++) {
+    tile = g_ptr_array_index (mosaic->tiles, i);
+    LOGD ("Tile %u (%s): %d frames, %.2f fps", i, tile->input, g_atomic_int_get (&tile->frames), tile_fps (tile));
+  }
+  gst_element_set_state (mosaic->pipeline, GST_STATE_NULL);
+  g_ptr_array_free (mosaic->tiles, TRUE);
+  gst_object_unref (mosaic->pipeline);
+  g_free (mosaic);
+}
+
+GstElement *mosaic_get_pipeline (Mosaic *mosaic) {
+  return mosaic->pipeline;
+}
+
+void mosaic_append_json (GString *out, gdouble wall, Mosaic *mosaic) {
+  MosaicTile *tile;
+  guint i;
+
+  g_string_append (out, "[");
+  for (i = 0; i < mosaic->tiles->len; i++) {
+    tile = g_ptr_array_index (mosaic->tiles, i);
+    g_string_append_printf (out, "%s\n    { \"input\": ", i ? "," : "");
+    bench_json_append_string (out, tile->input);
+    g_string_append_printf (out, ", \"frames\": %d, \"fps\": %.2f }", g_atomic_int_get (&tile->frames), tile_fps (tile));
+  }
+  g_string_append (out, "\n  ]");
+}
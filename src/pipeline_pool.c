@@ -0,0 +1,404 @@
+#include <gst/gst.h>
+#include <gst/video/videooverlay.h>
+
+#include "pipeline_pool.h"
+#include "util.h"
+#include "log.h"
+
+typedef struct _PoolMember {
+  PipelinePool *pool;
+  GstElement *pipeline;
+  GstElement *videoSink;          /* NULL when playbin autoplugs one; then switches aren't timed */
+  gchar *uri;
+  gboolean standby;               /* In the pool, rather than taken out */
+  gint64 lastUsed;                /* Monotonic time it was last prepared, taken or put back */
+  glong rssBefore;                /* kB when it started prerolling, 0 once measured */
+
+  /* Under the pool lock */
+  gboolean hasFrame;              /* The sink holds a frame, prerolled or played */
+  gboolean showsPreroll;          /* ...and shows it as soon as it comes */
+  gint64 switchStart;             /* When it was switched to, 0 once its first frame is shown */
+  gboolean pooled;                /* ...out of standby rather than cold */
+} PoolMember;
+
+struct _PipelinePool {
+  guint size;
+  GstBus *bus;
+  PipelineMakeFunc make;
+  gpointer userData;
+  gulong stateHandlerId;
+  gulong asyncDoneHandlerId;
+  gulong errorHandlerId;
+
+  GMutex lock;                    /* Protects members and the switch timing */
+  GPtrArray *members;             /* PoolMember, standby and taken out */
+
+  GArray *pooledSwitches;         /* gint64 microseconds from switch to first frame */
+  GArray *coldSwitches;
+  guint prepared;
+  guint evictions;
+  glong standbyRssSum;            /* kB each standby member took to preroll */
+  guint standbyRssCount;
+};
+
+/* Lock held */
+static void first_frame_shown (PoolMember *member) {
+  PipelinePool *pool = member->pool;
+  gint64 latency;
+
+  if (0 == member->switchStart)
+    return;
+  latency = g_get_monotonic_time () - member->switchStart;
+  member->switchStart = 0;
+  g_array_append_val (member->pooled ? pool->pooledSwitches : pool->coldSwitches, latency);
+  LOGD ("Switched to %s in %.1f ms (%s)", member->uri, latency / 1000.0, member->pooled ? "pooled" : "cold");
+}
+
+static GstPadProbeReturn sink_probe_cb (GstPad *pad, GstPadProbeInfo *info, PoolMember *member) {
+  PipelinePool *pool = member->pool;
+
+  g_mutex_lock (&pool->lock);
+  if (GST_IS_EVENT (GST_PAD_PROBE_INFO_DATA (info))) {
+    /* FLUSH_STOP: the frame held is gone */
+    member->hasFrame = FALSE;
+  } else {
+    member->hasFrame = TRUE;
+    if (member->showsPreroll || GST_STATE_PLAYING == GST_STATE (member->videoSink))
+      first_frame_shown (member);
+  }
+  g_mutex_unlock (&pool->lock);
+  return GST_PAD_PROBE_OK;
+}
+
+/* A prerolled sink going to PLAYING shows the frame it holds */
+static void sync_state_changed_cb (GstBus *bus, GstMessage *msg, PipelinePool *pool) {
+  GstState oldState, newState;
+  guint i;
+
+  gst_message_parse_state_changed (msg, &oldState, &newState, NULL);
+  if (GST_STATE_PLAYING != newState)
+    return;
+  g_mutex_lock (&pool->lock);
+  for (i = 0; i < pool->members->len; i++) {
+    PoolMember *member = g_ptr_array_index (pool->members, i);
+
+    if (GST_MESSAGE_SRC (msg) == GST_OBJECT (member->videoSink) && member->hasFrame)
+      first_frame_shown (member);
+  }
+  g_mutex_unlock (&pool->lock);
+}
+
+/* Sinks of standby members neither draw their preroll frame nor redraw on expose */
+static void set_showing (PoolMember *member, gboolean show) {
+  if (NULL == member->videoSink)
+    return;
+  if (g_object_class_find_property (G_OBJECT_GET_CLASS (member->videoSink), "show-preroll-frame")) {
+    g_object_set (member->videoSink, "show-preroll-frame", show, NULL);
+  }
+  if (GST_IS_VIDEO_OVERLAY (member->videoSink)) {
+    gst_video_overlay_handle_events (GST_VIDEO_OVERLAY (member->videoSink), show);
+  }
+  g_mutex_lock (&member->pool->lock);
+  member->showsPreroll = show;
+  g_mutex_unlock (&member->pool->lock);
+}
+
+/* Standby limits for decodebin, which sizes its multiqueue from them whenever the group
+   changes, and for a multiqueue already sized */
+static void cap_queue_limits (GstElement *element) {
+  GstElementFactory *factory = gst_element_get_factory (element);
+
+  if (NULL == factory || (g_strcmp0 (GST_OBJECT_NAME (factory), "decodebin") &&
+      g_strcmp0 (GST_OBJECT_NAME (factory), "multiqueue")))
+    return;
+  util_cap_property (element, "max-size-bytes", PIPELINE_POOL_QUEUE_BYTES, FALSE);
+  util_cap_property (element, "max-size-buffers", PIPELINE_POOL_QUEUE_BUFFERS, FALSE);
+  util_cap_property (element, "max-size-time", PIPELINE_POOL_QUEUE_TIME, FALSE);
+}
+
+/* Connected after the pipeline's own element-setup handlers, so the caps win over
+   profiles */
+static void standby_element_setup_cb (GstElement *playbin, GstElement *element, PoolMember *member) {
+  cap_queue_limits (element);
+}
+
+/* A pipeline put back was set up for playing; its queues fill up to that while paused */
+static void cap_pipeline_queues (GstElement *pipeline) {
+  GstIterator *it = gst_bin_iterate_recurse (GST_BIN (pipeline));
+  GValue item = G_VALUE_INIT;
+  gboolean done = FALSE;
+
+  while (!done) {
+    switch (gst_iterator_next (it, &item)) {
+      case GST_ITERATOR_OK:
+        cap_queue_limits (g_value_get_object (&item));
+        g_value_reset (&item);
+        break;
+      case GST_ITERATOR_RESYNC:
+        /* Capping twice is harmless */
+        gst_iterator_resync (it);
+        break;
+      default:
+        done = TRUE;
+        break;
+    }
+  }
+  g_value_unset (&item);
+  gst_iterator_free (it);
+}
+
+/* Takes over a reference to pipeline */
+static PoolMember *add_member (PipelinePool *pool, GstElement *pipeline) {
+  PoolMember *member = g_new0 (PoolMember, 1);
+  GstPad *pad;
+
+  member->pool = pool;
+  member->pipeline = pipeline;
+  /* Going to NULL would flush the bus the active pipeline posts on too */
+  g_object_set (pipeline, "auto-flush-bus", FALSE, NULL);
+  g_object_get (pipeline, "video-sink", &member->videoSink, NULL);
+  if (member->videoSink && NULL != (pad = gst_element_get_static_pad (member->videoSink, "sink"))) {
+    gst_pad_add_probe (pad, GST_PAD_PROBE_TYPE_BUFFER | GST_PAD_PROBE_TYPE_EVENT_FLUSH,
+        (GstPadProbeCallback)sink_probe_cb, member, NULL);
+    gst_object_unref (pad);
+  }
+  g_mutex_lock (&pool->lock);
+  g_ptr_array_add (pool->members, member);
+  g_mutex_unlock (&pool->lock);
+  return member;
+}
+
+static PoolMember *make_member (PipelinePool *pool, const char *uri, gboolean standby) {
+  GstElement *pipeline = pool->make (pool->userData);
+  PoolMember *member;
+
+  if (NULL == pipeline) {
+    LOGE ("Could not build a pipeline for %s", uri);
+    return NULL;
+  }
+  gst_object_ref_sink (pipeline);
+  gst_element_set_bus (pipeline, pool->bus);
+  g_object_set (pipeline, "uri", uri, NULL);
+  member = add_member (pool, pipeline);
+  member->uri = g_strdup (uri);
+  member->standby = standby;
+  member->lastUsed = g_get_monotonic_time ();
+  if (standby) {
+    g_signal_connect (pipeline, "element-setup", (GCallback)standby_element_setup_cb, member);
+  }
+  set_showing (member, !standby);
+  return member;
+}
+
+/* Stops the member's pipeline; its streaming threads, and so the probes, are gone after */
+static void free_member (PoolMember *member) {
+  PipelinePool *pool = member->pool;
+
+  g_mutex_lock (&pool->lock);
+  g_ptr_array_remove (pool->members, member);
+  g_mutex_unlock (&pool->lock);
+  if (member->standby) {
+    gst_element_set_state (member->pipeline, GST_STATE_NULL);
+  }
+  if (member->videoSink)
+    gst_object_unref (member->videoSink);
+  gst_object_unref (member->pipeline);
+  g_free (member->uri);
+  g_free (member);
+}
+
+static PoolMember *find_member (PipelinePool *pool, GstElement *pipeline, const char *uri) {
+  guint i;
+
+  for (i = 0; i < pool->members->len; i++) {
+    PoolMember *member = g_ptr_array_index (pool->members, i);
+
+    if (pipeline ? member->pipeline == pipeline : member->standby && !g_strcmp0 (member->uri, uri))
+      return member;
+  }
+  return NULL;
+}
+
+/* Makes room for one more standby member */
+static void evict (PipelinePool *pool) {
+  PoolMember *oldest = NULL;
+  guint i, standby = 0;
+
+  for (i = 0; i < pool->members->len; i++) {
+    PoolMember *member = g_ptr_array_index (pool->members, i);
+
+    if (!member->standby)
+      continue;
+    standby++;
+    if (NULL == oldest || member->lastUsed < oldest->lastUsed)
+      oldest = member;
+  }
+  if (standby < pool->size || NULL == oldest)
+    return;
+  LOGD ("Pool: dropping %s", oldest->uri);
+  pool->evictions++;
+  free_member (oldest);
+}
+
+/* Memory a standby member took, once it has prerolled */
+static void async_done_cb (GstBus *bus, GstMessage *msg, PipelinePool *pool) {
+  PoolMember *member = find_member (pool, GST_ELEMENT (GST_MESSAGE_SRC (msg)), NULL);
+
+  if (NULL == member || !member->standby || 0 == member->rssBefore)
+    return;
+  pool->standbyRssSum += MAX (util_current_rss_kb () - member->rssBefore, 0);
+  pool->standbyRssCount++;
+  member->rssBefore = 0;
+}
+
+/* A standby member that fails is dropped; it isn't the one being watched */
+static void error_cb (GstBus *bus, GstMessage *msg, PipelinePool *pool) {
+  guint i;
+
+  for (i = 0; i < pool->members->len; i++) {
+    PoolMember *member = g_ptr_array_index (pool->members, i);
+
+    if (member->standby && gst_object_has_as_ancestor (GST_MESSAGE_SRC (msg), GST_OBJECT (member->pipeline))) {
+      LOGW ("Pool: %s failed, dropped", member->uri);
+      free_member (member);
+      return;
+    }
+  }
+}
+
+PipelinePool *pipeline_pool_new (guint size, GstBus *bus, PipelineMakeFunc make, gpointer user_data) {
+  PipelinePool *pool = g_new0 (PipelinePool, 1);
+
+  pool->size = size;
+  pool->bus = gst_object_ref (bus);
+  pool->make = make;
+  pool->userData = user_data;
+  g_mutex_init (&pool->lock);
+  pool->members = g_ptr_array_new ();
+  pool->pooledSwitches = g_array_new (FALSE, FALSE, sizeof (gint64));
+  pool->coldSwitches = g_array_new (FALSE, FALSE, sizeof (gint64));
+
+  gst_bus_enable_sync_message_emission (bus);
+  pool->stateHandlerId = g_signal_connect (bus, "sync-message::state-changed", G_CALLBACK (sync_state_changed_cb), pool);
+  pool->asyncDoneHandlerId = g_signal_connect (bus, "message::async-done", G_CALLBACK (async_done_cb), pool);
+  pool->errorHandlerId = g_signal_connect (bus, "message::error", G_CALLBACK (error_cb), pool);
+  LOGD ("Pipeline pool of %u", size);
+  return pool;
+}
+
+void pipeline_pool_free (PipelinePool *pool) {
+  if (NULL == pool)
+    return;
+  LOGD ("Pipeline pool: %u pooled and %u cold switches, %u prerolled, %u dropped", pool->pooledSwitches->len,
+      pool->coldSwitches->len, pool->prepared, pool->evictions);
+  g_signal_handler_disconnect (pool->bus, pool->stateHandlerId);
+  g_signal_handler_disconnect (pool->bus, pool->asyncDoneHandlerId);
+  g_signal_handler_disconnect (pool->bus, pool->errorHandlerId);
+  gst_bus_disable_sync_message_emission (pool->bus);
+  while (pool->members->len > 0) {
+    free_member (g_ptr_array_index (pool->members, pool->members->len - 1));
+  }
+  g_ptr_array_free (pool->members, TRUE);
+  g_array_free (pool->pooledSwitches, TRUE);
+  g_array_free (pool->coldSwitches, TRUE);
+  g_mutex_clear (&pool->lock);
+  gst_object_unref (pool->bus);
+  g_free (pool);
+}
+
+void pipeline_pool_prepare (PipelinePool *pool, const char *uri) {
+  PoolMember *member;
+
+  if (NULL == pool || NULL == uri || 0 == pool->size)
+    return;
+  if (NULL != (member = find_member (pool, NULL, uri))) {
+    member->lastUsed = g_get_monotonic_time ();
+    return;
+  }
+  evict (pool);
+  if (NULL == (member = make_member (pool, uri, TRUE)))
+    return;
+  LOGD ("Pool: prerolling %s", uri);
+  member->rssBefore = util_current_rss_kb ();
+  pool->prepared++;
+  gst_element_set_state (member->pipeline, GST_STATE_PAUSED);
+}
+
+GstElement *pipeline_pool_take (PipelinePool *pool, const char *uri) {
+  PoolMember *member = find_member (pool, NULL, uri);
+  gboolean pooled = NULL != member;
+
+  if (NULL == member && NULL == (member = make_member (pool, uri, FALSE)))
+    return NULL;
+  member->standby = FALSE;
+  member->lastUsed = g_get_monotonic_time ();
+  set_showing (member, TRUE);
+
+  g_mutex_lock (&pool->lock);
+  member->pooled = pooled;
+  member->switchStart = g_get_monotonic_time ();
+  g_mutex_unlock (&pool->lock);
+  return gst_object_ref (member->pipeline);
+}
+
+void pipeline_pool_put (PipelinePool *pool, GstElement *pipeline, const char *uri) {
+  PoolMember *member = find_member (pool, pipeline, NULL);
+
+  if (NULL == member) {
+    /* One the pool didn't make, like the first one; its frames came before the probe */
+    member = add_member (pool, pipeline);
+    g_mutex_lock (&pool->lock);
+    member->hasFrame = GST_STATE (pipeline) >= GST_STATE_PAUSED;
+    g_mutex_unlock (&pool->lock);
+  } else {
+    gst_object_unref (pipeline);
+  }
+  g_free (member->uri);
+  member->uri = g_strdup (uri);
+
+  if (0 == pool->size) {
+    gst_element_set_state (member->pipeline, GST_STATE_NULL);
+    free_member (member);
+    return;
+  }
+  set_showing (member, FALSE);
+  cap_pipeline_queues (member->pipeline);
+  g_mutex_lock (&pool->lock);
+  member->switchStart = 0;
+  g_mutex_unlock (&pool->lock);
+  evict (pool);
+  member->standby = TRUE;
+  member->lastUsed = g_get_monotonic_time ();
+}
+
+GstElement *pipeline_pool_get_video_sink (PipelinePool *pool, GstElement *pipeline) {
+  PoolMember *member = find_member (pool, pipeline, NULL);
+
+  return member ? member->videoSink : NULL;
+}
+
+static void append_switches (GString *out, const char *name, GArray *switches) {
+  gint64 sum = 0, max = 0;
+  guint i;
+
+  for (i = 0; i < switches->len; i++) {
+    gint64 latency = g_array_index (switches, gint64, i);
+
+    sum += latency;
+    max = MAX (max, latency);
+  }
+  g_string_append_printf (out, "\n    \"%s\": { \"switches\": %u, \"avg_ms\": %.2f, \"max_ms\": %.2f }", name,
+      switches->len, switches->len ? sum / 1000.0 / switches->len : 0.0, max / 1000.0);
+}
+
+void pipeline_pool_append_json (GString *out, gdouble wall, PipelinePool *pool) {
+  g_mutex_lock (&pool->lock);
+  g_string_append_printf (out, "{\n    \"size\": %u, \"prerolled\": %u, \"dropped\": %u, \"avg_standby_rss_kb\": %ld,",
+      pool->size, pool->prepared, pool->evictions,
+      pool->standbyRssCount ? pool->standbyRssSum / (glong)pool->standbyRssCount : 0L);
+  append_switches (out, "pooled", pool->pooledSwitches);
+  g_string_append_c (out, ',');
+  append_switches (out, "cold", pool->coldSwitches);
+  g_mutex_unlock (&pool->lock);
+  g_string_append (out, "\n  }");
+}
@@ -0,0 +1,238 @@
+#include <string.h>
+
+#include <gst/gst.h>
+
+#include "playlist.h"
+#include "log.h"
+
+typedef struct _PlaylistItem {
+  gchar *input;
+  gchar *uri;                     /* NULL until resolved */
+  gboolean resolving;             /* An async resolution is running */
+} PlaylistItem;
+
+typedef struct _GapProbe {
+  GstSegment segment;             /* Current segment on the sink pad */
+  gboolean seenBuffer;
+  gboolean switching;             /* STREAM_START seen, waiting for the first buffer of the next item */
+  GstClockTime lastRunningEnd;    /* Running time at the end of the last buffer */
+  GstClockTime lastDuration;      /* Duration of the last buffer, i.e. one frame interval */
+  gint64 lastWall;                /* Monotonic time the last buffer arrived */
+
+  guint transitions;
+  gdouble maxGapMs;               /* Largest running time gap seen */
+} GapProbe;
+
+struct _Playlist {
+  UriResolver *resolver;
+  GMutex lock;                    /* Protects items, read from the streaming thread */
+  GPtrArray *items;               /* PlaylistItem */
+  GstPad *sinkPad;                /* Pad of the video sink being watched */
+  GapProbe gap;
+};
+
+typedef struct _PrepareRequest {
+  Playlist *playlist;
+  guint index;
+} PrepareRequest;
+
+static void item_free (PlaylistItem *item) {
+  g_free (item->input);
+  g_free (item->uri);
+  g_free (item);
+}
+
+Playlist *playlist_new (UriResolver *resolver) {
+  Playlist *playlist = g_new0 (Playlist, 1);
+
+  playlist->resolver = resolver;
+  g_mutex_init (&playlist->lock);
+  playlist->items = g_ptr_array_new_with_free_func ((GDestroyNotify)item_free);
+  return playlist;
+}
+
+void playlist_free (Playlist *playlist) {
+  if (NULL == playlist)
+    return;
+  if (playlist->gap.transitions) {
+    LOGD ("%u playlist transitions, largest gap %.2f ms", playlist->gap.transitions, playlist->gap.maxGapMs);
+  }
+  if (playlist->sinkPad)
+    gst_object_unref (playlist->sinkPad);
+  g_ptr_array_free (playlist->items, TRUE);
+  g_mutex_clear (&playlist->lock);
+  g_free (playlist);
+}
+
+static void add_item (Playlist *playlist, const char *input) {
+  PlaylistItem *item = g_new0 (PlaylistItem, 1);
+
+  item->input = g_strdup (input);
+  g_mutex_lock (&playlist->lock);
+  g_ptr_array_add (playlist->items, item);
+  g_mutex_unlock (&playlist->lock);
+}
+
+/* One entry per line, '#' lines are comments/extended info. Relative entries
+   are relative to the playlist file */
+static void add_m3u (Playlist *playlist, const char *path) {
+  gchar *contents = NULL;
+  gchar **lines, **line;
+  gchar *dir, *entry;
+
+  if (!g_file_get_contents (path, &contents, NULL, NULL)) {
+    LOGD ("Could not read playlist %s", path);
+    return;
+  }
+
+  dir = g_path_get_dirname (path);
+  lines = g_strsplit (contents, "\n", -1);
+  for (line = lines; *line; line++) {
+    g_strstrip (*line);
+    if ('\0' == **line || '#' == **line)
+      continue;
+    if (gst_uri_is_valid (*line) || g_path_is_absolute (*line)) {
+      add_item (playlist, *line);
+    } else {
+      entry = g_build_filename (dir, *line, NULL);
+      add_item (playlist, entry);
+      g_free (entry);
+    }
+  }
+  g_strfreev (lines);
+  g_free (dir);
+  g_free (contents);
+}
+
+void playlist_add (Playlist *playlist, const char *input) {
+  if (g_str_has_suffix (input, ".m3u") || g_str_has_suffix (input, ".m3u8")) {
+    add_m3u (playlist, input);
+  } else {
+    add_item (playlist, input);
+  }
+}
+
+guint playlist_length (Playlist *playlist) {
+  return playlist->items->len;
+}
+
+const char *playlist_get_input (Playlist *playlist, guint index) {
+  if (index >= playlist->items->len)
+    return NULL;
+  return ((PlaylistItem *)g_ptr_array_index (playlist->items, index))->input;
+}
+
+static void item_resolved_cb (const char *input, const char *uri, PrepareRequest *request) {
+  Playlist *playlist = request->playlist;
+  PlaylistItem *item;
+
+  g_mutex_lock (&playlist->lock);
+  item = g_ptr_array_index (playlist->items, request->index);
+  item->resolving = FALSE;
+  item->uri = g_strdup (uri);
+  g_mutex_unlock (&playlist->lock);
+
+  if (NULL == uri) {
+    LOGD ("Playlist item %u (%s) can't be resolved, playback will stop before it", request->index, input);
+  }
+  g_free (request);
+}
+
+void playlist_prepare (Playlist *playlist, guint index) {
+  PlaylistItem *item;
+  PrepareRequest *request;
+  gchar *uri;
+
+  if (index >= playlist->items->len)
+    return;
+
+  item = g_ptr_array_index (playlist->items, index);
+  if (item->uri || item->resolving)
+    return;
+
+  uri = uri_resolver_lookup (playlist->resolver, item->input);
+  if (uri) {
+    g_mutex_lock (&playlist->lock);
+    item->uri = uri;
+    g_mutex_unlock (&playlist->lock);
+    return;
+  }
+
+  request = g_new0 (PrepareRequest, 1);
+  request->playlist = playlist;
+  request->index = index;
+  item->resolving = TRUE;
+  uri_resolver_resolve_async (playlist->resolver, item->input, (UriResolvedFunc)item_resolved_cb, request);
+}
+
+gchar *playlist_get_uri (Playlist *playlist, guint index) {
+  gchar *uri = NULL;
+
+  g_mutex_lock (&playlist->lock);
+  if (index < playlist->items->len)
+    uri = g_strdup (((PlaylistItem *)g_ptr_array_index (playlist->items, index))->uri);
+  g_mutex_unlock (&playlist->lock);
+  return uri;
+}
+
+static GstPadProbeReturn gap_probe_cb (GstPad *pad, GstPadProbeInfo *info, Playlist *playlist) {
+  GapProbe *gap = &playlist->gap;
+  GstBuffer *buffer;
+  GstEvent *event;
+  const GstSegment *segment;
+  GstClockTime running;
+  gint64 now;
+  gdouble gapMs;
+
+  if (GST_PAD_PROBE_INFO_TYPE (info) & GST_PAD_PROBE_TYPE_EVENT_DOWNSTREAM) {
+    event = GST_PAD_PROBE_INFO_EVENT (info);
+    if (GST_EVENT_SEGMENT == GST_EVENT_TYPE (event)) {
+      gst_event_parse_segment (event, &segment);
+      gst_segment_copy_into (segment, &gap->segment);
+    } else if (GST_EVENT_STREAM_START == GST_EVENT_TYPE (event) && gap->seenBuffer) {
+      gap->switching = TRUE;
+    } else if (GST_EVENT_FLUSH_STOP == GST_EVENT_TYPE (event)) {
+      /* A seek, not an item change */
+      gap->switching = FALSE;
+    }
+    return GST_PAD_PROBE_OK;
+  }
+
+  buffer = GST_PAD_PROBE_INFO_BUFFER (info);
+  if (GST_FORMAT_TIME != gap->segment.format || !GST_BUFFER_PTS_IS_VALID (buffer))
+    return GST_PAD_PROBE_OK;
+
+  running = gst_segment_to_running_time (&gap->segment, GST_FORMAT_TIME, GST_BUFFER_PTS (buffer));
+  now = g_get_monotonic_time ();
+
+  if (gap->switching && GST_CLOCK_TIME_IS_VALID (running) && GST_CLOCK_TIME_IS_VALID (gap->lastRunningEnd)) {
+    gapMs = ((gdouble)GST_CLOCK_DIFF (gap->lastRunningEnd, running)) / GST_MSECOND;
+    gap->transitions++;
+    if (gapMs > gap->maxGapMs)
+      gap->maxGapMs = gapMs;
+    LOGD ("Playlist transition gap: %.2f ms running time (%.2f frame intervals), %.2f ms wall clock",
+        gapMs, GST_CLOCK_TIME_IS_VALID (gap->lastDuration) && gap->lastDuration > 0 ?
+        gapMs * GST_MSECOND / gap->lastDuration : 0.0, (now - gap->lastWall) / 1000.0);
+  }
+  gap->switching = FALSE;
+  gap->seenBuffer = TRUE;
+  gap->lastWall = now;
+  gap->lastDuration = GST_BUFFER_DURATION (buffer);
+  gap->lastRunningEnd = running;
+  if (GST_CLOCK_TIME_IS_VALID (running) && GST_BUFFER_DURATION_IS_VALID (buffer))
+    gap->lastRunningEnd = running + GST_BUFFER_DURATION (buffer);
+  return GST_PAD_PROBE_OK;
+}
+
+void playlist_watch_video_sink (Playlist *playlist, GstElement *sink) {
+  if (playlist->sinkPad)
+    return;
+
+  playlist->sinkPad = gst_element_get_static_pad (sink, "sink");
+  if (NULL == playlist->sinkPad)
+    return;
+  gst_segment_init (&playlist->gap.segment, GST_FORMAT_UNDEFINED);
+  playlist->gap.lastRunningEnd = GST_CLOCK_TIME_NONE;
+  gst_pad_add_probe (playlist->sinkPad, GST_PAD_PROBE_TYPE_BUFFER | GST_PAD_PROBE_TYPE_EVENT_DOWNSTREAM,
+      (GstPadProbeCallback)gap_probe_cb, playlist, NULL);
+}
@@ -0,0 +1,312 @@
+#include <dbus/dbus.h>
+#include <glib.h>
+
+#include "power_manager.h"
+#include "log.h"
+
+struct _PowerManager {
+  DBusConnection *sessionBus;     /* Dbus connection to session bus */
+  gchar *appName;
+
+  gboolean wanted;                /* Latest requested state */
+  gboolean isSleepInhibited;      /* State the session manager has, as far as we know */
+  unsigned int dbusInbitCookie;   /* Cookie got while calling sleep inhibit function to session manager.
+                                     used for calling uninhibit sleep */
+  DBusPendingCall *pendingCall;   /* Inhibit/Uninhibit call waiting for its reply */
+  gboolean pendingInhibit;        /* What pendingCall asks for */
+  gint failedRequest;             /* State whose call failed and isn't retried until wanted changes, -1 if none */
+  guint debounceId;               /* Debounce timeout source */
+  guint dispatchId;               /* Idle source dispatching incoming messages */
+};
+
+static void sync_state (PowerManager *pm);
+
+/* --- libdbus <-> GLib main loop glue --- */
+
+static gboolean watch_io_cb (GIOChannel *channel, GIOCondition condition, DBusWatch *watch) {
+  unsigned int flags = 0;
+
+  if (condition & G_IO_IN)
+    flags |= DBUS_WATCH_READABLE;
+  if (condition & G_IO_OUT)
+    flags |= DBUS_WATCH_WRITABLE;
+  if (condition & G_IO_ERR)
+    flags |= DBUS_WATCH_ERROR;
+  if (condition & G_IO_HUP)
+    flags |= DBUS_WATCH_HANGUP;
+  dbus_watch_handle (watch, flags);
+  return TRUE;
+}
+
+static void watch_enable (DBusWatch *watch) {
+  unsigned int flags = dbus_watch_get_flags (watch);
+  GIOCondition condition = G_IO_ERR | G_IO_HUP;
+  GIOChannel *channel;
+  guint id;
+
+  if (flags & DBUS_WATCH_READABLE)
+    condition |= G_IO_IN;
+  if (flags & DBUS_WATCH_WRITABLE)
+    condition |= G_IO_OUT;
+
+  channel = g_io_channel_unix_new (dbus_watch_get_unix_fd (watch));
+  id = g_io_add_watch (channel, condition, (GIOFunc)watch_io_cb, watch);
+  g_io_channel_unref (channel);
+  dbus_watch_set_data (watch, GUINT_TO_POINTER (id), NULL);
+}
+
+static void watch_disable (DBusWatch *watch) {
+  guint id = GPOINTER_TO_UINT (dbus_watch_get_data (watch));
+
+  if (id) {
+    g_source_remove (id);
+    dbus_watch_set_data (watch, NULL, NULL);
+  }
+}
+
+static dbus_bool_t add_watch_cb (DBusWatch *watch, void *data) {
+  if (dbus_watch_get_enabled (watch))
+    watch_enable (watch);
+  return TRUE;
+}
+
+static void remove_watch_cb (DBusWatch *watch, void *data) {
+  watch_disable (watch);
+}
+
+static void toggle_watch_cb (DBusWatch *watch, void *data) {
+  watch_disable (watch);
+  if (dbus_watch_get_enabled (watch))
+    watch_enable (watch);
+}
+
+static gboolean timeout_cb (DBusTimeout *timeout) {
+  dbus_timeout_handle (timeout);
+  return TRUE;
+}
+
+static void timeout_enable (DBusTimeout *timeout) {
+  guint id = g_timeout_add (dbus_timeout_get_interval (timeout), (GSourceFunc)timeout_cb, timeout);
+
+  dbus_timeout_set_data (timeout, GUINT_TO_POINTER (id), NULL);
+}
+
+static void timeout_disable (DBusTimeout *timeout) {
+  guint id = GPOINTER_TO_UINT (dbus_timeout_get_data (timeout));
+
+  if (id) {
+    g_source_remove (id);
+    dbus_timeout_set_data (timeout, NULL, NULL);
+  }
+}
+
+static dbus_bool_t add_timeout_cb (DBusTimeout *timeout, void *data) {
+  if (dbus_timeout_get_enabled (timeout))
+    timeout_enable (timeout);
+  return TRUE;
+}
+
+static void remove_timeout_cb (DBusTimeout *timeout, void *data) {
+  timeout_disable (timeout);
+}
+
+static void toggle_timeout_cb (DBusTimeout *timeout, void *data) {
+  timeout_disable (timeout);
+  if (dbus_timeout_get_enabled (timeout))
+    timeout_enable (timeout);
+}
+
+static gboolean dispatch_cb (PowerManager *pm) {
+  pm->dispatchId = 0;
+  while (DBUS_DISPATCH_DATA_REMAINS == dbus_connection_dispatch (pm->sessionBus))
+    ;
+  return FALSE;
+}
+
+/* libdbus must not be re-entered from here, so dispatching is deferred to an idle */
+static void dispatch_status_cb (DBusConnection *connection, DBusDispatchStatus status, PowerManager *pm) {
+  if (DBUS_DISPATCH_DATA_REMAINS == status && 0 == pm->dispatchId)
+    pm->dispatchId = g_idle_add ((GSourceFunc)dispatch_cb, pm);
+}
+
+/* --- Session manager calls --- */
+
+static DBusMessage *create_request (PowerManager *pm, gboolean inhibit) {
+  DBusMessage *request;
+  DBusMessageIter reqIter;
+  dbus_uint32_t windowId = 0;
+  const char *reason = "my video player is running";
+  dbus_uint32_t flag = 8; /* 8: to stop session being marked as idle */
+
+  request = dbus_message_new_method_call (SESSION_MANAGER_DBUS, SESSION_MANAGER_DBUS_PATH,
+      SESSION_MANAGER_DBUS_INTERFACE, inhibit ? SESSION_MANAGER_INHIBIT : SESSION_MANAGER_UNINHIBIT);
+  if (NULL == request) {
+    LOGD ("Error in creating dbus method");
+    return NULL;
+  }
+  dbus_message_iter_init_append (request, &reqIter);
+
+  if (inhibit) {
+    if (!dbus_message_iter_append_basic (&reqIter, DBUS_TYPE_STRING, &pm->appName) ||
+        !dbus_message_iter_append_basic (&reqIter, DBUS_TYPE_UINT32, &windowId) ||
+        !dbus_message_iter_append_basic (&reqIter, DBUS_TYPE_STRING, &reason) ||
+        !dbus_message_iter_append_basic (&reqIter, DBUS_TYPE_UINT32, &flag)) {
+      LOGD ("Error adding inhibit arguments");
+      dbus_message_unref (request);
+      return NULL;
+    }
+  } else if (!dbus_message_iter_append_basic (&reqIter, DBUS_TYPE_UINT32, &pm->dbusInbitCookie)) {
+    LOGD ("Error adding inhibit cookie");
+    dbus_message_unref (request);
+    return NULL;
+  }
+  return request;
+}
+
+/* Called from dbus_connection_dispatch when the session manager answers */
+static void reply_cb (DBusPendingCall *pending, PowerManager *pm) {
+  DBusMessage *reply = dbus_pending_call_steal_reply (pending);
+  DBusMessageIter replyIter;
+
+  dbus_pending_call_unref (pm->pendingCall);
+  pm->pendingCall = NULL;
+
+  /* Failed until proven otherwise; without a session manager every call fails */
+  pm->failedRequest = pm->pendingInhibit;
+  if (NULL == reply) {
+    LOGD ("Error in dbus_pending_call_steal_reply");
+  } else if (DBUS_MESSAGE_TYPE_ERROR == dbus_message_get_type (reply)) {
+    LOGD ("%s failed: %s", pm->pendingInhibit ? SESSION_MANAGER_INHIBIT : SESSION_MANAGER_UNINHIBIT,
+        dbus_message_get_error_name (reply));
+  } else if (pm->pendingInhibit) {
+    /* parse reply according to inbit/unhibit method called */
+    if (dbus_message_iter_init (reply, &replyIter) && DBUS_TYPE_UINT32 == dbus_message_iter_get_arg_type (&replyIter)) {
+      dbus_message_iter_get_basic (&replyIter, &pm->dbusInbitCookie);
+      pm->isSleepInhibited = TRUE;
+      pm->failedRequest = -1;
+      LOGD ("Got inhibit cookie:%u", pm->dbusInbitCookie);
+    } else {
+      LOGD ("inhibit return type is not as expected");
+    }
+  } else {
+    pm->isSleepInhibited = FALSE;
+    pm->failedRequest = -1;
+    LOGD ("Sleep uninhibited");
+  }
+
+  if (reply)
+    dbus_message_unref (reply);
+
+  /* The wanted state may have changed while the call was out; a failed one isn't
+   * sent again until it changes */
+  sync_state (pm);
+}
+
+/* Sends the call bringing the session manager to the wanted state, if needed */
+static void sync_state (PowerManager *pm) {
+  DBusMessage *request;
+  DBusPendingCall *pending = NULL;
+
+  if (NULL != pm->pendingCall || 0 != pm->debounceId || pm->wanted == pm->isSleepInhibited ||
+      pm->failedRequest == (gint)pm->wanted)
+    return;
+
+  request = create_request (pm, pm->wanted);
+  if (NULL == request)
+    return;
+
+  if (!dbus_connection_send_with_reply (pm->sessionBus, request, &pending, DBUS_TIMEOUT_USE_DEFAULT) || NULL == pending) {
+    LOGD ("Error in dbus_connection_send_with_reply");
+  } else {
+    pm->pendingCall = pending;
+    pm->pendingInhibit = pm->wanted;
+    dbus_pending_call_set_notify (pending, (DBusPendingCallNotifyFunction)reply_cb, pm, NULL);
+  }
+  dbus_message_unref (request);
+}
+
+static gboolean debounce_cb (PowerManager *pm) {
+  pm->debounceId = 0;
+  sync_state (pm);
+  return FALSE;
+}
+
+/* function to print dbus error */
+static void print_dbus_error (char *str, DBusError *error) {
+  LOGD ("%s: %s", str, error->message);
+  dbus_error_free (error);
+}
+
+PowerManager *power_manager_new (const char *appName) {
+  PowerManager *pm;
+  DBusConnection *connection;
+  DBusError dbusError;
+
+  dbus_error_init (&dbusError);
+  connection = dbus_bus_get (DBUS_BUS_SESSION, &dbusError);
+  if (dbus_error_is_set (&dbusError) || NULL == connection) {
+    print_dbus_error ("error in Dbus connection", &dbusError);
+    return NULL;
+  }
+
+  pm = g_new0 (PowerManager, 1);
+  pm->sessionBus = connection;
+  pm->appName = g_strdup (appName);
+  pm->failedRequest = -1;
+
+  /* The connection is shared with anyone else calling dbus_bus_get; don't let a
+     session bus going away take the player down */
+  dbus_connection_set_exit_on_disconnect (connection, FALSE);
+  dbus_connection_set_watch_functions (connection, add_watch_cb, remove_watch_cb, toggle_watch_cb, pm, NULL);
+  dbus_connection_set_timeout_functions (connection, add_timeout_cb, remove_timeout_cb, toggle_timeout_cb, pm, NULL);
+  dbus_connection_set_dispatch_status_function (connection,
+      (DBusDispatchStatusFunction)dispatch_status_cb, pm, NULL);
+  dispatch_status_cb (connection, dbus_connection_get_dispatch_status (connection), pm);
+  return pm;
+}
+
+void power_manager_free (PowerManager *pm) {
+  DBusMessage *request;
+
+  if (NULL == pm)
+    return;
+
+  if (pm->debounceId)
+    g_source_remove (pm->debounceId);
+  if (pm->dispatchId)
+    g_source_remove (pm->dispatchId);
+  if (pm->pendingCall) {
+    dbus_pending_call_cancel (pm->pendingCall);
+    dbus_pending_call_unref (pm->pendingCall);
+  }
+
+  /* Nobody will wait for the reply any more; the session manager also drops the
+     inhibitor when we disconnect */
+  if (pm->isSleepInhibited && NULL != (request = create_request (pm, FALSE))) {
+    dbus_connection_send (pm->sessionBus, request, NULL);
+    dbus_message_unref (request);
+  }
+  dbus_connection_flush (pm->sessionBus);
+
+  dbus_connection_set_watch_functions (pm->sessionBus, NULL, NULL, NULL, NULL, NULL);
+  dbus_connection_set_timeout_functions (pm->sessionBus, NULL, NULL, NULL, NULL, NULL);
+  dbus_connection_set_dispatch_status_function (pm->sessionBus, NULL, NULL, NULL);
+  dbus_connection_unref (pm->sessionBus);
+  g_free (pm->appName);
+  g_free (pm);
+}
+
+void power_manager_set_inhibited (PowerManager *pm, gboolean inhibit) {
+  if (NULL == pm)
+    return;
+
+  if (inhibit != pm->wanted) {
+    /* A new request; whatever failed before may work now */
+    pm->failedRequest = -1;
+  }
+  pm->wanted = inhibit;
+  /* Restart the debounce window on every change */
+  if (pm->debounceId)
+    g_source_remove (pm->debounceId);
+  pm->debounceId = g_timeout_add (POWER_MANAGER_DEBOUNCE_MS, (GSourceFunc)debounce_cb, pm);
+}
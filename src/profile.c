@@ -0,0 +1,207 @@
+#include <string.h>
+
+#include <gst/gst.h>
+
+#include "profile.h"
+#include "log.h"
+
+/* Sinks that show frames on screen; fakesink is left alone so headless benches keep
+   rendering as fast as they decode */
+#define PROFILE_SCREEN_SINKS "xvimagesink,ximagesink,glimagesink,gtksink,gtkglsink"
+
+/* Sinks on a sound card, the ones with a ring buffer */
+#define PROFILE_AUDIO_SINKS "pulsesink,alsasink,osssink,oss4sink,jackaudiosink"
+
+/* decodebin sizes its multiqueue from its own max-size-* properties whenever the group
+   changes, so the demuxer queue limits go there rather than on the multiqueue.
+   Durations are in nanoseconds */
+static const char *throughputPreset =
+  "[avdec_*]\n"
+  "max-threads=0\n"                     /* One thread per core */
+  "thread-type=frame\n"                 /* Frame threads scale best, at a frame of latency each */
+  "[decodebin]\n"
+  "max-size-bytes=67108864\n"
+  "max-size-time=5000000000\n"
+  "max-size-buffers=0\n"
+  "[queue2]\n"
+  "max-size-bytes=33554432\n"
+  "[" PROFILE_SCREEN_SINKS "]\n"
+  "max-lateness=-1\n"                   /* Show every frame rather than dropping late ones */
+  "qos=false\n";
+
+static const char *lowLatencyPreset =
+  "[avdec_*]\n"
+  "thread-type=slice\n"                 /* Slice threads add no frame delay */
+  "[decodebin]\n"
+  "max-size-bytes=0\n"
+  "max-size-time=200000000\n"
+  "max-size-buffers=0\n"
+  "[queue2]\n"
+  "max-size-time=500000000\n"
+  "[" PROFILE_SCREEN_SINKS "]\n"
+  "max-lateness=5000000\n"
+  "processing-deadline=5000000\n"
+  "sync=true\n";
+
+/* Audio sink ring buffers in microseconds: 20 ms in 5 ms segments instead of 200 ms in
+   10 ms ones, so less sound is queued ahead of the speaker after seeks and rate changes. Output
+   devices add latency of their own which the sinks don't report; --av-offset moves
+   video to match, scripts/check-av-sync.sh measures it */
+static const char *lowLatencyAudioPreset =
+  "[" PROFILE_AUDIO_SINKS "]\n"
+  "buffer-time=20000\n"
+  "latency-time=5000\n";
+
+static const char *lowMemoryPreset =
+  "[avdec_*]\n"
+  "max-threads=2\n"                     /* Every frame thread holds its own reference frames */
+  "[decodebin]\n"
+  "max-size-bytes=4194304\n"
+  "max-size-time=1000000000\n"
+  "max-size-buffers=0\n"
+  "[queue2]\n"
+  "max-size-bytes=2097152\n"
+  "[" PROFILE_SCREEN_SINKS "]\n"
+  "max-lateness=20000000\n";
+
+static const struct {
+  const char *name;
+  const char **data;
+} presets[] = {
+  { "throughput", &throughputPreset },
+  { "low-latency", &lowLatencyPreset },
+  { "low-latency-audio", &lowLatencyAudioPreset },
+  { "low-memory", &lowMemoryPreset },
+};
+
+struct _Profile {
+  GPtrArray *keyFiles;            /* GKeyFile, the preset first so the file overrides it */
+};
+
+static GKeyFile *load_preset (const char *name) {
+  GKeyFile *keyFile;
+  GError *err = NULL;
+  guint i;
+
+  for (i = 0; i < G_N_ELEMENTS (presets); i++) {
+    if (!strcmp (presets[i].name, name))
+      break;
+  }
+  if (i == G_N_ELEMENTS (presets)) {
+    LOGE ("Unknown profile %s, expected throughput, low-latency, low-latency-audio or low-memory", name);
+    return NULL;
+  }
+
+  keyFile = g_key_file_new ();
+  if (!g_key_file_load_from_data (keyFile, *presets[i].data, -1, G_KEY_FILE_NONE, &err)) {
+    LOGE ("Broken built-in profile %s: %s", name, err->message);
+    g_clear_error (&err);
+    g_key_file_free (keyFile);
+    return NULL;
+  }
+  return keyFile;
+}
+
+static GKeyFile *load_file (const char *path) {
+  GKeyFile *keyFile = g_key_file_new ();
+  GError *err = NULL;
+
+  if (!g_key_file_load_from_file (keyFile, path, G_KEY_FILE_NONE, &err)) {
+    LOGE ("Could not load profile %s: %s", path, err->message);
+    g_clear_error (&err);
+    g_key_file_free (keyFile);
+    return NULL;
+  }
+  return keyFile;
+}
+
+Profile *profile_new (const char *preset, const char *path) {
+  Profile *profile;
+  GKeyFile *keyFile;
+
+  if (NULL == preset && NULL == path)
+    return NULL;
+
+  profile = g_new0 (Profile, 1);
+  profile->keyFiles = g_ptr_array_new_with_free_func ((GDestroyNotify)g_key_file_free);
+  if (preset) {
+    if (NULL == (keyFile = load_preset (preset))) {
+      profile_free (profile);
+      return NULL;
+    }
+    g_ptr_array_add (profile->keyFiles, keyFile);
+  }
+  if (path) {
+    if (NULL == (keyFile = load_file (path))) {
+      profile_free (profile);
+      return NULL;
+    }
+    g_ptr_array_add (profile->keyFiles, keyFile);
+  }
+  LOGD ("Using profile %s%s%s", preset ? preset : "", preset && path ? " + " : "", path ? path : "");
+  return profile;
+}
+
+void profile_free (Profile *profile) {
+  if (NULL == profile)
+    return;
+  g_ptr_array_free (profile->keyFiles, TRUE);
+  g_free (profile);
+}
+
+/* Group names are comma separated factory name globs */
+static gboolean group_matches (const gchar *group, const gchar *factoryName) {
+  gchar **globs = g_strsplit (group, ",", -1);
+  gboolean match = FALSE;
+  guint i;
+
+  for (i = 0; globs[i] && !match; i++) {
+    match = g_pattern_match_simple (g_strstrip (globs[i]), factoryName);
+  }
+  g_strfreev (globs);
+  return match;
+}
+
+static void apply_group (GKeyFile *keyFile, const gchar *group, GstElement *element) {
+  GObjectClass *klass = G_OBJECT_GET_CLASS (element);
+  gchar **keys = g_key_file_get_keys (keyFile, group, NULL, NULL);
+  gchar *value;
+  guint i;
+
+  for (i = 0; keys && keys[i]; i++) {
+    /* Presets cover several element versions; a missing property isn't an error */
+    if (NULL == g_object_class_find_property (klass, keys[i])) {
+      LOGD ("%s has no property %s, skipped", GST_OBJECT_NAME (element), keys[i]);
+      continue;
+    }
+    value = g_key_file_get_value (keyFile, group, keys[i], NULL);
+    g_strstrip (value);
+    gst_util_set_object_arg (G_OBJECT (element), keys[i], value);
+    LOGD ("%s: %s=%s", GST_OBJECT_NAME (element), keys[i], value);
+    g_free (value);
+  }
+  g_strfreev (keys);
+}
+
+void profile_apply (Profile *profile, GstElement *element) {
+  GstElementFactory *factory = gst_element_get_factory (element);
+  const gchar *factoryName;
+  gchar **groups;
+  guint i, j;
+
+  if (NULL == profile || NULL == factory)
+    return;
+  factoryName = GST_OBJECT_NAME (factory);
+
+  for (i = 0; i < profile->keyFiles->len; i++) {
+    GKeyFile *keyFile = g_ptr_array_index (profile->keyFiles, i);
+
+    groups = g_key_file_get_groups (keyFile, NULL);
+    for (j = 0; groups[j]; j++) {
+      if (group_matches (groups[j], factoryName)) {
+        apply_group (keyFile, groups[j], element);
+      }
+    }
+    g_strfreev (groups);
+  }
+}
@@ -0,0 +1,276 @@
+#include <string.h>
+
+#include <gst/gst.h>
+
+#include "qos_controller.h"
+#include "bench.h"
+#include "log.h"
+
+#define QOS_SKIP_FRAME_NONREF 1      /* avdec skip-frame: "Skip B-frames" */
+#define QOS_SCALE_NEAREST 0          /* videoscale method: nearest neighbour */
+#define QOS_SCALE_BILINEAR 1         /* videoscale method: the default */
+
+static const char *levelNames[QOS_LEVEL_COUNT] = {
+  "full", "skip-nonref", "lowres", "fast-scaling", "keyframes-only"
+};
+
+typedef struct _QosElementStats {
+  gchar *name;
+  guint64 reports;                /* QoS messages posted by the element */
+  guint64 lateReports;            /* ...of which reported lateness */
+  gdouble jitterSumMs;
+  gdouble maxJitterMs;
+  gdouble proportion;             /* Latest proportion, > 1 means too slow */
+  guint64 processed;              /* Latest cumulative counts, in buffers */
+  guint64 dropped;
+} QosElementStats;
+
+struct _QosController {
+  GstElement *pipeline;
+  GstBus *bus;
+  gulong qosHandlerId;
+  SeekScheduler *seeker;
+  guint timerId;
+
+  GHashTable *elements;           /* Element name -> QosElementStats */
+  QosLevel level;
+  QosLevel maxLevel;
+  guint levelChanges;
+  gboolean periodLate;            /* Lateness seen in the current period */
+  guint latePeriods;              /* Consecutive late periods */
+  guint cleanPeriods;             /* Consecutive clean periods */
+  guint stepUpPeriods;            /* Clean periods needed to recover a level, backed off on flapping */
+  guint backoffs;
+  gint64 recoveredAt[QOS_LEVEL_COUNT]; /* Monotonic time each level was last left upwards, 0 if never */
+};
+
+static void element_stats_free (QosElementStats *stats) {
+  g_free (stats->name);
+  g_free (stats);
+}
+
+static guint64 total_dropped (QosController *qos) {
+  GHashTableIter iter;
+  QosElementStats *stats;
+  guint64 dropped = 0;
+
+  g_hash_table_iter_init (&iter, qos->elements);
+  while (g_hash_table_iter_next (&iter, NULL, (gpointer *)&stats))
+    dropped += stats->dropped;
+  return dropped;
+}
+
+/* Applies the settings of the current level to one element of the pipeline */
+static void apply_to_element (const GValue *value, QosController *qos) {
+  GstElement *element = g_value_get_object (value);
+  GObjectClass *klass = G_OBJECT_GET_CLASS (element);
+  GstElementFactory *factory = gst_element_get_factory (element);
+
+  if (g_object_class_find_property (klass, "skip-frame")) {
+    g_object_set (element, "skip-frame", qos->level >= QOS_LEVEL_SKIP_NONREF ? QOS_SKIP_FRAME_NONREF : 0, NULL);
+  }
+  if (g_object_class_find_property (klass, "lowres")) {
+    g_object_set (element, "lowres", qos->level >= QOS_LEVEL_LOWRES ? 1 : 0, NULL);
+  }
+  if (factory && (!strcmp (GST_OBJECT_NAME (factory), "videoscale") ||
+      !strcmp (GST_OBJECT_NAME (factory), "videoconvertscale")) && g_object_class_find_property (klass, "method")) {
+    g_object_set (element, "method", qos->level >= QOS_LEVEL_FAST_SCALING ? QOS_SCALE_NEAREST : QOS_SCALE_BILINEAR, NULL);
+  }
+}
+
+static void set_level (QosController *qos, QosLevel level) {
+  QosLevel old = qos->level;
+  GstIterator *it;
+
+  qos->level = level;
+  qos->levelChanges++;
+  if (level > qos->maxLevel)
+    qos->maxLevel = level;
+  LOGD ("QoS level %s -> %s, %" G_GUINT64_FORMAT " frames dropped so far", levelNames[old], levelNames[level],
+      total_dropped (qos));
+
+  /* Decoders and scalers come and go with the stream, so they are looked up each time */
+  it = gst_bin_iterate_recurse (GST_BIN (qos->pipeline));
+  gst_iterator_foreach (it, (GstIteratorForeachFunction)apply_to_element, qos);
+  gst_iterator_free (it);
+
+  /* Keyframe only playback is held in the seek scheduler, so user seeks meanwhile keep it */
+  if (QOS_LEVEL_KEYFRAMES_ONLY == level || QOS_LEVEL_KEYFRAMES_ONLY == old)
+    seek_scheduler_set_keyframes_only (qos->seeker, QOS_LEVEL_KEYFRAMES_ONLY == level);
+}
+
+/* Posted by sinks for late or dropped buffers and by decoders dropping frames */
+static void qos_cb (GstBus *bus, GstMessage *msg, QosController *qos) {
+  const gchar *name = GST_OBJECT_NAME (GST_MESSAGE_SRC (msg));
+  QosElementStats *stats = g_hash_table_lookup (qos->elements, name);
+  gint64 jitter;
+  gdouble proportion, jitterMs;
+  gint quality;
+  GstFormat format;
+  guint64 processed, dropped;
+
+  if (NULL == stats) {
+    stats = g_new0 (QosElementStats, 1);
+    stats->name = g_strdup (name);
+    g_hash_table_insert (qos->elements, stats->name, stats);
+  }
+
+  gst_message_parse_qos_values (msg, &jitter, &proportion, &quality);
+  gst_message_parse_qos_stats (msg, &format, &processed, &dropped);
+  jitterMs = (gdouble)jitter / GST_MSECOND;
+  stats->reports++;
+  stats->jitterSumMs += jitterMs;
+  if (jitterMs > stats->maxJitterMs)
+    stats->maxJitterMs = jitterMs;
+  stats->proportion = proportion;
+  if (GST_FORMAT_BUFFERS == format || GST_FORMAT_DEFAULT == format) {
+    if ((guint64)-1 != dropped && dropped > stats->dropped) {
+      /* A dropped frame is lateness whatever the jitter says */
+      qos->periodLate = TRUE;
+      stats->dropped = dropped;
+    }
+    if ((guint64)-1 != processed)
+      stats->processed = processed;
+  }
+  if (jitter > QOS_CONTROLLER_LATE_JITTER) {
+    stats->lateReports++;
+    qos->periodLate = TRUE;
+  }
+}
+
+/* Going down a level: back in it soon after recovering from it means the load sits at
+   its edge, so recovering takes twice as long from now on. Any other step down starts
+   over with the base count */
+static void back_off (QosController *qos, QosLevel level) {
+  gint64 recovered = qos->recoveredAt[level];
+
+  if (recovered && g_get_monotonic_time () - recovered < QOS_CONTROLLER_REENTER_WINDOW) {
+    qos->stepUpPeriods = MIN (qos->stepUpPeriods * 2, QOS_CONTROLLER_MAX_STEP_UP_PERIODS);
+    qos->backoffs++;
+    LOGD ("QoS level %s re-entered, %u clean periods to recover", levelNames[level], qos->stepUpPeriods);
+  } else {
+    qos->stepUpPeriods = QOS_CONTROLLER_STEP_UP_PERIODS;
+  }
+}
+
+static gboolean tick_cb (QosController *qos) {
+  GstState state;
+
+  /* Paused pipelines post no QoS, that says nothing about the load */
+  gst_element_get_state (qos->pipeline, &state, NULL, 0);
+  if (GST_STATE_PLAYING != state)
+    return TRUE;
+
+  if (qos->periodLate) {
+    qos->latePeriods++;
+    qos->cleanPeriods = 0;
+  } else {
+    qos->cleanPeriods++;
+    qos->latePeriods = 0;
+  }
+  qos->periodLate = FALSE;
+
+  /* Degrade quickly, recover slowly, so a level doesn't flap at the edge of the load */
+  if (qos->latePeriods >= QOS_CONTROLLER_STEP_DOWN_PERIODS && qos->level < QOS_LEVEL_COUNT - 1) {
+    qos->latePeriods = 0;
+    back_off (qos, qos->level + 1);
+    set_level (qos, qos->level + 1);
+  } else if (qos->cleanPeriods >= qos->stepUpPeriods && qos->level > QOS_LEVEL_FULL) {
+    qos->cleanPeriods = 0;
+    qos->recoveredAt[qos->level] = g_get_monotonic_time ();
+    set_level (qos, qos->level - 1);
+  }
+  return TRUE;
+}
+
+QosController *qos_controller_new (GstElement *pipeline, GstBus *bus, SeekScheduler *seeker) {
+  QosController *qos = g_new0 (QosController, 1);
+
+  qos->pipeline = gst_object_ref (pipeline);
+  qos->bus = gst_object_ref (bus);
+  qos->seeker = seeker;
+  qos->stepUpPeriods = QOS_CONTROLLER_STEP_UP_PERIODS;
+  qos->elements = g_hash_table_new_full (g_str_hash, g_str_equal, NULL, (GDestroyNotify)element_stats_free);
+  /* The bus already has a signal watch */
+  qos->qosHandlerId = g_signal_connect (bus, "message::qos", G_CALLBACK (qos_cb), qos);
+  qos->timerId = g_timeout_add (QOS_CONTROLLER_PERIOD_MS, (GSourceFunc)tick_cb, qos);
+  return qos;
+}
+
+void qos_controller_free (QosController *qos) {
+  GHashTableIter iter;
+  QosElementStats *stats;
+
+  if (NULL == qos)
+    return;
+
+  g_hash_table_iter_init (&iter, qos->elements);
+  while (g_hash_table_iter_next (&iter, NULL, (gpointer *)&stats)) {
+    LOGD ("QoS %s: %" G_GUINT64_FORMAT " reports (%" G_GUINT64_FORMAT " late), avg jitter %.2f ms, max %.2f ms, "
+        "proportion %.2f, %" G_GUINT64_FORMAT "/%" G_GUINT64_FORMAT " dropped", stats->name, stats->reports,
+        stats->lateReports, stats->reports ? stats->jitterSumMs / stats->reports : 0.0, stats->maxJitterMs,
+        stats->proportion, stats->dropped, stats->processed + stats->dropped);
+  }
+  LOGD ("QoS level changes: %u, worst level %s, %u backoffs", qos->levelChanges, levelNames[qos->maxLevel],
+      qos->backoffs);
+
+  g_source_remove (qos->timerId);
+  g_signal_handler_disconnect (qos->bus, qos->qosHandlerId);
+  g_hash_table_destroy (qos->elements);
+  gst_object_unref (qos->bus);
+  gst_object_unref (qos->pipeline);
+  g_free (qos);
+}
+
+void qos_controller_set_pipeline (QosController *qos, GstElement *pipeline) {
+  GstIterator *it;
+  gint64 position;
+
+  if (NULL == qos || pipeline == qos->pipeline)
+    return;
+  /* The pipeline going idle is put back to full quality for when it comes back; the
+     seek scheduler has moved on already, so keyframe only playback ends here */
+  if (QOS_LEVEL_FULL != qos->level) {
+    if (QOS_LEVEL_KEYFRAMES_ONLY == qos->level &&
+        gst_element_query_position (qos->pipeline, GST_FORMAT_TIME, &position)) {
+      gst_element_seek_simple (qos->pipeline, GST_FORMAT_TIME, GST_SEEK_FLAG_FLUSH | GST_SEEK_FLAG_KEY_UNIT, position);
+    }
+    qos->level = QOS_LEVEL_FULL;
+    it = gst_bin_iterate_recurse (GST_BIN (qos->pipeline));
+    gst_iterator_foreach (it, (GstIteratorForeachFunction)apply_to_element, qos);
+    gst_iterator_free (it);
+    LOGD ("QoS level back to %s for the pipeline switched to", levelNames[QOS_LEVEL_FULL]);
+  }
+  gst_object_replace ((GstObject **)&qos->pipeline, GST_OBJECT (pipeline));
+  qos->periodLate = FALSE;
+  qos->latePeriods = 0;
+  qos->cleanPeriods = 0;
+  qos->stepUpPeriods = QOS_CONTROLLER_STEP_UP_PERIODS;
+  memset (qos->recoveredAt, 0, sizeof (qos->recoveredAt));
+}
+
+QosLevel qos_controller_get_level (QosController *qos) {
+  return qos->level;
+}
+
+void qos_controller_append_json (GString *out, gdouble wall, QosController *qos) {
+  GHashTableIter iter;
+  QosElementStats *stats;
+  gboolean first = TRUE;
+
+  g_string_append_printf (out, "{ \"level_changes\": %u, \"max_level\": \"%s\", \"final_level\": \"%s\", "
+      "\"backoffs\": %u, \"step_up_periods\": %u, \"dropped\": %" G_GUINT64_FORMAT ", \"elements\": {",
+      qos->levelChanges, levelNames[qos->maxLevel], levelNames[qos->level], qos->backoffs, qos->stepUpPeriods,
+      total_dropped (qos));
+  g_hash_table_iter_init (&iter, qos->elements);
+  while (g_hash_table_iter_next (&iter, NULL, (gpointer *)&stats)) {
+    g_string_append_printf (out, "%s\n    ", first ? "" : ",");
+    bench_json_append_string (out, stats->name);
+    g_string_append_printf (out, ": { \"reports\": %" G_GUINT64_FORMAT ", \"avg_jitter_ms\": %.2f, "
+        "\"max_jitter_ms\": %.2f, \"proportion\": %.2f, \"dropped\": %" G_GUINT64_FORMAT " }", stats->reports,
+        stats->reports ? stats->jitterSumMs / stats->reports : 0.0, stats->maxJitterMs, stats->proportion,
+        stats->dropped);
+    first = FALSE;
+  }
+  g_string_append (out, first ? "} }" : "\n  } }");
+}
@@ -0,0 +1,132 @@
+#include <gst/gst.h>
+
+#include "rate_sweep.h"
+#include "log.h"
+
+static const gdouble rates[] = { 1.0, 2.0, 4.0, 8.0, 16.0, 32.0, 0.5, 0.25, -1.0, -2.0, -8.0, -32.0 };
+
+typedef struct _RateResult {
+  gdouble rate;
+  gdouble fps;                    /* Frames reaching the video sink per second */
+  gdouble cpuPercent;
+  gdouble speed;                  /* Media seconds covered per second */
+} RateResult;
+
+struct _RateSweep {
+  GstElement *pipeline;
+  SeekScheduler *seeker;
+  BenchData *bench;
+  RateSweepDoneFunc done;
+  gpointer userData;
+
+  gboolean started;
+  guint index;                    /* Rate being measured */
+  guint timeoutId;
+
+  gint64 startTime;               /* Sample at the start of the measured period */
+  gint startFrames;
+  gdouble startCpu;
+  gint64 startPosition;
+
+  RateResult results[G_N_ELEMENTS (rates)];
+  guint count;
+};
+
+static gint64 query_position (RateSweep *sweep) {
+  gint64 position = -1;
+
+  gst_element_query_position (sweep->pipeline, GST_FORMAT_TIME, &position);
+  return position;
+}
+
+static gboolean next_rate_cb (RateSweep *sweep);
+
+static gboolean measure_end_cb (RateSweep *sweep) {
+  RateResult *result = &sweep->results[sweep->count++];
+  gdouble wall = (g_get_monotonic_time () - sweep->startTime) / (gdouble)G_USEC_PER_SEC;
+  gint64 position = query_position (sweep);
+
+  result->rate = rates[sweep->index];
+  result->fps = (bench_get_frames (sweep->bench) - sweep->startFrames) / wall;
+  result->cpuPercent = 100.0 * (bench_get_cpu_time (sweep->bench) - sweep->startCpu) / wall;
+  result->speed = position >= 0 && sweep->startPosition >= 0 ?
+      (position - sweep->startPosition) / (gdouble)GST_SECOND / wall : 0.0;
+  LOGI ("Rate %.2f: %.1f fps, %.1f%% CPU, %.2fx media speed", result->rate, result->fps, result->cpuPercent,
+      result->speed);
+
+  sweep->index++;
+  sweep->timeoutId = 0;
+  next_rate_cb (sweep);
+  return G_SOURCE_REMOVE;
+}
+
+static gboolean measure_start_cb (RateSweep *sweep) {
+  sweep->startTime = g_get_monotonic_time ();
+  sweep->startFrames = bench_get_frames (sweep->bench);
+  sweep->startCpu = bench_get_cpu_time (sweep->bench);
+  sweep->startPosition = query_position (sweep);
+  sweep->timeoutId = g_timeout_add (RATE_SWEEP_PERIOD_MS, (GSourceFunc)measure_end_cb, sweep);
+  return G_SOURCE_REMOVE;
+}
+
+static gboolean next_rate_cb (RateSweep *sweep) {
+  gint64 duration = 0;
+  gdouble rate;
+
+  if (sweep->index == G_N_ELEMENTS (rates)) {
+    seek_scheduler_set_rate (sweep->seeker, 1.0);
+    sweep->done (sweep->userData);
+    return G_SOURCE_REMOVE;
+  }
+
+  /* Forward rates start from the beginning, reverse ones from the end, so every rate
+   * has the same room to run */
+  rate = rates[sweep->index];
+  seek_scheduler_set_rate (sweep->seeker, rate);
+  if (rate < 0 && !gst_element_query_duration (sweep->pipeline, GST_FORMAT_TIME, &duration)) {
+    LOGD ("Could not query duration, reverse rates start where playback is");
+  } else {
+    seek_scheduler_seek (sweep->seeker, rate < 0 ? duration : 0, FALSE);
+  }
+  sweep->timeoutId = g_timeout_add (RATE_SWEEP_SETTLE_MS, (GSourceFunc)measure_start_cb, sweep);
+  return G_SOURCE_REMOVE;
+}
+
+RateSweep *rate_sweep_new (GstElement *pipeline, SeekScheduler *seeker, BenchData *bench,
+    RateSweepDoneFunc done, gpointer user_data) {
+  RateSweep *sweep = g_new0 (RateSweep, 1);
+
+  sweep->pipeline = pipeline;
+  sweep->seeker = seeker;
+  sweep->bench = bench;
+  sweep->done = done;
+  sweep->userData = user_data;
+  return sweep;
+}
+
+void rate_sweep_free (RateSweep *sweep) {
+  if (NULL == sweep)
+    return;
+  if (sweep->timeoutId)
+    g_source_remove (sweep->timeoutId);
+  g_free (sweep);
+}
+
+void rate_sweep_start (RateSweep *sweep) {
+  if (NULL == sweep || sweep->started)
+    return;
+  sweep->started = TRUE;
+  next_rate_cb (sweep);
+}
+
+void rate_sweep_append_json (GString *out, gdouble wall, RateSweep *sweep) {
+  guint i;
+
+  g_string_append_c (out, '[');
+  for (i = 0; i < sweep->count; i++) {
+    g_string_append_printf (out, "%s\n    { \"rate\": %.2f, \"fps\": %.1f, \"cpu_percent\": %.1f, \"speed\": %.2f }",
+        i ? "," : "", sweep->results[i].rate, sweep->results[i].fps, sweep->results[i].cpuPercent,
+        sweep->results[i].speed);
+  }
+  g_string_append (out, sweep->count ? "\n  ]" : "]");
+}
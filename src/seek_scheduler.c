@@ -0,0 +1,391 @@
+#include <gst/gst.h>
+
+#include "seek_scheduler.h"
+#include "log.h"
+
+struct _SeekScheduler {
+  GstElement *pipeline;
+  SeekFlagsFunc flagsFunc;
+  gpointer userData;
+
+  gboolean inFlight;              /* A flushing seek waits for ASYNC_DONE */
+  gint64 inFlightTarget;
+  gint64 inFlightStart;           /* Monotonic time it was issued */
+  gint64 refineTarget;            /* Accurate seek to follow the in flight one, -1 if none */
+
+  gboolean pending;               /* A request is waiting for the in flight seek */
+  gint64 pendingTarget;
+  gboolean pendingScrubbing;
+
+  gint64 lastTarget;              /* Target of the latest request, for scrub_end */
+  gboolean lastScrubbing;
+
+  gdouble rate;                   /* Playback rate every seek is made at */
+  gint pendingStep;               /* Frames to step once the in flight seek is done */
+  gint64 loopStart;               /* A-B loop bounds, -1 when not looping */
+  gint64 loopStop;
+  gboolean keyframesOnly;         /* Held by the QoS controller, every seek is keyframe only */
+
+  /* Instrumentation */
+  guint requested;
+  guint issued;
+  guint coalesced;
+  gint64 latencyTotal;            /* Sum of completed seek latencies, microseconds */
+  gint64 latencyMax;
+  guint completed;
+  guint instantRateChanges;
+  guint steps;
+  guint loopWraps;
+};
+
+SeekScheduler *seek_scheduler_new (GstElement *pipeline, SeekFlagsFunc flagsFunc, gpointer user_data) {
+  SeekScheduler *sched = g_new0 (SeekScheduler, 1);
+
+  sched->pipeline = gst_object_ref (pipeline);
+  sched->flagsFunc = flagsFunc;
+  sched->userData = user_data;
+  sched->lastTarget = -1;
+  sched->refineTarget = -1;
+  sched->rate = 1.0;
+  sched->loopStart = sched->loopStop = -1;
+  return sched;
+}
+
+void seek_scheduler_free (SeekScheduler *sched) {
+  if (NULL == sched)
+    return;
+  seek_scheduler_log_stats (sched);
+  gst_object_unref (sched->pipeline);
+  g_free (sched);
+}
+
+static GstSeekFlags trick_flags (gdouble rate) {
+  if (ABS (rate) > SEEK_SCHEDULER_TRICKMODE_RATE)
+    return GST_SEEK_FLAG_TRICKMODE | GST_SEEK_FLAG_TRICKMODE_KEY_UNITS | GST_SEEK_FLAG_TRICKMODE_NO_AUDIO;
+  return 0;
+}
+
+/* Trick mode flags every seek of the current segment is made with */
+static GstSeekFlags segment_flags (SeekScheduler *sched, gdouble rate) {
+  GstSeekFlags flags = trick_flags (rate);
+
+  if (sched->keyframesOnly)
+    flags |= GST_SEEK_FLAG_TRICKMODE | GST_SEEK_FLAG_TRICKMODE_KEY_UNITS;
+  return flags;
+}
+
+/* Audio is dropped in trick modes; muting also covers instant rate changes, which
+ * can't change the trick mode flags, and reverse playback */
+static void update_mute (SeekScheduler *sched) {
+  if (g_object_class_find_property (G_OBJECT_GET_CLASS (sched->pipeline), "mute")) {
+    g_object_set (sched->pipeline, "mute", 0 != trick_flags (sched->rate) || sched->rate < 0, NULL);
+  }
+}
+
+void seek_scheduler_set_pipeline (SeekScheduler *sched, GstElement *pipeline) {
+  /* Whatever was outstanding was for the old pipeline; its ASYNC_DONE won't come */
+  sched->inFlight = FALSE;
+  sched->pending = FALSE;
+  sched->pendingStep = 0;
+  sched->lastTarget = -1;
+  sched->refineTarget = -1;
+  sched->loopStart = sched->loopStop = -1;
+  sched->keyframesOnly = FALSE;
+  gst_object_replace ((GstObject **)&sched->pipeline, GST_OBJECT (pipeline));
+  sched->rate = 1.0;
+  update_mute (sched);
+}
+
+static void send_step (SeekScheduler *sched, gint frames) {
+  /* playsink hands buffer steps to the video sink only */
+  if (gst_element_send_event (sched->pipeline, gst_event_new_step (GST_FORMAT_BUFFERS, ABS (frames), ABS (sched->rate),
+      TRUE, FALSE))) {
+    sched->steps++;
+  } else {
+    LOGD ("Step of %d frames failed", frames);
+  }
+}
+
+/* refining: the accurate seek following a keyframe one, flags aren't asked for */
+static void issue_seek (SeekScheduler *sched, gint64 position, gboolean scrubbing, gboolean refining) {
+  GstSeekFlags flags;
+  GstSeekType stopType = GST_SEEK_TYPE_NONE;
+  gint64 start, stop = GST_CLOCK_TIME_NONE, refine = -1;
+
+  if (scrubbing) {
+    /* Keyframes only while the user is dragging, the accurate seek comes on release */
+    flags = GST_SEEK_FLAG_FLUSH | GST_SEEK_FLAG_KEY_UNIT | GST_SEEK_FLAG_SNAP_NEAREST |
+        GST_SEEK_FLAG_TRICKMODE | GST_SEEK_FLAG_TRICKMODE_KEY_UNITS;
+  } else if (sched->keyframesOnly) {
+    /* Only keyframes are decoded: an accurate seek would show nothing until the next one */
+    flags = GST_SEEK_FLAG_FLUSH | GST_SEEK_FLAG_KEY_UNIT | GST_SEEK_FLAG_SNAP_NEAREST;
+  } else if (sched->flagsFunc && !refining) {
+    flags = sched->flagsFunc (&position, &refine, sched->userData);
+  } else {
+    flags = GST_SEEK_FLAG_FLUSH | GST_SEEK_FLAG_ACCURATE;
+  }
+
+  flags |= segment_flags (sched, sched->rate);
+  start = position;
+
+  /* Inside a loop, segments end on its bounds and post SEGMENT_DONE there */
+  if (sched->loopStart >= 0) {
+    flags |= GST_SEEK_FLAG_SEGMENT;
+    position = CLAMP (position, sched->loopStart, sched->loopStop);
+    start = position;
+    stop = sched->loopStop;
+    stopType = GST_SEEK_TYPE_SET;
+  }
+  /* Reverse playback runs from position back to the start (of the loop) */
+  if (sched->rate < 0) {
+    start = MAX (sched->loopStart, 0);
+    stop = position;
+    stopType = GST_SEEK_TYPE_SET;
+  }
+
+  if (!gst_element_seek (sched->pipeline, sched->rate, GST_FORMAT_TIME, flags, GST_SEEK_TYPE_SET, start,
+      stopType, stop)) {
+    /* Not prerolled yet or not seekable; no ASYNC_DONE will follow */
+    LOGD ("Seek to %" GST_TIME_FORMAT " failed", GST_TIME_ARGS (position));
+    sched->inFlight = FALSE;
+    sched->refineTarget = -1;
+    return;
+  }
+
+  sched->issued++;
+  sched->refineTarget = refine;
+  sched->inFlight = TRUE;
+  sched->inFlightTarget = position;
+  sched->inFlightStart = g_get_monotonic_time ();
+}
+
+/* Drops an in flight seek whose ASYNC_DONE never came; returns TRUE if there was one */
+static gboolean expire_lost_seek (SeekScheduler *sched) {
+  if (!sched->inFlight || g_get_monotonic_time () - sched->inFlightStart <= SEEK_SCHEDULER_TIMEOUT)
+    return FALSE;
+  LOGD ("Seek to %" GST_TIME_FORMAT " never completed, dropping it", GST_TIME_ARGS (sched->inFlightTarget));
+  sched->inFlight = FALSE;
+  sched->refineTarget = -1;
+  return TRUE;
+}
+
+void seek_scheduler_seek (SeekScheduler *sched, gint64 position, gboolean scrubbing) {
+  if (position < 0)
+    position = 0;
+
+  sched->requested++;
+  sched->lastTarget = position;
+  sched->lastScrubbing = scrubbing;
+
+  if (expire_lost_seek (sched) && sched->pending) {
+    /* This request replaces the one that was waiting on the lost seek */
+    sched->pending = FALSE;
+    sched->coalesced++;
+  }
+
+  if (sched->inFlight) {
+    if (sched->pending) {
+      /* The older pending request is never issued */
+      sched->coalesced++;
+    }
+    sched->pending = TRUE;
+    sched->pendingTarget = position;
+    sched->pendingScrubbing = scrubbing;
+    return;
+  }
+
+  issue_seek (sched, position, scrubbing, FALSE);
+}
+
+gint64 seek_scheduler_get_target (SeekScheduler *sched) {
+  /* Polled by the UI, so a lost seek doesn't keep the position frozen until the next
+   * request; one that was waiting on it goes out now */
+  if (expire_lost_seek (sched) && sched->pending) {
+    sched->pending = FALSE;
+    issue_seek (sched, sched->pendingTarget, sched->pendingScrubbing, FALSE);
+  }
+  if (sched->pending)
+    return sched->pendingTarget;
+  if (sched->inFlight)
+    return sched->refineTarget >= 0 ? sched->refineTarget : sched->inFlightTarget;
+  return -1;
+}
+
+void seek_scheduler_seek_relative (SeekScheduler *sched, gint64 delta) {
+  gint64 base = seek_scheduler_get_target (sched);
+  gint64 duration = -1;
+
+  /* Held arrow keys accumulate on the outstanding target instead of the stale position */
+  if (base < 0 && !gst_element_query_position (sched->pipeline, GST_FORMAT_TIME, &base)) {
+    LOGD ("Failed to get position");
+    return;
+  }
+
+  base += delta;
+  if (gst_element_query_duration (sched->pipeline, GST_FORMAT_TIME, &duration) && duration > 0 && base > duration)
+    base = duration;
+  seek_scheduler_seek (sched, base, FALSE);
+}
+
+void seek_scheduler_scrub_end (SeekScheduler *sched) {
+  if (sched->lastTarget < 0 || !sched->lastScrubbing)
+    return;
+  seek_scheduler_seek (sched, sched->lastTarget, FALSE);
+}
+
+gint64 seek_scheduler_async_done (SeekScheduler *sched) {
+  gint64 latency;
+
+  if (!sched->inFlight)
+    return -1;
+
+  latency = g_get_monotonic_time () - sched->inFlightStart;
+  sched->inFlight = FALSE;
+  sched->completed++;
+  sched->latencyTotal += latency;
+  if (latency > sched->latencyMax)
+    sched->latencyMax = latency;
+  LOGD ("Seek to %" GST_TIME_FORMAT " displayed after %.1f ms", GST_TIME_ARGS (sched->inFlightTarget), latency / 1000.0);
+
+  if (sched->pending) {
+    /* A newer request replaces the accurate follow-up too */
+    sched->pending = FALSE;
+    issue_seek (sched, sched->pendingTarget, sched->pendingScrubbing, FALSE);
+  } else if (sched->refineTarget >= 0) {
+    issue_seek (sched, sched->refineTarget, FALSE, TRUE);
+  } else if (sched->pendingStep) {
+    send_step (sched, sched->pendingStep);
+    sched->pendingStep = 0;
+  }
+  return latency;
+}
+
+/* Where a seek made now should start from */
+static gboolean current_position (SeekScheduler *sched, gint64 *position) {
+  *position = seek_scheduler_get_target (sched);
+  return *position >= 0 || gst_element_query_position (sched->pipeline, GST_FORMAT_TIME, position);
+}
+
+void seek_scheduler_set_rate (SeekScheduler *sched, gdouble rate) {
+  gdouble old = sched->rate;
+  gint64 position;
+
+  if (rate == old || 0.0 == rate)
+    return;
+  sched->rate = rate;
+  update_mute (sched);
+  LOGD ("Playback rate %.2f -> %.2f", old, rate);
+
+#if GST_CHECK_VERSION (1, 18, 0)
+  /* Same direction and trick mode: the running segment just changes its rate, no flush */
+  if (!sched->inFlight && (rate > 0) == (old > 0) && trick_flags (rate) == trick_flags (old) &&
+      gst_element_seek (sched->pipeline, rate, GST_FORMAT_TIME, GST_SEEK_FLAG_INSTANT_RATE_CHANGE | segment_flags (sched, rate),
+          GST_SEEK_TYPE_NONE, GST_CLOCK_TIME_NONE, GST_SEEK_TYPE_NONE, GST_CLOCK_TIME_NONE)) {
+    sched->instantRateChanges++;
+    return;
+  }
+#endif
+
+  if (!current_position (sched, &position)) {
+    LOGD ("Failed to get position");
+    return;
+  }
+  seek_scheduler_seek (sched, position, FALSE);
+}
+
+gdouble seek_scheduler_get_rate (SeekScheduler *sched) {
+  return sched->rate;
+}
+
+void seek_scheduler_set_keyframes_only (SeekScheduler *sched, gboolean keyframesOnly) {
+  gint64 position;
+
+  if (keyframesOnly == sched->keyframesOnly)
+    return;
+  sched->keyframesOnly = keyframesOnly;
+  LOGD ("Keyframe only seeks %s", keyframesOnly ? "held" : "released");
+  if (!current_position (sched, &position)) {
+    LOGD ("Failed to get position");
+    return;
+  }
+  seek_scheduler_seek (sched, position, FALSE);
+}
+
+void seek_scheduler_step (SeekScheduler *sched, gint frames) {
+  gint64 position;
+
+  if (0 == frames)
+    return;
+  if ((frames > 0) != (sched->rate > 0)) {
+    /* Steps go the way of the segment: turn it around first, without a trick mode */
+    if (!current_position (sched, &position)) {
+      LOGD ("Failed to get position");
+      return;
+    }
+    sched->rate = frames > 0 ? 1.0 : -1.0;
+    update_mute (sched);
+    seek_scheduler_seek (sched, position, FALSE);
+  }
+  if (sched->inFlight) {
+    sched->pendingStep += frames;
+    return;
+  }
+  send_step (sched, frames);
+}
+
+void seek_scheduler_set_loop (SeekScheduler *sched, gint64 start, gint64 stop) {
+  gint64 position;
+
+  if (start >= 0 && stop <= start) {
+    LOGD ("Empty loop %" GST_TIME_FORMAT " - %" GST_TIME_FORMAT " ignored", GST_TIME_ARGS (start),
+        GST_TIME_ARGS (stop));
+    return;
+  }
+  if (start < 0) {
+    if (sched->loopStart < 0)
+      return;
+    sched->loopStart = sched->loopStop = -1;
+    /* A plain seek drops the segment flag and the stop position */
+    if (current_position (sched, &position)) {
+      seek_scheduler_seek (sched, position, FALSE);
+    }
+    return;
+  }
+
+  LOGD ("Looping %" GST_TIME_FORMAT " - %" GST_TIME_FORMAT, GST_TIME_ARGS (start), GST_TIME_ARGS (stop));
+  sched->loopStart = start;
+  sched->loopStop = stop;
+  seek_scheduler_seek (sched, sched->rate < 0 ? stop : start, FALSE);
+}
+
+gboolean seek_scheduler_get_loop (SeekScheduler *sched, gint64 *start, gint64 *stop) {
+  *start = sched->loopStart;
+  *stop = sched->loopStop;
+  return sched->loopStart >= 0;
+}
+
+gboolean seek_scheduler_segment_done (SeekScheduler *sched) {
+  GstSeekFlags flags = GST_SEEK_FLAG_SEGMENT | segment_flags (sched, sched->rate) |
+      (sched->keyframesOnly ? GST_SEEK_FLAG_KEY_UNIT : GST_SEEK_FLAG_ACCURATE);
+
+  if (sched->loopStart < 0)
+    return FALSE;
+  /* A flushing seek on its way starts a segment of its own */
+  if (sched->inFlight)
+    return TRUE;
+
+  if (!gst_element_seek (sched->pipeline, sched->rate, GST_FORMAT_TIME, flags, GST_SEEK_TYPE_SET, sched->loopStart,
+      GST_SEEK_TYPE_SET, sched->loopStop)) {
+    LOGD ("Loop seek failed");
+    return FALSE;
+  }
+  sched->loopWraps++;
+  return TRUE;
+}
+
+void seek_scheduler_log_stats (SeekScheduler *sched) {
+  LOGD ("Seeks requested:%u issued:%u coalesced:%u completed:%u avg latency:%.1f ms max:%.1f ms, "
+      "instant rate changes:%u, steps:%u, loop wraps:%u", sched->requested, sched->issued, sched->coalesced, sched->completed,
+      sched->completed ? sched->latencyTotal / 1000.0 / sched->completed : 0.0, sched->latencyMax / 1000.0,
+      sched->instantRateChanges, sched->steps, sched->loopWraps);
+}
@@ -0,0 +1,116 @@
+#include <stdio.h>
+
+#include <gst/gst.h>
+
+#include "startup_trace.h"
+#include "bench.h"
+#include "log.h"
+
+#define STARTUP_TRACE_FIRST_FRAME "first_frame"
+
+typedef struct _StartupPhase {
+  const gchar *name;              /* Static string given to startup_trace_mark */
+  gint64 time;                    /* Monotonic, in microseconds */
+} StartupPhase;
+
+struct _StartupTrace {
+  gint64 startTime;               /* Monotonic time main() started */
+  gboolean print;
+  GMutex lock;                    /* Protects phases and idleId, marked from streaming threads */
+  GArray *phases;                 /* StartupPhase, in the order they happened */
+  guint idleId;                   /* Pending print of the finished trace */
+};
+
+StartupTrace *startup_trace_new (gint64 startTime, gboolean print) {
+  StartupTrace *trace = g_new0 (StartupTrace, 1);
+
+  trace->startTime = startTime;
+  trace->print = print;
+  g_mutex_init (&trace->lock);
+  trace->phases = g_array_new (FALSE, FALSE, sizeof (StartupPhase));
+  return trace;
+}
+
+void startup_trace_free (StartupTrace *trace) {
+  if (NULL == trace)
+    return;
+  if (trace->idleId)
+    g_source_remove (trace->idleId);
+  g_array_free (trace->phases, TRUE);
+  g_mutex_clear (&trace->lock);
+  g_free (trace);
+}
+
+static void append_phases (GString *out, StartupTrace *trace) {
+  guint i;
+
+  g_string_append (out, "{");
+  for (i = 0; i < trace->phases->len; i++) {
+    StartupPhase *phase = &g_array_index (trace->phases, StartupPhase, i);
+
+    g_string_append_printf (out, "%s ", i ? "," : "");
+    bench_json_append_string (out, phase->name);
+    g_string_append_printf (out, ": %.1f", (phase->time - trace->startTime) / 1000.0);
+  }
+  g_string_append (out, " }");
+}
+
+/* Runs on the main loop, so the trace doesn't interleave with a streaming thread */
+static gboolean print_cb (StartupTrace *trace) {
+  GString *out = g_string_new ("{ \"startup_ms\": ");
+
+  g_mutex_lock (&trace->lock);
+  trace->idleId = 0;
+  append_phases (out, trace);
+  g_mutex_unlock (&trace->lock);
+  g_string_append (out, " }\n");
+  fputs (out->str, stdout);
+  fflush (stdout);
+  g_string_free (out, TRUE);
+  return G_SOURCE_REMOVE;
+}
+
+void startup_trace_mark (StartupTrace *trace, const char *phase) {
+  StartupPhase mark = { phase, g_get_monotonic_time () };
+  guint i;
+
+  if (NULL == trace)
+    return;
+  g_mutex_lock (&trace->lock);
+  for (i = 0; i < trace->phases->len; i++) {
+    if (!g_strcmp0 (g_array_index (trace->phases, StartupPhase, i).name, phase)) {
+      g_mutex_unlock (&trace->lock);
+      return;
+    }
+  }
+  g_array_append_val (trace->phases, mark);
+  if (!g_strcmp0 (phase, STARTUP_TRACE_FIRST_FRAME)) {
+    LOGI ("Time to first frame: %" G_GINT64_FORMAT " ms", (mark.time - trace->startTime) / 1000);
+    if (trace->print)
+      trace->idleId = g_idle_add ((GSourceFunc)print_cb, trace);
+  }
+  g_mutex_unlock (&trace->lock);
+}
+
+static GstPadProbeReturn first_frame_probe_cb (GstPad *pad, GstPadProbeInfo *info, StartupTrace *trace) {
+  startup_trace_mark (trace, STARTUP_TRACE_FIRST_FRAME);
+  return GST_PAD_PROBE_REMOVE;
+}
+
+void startup_trace_watch_video_sink (StartupTrace *trace, GstElement *sink) {
+  GstPad *pad;
+
+  if (NULL == trace)
+    return;
+  pad = gst_element_get_static_pad (sink, "sink");
+  if (NULL == pad)
+    return;
+  gst_pad_add_probe (pad, GST_PAD_PROBE_TYPE_BUFFER, (GstPadProbeCallback)first_frame_probe_cb, trace, NULL);
+  gst_object_unref (pad);
+}
+
+void startup_trace_append_json (GString *out, gdouble wall, StartupTrace *trace) {
+  g_mutex_lock (&trace->lock);
+  append_phases (out, trace);
+  g_mutex_unlock (&trace->lock);
+}
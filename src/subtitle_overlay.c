@@ -0,0 +1,386 @@
+#include <string.h>
+
+#include <gst/gst.h>
+#include <gst/video/video.h>
+#include <pango/pangocairo.h>
+
+#include "subtitle_overlay.h"
+#include "log.h"
+
+typedef struct _Cue {
+  guint64 id;                     /* Cache key; pointers get reused */
+  gchar *markup;
+  GstClockTime start;             /* Running time span */
+  GstClockTime end;
+} Cue;
+
+struct _SubtitleOverlay {
+  GstElement *playbin;
+  GstElement *textSink;
+  GstElement *videoSink;
+
+  GMutex lock;                    /* Protects the cues, the window size and the cache */
+  GQueue cues;                    /* Cue, in start order */
+  guint64 nextId;
+  gint windowWidth;               /* 0 until known */
+  gint windowHeight;
+
+  GstSegment textSegment;         /* Text sink streaming thread only */
+  gboolean markup;                /* Cues are Pango markup rather than plain text */
+
+  GstSegment videoSegment;        /* Video sink streaming thread only */
+  GstVideoInfo videoInfo;
+  gboolean haveInfo;
+  gboolean sinkTakesMeta;         /* The sink composites overlay composition metas itself */
+
+  guint64 cachedId;               /* What the cached composition shows... */
+  gint cachedWidth;               /* ...and the output size it was drawn for */
+  gint cachedHeight;
+  GstVideoOverlayComposition *composition;
+
+  guint cueCount;
+  guint renders;
+  gint64 renderTime;              /* Spent rasterizing, in microseconds */
+  guint64 metaFrames;
+  guint64 blendedFrames;
+};
+
+static void cue_free (Cue *cue) {
+  g_free (cue->markup);
+  g_free (cue);
+}
+
+static void clear_cues (SubtitleOverlay *overlay) {
+  Cue *cue;
+
+  g_mutex_lock (&overlay->lock);
+  while ((cue = g_queue_pop_head (&overlay->cues)))
+    cue_free (cue);
+  g_mutex_unlock (&overlay->lock);
+}
+
+static void add_cue (SubtitleOverlay *overlay, GstBuffer *buffer) {
+  GstClockTime pts = GST_BUFFER_PTS (buffer);
+  GstClockTime duration = GST_BUFFER_DURATION_IS_VALID (buffer) ? GST_BUFFER_DURATION (buffer) :
+      SUBTITLE_OVERLAY_DEFAULT_DURATION;
+  GstMapInfo map;
+  gchar *text;
+  Cue *cue;
+
+  if (!GST_CLOCK_TIME_IS_VALID (pts) || !gst_buffer_map (buffer, &map, GST_MAP_READ))
+    return;
+  text = g_strstrip (g_strndup ((const gchar *)map.data, map.size));
+  gst_buffer_unmap (buffer, &map);
+  if ('\0' == *text) {
+    g_free (text);
+    return;
+  }
+
+  cue = g_new0 (Cue, 1);
+  cue->markup = overlay->markup ? text : g_markup_escape_text (text, -1);
+  if (!overlay->markup)
+    g_free (text);
+  cue->start = gst_segment_to_running_time (&overlay->textSegment, GST_FORMAT_TIME, pts);
+  cue->end = gst_segment_to_running_time (&overlay->textSegment, GST_FORMAT_TIME, pts + duration);
+  if (!GST_CLOCK_TIME_IS_VALID (cue->start)) {
+    cue_free (cue);
+    return;
+  }
+  if (!GST_CLOCK_TIME_IS_VALID (cue->end))
+    cue->end = cue->start + duration;
+
+  g_mutex_lock (&overlay->lock);
+  cue->id = ++overlay->nextId;
+  g_queue_push_tail (&overlay->cues, cue);
+  overlay->cueCount++;
+  g_mutex_unlock (&overlay->lock);
+}
+
+static GstPadProbeReturn text_probe_cb (GstPad *pad, GstPadProbeInfo *info, SubtitleOverlay *overlay) {
+  GstEvent *event;
+  GstCaps *caps;
+
+  if (!GST_IS_EVENT (GST_PAD_PROBE_INFO_DATA (info))) {
+    add_cue (overlay, GST_PAD_PROBE_INFO_BUFFER (info));
+    return GST_PAD_PROBE_OK;
+  }
+
+  event = GST_PAD_PROBE_INFO_EVENT (info);
+  switch (GST_EVENT_TYPE (event)) {
+    case GST_EVENT_CAPS:
+      gst_event_parse_caps (event, &caps);
+      overlay->markup = !g_strcmp0 (gst_structure_get_string (gst_caps_get_structure (caps, 0), "format"),
+          "pango-markup");
+      break;
+    case GST_EVENT_SEGMENT:
+      gst_event_copy_segment (event, &overlay->textSegment);
+      break;
+    case GST_EVENT_FLUSH_STOP:
+      /* A seek: the text stream resends what is due from the new position */
+      clear_cues (overlay);
+      break;
+    default:
+      break;
+  }
+  return GST_PAD_PROBE_OK;
+}
+
+SubtitleOverlay *subtitle_overlay_new (GstElement *playbin) {
+  SubtitleOverlay *overlay = g_new0 (SubtitleOverlay, 1);
+  GstPad *pad;
+
+  overlay->playbin = gst_object_ref (playbin);
+  g_mutex_init (&overlay->lock);
+  g_queue_init (&overlay->cues);
+  gst_segment_init (&overlay->textSegment, GST_FORMAT_TIME);
+  gst_segment_init (&overlay->videoSegment, GST_FORMAT_TIME);
+
+  /* Cues are collected ahead of time and matched against frames by running time, so
+   * the text sink neither waits for the clock nor holds up preroll */
+  overlay->textSink = gst_element_factory_make ("fakesink", "textsink");
+  g_object_set (overlay->textSink, "sync", FALSE, "async", FALSE, NULL);
+  pad = gst_element_get_static_pad (overlay->textSink, "sink");
+  gst_pad_add_probe (pad, GST_PAD_PROBE_TYPE_BUFFER | GST_PAD_PROBE_TYPE_EVENT_DOWNSTREAM |
+      GST_PAD_PROBE_TYPE_EVENT_FLUSH, (GstPadProbeCallback)text_probe_cb, overlay, NULL);
+  gst_object_unref (pad);
+  g_object_set (playbin, "text-sink", overlay->textSink, NULL);
+  return overlay;
+}
+
+void subtitle_overlay_free (SubtitleOverlay *overlay) {
+  if (NULL == overlay)
+    return;
+  LOGD ("Subtitles: %u cues, %u renders (%.2f ms avg), %" G_GUINT64_FORMAT " frames with a meta, %"
+      G_GUINT64_FORMAT " blended", overlay->cueCount, overlay->renders,
+      overlay->renders ? overlay->renderTime / 1000.0 / overlay->renders : 0.0, overlay->metaFrames,
+      overlay->blendedFrames);
+  clear_cues (overlay);
+  if (overlay->composition)
+    gst_video_overlay_composition_unref (overlay->composition);
+  if (overlay->videoSink)
+    gst_object_unref (overlay->videoSink);
+  g_mutex_clear (&overlay->lock);
+  gst_object_unref (overlay->playbin);
+  g_free (overlay);
+}
+
+void subtitle_overlay_set_window_size (SubtitleOverlay *overlay, gint width, gint height) {
+  if (NULL == overlay)
+    return;
+  g_mutex_lock (&overlay->lock);
+  overlay->windowWidth = width;
+  overlay->windowHeight = height;
+  g_mutex_unlock (&overlay->lock);
+}
+
+/* Draws the cue's text centred on a shaded box, for an output of width x height pixels
+ * showing the video scaled by scale, and places it at the bottom of the video */
+static GstVideoOverlayComposition *render (const gchar *markup, gint width, gint height, gdouble scale) {
+  gint fontSize = MAX (8, (gint)(height * SUBTITLE_OVERLAY_FONT_SCALE));
+  gint pad = fontSize / 4;
+  PangoFontDescription *desc;
+  PangoContext *context;
+  PangoLayout *layout;
+  PangoRectangle logical;
+  cairo_surface_t *surface;
+  cairo_t *cr;
+  GstVideoOverlayRectangle *rect;
+  GstVideoOverlayComposition *composition;
+  GstBuffer *buffer;
+  gint boxWidth, boxHeight, stride;
+  gsize offset[GST_VIDEO_MAX_PLANES] = { 0 };
+  gint strides[GST_VIDEO_MAX_PLANES] = { 0 };
+
+  context = pango_font_map_create_context (pango_cairo_font_map_get_default ());
+  layout = pango_layout_new (context);
+  desc = pango_font_description_from_string (SUBTITLE_OVERLAY_FONT);
+  pango_font_description_set_absolute_size (desc, fontSize * PANGO_SCALE);
+  pango_layout_set_font_description (layout, desc);
+  pango_font_description_free (desc);
+  pango_layout_set_width (layout, (gint)(width * 0.9) * PANGO_SCALE);
+  pango_layout_set_wrap (layout, PANGO_WRAP_WORD_CHAR);
+  pango_layout_set_alignment (layout, PANGO_ALIGN_CENTER);
+  pango_layout_set_markup (layout, markup, -1);
+  pango_layout_get_pixel_extents (layout, NULL, &logical);
+
+  boxWidth = MIN (logical.width + 2 * pad, width);
+  boxHeight = MIN (logical.height + 2 * pad, height);
+  surface = cairo_image_surface_create (CAIRO_FORMAT_ARGB32, boxWidth, boxHeight);
+  cr = cairo_create (surface);
+  /* What textoverlay's shaded-background gave, drawn once per cue instead of per frame */
+  cairo_set_source_rgba (cr, 0, 0, 0, 0.5);
+  cairo_paint (cr);
+  cairo_move_to (cr, pad - logical.x, pad - logical.y);
+  cairo_set_source_rgb (cr, 1, 1, 1);
+  pango_cairo_update_layout (cr, layout);
+  pango_cairo_show_layout (cr, layout);
+  cairo_destroy (cr);
+  cairo_surface_flush (surface);
+  g_object_unref (layout);
+  g_object_unref (context);
+
+  /* Premultiplied ARGB32 is BGRA in memory on little endian, the composition's native format */
+  stride = cairo_image_surface_get_stride (surface);
+  strides[0] = stride;
+  buffer = gst_buffer_new_wrapped_full (GST_MEMORY_FLAG_READONLY, cairo_image_surface_get_data (surface),
+      (gsize)stride * boxHeight, 0, (gsize)stride * boxHeight, surface, (GDestroyNotify)cairo_surface_destroy);
+  gst_buffer_add_video_meta_full (buffer, GST_VIDEO_FRAME_FLAG_NONE, GST_VIDEO_OVERLAY_COMPOSITION_FORMAT_RGB,
+      boxWidth, boxHeight, 1, offset, strides);
+
+  /* Rectangles are placed in video pixels; the bitmap may have more of its own */
+  rect = gst_video_overlay_rectangle_new_raw (buffer, (gint)((width - boxWidth) / 2 / scale),
+      (gint)((height - boxHeight - height * SUBTITLE_OVERLAY_MARGIN) / scale), (guint)(boxWidth / scale),
+      (guint)(boxHeight / scale), GST_VIDEO_OVERLAY_FORMAT_FLAG_PREMULTIPLIED_ALPHA);
+  gst_buffer_unref (buffer);
+  composition = gst_video_overlay_composition_new (rect);
+  gst_video_overlay_rectangle_unref (rect);
+  return composition;
+}
+
+/* The composition for the cue showing at running time, NULL when there is none */
+static GstVideoOverlayComposition *get_composition (SubtitleOverlay *overlay, GstClockTime runningTime) {
+  GstVideoOverlayComposition *composition = NULL;
+  gint videoWidth = GST_VIDEO_INFO_WIDTH (&overlay->videoInfo);
+  gint videoHeight = GST_VIDEO_INFO_HEIGHT (&overlay->videoInfo);
+  gint width = videoWidth, height = videoHeight;
+  gdouble scale = 1.0;
+  gchar *markup = NULL;
+  guint64 id = 0;
+  GList *l;
+  Cue *cue;
+  gint64 start;
+
+  g_mutex_lock (&overlay->lock);
+  /* Cues are over for good once playback is past them; seeks flush them anyway */
+  while ((cue = g_queue_peek_head (&overlay->cues)) && cue->end <= runningTime) {
+    cue_free (g_queue_pop_head (&overlay->cues));
+  }
+  for (l = overlay->cues.head; l; l = l->next) {
+    cue = l->data;
+    if (cue->start > runningTime)
+      break;
+    if (runningTime < cue->end) {
+      id = cue->id;
+      break;
+    }
+  }
+  if (0 == id) {
+    g_mutex_unlock (&overlay->lock);
+    return NULL;
+  }
+
+  /* A sink compositing the meta scales the bitmap with the video: draw it at window
+   * resolution so text stays sharp */
+  if (overlay->sinkTakesMeta && overlay->windowWidth > 0 && overlay->windowHeight > 0) {
+    scale = MIN ((gdouble)overlay->windowWidth / videoWidth, (gdouble)overlay->windowHeight / videoHeight);
+    width = (gint)(videoWidth * scale);
+    height = (gint)(videoHeight * scale);
+  }
+  if (overlay->composition && id == overlay->cachedId && width == overlay->cachedWidth &&
+      height == overlay->cachedHeight) {
+    composition = gst_video_overlay_composition_ref (overlay->composition);
+    g_mutex_unlock (&overlay->lock);
+    return composition;
+  }
+  markup = g_strdup (cue->markup);
+  g_mutex_unlock (&overlay->lock);
+
+  /* Only this thread renders; the others never wait for Pango */
+  start = g_get_monotonic_time ();
+  composition = render (markup, width, height, scale);
+  g_free (markup);
+
+  g_mutex_lock (&overlay->lock);
+  overlay->renderTime += g_get_monotonic_time () - start;
+  overlay->renders++;
+  if (overlay->composition)
+    gst_video_overlay_composition_unref (overlay->composition);
+  overlay->composition = gst_video_overlay_composition_ref (composition);
+  overlay->cachedId = id;
+  overlay->cachedWidth = width;
+  overlay->cachedHeight = height;
+  g_mutex_unlock (&overlay->lock);
+  return composition;
+}
+
+static GstBuffer *overlay_buffer (SubtitleOverlay *overlay, GstBuffer *buffer) {
+  GstVideoOverlayComposition *composition;
+  GstClockTime runningTime;
+  GstVideoFrame frame;
+
+  if (!overlay->haveInfo || !GST_BUFFER_PTS_IS_VALID (buffer))
+    return buffer;
+  runningTime = gst_segment_to_running_time (&overlay->videoSegment, GST_FORMAT_TIME, GST_BUFFER_PTS (buffer));
+  if (!GST_CLOCK_TIME_IS_VALID (runningTime) || NULL == (composition = get_composition (overlay, runningTime)))
+    return buffer;
+
+  buffer = gst_buffer_make_writable (buffer);
+  if (overlay->sinkTakesMeta) {
+    gst_buffer_add_video_overlay_composition_meta (buffer, composition);
+    overlay->metaFrames++;
+  } else if (gst_video_frame_map (&frame, &overlay->videoInfo, buffer, GST_MAP_READWRITE)) {
+    /* Touches the box only, not the whole frame */
+    gst_video_overlay_composition_blend (composition, &frame);
+    gst_video_frame_unmap (&frame);
+    overlay->blendedFrames++;
+  }
+  gst_video_overlay_composition_unref (composition);
+  return buffer;
+}
+
+static GstPadProbeReturn video_probe_cb (GstPad *pad, GstPadProbeInfo *info, SubtitleOverlay *overlay) {
+  GstEvent *event;
+  GstQuery *query;
+  GstCaps *caps;
+
+  if (GST_PAD_PROBE_INFO_TYPE (info) & GST_PAD_PROBE_TYPE_BUFFER) {
+    GST_PAD_PROBE_INFO_DATA (info) = overlay_buffer (overlay, GST_PAD_PROBE_INFO_BUFFER (info));
+    return GST_PAD_PROBE_OK;
+  }
+
+  if (GST_PAD_PROBE_INFO_TYPE (info) & GST_PAD_PROBE_TYPE_QUERY_DOWNSTREAM) {
+    query = GST_PAD_PROBE_INFO_QUERY (info);
+    /* Once the sink has answered */
+    if (GST_QUERY_ALLOCATION == GST_QUERY_TYPE (query) && (GST_PAD_PROBE_INFO_TYPE (info) & GST_PAD_PROBE_TYPE_PULL)) {
+      overlay->sinkTakesMeta = gst_query_find_allocation_meta (query, GST_VIDEO_OVERLAY_COMPOSITION_META_API_TYPE,
+          NULL);
+      LOGD ("%s %s overlay composition metas", GST_OBJECT_NAME (overlay->videoSink),
+          overlay->sinkTakesMeta ? "takes" : "doesn't take, subtitles are blended into");
+    }
+    return GST_PAD_PROBE_OK;
+  }
+
+  event = GST_PAD_PROBE_INFO_EVENT (info);
+  if (GST_EVENT_CAPS == GST_EVENT_TYPE (event)) {
+    gst_event_parse_caps (event, &caps);
+    overlay->haveInfo = gst_video_info_from_caps (&overlay->videoInfo, caps);
+  } else if (GST_EVENT_SEGMENT == GST_EVENT_TYPE (event)) {
+    gst_event_copy_segment (event, &overlay->videoSegment);
+  }
+  return GST_PAD_PROBE_OK;
+}
+
+void subtitle_overlay_watch_video_sink (SubtitleOverlay *overlay, GstElement *sink) {
+  GstPad *pad;
+
+  if (NULL == overlay || overlay->videoSink)
+    return;
+  pad = gst_element_get_static_pad (sink, "sink");
+  if (NULL == pad) {
+    LOGD ("Video sink %s has no sink pad, subtitles will not be shown", GST_OBJECT_NAME (sink));
+    return;
+  }
+  overlay->videoSink = gst_object_ref (sink);
+  gst_pad_add_probe (pad, GST_PAD_PROBE_TYPE_BUFFER | GST_PAD_PROBE_TYPE_EVENT_DOWNSTREAM |
+      GST_PAD_PROBE_TYPE_QUERY_DOWNSTREAM, (GstPadProbeCallback)video_probe_cb, overlay, NULL);
+  gst_object_unref (pad);
+}
+
+void subtitle_overlay_append_json (GString *out, gdouble wall, SubtitleOverlay *overlay) {
+  g_mutex_lock (&overlay->lock);
+  g_string_append_printf (out, "{ \"cues\": %u, \"renders\": %u, \"render_ms_avg\": %.2f, \"meta_frames\": %"
+      G_GUINT64_FORMAT ", \"blended_frames\": %" G_GUINT64_FORMAT " }", overlay->cueCount, overlay->renders,
+      overlay->renders ? overlay->renderTime / 1000.0 / overlay->renders : 0.0, overlay->metaFrames,
+      overlay->blendedFrames);
+  g_mutex_unlock (&overlay->lock);
+}
@@ -0,0 +1,350 @@
+#include <string.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+
+#include <gst/gst.h>
+#include <gst/video/video.h>
+#include <gdk-pixbuf/gdk-pixbuf.h>
+
+#include "thumbnailer.h"
+#include "log.h"
+
+#define THUMBNAIL_NICE 19                 /* Streaming threads of the thumbnail pipeline run at lowest priority */
+#define THUMBNAIL_NEIGHBOUR_SLOTS 6       /* How far a hover looks for a cached neighbour */
+#define THUMBNAIL_TIMEOUT (5 * GST_SECOND)
+#define THUMBNAIL_STATS_INTERVAL 50       /* Log stats every that many lookups */
+
+typedef struct _ThumbnailEntry {
+  gint64 slot;
+  GdkPixbuf *pixbuf;
+  gsize bytes;
+  GList *link;                            /* Position in the LRU queue */
+} ThumbnailEntry;
+
+struct _Thumbnailer {
+  gchar *uri;
+  gsize budget;                           /* Byte budget of the cache */
+  gint refs;                              /* The owner's and the worker's (atomic); the last one frees */
+
+  GMutex lock;                            /* Protects everything below */
+  GCond cond;                             /* Wakes the worker up on re-centring or exit */
+  gboolean cancelled;
+  gint64 centerSlot;
+  gint64 slotCount;                       /* Slots covering the duration, 0 until known */
+  GHashTable *entries;                    /* slot -> ThumbnailEntry */
+  GQueue lru;                             /* Most recently used first */
+  GHashTable *failed;                     /* Slots that couldn't be decoded */
+  gsize bytes;                            /* Bytes held by the cache */
+  gsize thumbBytes;                       /* Size of one thumbnail, 0 until the first one */
+
+  guint lookups;
+  guint hits;
+  guint neighbourHits;
+};
+
+static void entry_free (ThumbnailEntry *entry) {
+  g_object_unref (entry->pixbuf);
+  g_free (entry);
+}
+
+/* Lowers the priority of the streaming threads; stream-status ENTER is posted from the thread itself */
+static GstBusSyncReply bus_sync_cb (GstBus *bus, GstMessage *msg, Thumbnailer *thumbs) {
+  GstStreamStatusType type;
+  GstElement *owner;
+
+  if (GST_MESSAGE_STREAM_STATUS == GST_MESSAGE_TYPE (msg)) {
+    gst_message_parse_stream_status (msg, &type, &owner);
+    if (GST_STREAM_STATUS_TYPE_ENTER == type) {
+      setpriority (PRIO_PROCESS, (id_t)syscall (SYS_gettid), THUMBNAIL_NICE);
+    }
+  }
+  return GST_BUS_PASS;
+}
+
+/* Audio is never decoded by the thumbnail pipeline */
+static gboolean autoplug_continue_cb (GstElement *bin, GstPad *pad, GstCaps *caps, Thumbnailer *thumbs) {
+  return !g_str_has_prefix (gst_structure_get_name (gst_caps_get_structure (caps, 0)), "audio/");
+}
+
+static GstElement *create_pipeline (Thumbnailer *thumbs, GstElement **sink) {
+  gchar *desc = g_strdup_printf ("uridecodebin name=src ! videoconvert ! videoscale ! "
+      "video/x-raw,format=RGB,width=%d,pixel-aspect-ratio=1/1 ! fakesink name=sink sync=false enable-last-sample=true",
+      THUMBNAIL_WIDTH);
+  GError *err = NULL;
+  GstElement *pipeline = gst_parse_launch (desc, &err);
+  GstElement *src;
+  GstBus *bus;
+
+  g_free (desc);
+  if (NULL == pipeline) {
+    LOGD ("Could not create thumbnail pipeline: %s", err ? err->message : "unknown");
+    g_clear_error (&err);
+    return NULL;
+  }
+
+  src = gst_bin_get_by_name (GST_BIN (pipeline), "src");
+  g_object_set (src, "uri", thumbs->uri, NULL);
+  g_signal_connect (src, "autoplug-continue", G_CALLBACK (autoplug_continue_cb), thumbs);
+  gst_object_unref (src);
+  *sink = gst_bin_get_by_name (GST_BIN (pipeline), "sink");
+
+  bus = gst_element_get_bus (pipeline);
+  gst_bus_set_sync_handler (bus, (GstBusSyncHandler)bus_sync_cb, thumbs, NULL);
+  gst_object_unref (bus);
+  return pipeline;
+}
+
+/* Waits for the pipeline to preroll, after a state change or a flushing seek */
+static gboolean wait_preroll (GstElement *pipeline) {
+  GstBus *bus = gst_element_get_bus (pipeline);
+  GstMessage *msg = gst_bus_timed_pop_filtered (bus, THUMBNAIL_TIMEOUT, GST_MESSAGE_ASYNC_DONE | GST_MESSAGE_ERROR);
+  gboolean ret = (NULL != msg && GST_MESSAGE_ASYNC_DONE == GST_MESSAGE_TYPE (msg));
+
+  if (msg)
+    gst_message_unref (msg);
+  gst_object_unref (bus);
+  return ret;
+}
+
+static GdkPixbuf *sample_to_pixbuf (GstSample *sample) {
+  GstVideoInfo info;
+  GstVideoFrame frame;
+  GdkPixbuf *pixbuf;
+  guint8 *dest;
+  gint row, destStride;
+
+  if (!gst_video_info_from_caps (&info, gst_sample_get_caps (sample)) ||
+      !gst_video_frame_map (&frame, &info, gst_sample_get_buffer (sample), GST_MAP_READ))
+    return NULL;
+
+  pixbuf = gdk_pixbuf_new (GDK_COLORSPACE_RGB, FALSE, 8, GST_VIDEO_INFO_WIDTH (&info), GST_VIDEO_INFO_HEIGHT (&info));
+  dest = gdk_pixbuf_get_pixels (pixbuf);
+  destStride = gdk_pixbuf_get_rowstride (pixbuf);
+  for (row = 0; row < GST_VIDEO_INFO_HEIGHT (&info); row++) {
+    memcpy (dest + row * destStride,
+        (guint8 *)GST_VIDEO_FRAME_PLANE_DATA (&frame, 0) + row * GST_VIDEO_FRAME_PLANE_STRIDE (&frame, 0),
+        GST_VIDEO_INFO_WIDTH (&info) * 3);
+  }
+  gst_video_frame_unmap (&frame);
+  return pixbuf;
+}
+
+/* Drops least recently used thumbnails until the cache fits the budget. Called locked */
+static void evict (Thumbnailer *thumbs) {
+  while (thumbs->bytes > thumbs->budget && thumbs->lru.length > 0) {
+    ThumbnailEntry *entry = g_queue_pop_tail (&thumbs->lru);
+
+    thumbs->bytes -= entry->bytes;
+    g_hash_table_remove (thumbs->entries, &entry->slot);
+  }
+}
+
+static void insert (Thumbnailer *thumbs, gint64 slot, GdkPixbuf *pixbuf) {
+  ThumbnailEntry *entry = g_new0 (ThumbnailEntry, 1);
+
+  entry->slot = slot;
+  entry->pixbuf = pixbuf;
+  entry->bytes = (gsize)gdk_pixbuf_get_rowstride (pixbuf) * gdk_pixbuf_get_height (pixbuf);
+
+  g_mutex_lock (&thumbs->lock);
+  thumbs->thumbBytes = entry->bytes;
+  g_queue_push_head (&thumbs->lru, entry);
+  entry->link = thumbs->lru.head;
+  g_hash_table_insert (thumbs->entries, &entry->slot, entry);
+  thumbs->bytes += entry->bytes;
+  evict (thumbs);
+  g_mutex_unlock (&thumbs->lock);
+}
+
+/* Next slot to decode: the closest one to the centre that is neither cached nor
+   failed, within the radius the budget can hold. -1 if there is none. Called locked */
+static gint64 next_slot (Thumbnailer *thumbs) {
+  gint64 radius = thumbs->slotCount;
+  gint64 capacity, distance, slot;
+  int side;
+
+  if (thumbs->thumbBytes > 0) {
+    /* 2 * radius + 1 slots have to fit, or decoding one evicts another in the window
+     * and the two take turns forever */
+    capacity = (gint64)(thumbs->budget / thumbs->thumbBytes);
+    radius = capacity > 0 ? MIN (radius, (capacity - 1) / 2) : -1;
+  }
+
+  for (distance = 0; distance <= radius; distance++) {
+    for (side = 0; side < 2; side++) {
+      slot = side ? thumbs->centerSlot - distance : thumbs->centerSlot + distance;
+      if (slot < 0 || slot >= thumbs->slotCount || (side && 0 == distance))
+        continue;
+      if (!g_hash_table_contains (thumbs->entries, &slot) && !g_hash_table_contains (thumbs->failed, &slot))
+        return slot;
+    }
+  }
+  return -1;
+}
+
+static void thumbnailer_unref (Thumbnailer *thumbs) {
+  if (!g_atomic_int_dec_and_test (&thumbs->refs))
+    return;
+  g_queue_clear (&thumbs->lru);
+  g_hash_table_destroy (thumbs->entries);
+  g_hash_table_destroy (thumbs->failed);
+  g_mutex_clear (&thumbs->lock);
+  g_cond_clear (&thumbs->cond);
+  g_free (thumbs->uri);
+  g_free (thumbs);
+}
+
+static void run_thumbnails (Thumbnailer *thumbs) {
+  GstElement *pipeline, *sink = NULL;
+  gint64 duration = -1, slot;
+  GstSample *sample;
+  GdkPixbuf *pixbuf;
+
+  setpriority (PRIO_PROCESS, (id_t)syscall (SYS_gettid), THUMBNAIL_NICE);
+
+  pipeline = create_pipeline (thumbs, &sink);
+  if (NULL == pipeline)
+    return;
+
+  gst_element_set_state (pipeline, GST_STATE_PAUSED);
+  if (!wait_preroll (pipeline) || !gst_element_query_duration (pipeline, GST_FORMAT_TIME, &duration) || duration <= 0) {
+    LOGD ("Thumbnails not available for this stream");
+    goto Exit;
+  }
+
+  g_mutex_lock (&thumbs->lock);
+  thumbs->slotCount = duration / THUMBNAIL_INTERVAL + 1;
+  while (!thumbs->cancelled) {
+    slot = next_slot (thumbs);
+    if (slot < 0) {
+      /* Everything in reach is cached, sleep until re-centred */
+      g_cond_wait (&thumbs->cond, &thumbs->lock);
+      continue;
+    }
+    g_mutex_unlock (&thumbs->lock);
+
+    pixbuf = NULL;
+    if (gst_element_seek_simple (pipeline, GST_FORMAT_TIME,
+          GST_SEEK_FLAG_FLUSH | GST_SEEK_FLAG_KEY_UNIT | GST_SEEK_FLAG_SNAP_NEAREST, slot * THUMBNAIL_INTERVAL) &&
+        wait_preroll (pipeline)) {
+      g_object_get (sink, "last-sample", &sample, NULL);
+      if (sample) {
+        pixbuf = sample_to_pixbuf (sample);
+        gst_sample_unref (sample);
+      }
+    }
+
+    if (pixbuf) {
+      insert (thumbs, slot, pixbuf);
+      g_mutex_lock (&thumbs->lock);
+    } else {
+      gint64 *failedSlot = g_new (gint64, 1);
+
+      *failedSlot = slot;
+      g_mutex_lock (&thumbs->lock);
+      g_hash_table_add (thumbs->failed, failedSlot);
+    }
+  }
+  g_mutex_unlock (&thumbs->lock);
+
+Exit:
+  gst_element_set_state (pipeline, GST_STATE_NULL);
+  gst_object_unref (sink);
+  gst_object_unref (pipeline);
+}
+
+static gpointer thumbnail_thread (Thumbnailer *thumbs) {
+  run_thumbnails (thumbs);
+  thumbnailer_unref (thumbs);
+  return NULL;
+}
+
+Thumbnailer *thumbnailer_new (const char *uri, gsize budget) {
+  Thumbnailer *thumbs = g_new0 (Thumbnailer, 1);
+
+  thumbs->uri = g_strdup (uri);
+  thumbs->budget = budget;
+  g_mutex_init (&thumbs->lock);
+  g_cond_init (&thumbs->cond);
+  thumbs->entries = g_hash_table_new_full (g_int64_hash, g_int64_equal, NULL, (GDestroyNotify)entry_free);
+  thumbs->failed = g_hash_table_new_full (g_int64_hash, g_int64_equal, g_free, NULL);
+  g_queue_init (&thumbs->lru);
+  thumbs->refs = 2;
+  /* Detached: the worker drops its reference when it is done */
+  g_thread_unref (g_thread_new ("thumbnailer", (GThreadFunc)thumbnail_thread, thumbs));
+  return thumbs;
+}
+
+void thumbnailer_free (Thumbnailer *thumbs) {
+  if (NULL == thumbs)
+    return;
+
+  g_mutex_lock (&thumbs->lock);
+  thumbs->cancelled = TRUE;
+  g_cond_signal (&thumbs->cond);
+  g_mutex_unlock (&thumbs->lock);
+
+  /* Not joined: the worker may be waiting up to THUMBNAIL_TIMEOUT on a preroll, and
+   * this runs on the UI thread. It sees cancelled and frees the rest if it is last */
+  thumbnailer_log_stats (thumbs);
+  thumbnailer_unref (thumbs);
+}
+
+void thumbnailer_set_position (Thumbnailer *thumbs, gint64 position) {
+  gint64 slot = position / THUMBNAIL_INTERVAL;
+
+  g_mutex_lock (&thumbs->lock);
+  if (slot != thumbs->centerSlot) {
+    thumbs->centerSlot = slot;
+    g_cond_signal (&thumbs->cond);
+  }
+  g_mutex_unlock (&thumbs->lock);
+}
+
+GdkPixbuf *thumbnailer_lookup (Thumbnailer *thumbs, gint64 position) {
+  gint64 slot = (position + THUMBNAIL_INTERVAL / 2) / THUMBNAIL_INTERVAL;
+  gint64 distance, candidate;
+  ThumbnailEntry *entry = NULL;
+  GdkPixbuf *pixbuf = NULL;
+  gboolean logStats;
+
+  g_mutex_lock (&thumbs->lock);
+  thumbs->lookups++;
+  for (distance = 0; distance <= THUMBNAIL_NEIGHBOUR_SLOTS && NULL == entry; distance++) {
+    candidate = slot - distance;
+    entry = g_hash_table_lookup (thumbs->entries, &candidate);
+    if (NULL == entry) {
+      candidate = slot + distance;
+      entry = g_hash_table_lookup (thumbs->entries, &candidate);
+    }
+    if (entry) {
+      if (0 == distance)
+        thumbs->hits++;
+      else
+        thumbs->neighbourHits++;
+    }
+  }
+
+  if (entry) {
+    /* Most recently used goes to the head */
+    g_queue_unlink (&thumbs->lru, entry->link);
+    g_queue_push_head_link (&thumbs->lru, entry->link);
+    pixbuf = g_object_ref (entry->pixbuf);
+  }
+  logStats = (0 == thumbs->lookups % THUMBNAIL_STATS_INTERVAL);
+  g_mutex_unlock (&thumbs->lock);
+
+  if (logStats)
+    thumbnailer_log_stats (thumbs);
+  return pixbuf;
+}
+
+void thumbnailer_log_stats (Thumbnailer *thumbs) {
+  g_mutex_lock (&thumbs->lock);
+  LOGD ("Thumbnails: %u lookups, %.1f%% hits, %.1f%% neighbour hits, %u cached, %" G_GSIZE_FORMAT "/%" G_GSIZE_FORMAT " bytes",
+      thumbs->lookups, thumbs->lookups ? 100.0 * thumbs->hits / thumbs->lookups : 0.0,
+      thumbs->lookups ? 100.0 * thumbs->neighbourHits / thumbs->lookups : 0.0,
+      thumbs->lru.length, thumbs->bytes, thumbs->budget);
+  g_mutex_unlock (&thumbs->lock);
+}
@@ -0,0 +1,195 @@
+#include <string.h>
+
+#include <gio/gio.h>
+#include <gst/gst.h>
+
+#include "uri_resolver.h"
+#include "log.h"
+
+#define URI_RESOLVER_CACHE_FILE "resolved-uris.ini"
+
+struct _UriResolver {
+  gchar **argv;                   /* Resolver command line, input is appended */
+  gchar *cachePath;
+};
+
+typedef struct _ResolveRequest {
+  UriResolver *resolver;
+  gchar *input;
+  UriResolvedFunc callback;
+  gpointer userData;
+  gint64 start;                   /* Monotonic time the resolver was spawned */
+} ResolveRequest;
+
+/* Only youtube links need resolving for now */
+static gboolean needs_resolution (const char *input) {
+  return (NULL != strstr (input, "https") &&
+      (NULL != strstr (input, "youtube") || NULL != strstr (input, "youtu.be")));
+}
+
+/* Key file group names can't hold arbitrary urls, the inputs are hashed */
+static gchar *cache_group (const char *input) {
+  return g_compute_checksum_for_string (G_CHECKSUM_SHA1, input, -1);
+}
+
+static GKeyFile *load_cache (UriResolver *resolver) {
+  GKeyFile *cache = g_key_file_new ();
+
+  /* A missing or broken cache is just empty */
+  g_key_file_load_from_file (cache, resolver->cachePath, G_KEY_FILE_NONE, NULL);
+  return cache;
+}
+
+static gchar *cache_lookup (UriResolver *resolver, const char *input) {
+  GKeyFile *cache = load_cache (resolver);
+  gchar *group = cache_group (input);
+  gchar *uri = NULL;
+  gint64 expires = g_key_file_get_int64 (cache, group, "expires", NULL);
+
+  if (expires > g_get_real_time () / G_USEC_PER_SEC) {
+    uri = g_key_file_get_string (cache, group, "uri", NULL);
+  }
+  g_free (group);
+  g_key_file_free (cache);
+  return uri;
+}
+
+static void cache_store (UriResolver *resolver, const char *input, const char *uri) {
+  GKeyFile *cache = load_cache (resolver);
+  gchar *group = cache_group (input);
+  gint64 now = g_get_real_time () / G_USEC_PER_SEC;
+  gchar **groups;
+  gchar *dir;
+  gsize i;
+  GError *err = NULL;
+
+  /* Expired entries are dropped so the file stays small */
+  groups = g_key_file_get_groups (cache, NULL);
+  for (i = 0; groups[i]; i++) {
+    if (g_key_file_get_int64 (cache, groups[i], "expires", NULL) <= now)
+      g_key_file_remove_group (cache, groups[i], NULL);
+  }
+  g_strfreev (groups);
+
+  g_key_file_set_string (cache, group, "uri", uri);
+  g_key_file_set_int64 (cache, group, "expires", now + URI_RESOLVER_TTL);
+
+  dir = g_path_get_dirname (resolver->cachePath);
+  if (0 != g_mkdir_with_parents (dir, 0755) || !g_key_file_save_to_file (cache, resolver->cachePath, &err)) {
+    LOGD ("Could not save resolved uri cache: %s", err ? err->message : "no cache dir");
+    g_clear_error (&err);
+  }
+  g_free (dir);
+  g_free (group);
+  g_key_file_free (cache);
+}
+
+UriResolver *uri_resolver_new (const char *command) {
+  UriResolver *resolver = g_new0 (UriResolver, 1);
+  GError *err = NULL;
+
+  if (!g_shell_parse_argv (command ? command : URI_RESOLVER_DEFAULT_COMMAND, NULL, &resolver->argv, &err)) {
+    LOGD ("Bad resolver command, using the default one: %s", err->message);
+    g_clear_error (&err);
+    g_shell_parse_argv (URI_RESOLVER_DEFAULT_COMMAND, NULL, &resolver->argv, NULL);
+  }
+  resolver->cachePath = g_build_filename (g_get_user_cache_dir (), "vd_player", URI_RESOLVER_CACHE_FILE, NULL);
+  return resolver;
+}
+
+void uri_resolver_free (UriResolver *resolver) {
+  if (NULL == resolver)
+    return;
+  g_strfreev (resolver->argv);
+  g_free (resolver->cachePath);
+  g_free (resolver);
+}
+
+gchar *uri_resolver_lookup (UriResolver *resolver, const char *input) {
+  gchar *uri;
+
+  if (needs_resolution (input)) {
+    uri = cache_lookup (resolver, input);
+    LOGD ("Resolved uri cache %s for %s", uri ? "hit" : "miss", input);
+    return uri;
+  }
+
+  if (!gst_uri_is_valid (input)) {
+    /* Plain file name, playbin wants a uri */
+    return gst_filename_to_uri (input, NULL);
+  }
+  /* Assume that the passed uri is playable by playbin */
+  return g_strdup (input);
+}
+
+static void resolve_request_free (ResolveRequest *request) {
+  g_free (request->input);
+  g_free (request);
+}
+
+static void communicate_cb (GSubprocess *process, GAsyncResult *result, ResolveRequest *request) {
+  gchar *output = NULL;
+  gchar *uri = NULL;
+  gchar *newline;
+  GError *err = NULL;
+
+  if (!g_subprocess_communicate_utf8_finish (process, result, &output, NULL, &err)) {
+    LOGD ("Resolver failed: %s", err->message);
+    g_clear_error (&err);
+  } else if (!g_subprocess_get_successful (process)) {
+    LOGD ("Resolver exited with status %d", g_subprocess_get_exit_status (process));
+  } else if (output) {
+    /* First line of the output is the playable url */
+    newline = strchr (output, '\n');
+    if (newline)
+      *newline = '\0';
+    g_strstrip (output);
+    if (gst_uri_is_valid (output)) {
+      uri = g_strdup (output);
+      cache_store (request->resolver, request->input, uri);
+    } else {
+      LOGD ("Resolver returned no valid uri: '%s'", output);
+    }
+  }
+
+  LOGD ("Resolving took %" G_GINT64_FORMAT " ms", (g_get_monotonic_time () - request->start) / 1000);
+  request->callback (request->input, uri, request->userData);
+
+  g_free (uri);
+  g_free (output);
+  g_object_unref (process);
+  resolve_request_free (request);
+}
+
+void uri_resolver_resolve_async (UriResolver *resolver, const char *input,
+    UriResolvedFunc callback, gpointer user_data) {
+  ResolveRequest *request = g_new0 (ResolveRequest, 1);
+  GPtrArray *argv = g_ptr_array_new ();
+  GSubprocess *process;
+  GError *err = NULL;
+  gchar **arg;
+
+  request->resolver = resolver;
+  request->input = g_strdup (input);
+  request->callback = callback;
+  request->userData = user_data;
+  request->start = g_get_monotonic_time ();
+
+  for (arg = resolver->argv; *arg; arg++)
+    g_ptr_array_add (argv, *arg);
+  g_ptr_array_add (argv, (gpointer)input);
+  g_ptr_array_add (argv, NULL);
+
+  /* stdout comes back through a pipe, stderr still goes to the terminal */
+  process = g_subprocess_newv ((const gchar * const *)argv->pdata, G_SUBPROCESS_FLAGS_STDOUT_PIPE, &err);
+  g_ptr_array_free (argv, TRUE);
+  if (NULL == process) {
+    LOGD ("Could not start resolver: %s", err->message);
+    g_clear_error (&err);
+    callback (input, NULL, user_data);
+    resolve_request_free (request);
+    return;
+  }
+
+  g_subprocess_communicate_utf8_async (process, NULL, NULL, (GAsyncReadyCallback)communicate_cb, request);
+}
@@ -0,0 +1,54 @@
+#include <stdio.h>
+#include <unistd.h>
+
+#include <gst/gst.h>
+
+#include "util.h"
+
+gboolean util_cap_property (GstElement *element, const char *name, guint64 cap, gboolean zeroDisables) {
+  GParamSpec *pspec = g_object_class_find_property (G_OBJECT_GET_CLASS (element), name);
+  GValue value = G_VALUE_INIT;
+  guint64 current;
+  gboolean capped;
+
+  if (NULL == pspec)
+    return FALSE;
+  g_value_init (&value, pspec->value_type);
+  g_object_get_property (G_OBJECT (element), name, &value);
+  if (G_VALUE_HOLDS_INT (&value)) {
+    current = (guint64)MAX (g_value_get_int (&value), 0);
+  } else if (G_VALUE_HOLDS_UINT (&value)) {
+    current = g_value_get_uint (&value);
+  } else if (G_VALUE_HOLDS_UINT64 (&value)) {
+    current = g_value_get_uint64 (&value);
+  } else {
+    g_value_unset (&value);
+    return FALSE;
+  }
+
+  capped = (0 == current) ? !zeroDisables : current > cap;
+  if (capped) {
+    if (G_VALUE_HOLDS_INT (&value)) {
+      g_value_set_int (&value, (gint)MIN (cap, G_MAXINT));
+    } else if (G_VALUE_HOLDS_UINT (&value)) {
+      g_value_set_uint (&value, (guint)MIN (cap, G_MAXUINT));
+    } else {
+      g_value_set_uint64 (&value, cap);
+    }
+    g_object_set_property (G_OBJECT (element), name, &value);
+  }
+  g_value_unset (&value);
+  return capped;
+}
+
+glong util_current_rss_kb (void) {
+  glong pages = 0;
+  FILE *f = fopen ("/proc/self/statm", "r");
+
+  if (f) {
+    if (1 != fscanf (f, "%*ld %ld", &pages))
+      pages = 0;
+    fclose (f);
+  }
+  return pages * (sysconf (_SC_PAGESIZE) / 1024);
+}
@@ -0,0 +1,233 @@
+#include <gst/gst.h>
+#include <gst/video/video.h>
+#include <gst/video/gstvideofilter.h>
+
+#include "vd_convert.h"
+#include "vd_scaler.h"
+#include "log.h"
+
+#define VD_TYPE_CONVERT (vd_convert_get_type ())
+G_DECLARE_FINAL_TYPE (VdConvert, vd_convert, VD, CONVERT, GstVideoFilter)
+
+struct _VdConvert {
+  GstVideoFilter parent;
+
+  gint fitWidth;                  /* Output box, 0 keeps the input size (object lock) */
+  gint fitHeight;
+  const VdScalerKernel *kernel;
+  VdScaler *scaler;               /* For the negotiated formats */
+};
+
+enum {
+  PROP_0,
+  PROP_FIT_WIDTH,
+  PROP_FIT_HEIGHT
+};
+
+G_DEFINE_TYPE (VdConvert, vd_convert, GST_TYPE_VIDEO_FILTER)
+
+static GstStaticPadTemplate sink_template = GST_STATIC_PAD_TEMPLATE ("sink", GST_PAD_SINK, GST_PAD_ALWAYS,
+    GST_STATIC_CAPS (GST_VIDEO_CAPS_MAKE ("{ I420, NV12 }")));
+static GstStaticPadTemplate src_template = GST_STATIC_PAD_TEMPLATE ("src", GST_PAD_SRC, GST_PAD_ALWAYS,
+    GST_STATIC_CAPS (GST_VIDEO_CAPS_MAKE ("BGRx")));
+
+/* Largest even size with the input's display aspect ratio fitting in the box */
+static void fit_size (gint width, gint height, gint parN, gint parD, gint boxWidth, gint boxHeight,
+    gint *outWidth, gint *outHeight) {
+  gdouble dar = ((gdouble)width * parN) / ((gdouble)height * parD);
+
+  if (boxWidth / dar <= boxHeight) {
+    *outWidth = boxWidth;
+    *outHeight = (gint)(boxWidth / dar + 0.5);
+  } else {
+    *outWidth = (gint)(boxHeight * dar + 0.5);
+    *outHeight = boxHeight;
+  }
+  *outWidth = MAX (2, *outWidth & ~1);
+  *outHeight = MAX (2, *outHeight & ~1);
+}
+
+static void set_yuv_formats (GstStructure *s) {
+  GValue list = G_VALUE_INIT;
+  GValue value = G_VALUE_INIT;
+
+  g_value_init (&list, GST_TYPE_LIST);
+  g_value_init (&value, G_TYPE_STRING);
+  g_value_set_static_string (&value, "I420");
+  gst_value_list_append_value (&list, &value);
+  g_value_set_static_string (&value, "NV12");
+  gst_value_list_append_value (&list, &value);
+  gst_structure_take_value (s, "format", &list);
+  g_value_unset (&value);
+}
+
+static GstCaps *vd_convert_transform_caps (GstBaseTransform *trans, GstPadDirection direction,
+    GstCaps *caps, GstCaps *filter) {
+  VdConvert *self = VD_CONVERT (trans);
+  GstCaps *result = gst_caps_new_empty ();
+  GstCaps *tmp;
+  GstStructure *s;
+  gint fitWidth, fitHeight, width, height, outWidth, outHeight;
+  gint parN = 1, parD = 1;
+  guint i;
+
+  GST_OBJECT_LOCK (self);
+  fitWidth = self->fitWidth;
+  fitHeight = self->fitHeight;
+  GST_OBJECT_UNLOCK (self);
+
+  for (i = 0; i < gst_caps_get_size (caps); i++) {
+    s = gst_structure_copy (gst_caps_get_structure (caps, i));
+    gst_structure_remove_fields (s, "format", "colorimetry", "chroma-site", NULL);
+
+    if (GST_PAD_SINK == direction && fitWidth > 0 && fitHeight > 0 &&
+        gst_structure_get_int (s, "width", &width) && gst_structure_get_int (s, "height", &height)) {
+      gst_structure_get_fraction (s, "pixel-aspect-ratio", &parN, &parD);
+      fit_size (width, height, parN, parD, fitWidth, fitHeight, &outWidth, &outHeight);
+      gst_structure_set (s, "width", G_TYPE_INT, outWidth, "height", G_TYPE_INT, outHeight,
+          "pixel-aspect-ratio", GST_TYPE_FRACTION, 1, 1, NULL);
+    } else {
+      gst_structure_set (s, "width", GST_TYPE_INT_RANGE, 1, G_MAXINT, "height", GST_TYPE_INT_RANGE, 1, G_MAXINT, NULL);
+      gst_structure_remove_field (s, "pixel-aspect-ratio");
+    }
+
+    if (GST_PAD_SINK == direction) {
+      gst_structure_set (s, "format", G_TYPE_STRING, "BGRx", NULL);
+    } else {
+      set_yuv_formats (s);
+    }
+    result = gst_caps_merge_structure (result, s);
+  }
+
+  if (filter) {
+    tmp = gst_caps_intersect_full (filter, result, GST_CAPS_INTERSECT_FIRST);
+    gst_caps_unref (result);
+    result = tmp;
+  }
+  return result;
+}
+
+/* Without a box the output keeps the input size, in square pixels */
+static GstCaps *vd_convert_fixate_caps (GstBaseTransform *trans, GstPadDirection direction,
+    GstCaps *caps, GstCaps *othercaps) {
+  GstStructure *in, *out;
+  gint width, height, parN = 1, parD = 1;
+
+  othercaps = gst_caps_make_writable (gst_caps_truncate (othercaps));
+  in = gst_caps_get_structure (caps, 0);
+  out = gst_caps_get_structure (othercaps, 0);
+  if (gst_structure_get_int (in, "width", &width) && gst_structure_get_int (in, "height", &height)) {
+    if (GST_PAD_SINK == direction && gst_structure_get_fraction (in, "pixel-aspect-ratio", &parN, &parD)) {
+      width = (gint)gst_util_uint64_scale_int (width, parN, parD);
+    }
+    gst_structure_fixate_field_nearest_int (out, "width", width);
+    gst_structure_fixate_field_nearest_int (out, "height", height);
+    if (gst_structure_has_field (out, "pixel-aspect-ratio"))
+      gst_structure_fixate_field_nearest_fraction (out, "pixel-aspect-ratio", 1, 1);
+  }
+  return gst_caps_fixate (othercaps);
+}
+
+static gboolean vd_convert_set_info (GstVideoFilter *filter, GstCaps *incaps, GstVideoInfo *inInfo,
+    GstCaps *outcaps, GstVideoInfo *outInfo) {
+  VdConvert *self = VD_CONVERT (filter);
+
+  vd_scaler_free (self->scaler);
+  self->scaler = vd_scaler_new (inInfo, outInfo, self->kernel);
+  if (NULL == self->scaler)
+    return FALSE;
+  LOGD ("%dx%d %s -> %dx%d BGRx, %s kernel", GST_VIDEO_INFO_WIDTH (inInfo), GST_VIDEO_INFO_HEIGHT (inInfo),
+      GST_VIDEO_INFO_NAME (inInfo), GST_VIDEO_INFO_WIDTH (outInfo), GST_VIDEO_INFO_HEIGHT (outInfo), self->kernel->name);
+  return TRUE;
+}
+
+static GstFlowReturn vd_convert_transform_frame (GstVideoFilter *filter, GstVideoFrame *inFrame, GstVideoFrame *outFrame) {
+  vd_scaler_process (VD_CONVERT (filter)->scaler, inFrame, outFrame);
+  return GST_FLOW_OK;
+}
+
+static void vd_convert_set_property (GObject *object, guint id, const GValue *value, GParamSpec *pspec) {
+  VdConvert *self = VD_CONVERT (object);
+  gint *field;
+  gboolean changed;
+
+  switch (id) {
+    case PROP_FIT_WIDTH:
+      field = &self->fitWidth;
+      break;
+    case PROP_FIT_HEIGHT:
+      field = &self->fitHeight;
+      break;
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, id, pspec);
+      return;
+  }
+
+  GST_OBJECT_LOCK (self);
+  changed = *field != g_value_get_int (value);
+  *field = g_value_get_int (value);
+  GST_OBJECT_UNLOCK (self);
+  if (changed) {
+    /* Renegotiates the output size on the next buffer */
+    gst_base_transform_reconfigure_src (GST_BASE_TRANSFORM (self));
+  }
+}
+
+static void vd_convert_get_property (GObject *object, guint id, GValue *value, GParamSpec *pspec) {
+  VdConvert *self = VD_CONVERT (object);
+
+  GST_OBJECT_LOCK (self);
+  switch (id) {
+    case PROP_FIT_WIDTH:
+      g_value_set_int (value, self->fitWidth);
+      break;
+    case PROP_FIT_HEIGHT:
+      g_value_set_int (value, self->fitHeight);
+      break;
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, id, pspec);
+      break;
+  }
+  GST_OBJECT_UNLOCK (self);
+}
+
+static void vd_convert_finalize (GObject *object) {
+  vd_scaler_free (VD_CONVERT (object)->scaler);
+  G_OBJECT_CLASS (vd_convert_parent_class)->finalize (object);
+}
+
+static void vd_convert_class_init (VdConvertClass *klass) {
+  GObjectClass *objectClass = G_OBJECT_CLASS (klass);
+  GstElementClass *elementClass = GST_ELEMENT_CLASS (klass);
+  GstBaseTransformClass *transClass = GST_BASE_TRANSFORM_CLASS (klass);
+  GstVideoFilterClass *filterClass = GST_VIDEO_FILTER_CLASS (klass);
+
+  objectClass->set_property = vd_convert_set_property;
+  objectClass->get_property = vd_convert_get_property;
+  objectClass->finalize = vd_convert_finalize;
+  g_object_class_install_property (objectClass, PROP_FIT_WIDTH, g_param_spec_int ("fit-width", "Fit width",
+      "Width of the box the output is scaled into, 0 keeps the input size", 0, G_MAXINT, 0,
+      G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+  g_object_class_install_property (objectClass, PROP_FIT_HEIGHT, g_param_spec_int ("fit-height", "Fit height",
+      "Height of the box the output is scaled into, 0 keeps the input size", 0, G_MAXINT, 0,
+      G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  gst_element_class_add_static_pad_template (elementClass, &sink_template);
+  gst_element_class_add_static_pad_template (elementClass, &src_template);
+  gst_element_class_set_static_metadata (elementClass, "vd_player SIMD converter", "Filter/Converter/Video/Scaler",
+      "Fused I420/NV12 to BGRx conversion and bilinear scaling", "vd_player");
+
+  transClass->transform_caps = vd_convert_transform_caps;
+  transClass->fixate_caps = vd_convert_fixate_caps;
+  filterClass->set_info = vd_convert_set_info;
+  filterClass->transform_frame = vd_convert_transform_frame;
+}
+
+static void vd_convert_init (VdConvert *self) {
+  self->kernel = vd_scaler_best_kernel ();
+}
+
+gboolean vd_convert_register (void) {
+  LOGD ("Registering %s, %s kernel", VD_CONVERT_ELEMENT, vd_scaler_best_kernel ()->name);
+  return gst_element_register (NULL, VD_CONVERT_ELEMENT, GST_RANK_NONE, VD_TYPE_CONVERT);
+}
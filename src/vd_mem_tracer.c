@@ -0,0 +1,240 @@
+/* gst_tracing_register_hook is only declared with the unstable API */
+#define GST_USE_UNSTABLE_API
+#include <gst/gst.h>
+
+#include "vd_mem_tracer.h"
+#include "bench.h"
+#include "log.h"
+
+#define VD_TYPE_MEM_TRACER (vd_mem_tracer_get_type ())
+G_DECLARE_FINAL_TYPE (VdMemTracer, vd_mem_tracer, VD, MEM_TRACER, GstTracer)
+
+typedef struct _ElementMemory {
+  gchar *name;
+  gint64 live;                    /* Bytes */
+  gint64 peak;
+  guint64 allocations;
+} ElementMemory;
+
+/* What one thread is running */
+typedef struct _ThreadContext {
+  GPtrArray *stack;               /* ElementMemory of each push or pull in progress, innermost last */
+  ElementMemory *base;            /* The element whose task the thread runs, from its outermost push */
+} ThreadContext;
+
+struct _VdMemTracer {
+  GstTracer parent;
+
+  GMutex lock;                    /* Protects everything below */
+  GHashTable *elements;           /* Element name -> ElementMemory */
+  GHashTable *memories;           /* GstMemory -> the ElementMemory it is counted against */
+  ElementMemory *unattributed;    /* Allocated outside any streaming thread, or before its first push */
+  gint64 live;
+  gint64 peak;
+};
+
+G_DEFINE_TYPE (VdMemTracer, vd_mem_tracer, GST_TYPE_TRACER)
+
+static void thread_context_free (ThreadContext *context) {
+  g_ptr_array_free (context->stack, TRUE);
+  g_free (context);
+}
+
+static GPrivate threadContext = G_PRIVATE_INIT ((GDestroyNotify)thread_context_free);
+
+static ThreadContext *get_context (void) {
+  ThreadContext *context = g_private_get (&threadContext);
+
+  if (NULL == context) {
+    context = g_new0 (ThreadContext, 1);
+    context->stack = g_ptr_array_new ();
+    g_private_set (&threadContext, context);
+  }
+  return context;
+}
+
+static void element_memory_free (ElementMemory *element) {
+  g_free (element->name);
+  g_free (element);
+}
+
+/* The element a pad belongs to, through ghost and proxy pads. Lock held */
+static ElementMemory *element_memory_for (VdMemTracer *self, GstPad *pad) {
+  GstObject *object = GST_OBJECT (pad);
+  ElementMemory *element;
+
+  while (object && !GST_IS_ELEMENT (object)) {
+    object = GST_OBJECT_PARENT (object);
+  }
+  if (NULL == object)
+    return self->unattributed;
+  element = g_hash_table_lookup (self->elements, GST_OBJECT_NAME (object));
+  if (NULL == element) {
+    element = g_new0 (ElementMemory, 1);
+    element->name = g_strdup (GST_OBJECT_NAME (object));
+    g_hash_table_insert (self->elements, element->name, element);
+  }
+  return element;
+}
+
+/* pad is about to call into its peer: the peer's element runs until the matching leave */
+static void enter (VdMemTracer *self, GstPad *pad) {
+  ThreadContext *context = get_context ();
+  GstPad *peer = GST_PAD_PEER (pad);
+
+  g_mutex_lock (&self->lock);
+  if (0 == context->stack->len) {
+    /* Outermost: the thread is in this element's task. Task threads are pooled, so
+     * this is updated every time rather than kept from the first */
+    context->base = element_memory_for (self, pad);
+  }
+  g_ptr_array_add (context->stack, peer ? element_memory_for (self, peer) : self->unattributed);
+  g_mutex_unlock (&self->lock);
+}
+
+static void leave (void) {
+  ThreadContext *context = get_context ();
+
+  if (context->stack->len > 0)
+    g_ptr_array_remove_index (context->stack, context->stack->len - 1);
+}
+
+static void pad_push_pre_cb (VdMemTracer *self, GstClockTime ts, GstPad *pad, GstBuffer *buffer) {
+  enter (self, pad);
+}
+
+static void pad_push_list_pre_cb (VdMemTracer *self, GstClockTime ts, GstPad *pad, GstBufferList *list) {
+  enter (self, pad);
+}
+
+static void pad_push_post_cb (VdMemTracer *self, GstClockTime ts, GstPad *pad, GstFlowReturn res) {
+  leave ();
+}
+
+static void pad_pull_range_pre_cb (VdMemTracer *self, GstClockTime ts, GstPad *pad, guint64 offset, guint size) {
+  enter (self, pad);
+}
+
+static void pad_pull_range_post_cb (VdMemTracer *self, GstClockTime ts, GstPad *pad, GstBuffer *buffer,
+    GstFlowReturn res) {
+  leave ();
+}
+
+#if GST_CHECK_VERSION (1, 18, 0)
+static void memory_init_cb (VdMemTracer *self, GstClockTime ts, GstMemory *mem) {
+  ThreadContext *context;
+  ElementMemory *owner;
+
+  /* Shares point into their parent; read-only wrapped memory is a file mapping */
+  if (mem->parent || GST_MEMORY_IS_READONLY (mem))
+    return;
+  context = get_context ();
+
+  g_mutex_lock (&self->lock);
+  owner = context->stack->len > 0 ? g_ptr_array_index (context->stack, context->stack->len - 1) :
+      (context->base ? context->base : self->unattributed);
+  owner->live += mem->maxsize;
+  owner->peak = MAX (owner->peak, owner->live);
+  owner->allocations++;
+  self->live += mem->maxsize;
+  self->peak = MAX (self->peak, self->live);
+  g_hash_table_insert (self->memories, mem, owner);
+  g_mutex_unlock (&self->lock);
+}
+
+static void memory_free_pre_cb (VdMemTracer *self, GstClockTime ts, GstMemory *mem) {
+  ElementMemory *owner;
+
+  g_mutex_lock (&self->lock);
+  if (NULL != (owner = g_hash_table_lookup (self->memories, mem))) {
+    owner->live -= mem->maxsize;
+    self->live -= mem->maxsize;
+    g_hash_table_remove (self->memories, mem);
+  }
+  g_mutex_unlock (&self->lock);
+}
+#endif
+
+static void vd_mem_tracer_finalize (GObject *object) {
+  VdMemTracer *self = VD_MEM_TRACER (object);
+
+  g_hash_table_destroy (self->memories);
+  g_hash_table_destroy (self->elements);
+  element_memory_free (self->unattributed);
+  g_mutex_clear (&self->lock);
+  G_OBJECT_CLASS (vd_mem_tracer_parent_class)->finalize (object);
+}
+
+static void vd_mem_tracer_class_init (VdMemTracerClass *klass) {
+  G_OBJECT_CLASS (klass)->finalize = vd_mem_tracer_finalize;
+}
+
+static void vd_mem_tracer_init (VdMemTracer *self) {
+  GstTracer *tracer = GST_TRACER (self);
+
+  g_mutex_init (&self->lock);
+  self->elements = g_hash_table_new_full (g_str_hash, g_str_equal, NULL, (GDestroyNotify)element_memory_free);
+  self->memories = g_hash_table_new (g_direct_hash, g_direct_equal);
+  self->unattributed = g_new0 (ElementMemory, 1);
+  self->unattributed->name = g_strdup ("unattributed");
+
+  gst_tracing_register_hook (tracer, "pad-push-pre", G_CALLBACK (pad_push_pre_cb));
+  gst_tracing_register_hook (tracer, "pad-push-post", G_CALLBACK (pad_push_post_cb));
+  gst_tracing_register_hook (tracer, "pad-push-list-pre", G_CALLBACK (pad_push_list_pre_cb));
+  gst_tracing_register_hook (tracer, "pad-push-list-post", G_CALLBACK (pad_push_post_cb));
+  gst_tracing_register_hook (tracer, "pad-pull-range-pre", G_CALLBACK (pad_pull_range_pre_cb));
+  gst_tracing_register_hook (tracer, "pad-pull-range-post", G_CALLBACK (pad_pull_range_post_cb));
+#if GST_CHECK_VERSION (1, 18, 0)
+  gst_tracing_register_hook (tracer, "memory-init", G_CALLBACK (memory_init_cb));
+  gst_tracing_register_hook (tracer, "memory-free-pre", G_CALLBACK (memory_free_pre_cb));
+#else
+  LOGW ("GStreamer %s has no memory tracing hooks, nothing will be counted", gst_version_string ());
+#endif
+}
+
+VdMemTracer *vd_mem_tracer_new (void) {
+  VdMemTracer *self = g_object_new (VD_TYPE_MEM_TRACER, NULL);
+
+  gst_object_ref_sink (self);
+  LOGD ("Tracing GstMemory per element");
+  return self;
+}
+
+static gint compare_peak (gconstpointer a, gconstpointer b) {
+  const ElementMemory *first = *(ElementMemory * const *)a;
+  const ElementMemory *second = *(ElementMemory * const *)b;
+
+  return first->peak < second->peak ? 1 : (first->peak > second->peak ? -1 : 0);
+}
+
+static void append_element (GString *out, const ElementMemory *element, gboolean first) {
+  g_string_append (out, first ? "\n      " : ",\n      ");
+  bench_json_append_string (out, element->name);
+  g_string_append_printf (out, ": { \"live_kb\": %" G_GINT64_FORMAT ", \"peak_kb\": %" G_GINT64_FORMAT
+      ", \"allocations\": %" G_GUINT64_FORMAT " }", element->live / 1024, element->peak / 1024, element->allocations);
+}
+
+void vd_mem_tracer_append_json (GString *out, gdouble wall, VdMemTracer *tracer) {
+  GPtrArray *elements = g_ptr_array_new ();
+  GHashTableIter iter;
+  gpointer value;
+  guint i;
+
+  g_mutex_lock (&tracer->lock);
+  g_hash_table_iter_init (&iter, tracer->elements);
+  while (g_hash_table_iter_next (&iter, NULL, &value)) {
+    g_ptr_array_add (elements, value);
+  }
+  g_ptr_array_sort (elements, compare_peak);
+
+  g_string_append_printf (out, "{\n    \"live_kb\": %" G_GINT64_FORMAT ", \"peak_kb\": %" G_GINT64_FORMAT
+      ", \"live_memories\": %u,\n    \"elements\": {", tracer->live / 1024, tracer->peak / 1024,
+      g_hash_table_size (tracer->memories));
+  for (i = 0; i < MIN (elements->len, VD_MEM_TRACER_TOP); i++) {
+    append_element (out, g_ptr_array_index (elements, i), 0 == i);
+  }
+  append_element (out, tracer->unattributed, 0 == elements->len);
+  g_mutex_unlock (&tracer->lock);
+  g_string_append (out, "\n    }\n  }");
+  g_ptr_array_free (elements, TRUE);
+}
@@ -0,0 +1,345 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <gst/gst.h>
+#include <gst/base/gstbasesrc.h>
+
+#include "vd_mmap_src.h"
+#include "log.h"
+
+#define VD_TYPE_MMAP_SRC (vd_mmap_src_get_type ())
+G_DECLARE_FINAL_TYPE (VdMmapSrc, vd_mmap_src, VD, MMAP_SRC, GstBaseSrc)
+
+/* Outlives the element while buffers still point into it */
+typedef struct _VdMapping {
+  gpointer addr;
+  gsize size;
+} VdMapping;
+
+struct _VdMmapSrc {
+  GstBaseSrc parent;
+
+  gchar *location;                /* File name (object lock) */
+  GstMemory *mapping;             /* Whole file, parent of every buffer's memory */
+  guint8 *data;
+  guint64 size;
+  int fd;                         /* Kept open to notice the file shrinking under the mapping */
+  gboolean truncated;             /* It did: reads are read() copies from then on */
+
+  guint64 nextOffset;             /* Where a sequential read would continue */
+  guint64 adviseEnd;              /* End of the WILLNEED window */
+  guint64 buffers;
+  guint64 bytes;
+  guint seeks;                    /* Reads that didn't continue the previous one */
+};
+
+enum {
+  PROP_0,
+  PROP_LOCATION
+};
+
+static void vd_mmap_src_uri_handler_init (gpointer iface, gpointer iface_data);
+
+G_DEFINE_TYPE_WITH_CODE (VdMmapSrc, vd_mmap_src, GST_TYPE_BASE_SRC,
+    G_IMPLEMENT_INTERFACE (GST_TYPE_URI_HANDLER, vd_mmap_src_uri_handler_init))
+
+static GstStaticPadTemplate src_template = GST_STATIC_PAD_TEMPLATE ("src", GST_PAD_SRC, GST_PAD_ALWAYS,
+    GST_STATIC_CAPS_ANY);
+
+static void unmap (VdMapping *mapping) {
+  munmap (mapping->addr, mapping->size);
+  g_free (mapping);
+}
+
+/* Asks the kernel to start reading the window from offset on */
+static void advise (VdMmapSrc *self, guint64 offset) {
+  guint64 page = (guint64)sysconf (_SC_PAGESIZE);
+  guint64 start = offset & ~(page - 1);
+  guint64 end = MIN (start + VD_MMAP_SRC_READ_AHEAD, self->size);
+
+  if (start >= end)
+    return;
+  madvise (self->data + start, end - start, MADV_WILLNEED);
+  self->adviseEnd = end;
+}
+
+/* After the file shrank: touching mapped pages past its new end would raise SIGBUS,
+   so the rest is read like filesrc does */
+static GstFlowReturn read_buffer (VdMmapSrc *self, guint64 offset, guint length, GstBuffer **buf) {
+  GstBuffer *buffer = gst_buffer_new_allocate (NULL, length, NULL);
+  GstMapInfo info;
+  ssize_t count;
+
+  gst_buffer_map (buffer, &info, GST_MAP_WRITE);
+  count = pread (self->fd, info.data, length, offset);
+  gst_buffer_unmap (buffer, &info);
+  if (count <= 0) {
+    gst_buffer_unref (buffer);
+    if (0 == count)
+      return GST_FLOW_EOS;
+    GST_ELEMENT_ERROR (self, RESOURCE, READ, (NULL), ("%s", g_strerror (errno)));
+    return GST_FLOW_ERROR;
+  }
+  gst_buffer_set_size (buffer, count);
+  GST_BUFFER_OFFSET (buffer) = offset;
+  GST_BUFFER_OFFSET_END (buffer) = offset + count;
+  *buf = buffer;
+  return GST_FLOW_OK;
+}
+
+static gboolean vd_mmap_src_start (GstBaseSrc *src) {
+  VdMmapSrc *self = VD_MMAP_SRC (src);
+  VdMapping *mapping;
+  struct stat st;
+  gchar *location;
+  int fd;
+
+  GST_OBJECT_LOCK (self);
+  location = g_strdup (self->location);
+  GST_OBJECT_UNLOCK (self);
+  if (NULL == location) {
+    GST_ELEMENT_ERROR (self, RESOURCE, NOT_FOUND, ("No file name specified for reading."), (NULL));
+    return FALSE;
+  }
+
+  fd = open (location, O_RDONLY | O_CLOEXEC);
+  if (fd < 0 || fstat (fd, &st) < 0) {
+    GST_ELEMENT_ERROR (self, RESOURCE, OPEN_READ, ("Could not open file \"%s\" for reading.", location),
+        ("%s", g_strerror (errno)));
+    if (fd >= 0)
+      close (fd);
+    g_free (location);
+    return FALSE;
+  }
+
+  self->size = st.st_size;
+  self->nextOffset = 0;
+  self->adviseEnd = 0;
+  self->buffers = self->bytes = 0;
+  self->seeks = 0;
+  self->truncated = FALSE;
+  if (self->size > 0) {
+    self->data = mmap (NULL, self->size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (MAP_FAILED == self->data) {
+      GST_ELEMENT_ERROR (self, RESOURCE, OPEN_READ, ("Could not map file \"%s\".", location),
+          ("%s", g_strerror (errno)));
+      self->data = NULL;
+      close (fd);
+      g_free (location);
+      return FALSE;
+    }
+    /* Demuxers mostly read front to back: aggressive kernel read-ahead, early reclaim */
+    madvise (self->data, self->size, MADV_SEQUENTIAL);
+    mapping = g_new (VdMapping, 1);
+    mapping->addr = self->data;
+    mapping->size = self->size;
+    /* The pages are read-only: anybody wanting to write gets a copy */
+    self->mapping = gst_memory_new_wrapped (GST_MEMORY_FLAG_READONLY, self->data, self->size, 0, self->size,
+        mapping, (GDestroyNotify)unmap);
+  }
+  self->fd = fd;
+  g_free (location);
+  return TRUE;
+}
+
+static gboolean vd_mmap_src_stop (GstBaseSrc *src) {
+  VdMmapSrc *self = VD_MMAP_SRC (src);
+
+  LOGD ("%s: %" G_GUINT64_FORMAT " buffers, %" G_GUINT64_FORMAT " bytes shared from the mapping, %u seeks",
+      GST_OBJECT_NAME (self), self->buffers, self->bytes, self->seeks);
+  /* Unmapped once the last buffer pointing into it is gone */
+  if (self->mapping) {
+    gst_memory_unref (self->mapping);
+    self->mapping = NULL;
+  }
+  self->data = NULL;
+  self->size = 0;
+  if (self->fd >= 0) {
+    close (self->fd);
+    self->fd = -1;
+  }
+  return TRUE;
+}
+
+static gboolean vd_mmap_src_get_size (GstBaseSrc *src, guint64 *size) {
+  VdMmapSrc *self = VD_MMAP_SRC (src);
+  struct stat st;
+
+  if (self->truncated && 0 == fstat (self->fd, &st)) {
+    *size = st.st_size;
+    return TRUE;
+  }
+  *size = self->size;
+  return TRUE;
+}
+
+static gboolean vd_mmap_src_is_seekable (GstBaseSrc *src) {
+  return TRUE;
+}
+
+static GstFlowReturn vd_mmap_src_create (GstBaseSrc *src, guint64 offset, guint length, GstBuffer **buf) {
+  VdMmapSrc *self = VD_MMAP_SRC (src);
+  GstBuffer *buffer;
+  struct stat st;
+
+  /* A recording rotated or rewritten while it plays. Slices already handed out stay
+   * mapped, but none are made past the check */
+  if (!self->truncated && self->size > 0 && (fstat (self->fd, &st) < 0 || (guint64)st.st_size < self->size)) {
+    LOGW ("%s: file shrank from %" G_GUINT64_FORMAT " bytes, reading it instead of mapping", GST_OBJECT_NAME (self),
+        self->size);
+    self->truncated = TRUE;
+  }
+  if (self->truncated)
+    return read_buffer (self, offset, length, buf);
+
+  if (offset >= self->size)
+    return GST_FLOW_EOS;
+  length = MIN (length, self->size - offset);
+
+  /* A jump is a seek (or a demuxer looking at the index): read ahead from there.
+   * Sequential reads slide the window before they catch up with it */
+  if (offset != self->nextOffset) {
+    self->seeks++;
+    advise (self, offset);
+  } else if (offset + length + VD_MMAP_SRC_READ_AHEAD / 2 > self->adviseEnd && self->adviseEnd < self->size) {
+    advise (self, MAX (offset, self->adviseEnd));
+  }
+  self->nextOffset = offset + length;
+
+  buffer = gst_buffer_new ();
+  gst_buffer_append_memory (buffer, gst_memory_share (self->mapping, offset, length));
+  GST_BUFFER_OFFSET (buffer) = offset;
+  GST_BUFFER_OFFSET_END (buffer) = offset + length;
+  self->buffers++;
+  self->bytes += length;
+  *buf = buffer;
+  return GST_FLOW_OK;
+}
+
+static gboolean set_location (VdMmapSrc *self, const gchar *location, GError **error) {
+  GstState state;
+
+  GST_OBJECT_LOCK (self);
+  state = GST_STATE (self);
+  if (GST_STATE_READY < state) {
+    GST_OBJECT_UNLOCK (self);
+    g_set_error (error, GST_URI_ERROR, GST_URI_ERROR_BAD_STATE, "Changing the location while running isn't supported");
+    return FALSE;
+  }
+  g_free (self->location);
+  self->location = g_strdup (location);
+  GST_OBJECT_UNLOCK (self);
+  return TRUE;
+}
+
+static void vd_mmap_src_set_property (GObject *object, guint id, const GValue *value, GParamSpec *pspec) {
+  switch (id) {
+    case PROP_LOCATION:
+      set_location (VD_MMAP_SRC (object), g_value_get_string (value), NULL);
+      break;
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, id, pspec);
+      break;
+  }
+}
+
+static void vd_mmap_src_get_property (GObject *object, guint id, GValue *value, GParamSpec *pspec) {
+  VdMmapSrc *self = VD_MMAP_SRC (object);
+
+  switch (id) {
+    case PROP_LOCATION:
+      GST_OBJECT_LOCK (self);
+      g_value_set_string (value, self->location);
+      GST_OBJECT_UNLOCK (self);
+      break;
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, id, pspec);
+      break;
+  }
+}
+
+static void vd_mmap_src_finalize (GObject *object) {
+  g_free (VD_MMAP_SRC (object)->location);
+  G_OBJECT_CLASS (vd_mmap_src_parent_class)->finalize (object);
+}
+
+static GstURIType vd_mmap_src_uri_get_type (GType type) {
+  return GST_URI_SRC;
+}
+
+static const gchar *const *vd_mmap_src_uri_get_protocols (GType type) {
+  static const gchar *protocols[] = { "file", NULL };
+
+  return protocols;
+}
+
+static gchar *vd_mmap_src_uri_get_uri (GstURIHandler *handler) {
+  VdMmapSrc *self = VD_MMAP_SRC (handler);
+  gchar *uri = NULL;
+
+  GST_OBJECT_LOCK (self);
+  if (self->location)
+    uri = gst_filename_to_uri (self->location, NULL);
+  GST_OBJECT_UNLOCK (self);
+  return uri;
+}
+
+/* Only regular files can be mapped; refusing the rest makes playbin fall back to filesrc */
+static gboolean vd_mmap_src_uri_set_uri (GstURIHandler *handler, const gchar *uri, GError **error) {
+  gchar *location = g_filename_from_uri (uri, NULL, NULL);
+  gboolean ret;
+
+  if (NULL == location || !g_file_test (location, G_FILE_TEST_IS_REGULAR)) {
+    g_set_error (error, GST_URI_ERROR, GST_URI_ERROR_BAD_URI, "%s is not a regular local file", uri);
+    g_free (location);
+    return FALSE;
+  }
+  ret = set_location (VD_MMAP_SRC (handler), location, error);
+  g_free (location);
+  return ret;
+}
+
+static void vd_mmap_src_uri_handler_init (gpointer iface, gpointer iface_data) {
+  GstURIHandlerInterface *uriIface = iface;
+
+  uriIface->get_type = vd_mmap_src_uri_get_type;
+  uriIface->get_protocols = vd_mmap_src_uri_get_protocols;
+  uriIface->get_uri = vd_mmap_src_uri_get_uri;
+  uriIface->set_uri = vd_mmap_src_uri_set_uri;
+}
+
+static void vd_mmap_src_class_init (VdMmapSrcClass *klass) {
+  GObjectClass *objectClass = G_OBJECT_CLASS (klass);
+  GstElementClass *elementClass = GST_ELEMENT_CLASS (klass);
+  GstBaseSrcClass *srcClass = GST_BASE_SRC_CLASS (klass);
+
+  objectClass->set_property = vd_mmap_src_set_property;
+  objectClass->get_property = vd_mmap_src_get_property;
+  objectClass->finalize = vd_mmap_src_finalize;
+  g_object_class_install_property (objectClass, PROP_LOCATION, g_param_spec_string ("location", "File Location",
+      "Location of the file to read", NULL, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  gst_element_class_add_static_pad_template (elementClass, &src_template);
+  gst_element_class_set_static_metadata (elementClass, "vd_player mmap file source", "Source/File",
+      "Hands out slices of a memory mapped file without copying", "vd_player");
+
+  srcClass->start = vd_mmap_src_start;
+  srcClass->stop = vd_mmap_src_stop;
+  srcClass->get_size = vd_mmap_src_get_size;
+  srcClass->is_seekable = vd_mmap_src_is_seekable;
+  srcClass->create = vd_mmap_src_create;
+}
+
+static void vd_mmap_src_init (VdMmapSrc *self) {
+  self->fd = -1;
+  gst_base_src_set_blocksize (GST_BASE_SRC (self), VD_MMAP_SRC_BLOCKSIZE);
+}
+
+gboolean vd_mmap_src_register (void) {
+  LOGD ("Registering %s", VD_MMAP_SRC_ELEMENT);
+  return gst_element_register (NULL, VD_MMAP_SRC_ELEMENT, GST_RANK_PRIMARY + 1, VD_TYPE_MMAP_SRC);
+}
@@ -0,0 +1,381 @@
+#include <string.h>
+
+#include <gst/gst.h>
+#include <gst/video/video.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define VD_SCALER_X86 1
+#endif
+
+#include "vd_scaler.h"
+#include "log.h"
+
+struct _VdScaler {
+  const VdScalerKernel *kernel;
+  const VdScalerMatrix *matrix;
+  gboolean semiPlanar;            /* NV12: interleaved UV plane */
+  gint inWidth, inHeight;
+  gint chromaWidth, chromaHeight; /* Size of the input chroma planes, in samples */
+  gint outWidth, outHeight;
+
+  gint32 *lumaIndex;              /* Per output column: left source sample and weight of the right one */
+  guint16 *lumaWeight;
+  gint32 *chromaIndex;            /* Same in the chroma plane, in bytes (x2 for NV12) */
+  guint16 *chromaWeight;
+
+  guint8 *lumaRow;                /* Vertically blended input rows */
+  guint8 *chromaRow;
+  guint8 *yRow;                   /* Output width Y, U and V rows fed to the conversion */
+  guint8 *uRow;
+  guint8 *vRow;
+};
+
+static const VdScalerMatrix bt601 = { 298, 409, 100, 208, 516 };
+static const VdScalerMatrix bt709 = { 298, 459, 55, 136, 541 };
+
+/* --- Scalar kernel, the reference for the vector ones --- */
+
+static inline guint8 clamp_u8 (gint32 v) {
+  return v < 0 ? 0 : (v > 255 ? 255 : (guint8)v);
+}
+
+static void blend_rows_c (guint8 *dst, const guint8 *row0, const guint8 *row1, gint width, gint weight) {
+  gint i;
+
+  for (i = 0; i < width; i++)
+    dst[i] = (row0[i] * (256 - weight) + row1[i] * weight + 128) >> 8;
+}
+
+static void sample_row_c (guint8 *dst, const guint8 *src, const gint32 *index, const guint16 *weight, gint width, gint stride) {
+  gint i;
+
+  for (i = 0; i < width; i++)
+    dst[i] = (src[index[i]] * (256 - weight[i]) + src[index[i] + stride] * weight[i] + 128) >> 8;
+}
+
+static inline void yuv_to_bgrx_pixel (guint8 *dst, gint y, gint u, gint v, const VdScalerMatrix *m) {
+  gint32 c = (y - 16) * m->y;
+  gint32 d = u - 128;
+  gint32 e = v - 128;
+
+  dst[0] = clamp_u8 ((c + m->bu * d + 128) >> 8);
+  dst[1] = clamp_u8 ((c - m->gu * d - m->gv * e + 128) >> 8);
+  dst[2] = clamp_u8 ((c + m->rv * e + 128) >> 8);
+  dst[3] = 0xff;
+}
+
+static void yuv_to_bgrx_c (guint8 *dst, const guint8 *y, const guint8 *u, const guint8 *v, gint width,
+    const VdScalerMatrix *matrix) {
+  gint i;
+
+  for (i = 0; i < width; i++)
+    yuv_to_bgrx_pixel (dst + 4 * i, y[i], u[i], v[i], matrix);
+}
+
+static const VdScalerKernel kernel_c = { "scalar", blend_rows_c, sample_row_c, yuv_to_bgrx_c };
+
+#ifdef VD_SCALER_X86
+
+/* --- SSE4.1 kernel: 16 bytes per blend, 4 pixels per conversion --- */
+
+__attribute__ ((target ("sse4.1")))
+static void blend_rows_sse4 (guint8 *dst, const guint8 *row0, const guint8 *row1, gint width, gint weight) {
+  const __m128i w0 = _mm_set1_epi16 (256 - weight);
+  const __m128i w1 = _mm_set1_epi16 (weight);
+  const __m128i round = _mm_set1_epi16 (128);
+  const __m128i zero = _mm_setzero_si128 ();
+  gint i = 0;
+
+  /* a * (256 - w) + b * w <= 255 * 256, so unsigned 16 bit lanes don't overflow */
+  for (; i + 16 <= width; i += 16) {
+    __m128i a = _mm_loadu_si128 ((const __m128i *)(row0 + i));
+    __m128i b = _mm_loadu_si128 ((const __m128i *)(row1 + i));
+    __m128i lo = _mm_add_epi16 (_mm_mullo_epi16 (_mm_unpacklo_epi8 (a, zero), w0),
+        _mm_mullo_epi16 (_mm_unpacklo_epi8 (b, zero), w1));
+    __m128i hi = _mm_add_epi16 (_mm_mullo_epi16 (_mm_unpackhi_epi8 (a, zero), w0),
+        _mm_mullo_epi16 (_mm_unpackhi_epi8 (b, zero), w1));
+
+    lo = _mm_srli_epi16 (_mm_add_epi16 (lo, round), 8);
+    hi = _mm_srli_epi16 (_mm_add_epi16 (hi, round), 8);
+    _mm_storeu_si128 ((__m128i *)(dst + i), _mm_packus_epi16 (lo, hi));
+  }
+  blend_rows_c (dst + i, row0 + i, row1 + i, width - i, weight);
+}
+
+__attribute__ ((target ("sse4.1")))
+static void yuv_to_bgrx_sse4 (guint8 *dst, const guint8 *y, const guint8 *u, const guint8 *v, gint width,
+    const VdScalerMatrix *m) {
+  const __m128i cy = _mm_set1_epi32 (m->y), crv = _mm_set1_epi32 (m->rv), cgu = _mm_set1_epi32 (m->gu);
+  const __m128i cgv = _mm_set1_epi32 (m->gv), cbu = _mm_set1_epi32 (m->bu);
+  const __m128i c16 = _mm_set1_epi32 (16), c128 = _mm_set1_epi32 (128);
+  const __m128i zero = _mm_setzero_si128 (), max = _mm_set1_epi32 (255);
+  const __m128i alpha = _mm_set1_epi32 ((gint32)0xff000000);
+  gint32 in;
+  gint i = 0;
+
+  for (; i + 4 <= width; i += 4) {
+    __m128i yv, d, e, c, r, g, b;
+
+    memcpy (&in, y + i, 4);
+    yv = _mm_cvtepu8_epi32 (_mm_cvtsi32_si128 (in));
+    memcpy (&in, u + i, 4);
+    d = _mm_sub_epi32 (_mm_cvtepu8_epi32 (_mm_cvtsi32_si128 (in)), c128);
+    memcpy (&in, v + i, 4);
+    e = _mm_sub_epi32 (_mm_cvtepu8_epi32 (_mm_cvtsi32_si128 (in)), c128);
+
+    c = _mm_add_epi32 (_mm_mullo_epi32 (_mm_sub_epi32 (yv, c16), cy), c128);
+    b = _mm_srai_epi32 (_mm_add_epi32 (c, _mm_mullo_epi32 (cbu, d)), 8);
+    g = _mm_srai_epi32 (_mm_sub_epi32 (c, _mm_add_epi32 (_mm_mullo_epi32 (cgu, d), _mm_mullo_epi32 (cgv, e))), 8);
+    r = _mm_srai_epi32 (_mm_add_epi32 (c, _mm_mullo_epi32 (crv, e)), 8);
+    b = _mm_min_epi32 (_mm_max_epi32 (b, zero), max);
+    g = _mm_min_epi32 (_mm_max_epi32 (g, zero), max);
+    r = _mm_min_epi32 (_mm_max_epi32 (r, zero), max);
+
+    _mm_storeu_si128 ((__m128i *)(dst + 4 * i), _mm_or_si128 (_mm_or_si128 (b, _mm_slli_epi32 (g, 8)),
+        _mm_or_si128 (_mm_slli_epi32 (r, 16), alpha)));
+  }
+  yuv_to_bgrx_c (dst + 4 * i, y + i, u + i, v + i, width - i, m);
+}
+
+/* Without gathers the horizontal sampling stays scalar */
+static const VdScalerKernel kernel_sse4 = { "sse4.1", blend_rows_sse4, sample_row_c, yuv_to_bgrx_sse4 };
+
+/* --- AVX2 kernel: 32 bytes per blend, 8 pixels per gather and conversion --- */
+
+__attribute__ ((target ("avx2")))
+static void blend_rows_avx2 (guint8 *dst, const guint8 *row0, const guint8 *row1, gint width, gint weight) {
+  const __m256i w0 = _mm256_set1_epi16 (256 - weight);
+  const __m256i w1 = _mm256_set1_epi16 (weight);
+  const __m256i round = _mm256_set1_epi16 (128);
+  const __m256i zero = _mm256_setzero_si256 ();
+  gint i = 0;
+
+  /* Unpack and pack both work per 128 bit lane, so the byte order comes out right */
+  for (; i + 32 <= width; i += 32) {
+    __m256i a = _mm256_loadu_si256 ((const __m256i *)(row0 + i));
+    __m256i b = _mm256_loadu_si256 ((const __m256i *)(row1 + i));
+    __m256i lo = _mm256_add_epi16 (_mm256_mullo_epi16 (_mm256_unpacklo_epi8 (a, zero), w0),
+        _mm256_mullo_epi16 (_mm256_unpacklo_epi8 (b, zero), w1));
+    __m256i hi = _mm256_add_epi16 (_mm256_mullo_epi16 (_mm256_unpackhi_epi8 (a, zero), w0),
+        _mm256_mullo_epi16 (_mm256_unpackhi_epi8 (b, zero), w1));
+
+    lo = _mm256_srli_epi16 (_mm256_add_epi16 (lo, round), 8);
+    hi = _mm256_srli_epi16 (_mm256_add_epi16 (hi, round), 8);
+    _mm256_storeu_si256 ((__m256i *)(dst + i), _mm256_packus_epi16 (lo, hi));
+  }
+  blend_rows_c (dst + i, row0 + i, row1 + i, width - i, weight);
+}
+
+__attribute__ ((target ("avx2")))
+static void sample_row_avx2 (guint8 *dst, const guint8 *src, const gint32 *index, const guint16 *weight, gint width, gint stride) {
+  const __m256i mask = _mm256_set1_epi32 (0xff);
+  const __m256i c256 = _mm256_set1_epi32 (256), round = _mm256_set1_epi32 (128);
+  const __m128i shift = _mm_cvtsi32_si128 (8 * stride);
+  const __m256i zero = _mm256_setzero_si256 ();
+  gint32 out;
+  gint i = 0;
+
+  for (; i + 8 <= width; i += 8) {
+    /* One 32 bit load per sample holds both neighbours; the row padding covers the overrun */
+    __m256i words = _mm256_i32gather_epi32 ((const int *)src, _mm256_loadu_si256 ((const __m256i *)(index + i)), 1);
+    __m256i p0 = _mm256_and_si256 (words, mask);
+    __m256i p1 = _mm256_and_si256 (_mm256_srl_epi32 (words, shift), mask);
+    __m256i w = _mm256_cvtepu16_epi32 (_mm_loadu_si128 ((const __m128i *)(weight + i)));
+    __m256i r = _mm256_add_epi32 (_mm256_mullo_epi32 (p0, _mm256_sub_epi32 (c256, w)), _mm256_mullo_epi32 (p1, w));
+
+    r = _mm256_srli_epi32 (_mm256_add_epi32 (r, round), 8);
+    r = _mm256_packus_epi16 (_mm256_packus_epi32 (r, zero), zero);
+    out = _mm_cvtsi128_si32 (_mm256_castsi256_si128 (r));
+    memcpy (dst + i, &out, 4);
+    out = _mm_cvtsi128_si32 (_mm256_extracti128_si256 (r, 1));
+    memcpy (dst + i + 4, &out, 4);
+  }
+  sample_row_c (dst + i, src, index + i, weight + i, width - i, stride);
+}
+
+__attribute__ ((target ("avx2")))
+static void yuv_to_bgrx_avx2 (guint8 *dst, const guint8 *y, const guint8 *u, const guint8 *v, gint width,
+    const VdScalerMatrix *m) {
+  const __m256i cy = _mm256_set1_epi32 (m->y), crv = _mm256_set1_epi32 (m->rv), cgu = _mm256_set1_epi32 (m->gu);
+  const __m256i cgv = _mm256_set1_epi32 (m->gv), cbu = _mm256_set1_epi32 (m->bu);
+  const __m256i c16 = _mm256_set1_epi32 (16), c128 = _mm256_set1_epi32 (128);
+  const __m256i zero = _mm256_setzero_si256 (), max = _mm256_set1_epi32 (255);
+  const __m256i alpha = _mm256_set1_epi32 ((gint32)0xff000000);
+  gint i = 0;
+
+  for (; i + 8 <= width; i += 8) {
+    __m256i yv, d, e, c, r, g, b;
+
+    yv = _mm256_cvtepu8_epi32 (_mm_loadl_epi64 ((const __m128i *)(y + i)));
+    d = _mm256_sub_epi32 (_mm256_cvtepu8_epi32 (_mm_loadl_epi64 ((const __m128i *)(u + i))), c128);
+    e = _mm256_sub_epi32 (_mm256_cvtepu8_epi32 (_mm_loadl_epi64 ((const __m128i *)(v + i))), c128);
+
+    c = _mm256_add_epi32 (_mm256_mullo_epi32 (_mm256_sub_epi32 (yv, c16), cy), c128);
+    b = _mm256_srai_epi32 (_mm256_add_epi32 (c, _mm256_mullo_epi32 (cbu, d)), 8);
+    g = _mm256_srai_epi32 (_mm256_sub_epi32 (c, _mm256_add_epi32 (_mm256_mullo_epi32 (cgu, d), _mm256_mullo_epi32 (cgv, e))), 8);
+    r = _mm256_srai_epi32 (_mm256_add_epi32 (c, _mm256_mullo_epi32 (crv, e)), 8);
+    b = _mm256_min_epi32 (_mm256_max_epi32 (b, zero), max);
+    g = _mm256_min_epi32 (_mm256_max_epi32 (g, zero), max);
+    r = _mm256_min_epi32 (_mm256_max_epi32 (r, zero), max);
+
+    _mm256_storeu_si256 ((__m256i *)(dst + 4 * i), _mm256_or_si256 (_mm256_or_si256 (b, _mm256_slli_epi32 (g, 8)),
+        _mm256_or_si256 (_mm256_slli_epi32 (r, 16), alpha)));
+  }
+  yuv_to_bgrx_c (dst + 4 * i, y + i, u + i, v + i, width - i, m);
+}
+
+static const VdScalerKernel kernel_avx2 = { "avx2", blend_rows_avx2, sample_row_avx2, yuv_to_bgrx_avx2 };
+
+#endif /* VD_SCALER_X86 */
+
+const VdScalerKernel * const *vd_scaler_kernels (void) {
+  static const VdScalerKernel *kernels[4];
+  static gsize initialized = 0;
+  gint n = 0;
+
+  if (g_once_init_enter (&initialized)) {
+    kernels[n++] = &kernel_c;
+#ifdef VD_SCALER_X86
+    __builtin_cpu_init ();
+    if (__builtin_cpu_supports ("sse4.1"))
+      kernels[n++] = &kernel_sse4;
+    if (__builtin_cpu_supports ("avx2"))
+      kernels[n++] = &kernel_avx2;
+#endif
+    kernels[n] = NULL;
+    g_once_init_leave (&initialized, 1);
+  }
+  return kernels;
+}
+
+const VdScalerKernel *vd_scaler_best_kernel (void) {
+  const VdScalerKernel * const *kernels = vd_scaler_kernels ();
+  gint n = 0;
+
+  while (kernels[n + 1])
+    n++;
+  return kernels[n];
+}
+
+/* --- Fused conversion --- */
+
+/* Centre aligned bilinear position of output sample i: left source sample and the
+   weight (0-256) of the one after it. The last source sample is reached with weight
+   256 so the right neighbour never goes past the row */
+static void source_position (gint i, gint inSize, gint outSize, gint *index, gint *weight) {
+  gdouble pos = (i + 0.5) * inSize / outSize - 0.5;
+  gint p;
+
+  if (pos < 0)
+    pos = 0;
+  p = (gint)pos;
+  *weight = (gint)((pos - p) * 256 + 0.5);
+  if (p >= inSize - 1) {
+    p = MAX (inSize - 2, 0);
+    *weight = inSize > 1 ? 256 : 0;
+  }
+  *index = p;
+}
+
+static void build_table (gint inSize, gint outSize, gint scale, gint32 *index, guint16 *weight) {
+  gint i, p, w;
+
+  for (i = 0; i < outSize; i++) {
+    source_position (i, inSize, outSize, &p, &w);
+    index[i] = p * scale;
+    weight[i] = (guint16)w;
+  }
+}
+
+VdScaler *vd_scaler_new (const GstVideoInfo *in, const GstVideoInfo *out, const VdScalerKernel *kernel) {
+  VdScaler *scaler;
+  GstVideoFormat format = GST_VIDEO_INFO_FORMAT (in);
+
+  if ((GST_VIDEO_FORMAT_I420 != format && GST_VIDEO_FORMAT_NV12 != format) ||
+      GST_VIDEO_FORMAT_BGRx != GST_VIDEO_INFO_FORMAT (out))
+    return NULL;
+
+  scaler = g_new0 (VdScaler, 1);
+  scaler->kernel = kernel ? kernel : vd_scaler_best_kernel ();
+  scaler->matrix = GST_VIDEO_COLOR_MATRIX_BT709 == in->colorimetry.matrix ? &bt709 : &bt601;
+  scaler->semiPlanar = GST_VIDEO_FORMAT_NV12 == format;
+  scaler->inWidth = GST_VIDEO_INFO_WIDTH (in);
+  scaler->inHeight = GST_VIDEO_INFO_HEIGHT (in);
+  scaler->chromaWidth = GST_VIDEO_INFO_COMP_WIDTH (in, 1);
+  scaler->chromaHeight = GST_VIDEO_INFO_COMP_HEIGHT (in, 1);
+  scaler->outWidth = GST_VIDEO_INFO_WIDTH (out);
+  scaler->outHeight = GST_VIDEO_INFO_HEIGHT (out);
+
+  scaler->lumaIndex = g_new (gint32, scaler->outWidth + 8);
+  scaler->lumaWeight = g_new (guint16, scaler->outWidth + 8);
+  scaler->chromaIndex = g_new (gint32, scaler->outWidth + 8);
+  scaler->chromaWeight = g_new (guint16, scaler->outWidth + 8);
+  build_table (scaler->inWidth, scaler->outWidth, 1, scaler->lumaIndex, scaler->lumaWeight);
+  /* Chroma is upsampled and scaled in the same step, straight to the output width */
+  build_table (scaler->chromaWidth, scaler->outWidth, scaler->semiPlanar ? 2 : 1,
+      scaler->chromaIndex, scaler->chromaWeight);
+
+  scaler->lumaRow = g_malloc0 (scaler->inWidth + VD_SCALER_ROW_PADDING);
+  scaler->chromaRow = g_malloc0 (2 * scaler->chromaWidth + VD_SCALER_ROW_PADDING);
+  scaler->yRow = g_malloc0 (scaler->outWidth + VD_SCALER_ROW_PADDING);
+  scaler->uRow = g_malloc0 (scaler->outWidth + VD_SCALER_ROW_PADDING);
+  scaler->vRow = g_malloc0 (scaler->outWidth + VD_SCALER_ROW_PADDING);
+  return scaler;
+}
+
+void vd_scaler_free (VdScaler *scaler) {
+  if (NULL == scaler)
+    return;
+  g_free (scaler->lumaIndex);
+  g_free (scaler->lumaWeight);
+  g_free (scaler->chromaIndex);
+  g_free (scaler->chromaWeight);
+  g_free (scaler->lumaRow);
+  g_free (scaler->chromaRow);
+  g_free (scaler->yRow);
+  g_free (scaler->uRow);
+  g_free (scaler->vRow);
+  g_free (scaler);
+}
+
+/* Blends the two source rows around output row y of a plane and samples them to the output width */
+static void scale_row (VdScaler *scaler, guint8 *dst, guint8 *tmp, const guint8 *plane, gint stride,
+    gint width, gint height, gint y, const gint32 *index, const guint16 *weight, gint pstride) {
+  gint row, w;
+
+  source_position (y, height, scaler->outHeight, &row, &w);
+  scaler->kernel->blend_rows (tmp, plane + row * stride, plane + MIN (row + 1, height - 1) * stride, width, w);
+  scaler->kernel->sample_row (dst, tmp, index, weight, scaler->outWidth, pstride);
+}
+
+void vd_scaler_process (VdScaler *scaler, const GstVideoFrame *in, GstVideoFrame *out) {
+  const guint8 *yPlane = GST_VIDEO_FRAME_PLANE_DATA (in, 0);
+  const guint8 *uPlane = GST_VIDEO_FRAME_PLANE_DATA (in, 1);
+  const guint8 *vPlane = scaler->semiPlanar ? NULL : GST_VIDEO_FRAME_PLANE_DATA (in, 2);
+  gint yStride = GST_VIDEO_FRAME_PLANE_STRIDE (in, 0);
+  gint uStride = GST_VIDEO_FRAME_PLANE_STRIDE (in, 1);
+  gint vStride = scaler->semiPlanar ? 0 : GST_VIDEO_FRAME_PLANE_STRIDE (in, 2);
+  guint8 *dst = GST_VIDEO_FRAME_PLANE_DATA (out, 0);
+  gint dstStride = GST_VIDEO_FRAME_PLANE_STRIDE (out, 0);
+  gint y;
+
+  for (y = 0; y < scaler->outHeight; y++) {
+    scale_row (scaler, scaler->yRow, scaler->lumaRow, yPlane, yStride, scaler->inWidth, scaler->inHeight, y,
+        scaler->lumaIndex, scaler->lumaWeight, 1);
+    if (scaler->semiPlanar) {
+      /* U and V are sampled out of the same blended UV row, 2 bytes apart */
+      scale_row (scaler, scaler->uRow, scaler->chromaRow, uPlane, uStride, 2 * scaler->chromaWidth,
+          scaler->chromaHeight, y, scaler->chromaIndex, scaler->chromaWeight, 2);
+      scaler->kernel->sample_row (scaler->vRow, scaler->chromaRow + 1, scaler->chromaIndex, scaler->chromaWeight,
+          scaler->outWidth, 2);
+    } else {
+      scale_row (scaler, scaler->uRow, scaler->chromaRow, uPlane, uStride, scaler->chromaWidth,
+          scaler->chromaHeight, y, scaler->chromaIndex, scaler->chromaWeight, 1);
+      scale_row (scaler, scaler->vRow, scaler->chromaRow, vPlane, vStride, scaler->chromaWidth,
+          scaler->chromaHeight, y, scaler->chromaIndex, scaler->chromaWeight, 1);
+    }
+    scaler->kernel->yuv_to_bgrx (dst + y * dstStride, scaler->yRow, scaler->uRow, scaler->vRow,
+        scaler->outWidth, scaler->matrix);
+  }
+}
@@ -1,27 +1,62 @@
+#include <stdio.h>
 #include <string.h>
 
 #include <gtk/gtk.h>
 #include <gst/gst.h>
 #include <gst/video/videooverlay.h>
-#include <dbus/dbus.h>
 
 #include "log.h"
+#include "bench.h"
+#include "keyframe_index.h"
+#include "seek_scheduler.h"
+#include "thumbnailer.h"
+#include "power_manager.h"
+#include "uri_resolver.h"
+#include "playlist.h"
+#include "mosaic.h"
+#include "copy_stats.h"
+#include "vd_convert.h"
+#include "convert_bench.h"
+#include "frame_extract.h"
+#include "log_bench.h"
+#include "qos_controller.h"
+#include "profile.h"
+#include "buffering.h"
+#include "vd_mmap_src.h"
+#include "startup_trace.h"
+#include "rate_sweep.h"
+#include "ab_loop.h"
+#include "av_sync.h"
+#include "pipeline_pool.h"
+#include "memory_budget.h"
+#include "vd_mem_tracer.h"
+#include "subtitle_overlay.h"
+#include "metrics.h"
+#include "input_replay.h"
 
 #include <gdk/gdk.h>
 #include <gdk/gdkx.h>
 
 #define SEEK_INTERVAL 10
-#define SESSION_MANAGER_DBUS "org.gnome.SessionManager"
-#define SESSION_MANAGER_DBUS_PATH "/org/gnome/SessionManager"
-#define SESSION_MANAGER_DBUS_INTERFACE "org.gnome.SessionManager"
-#define SESSION_MANAGER_INHIBIT "Inhibit"
-#define SESSION_MANAGER_UNINHIBIT "Uninhibit"
 #define APPLICATION_NAME "vdplayer"
+#define BENCH_SEEK_SEED 42   /* Bench seek positions are pseudo random but reproducible */
+#define PLAY_FLAG_NATIVE_VIDEO (1 << 6)  /* GstPlayFlags isn't public: no converters in front of the video sink */
+#define WINDOW_HANDLE_TIMEOUT (5 * G_TIME_SPAN_SECOND) /* Longest a prerolling sink waits for the window */
+#define BENCH_SWITCH_INTERVAL_MS 2000 /* Between --bench-switches, long enough for the pool to preroll */
+
+/* How seeks from the slider and arrow keys pick their flags (--seek-mode) */
+typedef enum {
+  SEEK_MODE_INDEXED,   /* accurate, the keyframe first when beyond the keyframe index decode budget */
+  SEEK_MODE_SNAP,      /* accurate within the decode budget, else the nearest keyframe */
+  SEEK_MODE_KEY,       /* always key unit, the old behaviour */
+  SEEK_MODE_ACCURATE   /* always accurate, whatever the GOP length */
+} SeekMode;
 
 /* Structure to contain all our information, so we can pass it around */
 typedef struct _CustomData {
   GtkWidget *main_window;        /* Reference to main video wondow */
   GstElement *playbin;           /* Our one and only pipeline */
+  GstElement *overlay;           /* Element implementing GstVideoOverlay: playbin, or the mosaic video sink */
 
   GtkWidget *slider;              /* Slider widget to keep track of current position */
   //GtkWidget *streams_list;        /* Text widget to display info about the streams */
@@ -30,149 +65,224 @@ typedef struct _CustomData {
   GstState state;                 /* Current state of the pipeline */
   gint64 duration;                /* Duration of the clip, in nanoseconds */
 
-  DBusConnection *sessionBus;     /* Dbus connection to session bus */
-
-  Bool isSleepInhibited;         /* Represents whether session manager sleep is inhibited or not */
-  unsigned int dbusInbitCookie;  /* Cookie got while calling sleep inhibit function to session manager.
-                                    used for calling uninhibit sleep */
+  PowerManager *powerManager;     /* Sleep inhibition through the session manager, NULL without session bus */
+
+  UriResolver *resolver;          /* Turns the input into a playable uri */
+  gchar *resolverCommand;         /* External resolver command line (--resolver) */
+  gchar *uri;                     /* Uri being played, NULL while still resolving */
+  gint64 startTime;               /* Monotonic time main() started */
+  StartupTrace *startup;          /* Startup phases up to the first frame */
+  gboolean startupTrace;          /* Print them (--startup-trace) */
+  gboolean serialStartup;         /* Start the pipeline only after the UI is up (--serial-startup) */
+  GThread *mainThread;            /* Runs GTK; must never wait for the window itself */
+  GMutex windowLock;              /* Protects windowHandle, waited for from streaming threads */
+  GCond windowCond;
+  guintptr windowHandle;          /* XID of the video area once realized, 0 before */
+
+  Playlist *playlist;             /* Inputs from the command line, m3u files expanded */
+  guint playlistIndex;            /* Item currently shown */
+  gint queuedIndex;               /* Item last handed to playbin, set from the streaming thread (atomic) */
+  GstElement *videoSink;          /* The real video sink, once playbin has plugged it */
+
+  gboolean headless;              /* No UI; video and audio go to fakesinks (--headless) */
+  gboolean benchEnabled;          /* Print a JSON throughput report at EOS (--bench) */
+  GMainLoop *loop;                /* Main loop used instead of gtk_main() in headless mode */
+  BenchData *bench;               /* Throughput counters, only set with --bench */
+  int benchSeeks;                 /* Number of seeks to measure instead of playing (--bench-seeks) */
+  GRand *benchRand;               /* Source of the bench seek positions */
+  int exitCode;                   /* Value returned from main() */
+
+  SeekMode seekMode;              /* Seek flag policy */
+  KeyframeIndex *kfIndex;         /* Keyframe index of a local file, NULL otherwise */
+  SeekScheduler *seeker;          /* All seeks go through it */
+  gboolean scrubbing;             /* The slider is being dragged */
+
+  Thumbnailer *thumbnailer;       /* Slider hover previews, NULL when disabled */
+  int thumbnailCacheKb;           /* Thumbnail cache budget (--thumbnail-cache), 0 disables */
+
+  gboolean mosaicEnabled;         /* Show all inputs at once in a grid (--mosaic) */
+  Mosaic *mosaic;                 /* Compositor pipeline used instead of playbin in mosaic mode */
+
+  gchar *videoSinkName;           /* Output path (--video-sink): auto, xv, x or gtk */
+  GtkWidget *sinkWidget;          /* gtksink's widget, packed in place of the drawing area */
+  CopyStats *copyStats;           /* Conversion/copy bytes per displayed frame */
+  gboolean simdConvert;           /* Use vdconvert as playbin's video filter (--simd-convert) */
+  GstElement *convertFilter;      /* The vdconvert instance, scaled to the video window */
+  gboolean benchConvert;          /* Only run the converter self test and benchmark (--bench-convert) */
+  gboolean benchLog;              /* Only run the logger benchmark (--bench-log) */
+
+  gboolean qosEnabled;            /* Degrade decoding under CPU pressure (on, --no-qos disables) */
+  QosController *qos;
+  int cpuLoad;                    /* Busy loop threads started with the bench (--bench-cpu-load) */
+  gchar *extractDir;              /* Only extract frames of every input into this directory (--extract-frames) */
+  gdouble extractInterval;        /* Seconds between extracted frames (--extract-interval) */
+  gchar *extractTimes;            /* ...or the positions, comma separated seconds (--extract-times) */
+  gchar *extractFormat;           /* jpeg or png (--extract-format) */
+  gboolean extractAccurate;       /* Frame accurate rather than keyframe seeks (--extract-accurate) */
+  int extractWorkers;             /* Inputs decoded at once, 0 for one per core (--extract-workers) */
+  int memoryBudgetMb;             /* Hard limit for queues, frame pools and decoder threads (--memory-budget) */
+  MemoryBudget *memoryBudget;
+  gboolean memoryTrace;           /* Count live GstMemory per element, headless sinks synchronise (--memory-trace) */
+  VdMemTracer *memTracer;         /* Never freed, see vd_mem_tracer.h */
+
+  gchar *profileName;             /* Built-in element tuning preset (--profile) */
+  gchar *profileFile;             /* Key file applied on top of it (--profile-file) */
+  Profile *profile;               /* Element properties set as elements are created, NULL for defaults */
+
+  gboolean bufferingEnabled;      /* Pause to refill network sources (on, --no-buffering disables) */
+  Buffering *buffering;
+  gboolean mmapEnabled;           /* Read local files through vdmmapsrc (on, --no-mmap disables) */
+
+  gboolean benchRates;            /* With --bench, measure each playback rate instead of playing (--bench-rates) */
+  RateSweep *rateSweep;
+
+  AbLoop *abLoop;                 /* A-B loop markers and wrap measurement */
+  gint64 loopStart;               /* Loop to start once prerolled (--loop), -1 for none */
+  gint64 loopStop;
+  int benchLoops;                 /* With --bench and --loop, measure N wraps instead of playing (--bench-loops) */
+
+  gboolean cachedSubtitles;       /* Draw subtitles ourselves (on, --no-cached-subtitles uses playsink's renderer) */
+  SubtitleOverlay *subtitles;
+  gchar *subFile;                 /* External subtitle file or uri (--sub-file) */
+
+  gchar *metricsSocket;           /* Unix socket serving Prometheus metrics (--metrics-socket) */
+  Metrics *metrics;
+
+  gchar *recordFile;              /* Input events are appended here (--record) */
+  InputRecorder *recorder;
+  gchar *replayFile;              /* Input events to replay, with latency report (--replay) */
+  InputReplay *replay;
+
+  gboolean avSyncEnabled;         /* Measure A/V drift and sync marks, headless sinks synchronise (--av-sync) */
+  AvSync *avSync;
+  int avOffset;                   /* playbin av-offset in ms, positive delays audio (--av-offset) */
+
+  int poolSize;                   /* Standby pipelines for switching inputs (--pool), -1 when off */
+  PipelinePool *pool;
+  int benchSwitches;              /* With --bench, measure N switches instead of playing (--bench-switches) */
+  int benchSwitchCount;
+  guint benchSwitchTimer;
 } CustomData;
 
-/*Function to inhibit cpu sleep. Also used for setting cpu sleep back on */
-void inhibit_cpu_sleep(CustomData *data, Bool enable) {
-
-  DBusError dbusError;
-  DBusMessage *request;
-  DBusMessageIter reqIter;
-  DBusMessageIter replyIter;
-  int windowId = 0;
-  char *appName = APPLICATION_NAME;
-  char *reason = "my video player is running";
-  int flag = 8; /* 8: to stop session being marked as idle */
-  DBusPendingCall *pendingReturn;
-  DBusMessage *reply;
-  unsigned int inhibitCookie = 0;
-
-  LOGD("Entered %s", __func__);
-
-  if (enable) {
-    LOGD("Going to inhibit cpu sleep");
-    request = dbus_message_new_method_call(SESSION_MANAGER_DBUS, SESSION_MANAGER_DBUS_PATH,
-                             SESSION_MANAGER_DBUS_INTERFACE, SESSION_MANAGER_INHIBIT);
-    if (NULL == request) {
-      LOGD("Error in creating dbus method");
-      goto Exit;
-    }
-    dbus_message_iter_init_append (request, &reqIter);
+/* Playback rate steps of the [ and ] keys, applied in the current direction */
+static const gdouble playbackRates[] = { 0.25, 0.5, 1.0, 2.0, 4.0, 8.0, 16.0, 32.0 };
 
-    if (!(dbus_message_iter_append_basic (&reqIter, DBUS_TYPE_STRING, &appName))) {
-      LOGD("Error adding appilcation name %d", __LINE__);
-      goto Exit;
-    }
-    if (!(dbus_message_iter_append_basic (&reqIter, DBUS_TYPE_UINT32 , &windowId))) {
-      LOGD("Error adding window id %d", __LINE__);
-      goto Exit;
-    }
-    if (!(dbus_message_iter_append_basic (&reqIter, DBUS_TYPE_STRING, &reason))) {
-      LOGD("Error adding reason %d", __LINE__);
-      goto Exit;
-    }
-    if (!(dbus_message_iter_append_basic (&reqIter, DBUS_TYPE_UINT32, &flag))) {
-      LOGD("Error adding flag %d", __LINE__);
-      goto Exit;
-    }
+/* This function is called when the GUI toolkit creates the physical window that will hold the video.
+ * At this point we can retrieve its handler and pass it to GStreamer through the VideoOverlay interface. */
+static void realize_cb (GtkWidget *widget, CustomData *data) {
+  GdkWindow *window = gtk_widget_get_window (widget);
+  guintptr window_handle;
 
-  } else {
-    LOGD("Enabling CPU sleep");
-    request = dbus_message_new_method_call(SESSION_MANAGER_DBUS, SESSION_MANAGER_DBUS_PATH,
-                           SESSION_MANAGER_DBUS_INTERFACE, SESSION_MANAGER_UNINHIBIT);
-    if (NULL == request) {
-      LOGD("Error in creating dbus method");
-      goto Exit;
-    }
-    dbus_message_iter_init_append (request, &reqIter);
-    if (!(dbus_message_iter_append_basic (&reqIter, DBUS_TYPE_UINT32, &(data->dbusInbitCookie)))) {
-      LOGD("Error adding inhibit cookie");
-      goto Exit;
-    }
-  }
+  if (NULL == data->overlay)
+    return;
+  if (!gdk_window_ensure_native (window))
+    g_error ("Couldn't create native window needed for GstVideoOverlay!");
 
-  if (!dbus_connection_send_with_reply (data->sessionBus, request, &pendingReturn, -1)) {
-    LOGD ("Error in dbus_connection_send_with_reply");
-    goto Exit;
-  }
+  /* Retrieve window handler from GDK.Pass it to playbin, which implements VideoOverlay
+     and will forward it to the video sink. The mosaic pipeline hands it to its sink directly */
+  window_handle = GDK_WINDOW_XID (window);
+  startup_trace_mark (data->startup, "window_realized");
+  gst_video_overlay_set_window_handle (GST_VIDEO_OVERLAY (data->overlay), window_handle);
+
+  /* A sink prerolling meanwhile may be waiting for it in prepare_window_handle_cb */
+  g_mutex_lock (&data->windowLock);
+  data->windowHandle = window_handle;
+  g_cond_broadcast (&data->windowCond);
+  g_mutex_unlock (&data->windowLock);
+}
 
-  if (pendingReturn == NULL) {
-    LOGD ("pending return is NULL");
-    goto Exit;
+/* The pipeline prerolls while the window is still being built. A video sink asking for
+ * its window before realize_cb has run waits here, in its streaming thread, instead of
+ * opening a window of its own */
+static void prepare_window_handle_cb (GstBus *bus, GstMessage *msg, CustomData *data) {
+  gint64 deadline = g_get_monotonic_time () + WINDOW_HANDLE_TIMEOUT;
+  guintptr handle;
+
+  if (!gst_is_video_overlay_prepare_window_handle_message (msg) || NULL == data->overlay || data->headless)
+    return;
+  /* The main thread is the one building the window, it can't wait for it */
+  if (g_thread_self () == data->mainThread)
+    return;
+
+  g_mutex_lock (&data->windowLock);
+  while (0 == data->windowHandle) {
+    if (!g_cond_wait_until (&data->windowCond, &data->windowLock, deadline))
+      break;
   }
+  handle = data->windowHandle;
+  g_mutex_unlock (&data->windowLock);
 
-  dbus_pending_call_block (pendingReturn);
-  if ((reply = dbus_pending_call_steal_reply (pendingReturn)) == NULL) {
-    LOGD ("Error in dbus_pending_call_steal_reply");
-    goto Exit;
+  if (handle) {
+    gst_video_overlay_set_window_handle (GST_VIDEO_OVERLAY (GST_MESSAGE_SRC (msg)), handle);
+    startup_trace_mark (data->startup, "window_handle");
+  } else {
+    LOGW ("No video window after %d s, the sink opens its own", (int)(WINDOW_HANDLE_TIMEOUT / G_TIME_SPAN_SECOND));
   }
+}
 
-  /* parse reply according to inbit/unhibit method called */
-  if (enable) {
-    if (dbus_message_iter_init(reply, &replyIter)) {
-      if (DBUS_TYPE_UINT32 == dbus_message_iter_get_arg_type(&replyIter)) {
-        dbus_message_iter_get_basic(&replyIter, &(data->dbusInbitCookie));
-        LOGD("Got inhibit cookie:%d",data->dbusInbitCookie);
+/* Posted from the thread that completed the state change, so the marks aren't delayed
+ * by the main loop */
+static void sync_state_changed_cb (GstBus *bus, GstMessage *msg, CustomData *data) {
+  GstState old_state, new_state;
+
+  if (GST_MESSAGE_SRC (msg) != GST_OBJECT (data->playbin))
+    return;
+  gst_message_parse_state_changed (msg, &old_state, &new_state, NULL);
+  if (GST_STATE_READY == old_state && GST_STATE_PAUSED == new_state) {
+    startup_trace_mark (data->startup, "prerolled");
+  } else if (GST_STATE_PLAYING == new_state) {
+    startup_trace_mark (data->startup, "playing");
+  }
+}
 
-      } else {
-        LOGD("inhibit return type is not as expected\n");
-        goto Exit;
-      }
-    } else {
-      LOGD ("Error in creating reply iterator");
-      goto Exit;
-    }
-    data->isSleepInhibited = True;
+/* With --simd-convert the frames are scaled straight to the size of the video window,
+ * so the sink shows them 1:1 */
+static void video_size_allocate_cb (GtkWidget *widget, GdkRectangle *allocation, CustomData *data) {
+  gint scale = gtk_widget_get_scale_factor (widget);
 
-  } else {
-    /* TODO parse the unhibit command here */
-    data->isSleepInhibited = False;
+  if (data->convertFilter) {
+    g_object_set (data->convertFilter, "fit-width", allocation->width * scale,
+        "fit-height", allocation->height * scale, NULL);
   }
+  /* Subtitle bitmaps are drawn at this size when the sink scales them itself */
+  subtitle_overlay_set_window_size (data->subtitles, allocation->width * scale, allocation->height * scale);
+}
 
-Exit:
-  if (NULL != request) {
-    dbus_message_unref (request);
-  }
-  if (NULL != pendingReturn) {
-    dbus_pending_call_unref	(pendingReturn);
+/* Play/pause/stop from the user. While buffering, playing waits for the queues to fill */
+static void set_user_state (CustomData *data, GstState state) {
+  if (buffering_request_state (data->buffering, state)) {
+    gst_element_set_state (data->playbin, state);
   }
-  LOGD("Returning %s", __func__);
-  return;
 }
 
-/* This function is called when the GUI toolkit creates the physical window that will hold the video.
- * At this point we can retrieve its handler and pass it to GStreamer through the VideoOverlay interface. */
-static void realize_cb (GtkWidget *widget, CustomData *data) {
-  GdkWindow *window = gtk_widget_get_window (widget);
-  guintptr window_handle;
-
-  if (!gdk_window_ensure_native (window))
-    g_error ("Couldn't create native window needed for GstVideoOverlay!");
-
-  /* Retrieve window handler from GDK.Pass it to playbin, which implements VideoOverlay
-     and will forward it to the video sink */
-  window_handle = GDK_WINDOW_XID (window);
-  gst_video_overlay_set_window_handle (GST_VIDEO_OVERLAY (data->playbin), window_handle);
+/* The state play/pause toggles from. While buffering holds playback, the pipeline is
+   PAUSED but the user still has it playing */
+static GstState user_state (CustomData *data) {
+  return buffering_holds_playback (data->buffering) ? GST_STATE_PLAYING : data->state;
 }
 
 /* This function is called when the PLAY button is clicked */
 static void play_cb (GtkButton *button, CustomData *data) {
-  gst_element_set_state (data->playbin, GST_STATE_PLAYING);
+  set_user_state (data, GST_STATE_PLAYING);
 }
 
 /* This function is called when the PAUSE button is clicked */
 static void pause_cb (GtkButton *button, CustomData *data) {
-  gst_element_set_state (data->playbin, GST_STATE_PAUSED);
+  set_user_state (data, GST_STATE_PAUSED);
 }
 
 /* This function is called when the STOP button is clicked */
 static void stop_cb (GtkButton *button, CustomData *data) {
-  gst_element_set_state (data->playbin, GST_STATE_READY);
+  set_user_state (data, GST_STATE_READY);
+}
+
+/* Leaves whichever main loop is running */
+static void quit_main_loop (CustomData *data) {
+  if (data->loop) {
+    g_main_loop_quit (data->loop);
+  } else {
+    gtk_main_quit ();
+  }
 }
 
 /* This function is called when the main window is closed */
@@ -199,81 +309,218 @@ static gboolean draw_cb (GtkWidget *widget, cairo_t *cr, CustomData *data) {
   return FALSE;
 }
 
+/* Picks the flags of a (non scrubbing) flushing seek for the seek scheduler. With a keyframe
+ * index, a seek that has to decode more than a bounded amount forward from the keyframe
+ * shows the keyframe first, or with --seek-mode=snap stays on the nearest one */
+static GstSeekFlags seek_flags_cb (gint64 *position, gint64 *refine, CustomData *data) {
+  GstSeekFlags flags;
+
+  switch (data->seekMode) {
+    case SEEK_MODE_ACCURATE:
+      flags = GST_SEEK_FLAG_FLUSH | GST_SEEK_FLAG_ACCURATE;
+      break;
+    case SEEK_MODE_KEY:
+      flags = GST_SEEK_FLAG_FLUSH | GST_SEEK_FLAG_KEY_UNIT;
+      break;
+    case SEEK_MODE_SNAP:
+      flags = keyframe_index_seek_flags (data->kfIndex, position, NULL);
+      break;
+    default:
+      /* Falls back to key unit until the index is ready */
+      flags = keyframe_index_seek_flags (data->kfIndex, position, refine);
+      break;
+  }
+  return flags;
+}
+
 /* This function is called when the slider changes its position. We perform a seek to the
  * new position here. */
+static void slider_seek (CustomData *data, gdouble value) {
+  buffering_seek_started (data->buffering);
+  seek_scheduler_seek (data->seeker, (gint64)(value * GST_SECOND), data->scrubbing);
+}
+
 static void slider_cb (GtkRange *range, CustomData *data) {
-  gdouble value = gtk_range_get_value (GTK_RANGE (data->slider));
-  gst_element_seek_simple (data->playbin, GST_FORMAT_TIME, GST_SEEK_FLAG_FLUSH | GST_SEEK_FLAG_KEY_UNIT,
-      (gint64)(value * GST_SECOND));
+  InputEvent event = { .type = INPUT_SLIDER };
+
+  event.value = gtk_range_get_value (GTK_RANGE (data->slider));
+  input_recorder_add (data->recorder, &event);
+  slider_seek (data, event.value);
+}
+
+/* Slider drags seek on keyframes only; the accurate seek is done on release */
+static gboolean slider_press_cb (GtkWidget *widget, GdkEventButton *event, CustomData *data) {
+  InputEvent input = { .type = INPUT_SLIDER_PRESS };
+
+  input_recorder_add (data->recorder, &input);
+  data->scrubbing = TRUE;
+  return FALSE;
+}
+
+static gboolean slider_release_cb (GtkWidget *widget, GdkEventButton *event, CustomData *data) {
+  InputEvent input = { .type = INPUT_SLIDER_RELEASE };
+
+  input_recorder_add (data->recorder, &input);
+  data->scrubbing = FALSE;
+  seek_scheduler_scrub_end (data->seeker);
+  return FALSE;
+}
+
+/* Shows the scrub preview of the hovered slider position as tooltip icon */
+static gboolean slider_query_tooltip_cb (GtkWidget *widget, gint x, gint y, gboolean keyboard_mode,
+    GtkTooltip *tooltip, CustomData *data) {
+  GtkAdjustment *adjustment = gtk_range_get_adjustment (GTK_RANGE (widget));
+  gint width = gtk_widget_get_allocated_width (widget);
+  gdouble seconds;
+  GdkPixbuf *pixbuf;
+  gchar *text;
+
+  if (NULL == data->thumbnailer || keyboard_mode || width <= 0)
+    return FALSE;
+
+  seconds = gtk_adjustment_get_lower (adjustment) +
+      (gtk_adjustment_get_upper (adjustment) - gtk_adjustment_get_lower (adjustment)) * CLAMP ((gdouble)x / width, 0, 1);
+  pixbuf = thumbnailer_lookup (data->thumbnailer, (gint64)(seconds * GST_SECOND));
+  if (NULL == pixbuf)
+    return FALSE;
+
+  text = g_strdup_printf ("%d:%02d:%02d", (int)seconds / 3600, ((int)seconds / 60) % 60, (int)seconds % 60);
+  gtk_tooltip_set_icon (tooltip, pixbuf);
+  gtk_tooltip_set_text (tooltip, text);
+  g_free (text);
+  g_object_unref (pixbuf);
+  return TRUE;
+}
+
+/* Moves the slider to the latest seek target, in SECONDS */
+static void update_slider_to_target (CustomData *data) {
+  gint64 target = seek_scheduler_get_target (data->seeker);
+
+  if (target < 0 || NULL == data->slider)
+    return;
+
+  /* Block the "value-changed" signal, so the slider_cb function is not called
+   * (which would trigger a seek the user has not requested) */
+  g_signal_handler_block (data->slider, data->slider_update_signal_id);
+  gtk_range_set_value (GTK_RANGE (data->slider), (gdouble)target / GST_SECOND);
+  /* Re-enable the signal */
+  g_signal_handler_unblock (data->slider, data->slider_update_signal_id);
 }
 
+/* Moves the rate magnitude steps up or down the ladder, keeping the direction */
+static void step_rate (CustomData *data, gint steps) {
+  gdouble rate = seek_scheduler_get_rate (data->seeker);
+  gint i, n = G_N_ELEMENTS (playbackRates);
+
+  for (i = 0; i < n - 1 && playbackRates[i] < ABS (rate); i++)
+    ;
+  i = CLAMP (i + steps, 0, n - 1);
+  seek_scheduler_set_rate (data->seeker, rate < 0 ? -playbackRates[i] : playbackRates[i]);
+  LOGI ("Playback rate %.2fx", seek_scheduler_get_rate (data->seeker));
+}
+
+/* Step events only make sense while paused; playing on from a step keeps its direction */
+static void step_frame (CustomData *data, gint frames) {
+  if (GST_STATE_PLAYING == user_state (data)) {
+    set_user_state (data, GST_STATE_PAUSED);
+  }
+  seek_scheduler_step (data->seeker, frames);
+}
+
+static void switch_input (CustomData *data, guint index);
+static void prepare_next_input (CustomData *data);
+static gboolean bench_switch_cb (CustomData *data);
+
 /* Function to recieve keypress events */
 static void keypress_cb (GtkWidget *widget, GdkEventKey *event, CustomData *data) {
+  InputEvent input = { .type = INPUT_KEY };
+  guint n = playlist_length (data->playlist);
+
   LOGD("Got keypress event");
-  gint64 current = -1;
+  input.keyval = event->keyval;
+  input_recorder_add (data->recorder, &input);
   switch (event->keyval)
   {
     case GDK_KEY_space:
       LOGD ("Space key");
-      if (GST_STATE_PLAYING == data->state) {
-        gst_element_set_state (data->playbin, GST_STATE_PAUSED);
+      if (GST_STATE_PLAYING == user_state (data)) {
+        set_user_state (data, GST_STATE_PAUSED);
         LOGD("Pause called; Current sate: %d", GST_STATE(data->playbin));
-      } else if (GST_STATE_PAUSED == data->state) {
-        gst_element_set_state (data->playbin, GST_STATE_PLAYING);
+      } else if (GST_STATE_PAUSED == user_state (data)) {
+        set_user_state (data, GST_STATE_PLAYING);
         LOGD("Play called; Current sate: %d", GST_STATE(data->playbin));
       }
       break;
     case GDK_KEY_Left:
-      /* TODO add  proper error handlin and update the seek bar properly, if it is not correct */
-      if (gst_element_query_position (data->playbin, GST_FORMAT_TIME, &current)) {
-        gst_element_seek_simple (data->playbin, GST_FORMAT_TIME, GST_SEEK_FLAG_FLUSH | GST_SEEK_FLAG_KEY_UNIT,
-        (gint64)(current - ((SEEK_INTERVAL) * GST_SECOND)));
-
-        /* Block the "value-changed" signal, so the slider_cb function is not called
-         * (which would trigger a seek the user has not requested) */
-        g_signal_handler_block (data->slider, data->slider_update_signal_id);
-        /* Set the position of the slider to the current pipeline positoin, in SECONDS */
-        gtk_range_set_value (GTK_RANGE (data->slider), (gdouble)((current / GST_SECOND) - SEEK_INTERVAL));
-        /* Re-enable the signal */
-        g_signal_handler_unblock (data->slider, data->slider_update_signal_id);
-      } else {
-        LOGD("Failed to get duration");
-      }
+      /* Repeated presses accumulate on the pending target, see seek_scheduler_seek_relative */
+      buffering_seek_started (data->buffering);
+      seek_scheduler_seek_relative (data->seeker, -((gint64)SEEK_INTERVAL * GST_SECOND));
+      update_slider_to_target (data);
       break;
     case GDK_KEY_Right:
-      /* TODO add  proper error handlin and update the seek bar properly, if it is not correct */
-      if (gst_element_query_position (data->playbin, GST_FORMAT_TIME, &current)) {
-        gst_element_seek_simple (data->playbin, GST_FORMAT_TIME, GST_SEEK_FLAG_FLUSH | GST_SEEK_FLAG_KEY_UNIT,
-        (gint64)(current + ((SEEK_INTERVAL) * GST_SECOND)));
-
-        /* Block the "value-changed" signal, so the slider_cb function is not called
-         * (which would trigger a seek the user has not requested) */
-        g_signal_handler_block (data->slider, data->slider_update_signal_id);
-        /* Set the position of the slider to the current pipeline positoin, in SECONDS */
-        gtk_range_set_value (GTK_RANGE (data->slider), (gdouble)((current / GST_SECOND) + SEEK_INTERVAL));
-        /* Re-enable the signal */
-        g_signal_handler_unblock (data->slider, data->slider_update_signal_id);
-      } else {
-        LOGD("Failed to get duration");
-      }
+      buffering_seek_started (data->buffering);
+      seek_scheduler_seek_relative (data->seeker, (gint64)SEEK_INTERVAL * GST_SECOND);
+      update_slider_to_target (data);
+      break;
+    case GDK_KEY_bracketright:
+      step_rate (data, 1);
+      break;
+    case GDK_KEY_bracketleft:
+      step_rate (data, -1);
+      break;
+    case GDK_KEY_BackSpace:
+      /* Reverse, same speed */
+      seek_scheduler_set_rate (data->seeker, -seek_scheduler_get_rate (data->seeker));
+      LOGI ("Playback rate %.2fx", seek_scheduler_get_rate (data->seeker));
+      break;
+    case GDK_KEY_equal:
+      seek_scheduler_set_rate (data->seeker, 1.0);
+      break;
+    case GDK_KEY_l:
+      /* A, then B, then off */
+      ab_loop_mark (data->abLoop);
+      break;
+    case GDK_KEY_period:
+      step_frame (data, 1);
+      break;
+    case GDK_KEY_comma:
+      step_frame (data, -1);
+      break;
+    case GDK_KEY_Page_Down:
+      /* Next input, from the pipeline pool */
+      switch_input (data, (data->playlistIndex + 1) % n);
+      break;
+    case GDK_KEY_Page_Up:
+      switch_input (data, (data->playlistIndex + n - 1) % n);
       break;
     case GDK_KEY_Escape:
-      gtk_window_unfullscreen(GTK_WINDOW(data->main_window));
+      if (data->main_window)
+        gtk_window_unfullscreen(GTK_WINDOW(data->main_window));
       break;
     default:
+      /* 1 to 9 pick the input */
+      if (event->keyval >= GDK_KEY_1 && event->keyval <= GDK_KEY_9) {
+        switch_input (data, event->keyval - GDK_KEY_1);
+      }
       break;
   }
 }
 
 /*Function recieves click event on video window */
 gboolean video_screen_mouse_click_cb (GtkWidget *widget, GdkEventButton *event, CustomData *data) {
+  InputEvent input = { .type = INPUT_CLICK };
+
   LOGD("Got mouse keyevent %d", event->type);
+  input.button = event->button;
+  input.doubleClick = GDK_2BUTTON_PRESS == event->type;
+  input_recorder_add (data->recorder, &input);
 
   switch (event->type)
   {
     case GDK_2BUTTON_PRESS:
       /*TODO: state machine for window size */
-      gtk_window_unfullscreen(GTK_WINDOW(data->main_window));
+      if (data->main_window)
+        gtk_window_unfullscreen(GTK_WINDOW(data->main_window));
       break;
     default:
       LOGD ("mouse click unhandled");
@@ -283,6 +530,88 @@ gboolean video_screen_mouse_click_cb (GtkWidget *widget, GdkEventButton *event,
   return TRUE;
 }
 
+/* Runs a replayed event through the handler the live one goes to. Without a window the
+ * slider's handlers are called directly */
+static InputResponse replay_input_cb (const InputEvent *event, CustomData *data) {
+  GdkEventKey key;
+  GdkEventButton button;
+  GtkAdjustment *adjustment;
+  gdouble value;
+
+  switch (event->type) {
+    case INPUT_KEY:
+      memset (&key, 0, sizeof (key));
+      key.type = GDK_KEY_PRESS;
+      key.keyval = event->keyval;
+      keypress_cb (data->main_window, &key, data);
+      switch (event->keyval) {
+        case GDK_KEY_space:
+          return INPUT_RESPONSE_STATE;
+        case GDK_KEY_Left:
+        case GDK_KEY_Right:
+          return INPUT_RESPONSE_SEEK;
+        case GDK_KEY_bracketleft:
+        case GDK_KEY_bracketright:
+        case GDK_KEY_BackSpace:
+        case GDK_KEY_equal:
+        case GDK_KEY_period:
+        case GDK_KEY_comma:
+          /* Instant rate changes and steps have no ASYNC_DONE */
+          return INPUT_RESPONSE_FRAME;
+        case GDK_KEY_Page_Down:
+        case GDK_KEY_Page_Up:
+          /* The input switched to reaching PLAYING */
+          return data->pool ? INPUT_RESPONSE_STATE : INPUT_RESPONSE_NONE;
+        default:
+          return data->pool && event->keyval >= GDK_KEY_1 && event->keyval <= GDK_KEY_9 ?
+              INPUT_RESPONSE_STATE : INPUT_RESPONSE_NONE;
+      }
+    case INPUT_CLICK:
+      memset (&button, 0, sizeof (button));
+      button.type = event->doubleClick ? GDK_2BUTTON_PRESS : GDK_BUTTON_PRESS;
+      button.button = event->button;
+      video_screen_mouse_click_cb (data->main_window, &button, data);
+      return INPUT_RESPONSE_NONE;
+    case INPUT_SLIDER_PRESS:
+      slider_press_cb (data->slider, NULL, data);
+      return INPUT_RESPONSE_NONE;
+    case INPUT_SLIDER:
+      /* The slider only spans the clip once refresh_ui has the duration; until then it
+       * is 0-100 and would clamp the value, so the seek goes straight out */
+      if (data->slider && !GST_CLOCK_TIME_IS_VALID (data->duration) &&
+          gst_element_query_duration (data->playbin, GST_FORMAT_TIME, &data->duration)) {
+        g_signal_handler_block (data->slider, data->slider_update_signal_id);
+        gtk_range_set_range (GTK_RANGE (data->slider), 0, (gdouble)data->duration / GST_SECOND);
+        g_signal_handler_unblock (data->slider, data->slider_update_signal_id);
+      }
+      if (NULL == data->slider || !GST_CLOCK_TIME_IS_VALID (data->duration)) {
+        slider_seek (data, event->value);
+        return INPUT_RESPONSE_SEEK;
+      }
+      adjustment = gtk_range_get_adjustment (GTK_RANGE (data->slider));
+      value = CLAMP (event->value, gtk_adjustment_get_lower (adjustment), gtk_adjustment_get_upper (adjustment));
+      /* A drag to where the slider already is changes nothing, live or replayed */
+      if (value == gtk_range_get_value (GTK_RANGE (data->slider)))
+        return INPUT_RESPONSE_NONE;
+      /* Through "value-changed", as a drag would */
+      gtk_range_set_value (GTK_RANGE (data->slider), value);
+      return INPUT_RESPONSE_SEEK;
+    case INPUT_SLIDER_RELEASE:
+      slider_release_cb (data->slider, NULL, data);
+      return INPUT_RESPONSE_SEEK;
+  }
+  return INPUT_RESPONSE_NONE;
+}
+
+static void replay_done_cb (CustomData *data) {
+  input_replay_report (data->replay);
+  if (data->bench) {
+    /* What the replayed seeks did to playback */
+    bench_report (data->bench);
+  }
+  quit_main_loop (data);
+}
+
 /* This creates all the GTK+ widgets that compose our application, and registers the callbacks */
 static void create_ui (CustomData *data) {
   GtkWidget *main_window;  /* The uppermost window, containing all other windows */
@@ -295,10 +624,16 @@ static void create_ui (CustomData *data) {
   main_window = gtk_window_new (GTK_WINDOW_TOPLEVEL);
   g_signal_connect (G_OBJECT (main_window), "delete-event", G_CALLBACK (delete_event_cb), data);
 
-  video_window = gtk_drawing_area_new ();
-  gtk_widget_set_double_buffered (video_window, FALSE);
-  g_signal_connect (video_window, "realize", G_CALLBACK (realize_cb), data);
-  g_signal_connect (video_window, "draw", G_CALLBACK (draw_cb), data);
+  if (data->sinkWidget) {
+    /* gtksink draws into its own widget */
+    video_window = data->sinkWidget;
+  } else {
+    video_window = gtk_drawing_area_new ();
+    gtk_widget_set_double_buffered (video_window, FALSE);
+    g_signal_connect (video_window, "realize", G_CALLBACK (realize_cb), data);
+    g_signal_connect (video_window, "draw", G_CALLBACK (draw_cb), data);
+  }
+  g_signal_connect (video_window, "size-allocate", G_CALLBACK (video_size_allocate_cb), data);
   gtk_widget_add_events(video_window, GDK_BUTTON_PRESS_MASK);
   g_signal_connect (video_window, "button-press-event", G_CALLBACK (video_screen_mouse_click_cb), data);
 
@@ -314,6 +649,10 @@ static void create_ui (CustomData *data) {
   data->slider = gtk_scale_new_with_range (GTK_ORIENTATION_HORIZONTAL, 0, 100, 1);
   gtk_scale_set_draw_value (GTK_SCALE (data->slider), 0);
   data->slider_update_signal_id = g_signal_connect (G_OBJECT (data->slider), "value-changed", G_CALLBACK (slider_cb), data);
+  g_signal_connect (G_OBJECT (data->slider), "button-press-event", G_CALLBACK (slider_press_cb), data);
+  g_signal_connect (G_OBJECT (data->slider), "button-release-event", G_CALLBACK (slider_release_cb), data);
+  gtk_widget_set_has_tooltip (data->slider, TRUE);
+  g_signal_connect (G_OBJECT (data->slider), "query-tooltip", G_CALLBACK (slider_query_tooltip_cb), data);
 
   /* Listen for keypress events */
   gtk_widget_add_events(main_window, GDK_KEY_PRESS_MASK);
@@ -331,6 +670,10 @@ static void create_ui (CustomData *data) {
 
   main_hbox = gtk_box_new (GTK_ORIENTATION_HORIZONTAL, 0);
   gtk_box_pack_start (GTK_BOX (main_hbox), video_window, TRUE, TRUE, 0);
+  if (data->sinkWidget) {
+    /* The box holds it now */
+    g_object_unref (data->sinkWidget);
+  }
 
   main_box = gtk_box_new (GTK_ORIENTATION_VERTICAL, 0);
   gtk_box_pack_start (GTK_BOX (main_box), main_hbox, TRUE, TRUE, 0);
@@ -349,7 +692,7 @@ static gboolean refresh_ui (CustomData *data) {
   gint64 current = -1;
 
   /* We do not want to update anything unless we are in the PAUSED or PLAYING states */
-  if (data->state < GST_STATE_PAUSED)
+  if (data->state < GST_STATE_PAUSED || NULL == data->slider)
     return TRUE;
 
   /* If we didn't know it yet, query the stream duration */
@@ -362,7 +705,16 @@ static gboolean refresh_ui (CustomData *data) {
     }
   }
 
+  /* Don't pull the slider back while the user drags it or a seek is outstanding */
+  if (data->scrubbing || seek_scheduler_get_target (data->seeker) >= 0)
+    return TRUE;
+
   if (gst_element_query_position (data->playbin, GST_FORMAT_TIME, &current)) {
+    if (data->thumbnailer) {
+      /* Keep the previews around the playback position */
+      thumbnailer_set_position (data->thumbnailer, current);
+    }
+
     /* Block the "value-changed" signal, so the slider_cb function is not called
      * (which would trigger a seek the user has not requested) */
     g_signal_handler_block (data->slider, data->slider_update_signal_id);
@@ -388,22 +740,174 @@ static void error_cb (GstBus *bus, GstMessage *msg, CustomData *data) {
   GError *err;
   gchar *debug_info;
 
+  /* Standby pipelines of the pool post here too; the pool drops those that fail */
+  if (!gst_object_has_as_ancestor (GST_MESSAGE_SRC (msg), GST_OBJECT (data->playbin)))
+    return;
+
   /* Print error details on the screen */
   gst_message_parse_error (msg, &err, &debug_info);
-  LOGD ("Error received from element %s: %s", GST_OBJECT_NAME (msg->src), err->message);
-  LOGD ("Debugging information: %s", debug_info ? debug_info : "none");
+  LOGE ("Error received from element %s: %s", GST_OBJECT_NAME (msg->src), err->message);
+  LOGE ("Debugging information: %s", debug_info ? debug_info : "none");
   g_clear_error (&err);
   g_free (debug_info);
 
   /* Set the pipeline to READY (which stops playback) */
   gst_element_set_state (data->playbin, GST_STATE_READY);
+
+  if (data->headless) {
+    /* Nobody is there to pick another file, give up */
+    data->exitCode = -1;
+    quit_main_loop (data);
+  }
 }
 
 /* This function is called when an End-Of-Stream message is posted on the bus.
  * We just set the pipeline to READY (which stops playback) */
 static void eos_cb (GstBus *bus, GstMessage *msg, CustomData *data) {
+  if (GST_MESSAGE_SRC (msg) != GST_OBJECT (data->playbin))
+    return;
+
   LOGD ("End-Of-Stream reached.");
+  if (data->bench) {
+    /* Report before READY tears down the streaming threads we measure */
+    bench_report (data->bench);
+  }
   gst_element_set_state (data->playbin, GST_STATE_READY);
+
+  if (data->headless || data->bench) {
+    quit_main_loop (data);
+  }
+}
+
+/* Issues the next seek of a --bench-seeks run, to a pseudo random position */
+static void run_bench_seek (CustomData *data) {
+  gint64 position;
+
+  if (NULL == data->benchRand) {
+    /* First seek: the pipeline has just prerolled */
+    if (!gst_element_query_duration (data->playbin, GST_FORMAT_TIME, &data->duration) || data->duration <= 0) {
+      LOGD ("Could not query duration, can't bench seeks");
+      data->exitCode = -1;
+      quit_main_loop (data);
+      return;
+    }
+    if ((SEEK_MODE_INDEXED == data->seekMode || SEEK_MODE_SNAP == data->seekMode) && data->kfIndex) {
+      LOGD ("Waiting for the keyframe index");
+      keyframe_index_wait (data->kfIndex);
+    }
+    data->benchRand = g_rand_new_with_seed (BENCH_SEEK_SEED);
+    bench_start (data->bench);
+  }
+
+  position = (gint64)g_rand_double_range (data->benchRand, 0, (gdouble)data->duration);
+  seek_scheduler_seek (data->seeker, position, FALSE);
+}
+
+/* This function is called when the pipeline has finished an asynchronous state change,
+ * i.e. prerolled after going to PAUSED or after a flushing seek */
+static void async_done_cb (GstBus *bus, GstMessage *msg, CustomData *data) {
+  gint64 latency;
+
+  if (GST_MESSAGE_SRC (msg) != GST_OBJECT (data->playbin))
+    return;
+
+  /* Lets the next coalesced seek go */
+  latency = seek_scheduler_async_done (data->seeker);
+  metrics_observe_seek (data->metrics, latency);
+  input_replay_seek_done (data->replay, latency);
+  if (data->loopStart >= 0) {
+    /* --loop, once prerolled */
+    ab_loop_set (data->abLoop, data->loopStart, data->loopStop);
+    data->loopStart = -1;
+  }
+  if (NULL == data->bench || data->benchSeeks <= 0)
+    return;
+
+  if (latency >= 0) {
+    bench_add_seek_latency (data->bench, latency);
+  }
+  if (bench_seek_count (data->bench) >= (guint)data->benchSeeks) {
+    bench_report (data->bench);
+    quit_main_loop (data);
+  } else {
+    run_bench_seek (data);
+  }
+}
+
+/* The --bench-rates sweep is done */
+static void rate_sweep_done_cb (CustomData *data) {
+  bench_report (data->bench);
+  quit_main_loop (data);
+}
+
+/* The segment of an A-B loop has played out: wrap around without flushing */
+static void segment_done_cb (GstBus *bus, GstMessage *msg, CustomData *data) {
+  if (GST_MESSAGE_SRC (msg) != GST_OBJECT (data->playbin))
+    return;
+
+  seek_scheduler_segment_done (data->seeker);
+  if (data->bench && data->benchLoops > 0 && ab_loop_get_wraps (data->abLoop) >= (guint)data->benchLoops) {
+    bench_report (data->bench);
+    quit_main_loop (data);
+  }
+}
+
+/* Points the per-file helpers (keyframe index, thumbnails) at a new uri */
+static void set_current_uri (CustomData *data, const char *uri) {
+  g_free (data->uri);
+  data->uri = g_strdup (uri);
+  data->duration = GST_CLOCK_TIME_NONE;
+
+  keyframe_index_free (data->kfIndex);
+  data->kfIndex = NULL;
+  if (SEEK_MODE_INDEXED == data->seekMode || SEEK_MODE_SNAP == data->seekMode) {
+    /* Built (or loaded from the cache) in the background */
+    data->kfIndex = keyframe_index_open (uri);
+  }
+
+  thumbnailer_free (data->thumbnailer);
+  data->thumbnailer = NULL;
+  if (!data->headless && data->thumbnailCacheKb > 0) {
+    data->thumbnailer = thumbnailer_new (uri, (gsize)data->thumbnailCacheKb * 1024);
+  }
+}
+
+/* This function is called from a streaming thread when playbin has read all of the
+ * current item. Queuing the next uri here makes playbin build its source and demuxer
+ * while the current item drains, so it plays on without going back to READY */
+static void about_to_finish_cb (GstElement *playbin, CustomData *data) {
+  guint next = (guint)g_atomic_int_get (&data->queuedIndex) + 1;
+  gchar *uri = playlist_get_uri (data->playlist, next);
+
+  if (NULL == uri) {
+    LOGD ("Playlist item %u not available, stopping after this one", next);
+    return;
+  }
+  LOGD ("Queuing playlist item %u: %s", next, uri);
+  g_object_set (playbin, "uri", uri, NULL);
+  g_atomic_int_set (&data->queuedIndex, (gint)next);
+  g_free (uri);
+}
+
+/* This function is called when a new stream starts playing, which includes the switch
+ * to the next playlist item */
+static void stream_start_cb (GstBus *bus, GstMessage *msg, CustomData *data) {
+  guint queued = (guint)g_atomic_int_get (&data->queuedIndex);
+  gchar *uri;
+
+  if (NULL == data->playlist || data->mosaic || GST_MESSAGE_SRC (msg) != GST_OBJECT (data->playbin))
+    return;
+
+  if (queued != data->playlistIndex) {
+    data->playlistIndex = queued;
+    uri = playlist_get_uri (data->playlist, queued);
+    LOGD ("Now playing item %u: %s", queued, uri);
+    set_current_uri (data, uri);
+    g_free (uri);
+  }
+
+  /* Resolve the following item well before about-to-finish needs it */
+  playlist_prepare (data->playlist, data->playlistIndex + 1);
 }
 
 /* This function is called when the pipeline changes states. We use it to
@@ -419,14 +923,33 @@ static void state_changed_cb (GstBus *bus, GstMessage *msg, CustomData *data) {
       refresh_ui (data);
     }
 
-    if (data->isSleepInhibited && GST_STATE_PAUSED == new_state) {
-      /* Let him sleep */
-      inhibit_cpu_sleep (data, False);
+    if (GST_STATE_VOID_PENDING == pending_state) {
+      input_replay_state_changed (data->replay);
+    }
+    if (GST_STATE_PLAYING == new_state) {
+      /* Recorded and replayed times count from here */
+      input_recorder_start (data->recorder);
+      input_replay_start (data->replay);
+    }
+
+    if (data->bench && GST_STATE_PLAYING == new_state) {
+      bench_start (data->bench);
+      rate_sweep_start (data->rateSweep);
+    }
 
-    } else if (!(data->isSleepInhibited) && GST_STATE_PLAYING == new_state) {
-      /* Inhibit the sleep here */
-      inhibit_cpu_sleep (data, True);
+    if (data->pool && GST_STATE_PLAYING == new_state) {
+      prepare_next_input (data);
+      if (data->bench && data->benchSwitches > 0 && 0 == data->benchSwitchTimer && 0 == data->benchSwitchCount) {
+        data->benchSwitchTimer = g_timeout_add (BENCH_SWITCH_INTERVAL_MS, (GSourceFunc)bench_switch_cb, data);
+      }
+    }
 
+    /* Inhibit sleep while playing. Debounced and asynchronous, so pause toggling
+     * and seeks bouncing the state never wait on the session manager */
+    if (GST_STATE_PLAYING == new_state) {
+      power_manager_set_inhibited (data->powerManager, TRUE);
+    } else if (GST_STATE_PAUSED == new_state || GST_STATE_READY == new_state) {
+      power_manager_set_inhibited (data->powerManager, FALSE);
     }
   }
 }
@@ -526,6 +1049,43 @@ static void application_cb (GstBus *bus, GstMessage *msg, CustomData *data) {
   }
 }
 
+/* Checks the klass metadata of the element's factory, e.g. "Sink/Video" */
+static gboolean element_has_klass (GstElement *element, const char *klass) {
+  GstElementFactory *factory = gst_element_get_factory (element);
+  const gchar *elemKlass;
+
+  if (NULL == factory)
+    return FALSE;
+  elemKlass = gst_element_factory_get_metadata (factory, GST_ELEMENT_METADATA_KLASS);
+  return (NULL != elemKlass && NULL != strstr (elemKlass, klass));
+}
+
+static gboolean is_video_sink (GstElement *element) {
+  return element_has_klass (element, "Sink/Video");
+}
+
+/* Hooks the frame probes into the video sink that is actually used */
+static void video_sink_added (CustomData *data, GstElement *sink) {
+  if (data->videoSink)
+    return;
+
+  data->videoSink = gst_object_ref (sink);
+  ab_loop_watch_sink (data->abLoop, sink, "video");
+  av_sync_watch_sink (data->avSync, sink, FALSE);
+  subtitle_overlay_watch_video_sink (data->subtitles, sink);
+  metrics_watch_video_sink (data->metrics, sink);
+  input_replay_watch_video_sink (data->replay, sink);
+  startup_trace_watch_video_sink (data->startup, sink);
+  copy_stats_watch_video_sink (data->copyStats, sink);
+  if (data->bench) {
+    bench_watch_video_sink (data->bench, sink);
+  }
+  /* Pooled inputs are switched by hand, there is no gap to measure */
+  if (NULL == data->mosaic && data->poolSize < 0 && data->playlist && playlist_length (data->playlist) > 1) {
+    playlist_watch_video_sink (data->playlist, sink);
+  }
+}
+
 /* Callback function which will be invoked when a new element is added
    to playbin */
 static void element_setup_cb (GstElement *playbin, GstElement *element,  CustomData *data) {
@@ -533,137 +1093,835 @@ static void element_setup_cb (GstElement *playbin, GstElement *element,  CustomD
   char *elemName = gst_element_get_name(element);
   char *renderer = "renderer";
 
-  /* renderer is used for overlaying subtitle over text. Add property to add backround to subtitle */
+  /* renderer is used for overlaying subtitle over text. Add property to add backround to subtitle.
+   * Only plugged with --no-cached-subtitles, it shades every frame again */
   if (!strncmp(elemName, renderer, 8)) {
     LOGD("Setting property of text overlay renderer");
     g_object_set(G_OBJECT(element), "shaded-background", True, NULL);
   }
 
+  /* Counts what playsink's converters cost per frame */
+  copy_stats_watch_element (data->copyStats, element);
+
+  /* Fill levels for the metrics */
+  metrics_watch_element (data->metrics, element);
+
+  /* Watermarks and read-ahead of the network buffering queue */
+  buffering_watch_element (data->buffering, element);
+
+  /* Thread counts, queue limits and sink timing from --profile */
+  profile_apply (data->profile, element);
+
+  /* --memory-budget only ever lowers what the profile set */
+  memory_budget_apply (data->memoryBudget, element);
+
+  /* Autoplugged sinks are nested inside bins like autovideosink; watch the real one */
+  if (!GST_IS_BIN (element) && is_video_sink (element)) {
+    video_sink_added (data, element);
+  } else if (!GST_IS_BIN (element) && element_has_klass (element, "Sink/Audio")) {
+    ab_loop_watch_sink (data->abLoop, element, "audio");
+    av_sync_watch_sink (data->avSync, element, TRUE);
+  }
+
+  g_free (elemName);
 }
 
-/* function to print dbus error */
-void print_dbus_error (char *str, DBusError error)
-{
-  LOGD ("%s: %s", str, error.message);
-  dbus_error_free (&error);
-}
-
-/* This function will get the video uri from the uri passed by the user
-   For instance, if the uri is youtube link, this will get the vide uri
-   from youtube link, so that gstreamer can play the file */
-void get_video_uri(char *inputUri, char **opVideoUri) {
-  LOGD("Entered with i/p:%p o/p:%p", inputUri, opVideoUri);
-  char *videoUri = (char *)malloc (4096 * sizeof(char));
-  int ipUriSize = strlen(inputUri);
-
-  /* check whether the uri is a youtube link */
-  if (NULL != strstr(inputUri, "https")) {
-    if (NULL != strstr(inputUri, "youtube") || NULL != strstr(inputUri, "youtu.be")) {
-      LOGD("That's possibly a youtube link");
-      char command[4500] = "youtube-dl --format best[ext=mp4] --get-url ";
-      char tmpCmdTail[100] = " > /tmp/youtube_video_uri.txt";
-      int cmdSize = strlen (command);
-      FILE *tmpVideoUrifile;
-      memcpy(&command[cmdSize], inputUri, strlen(inputUri));
-      cmdSize = cmdSize + ipUriSize;
-      memcpy(&command[cmdSize], tmpCmdTail, 100);
-      cmdSize += 100;
-      system(command);
-
-      /* the video url will be written to /tmp/youtube_video_uri.txt. Read from there */
-      tmpVideoUrifile = fopen("/tmp/youtube_video_uri.txt", "r");
-      if (NULL == tmpVideoUrifile) {
-        LOGD(" Couldn't open file");
-      }
-      int size = fread(videoUri, 1024, 4, tmpVideoUrifile);
-      *opVideoUri = videoUri;
-    } else {
+/* Logs which element reads the input: vdmmapsrc for local files unless --no-mmap */
+static void source_setup_cb (GstElement *playbin, GstElement *source, CustomData *data) {
+  GstElementFactory *factory = gst_element_get_factory (source);
+
+  LOGD ("Source: %s", factory ? GST_OBJECT_NAME (factory) : GST_OBJECT_NAME (source));
+}
+
+/* The mosaic pipeline has no element-setup; its decoders are plugged by uridecodebin later on */
+static void mosaic_element_added_cb (GstBin *pipeline, GstBin *bin, GstElement *element, CustomData *data) {
+  profile_apply (data->profile, element);
+  memory_budget_apply (data->memoryBudget, element);
+}
+
+/* Starts the pipeline. Seek benchmarks run from the PAUSED state, driven by async_done_cb */
+static gboolean start_pipeline (CustomData *data) {
+  GstState state = (data->bench && data->benchSeeks > 0) ? GST_STATE_PAUSED : GST_STATE_PLAYING;
+  GstStateChangeReturn ret;
+
+  buffering_request_state (data->buffering, state);
+  ret = gst_element_set_state (data->playbin, state);
+  if (ret == GST_STATE_CHANGE_FAILURE) {
+    LOGE ("Unable to set the pipeline to the playing state.");
+    return FALSE;
+  }
+  return TRUE;
+}
+
+/* Sets the uri to play and starts the pipeline */
+static gboolean start_playback (CustomData *data, const char *uri) {
+  LOGD("Got Video URI: %s", uri);
+  /* Set the URI to play */
+  g_object_set (data->playbin, "uri", uri, NULL);
+  if (data->subFile) {
+    gchar *subUri = gst_uri_is_valid (data->subFile) ? g_strdup (data->subFile) :
+        gst_filename_to_uri (data->subFile, NULL);
+
+    g_object_set (data->playbin, "suburi", subUri, NULL);
+    g_free (subUri);
+  }
+  set_current_uri (data, uri);
+  return start_pipeline (data);
+}
 
+/* Creates the sink picked with --video-sink. X sinks use XShm by themselves when the
+   server has it. Returns NULL for "auto" so playbin autoplugs one, unless autoplug is
+   FALSE (the mosaic has no playbin to forward the window handle): then an overlay
+   capable X sink is used */
+static GstElement *make_video_sink (CustomData *data, gboolean autoplug) {
+  const char *name = data->videoSinkName ? data->videoSinkName : "auto";
+  GstElement *sink = NULL;
+
+  if (!strcmp (name, "xv")) {
+    sink = gst_element_factory_make ("xvimagesink", "videosink");
+  } else if (!strcmp (name, "x")) {
+    sink = gst_element_factory_make ("ximagesink", "videosink");
+  } else if (!strcmp (name, "gtk")) {
+    sink = gst_element_factory_make ("gtksink", "videosink");
+    if (sink) {
+      g_object_get (sink, "widget", &data->sinkWidget, NULL);
     }
+  } else if (strcmp (name, "auto")) {
+    LOGD ("Unknown video sink %s, using auto", name);
+  }
+
+  if (NULL == sink && strcmp (name, "auto")) {
+    LOGD ("Could not create the %s video sink", name);
+  }
+  if (NULL == sink && !autoplug) {
+    sink = gst_element_factory_make ("xvimagesink", "videosink");
+    if (NULL == sink)
+      sink = gst_element_factory_make ("ximagesink", "videosink");
+  }
+  return sink;
+}
+
+static void set_play_flag (CustomData *data, guint flag) {
+  guint flags;
+
+  g_object_get (data->playbin, "flags", &flags, NULL);
+  g_object_set (data->playbin, "flags", flags | flag, NULL);
+}
+
+/* The --simd-convert video filter. vdconvert takes I420 and NV12 only; a videoconvert
+   ahead of it brings 10 bit, 4:2:2 and other decoder formats to I420 and is passthrough
+   for the ones vdconvert takes. Keeps a reference to vdconvert in convertFilter */
+static GstElement *make_convert_filter (CustomData *data) {
+  GstElement *bin, *prepare, *convert;
+  GstPad *pad;
+
+  prepare = gst_element_factory_make ("videoconvert", NULL);
+  convert = gst_element_factory_make (VD_CONVERT_ELEMENT, NULL);
+  if (NULL == prepare || NULL == convert) {
+    LOGD ("Could not create the SIMD converter");
+    if (prepare)
+      gst_object_unref (prepare);
+    if (convert)
+      gst_object_unref (convert);
+    return NULL;
+  }
+
+  bin = gst_bin_new ("simdconvert");
+  gst_bin_add_many (GST_BIN (bin), prepare, convert, NULL);
+  gst_element_link (prepare, convert);
+  pad = gst_element_get_static_pad (prepare, "sink");
+  gst_element_add_pad (bin, gst_ghost_pad_new ("sink", pad));
+  gst_object_unref (pad);
+  pad = gst_element_get_static_pad (convert, "src");
+  gst_element_add_pad (bin, gst_ghost_pad_new ("src", pad));
+  gst_object_unref (pad);
+
+  data->convertFilter = gst_object_ref (convert);
+  return bin;
+}
+
+/* Headless fakesinks; --av-sync, --bench-switches and --memory-trace need them to play
+   in real time */
+static GstElement *make_headless_sink (CustomData *data, const char *name) {
+  GstElement *sink = bench_make_fakesink (name);
+
+  if (sink && (data->avSync || data->benchSwitches > 0 || data->memoryTrace)) {
+    g_object_set (sink, "sync", TRUE, NULL);
+  }
+  return sink;
+}
+
+/* PipelineMakeFunc for the pool: a playbin set up like the first one, with sinks of its
+   own. The video sink is always explicit so the pool can keep it from drawing */
+static GstElement *make_pool_pipeline (CustomData *data) {
+  GstElement *playbin = gst_element_factory_make ("playbin", NULL);
+  guint flags;
+
+  if (NULL == playbin)
+    return NULL;
+  if (data->headless) {
+    g_object_set (playbin, "video-sink", make_headless_sink (data, NULL),
+        "audio-sink", make_headless_sink (data, NULL), NULL);
   } else {
-    /* Assume that the passed uri is playable by playbin */
-    *opVideoUri = inputUri;
+    g_object_set (playbin, "video-sink", make_video_sink (data, FALSE), NULL);
+  }
+  /* The first pipeline's flags, but only Xv goes without converters; --simd-convert
+   * stays with the first pipeline */
+  g_object_get (data->playbin, "flags", &flags, NULL);
+  flags &= ~PLAY_FLAG_NATIVE_VIDEO;
+  if (!data->headless && !g_strcmp0 (data->videoSinkName, "xv")) {
+    flags |= PLAY_FLAG_NATIVE_VIDEO;
+  }
+  g_object_set (playbin, "flags", flags, NULL);
+  if (data->avOffset) {
+    g_object_set (playbin, "av-offset", (gint64)data->avOffset * GST_MSECOND, NULL);
+  }
+  g_signal_connect (G_OBJECT (playbin), "element-setup", (GCallback) element_setup_cb, data);
+  g_signal_connect (G_OBJECT (playbin), "source-setup", (GCallback) source_setup_cb, data);
+  return playbin;
+}
+
+/* The next item is the likeliest switch; the one switched away from is pooled already */
+static void prepare_next_input (CustomData *data) {
+  guint next = (data->playlistIndex + 1) % playlist_length (data->playlist);
+  gchar *uri;
+
+  if (next == data->playlistIndex)
+    return;
+  if (NULL == (uri = playlist_get_uri (data->playlist, next))) {
+    /* Prepared on the next switch once resolved */
+    playlist_prepare (data->playlist, next);
+    return;
+  }
+  pipeline_pool_prepare (data->pool, uri);
+  g_free (uri);
+}
+
+/* Shows playlist item index instead of the current one, out of the pool when it has it
+ * prerolled. The old pipeline stays paused where it was, for switching back. Everything
+ * that works on "the" pipeline follows the switch; subtitles, the A/V sync monitor and
+ * --simd-convert stay with the first one */
+static void switch_input (CustomData *data, guint index) {
+  GstElement *next, *sink;
+  gchar *uri;
+
+  if (NULL == data->pool || index == data->playlistIndex || index >= playlist_length (data->playlist))
+    return;
+  if (NULL == (uri = playlist_get_uri (data->playlist, index))) {
+    LOGD ("Playlist item %u not resolved yet", index);
+    playlist_prepare (data->playlist, index);
+    return;
+  }
+  if (NULL == (next = pipeline_pool_take (data->pool, uri))) {
+    g_free (uri);
+    return;
+  }
+  LOGI ("Switching to item %u: %s", index, uri);
+
+  gst_element_set_state (data->playbin, GST_STATE_PAUSED);
+  pipeline_pool_put (data->pool, data->playbin, data->uri);
+  data->playbin = data->overlay = next;
+  data->playlistIndex = index;
+  g_atomic_int_set (&data->queuedIndex, (gint)index);
+  set_current_uri (data, uri);
+  g_free (uri);
+
+  seek_scheduler_set_pipeline (data->seeker, next);
+  qos_controller_set_pipeline (data->qos, next);
+  ab_loop_set_pipeline (data->abLoop, next);
+  sink = pipeline_pool_get_video_sink (data->pool, next);
+  metrics_set_pipeline (data->metrics, next, sink);
+  copy_stats_set_video_sink (data->copyStats, sink);
+  if (data->bench) {
+    bench_set_video_sink (data->bench, sink);
+  }
+  gst_object_replace ((GstObject **)&data->videoSink, sink ? GST_OBJECT (sink) : NULL);
+  if (!data->headless && data->windowHandle) {
+    gst_video_overlay_set_window_handle (GST_VIDEO_OVERLAY (next), data->windowHandle);
+  }
+  if (GST_STATE_CHANGE_FAILURE == gst_element_set_state (next, GST_STATE_PLAYING)) {
+    LOGE ("Unable to play item %u", index);
+  }
+}
+
+/* --bench-switches: on to the next item every BENCH_SWITCH_INTERVAL_MS */
+static gboolean bench_switch_cb (CustomData *data) {
+  if (data->benchSwitchCount >= data->benchSwitches) {
+    data->benchSwitchTimer = 0;
+    bench_report (data->bench);
+    quit_main_loop (data);
+    return FALSE;
+  }
+  data->benchSwitchCount++;
+  switch_input (data, (data->playlistIndex + 1) % playlist_length (data->playlist));
+  return TRUE;
+}
+
+/* Builds the compositor pipeline out of all playlist inputs. Inputs needing an external
+   resolver are only used when their uri is cached */
+static gboolean create_mosaic (CustomData *data) {
+  GPtrArray *inputs = g_ptr_array_new_with_free_func (g_free);
+  GstElement *sink;
+  const char *input;
+  gchar *uri;
+  guint i;
+
+  for (i = 0; i < playlist_length (data->playlist); i++) {
+    input = playlist_get_input (data->playlist, i);
+    uri = g_str_has_prefix (input, MOSAIC_TEST_SOURCE) ? g_strdup (input) : uri_resolver_lookup (data->resolver, input);
+    if (uri) {
+      g_ptr_array_add (inputs, uri);
+    } else {
+      LOGD ("Leaving %s out of the mosaic, it is not resolved yet", input);
+    }
+  }
+
+  sink = data->headless ? make_headless_sink (data, "videosink") : make_video_sink (data, FALSE);
+  if (sink) {
+    gst_object_ref_sink (sink);
+    data->mosaic = mosaic_new ((const char * const *)inputs->pdata, inputs->len, sink);
+  }
+  g_ptr_array_free (inputs, TRUE);
+  if (NULL == data->mosaic) {
+    if (sink)
+      gst_object_unref (sink);
+    return FALSE;
+  }
+
+  data->playbin = gst_object_ref (mosaic_get_pipeline (data->mosaic));
+  /* The pipeline keeps the sink alive */
+  data->overlay = GST_IS_VIDEO_OVERLAY (sink) ? sink : NULL;
+  video_sink_added (data, sink);
+  gst_object_unref (sink);
+  if (data->bench) {
+    bench_add_section (data->bench, "tiles", (BenchSectionFunc)mosaic_append_json, data->mosaic);
+  }
+  return TRUE;
+}
+
+/* This function is called from the main loop when the external resolver (youtube-dl)
+   has turned the input into a playable uri */
+static void uri_resolved_cb (const char *input, const char *uri, CustomData *data) {
+  if (NULL == uri || !start_playback (data, uri)) {
+    LOGE ("Can't play %s", input);
+    data->exitCode = -1;
+    quit_main_loop (data);
+  }
+}
+
+/* Local files, plain uris and cached links start right away. Anything else is
+ * resolved in the background while playbin sits in READY */
+static gboolean start_input (CustomData *data) {
+  const char *input = playlist_get_input (data->playlist, 0);
+  gchar *uri;
+  gboolean ret;
+
+  if (data->mosaic) {
+    ret = start_pipeline (data);
+  } else if (NULL != (uri = uri_resolver_lookup (data->resolver, input))) {
+    ret = start_playback (data, uri);
+    g_free (uri);
+  } else {
+    gst_element_set_state (data->playbin, GST_STATE_READY);
+    uri_resolver_resolve_async (data->resolver, input, (UriResolvedFunc)uri_resolved_cb, data);
+    ret = TRUE;
+  }
+  startup_trace_mark (data->startup, "pipeline_started");
+  return ret;
+}
+
+/* --extract-frames: batch mode over every playlist input, without a player. Inputs
+ * needing an external resolver are only used when their uri is cached */
+static int run_frame_extract (CustomData *data) {
+  GPtrArray *uris = g_ptr_array_new_with_free_func (g_free);
+  FrameExtractOptions options = { 0 };
+  gchar **times = NULL;
+  const char *input;
+  gchar *uri, *end;
+  gint64 position;
+  int ret = -1;
+  guint i;
+
+  options.outDir = data->extractDir;
+  options.interval = data->extractInterval > 0 ? (gint64)(data->extractInterval * GST_SECOND) : FRAME_EXTRACT_DEFAULT_INTERVAL;
+  options.accurate = data->extractAccurate;
+  options.workers = (guint)MAX (data->extractWorkers, 0);
+  if (!g_strcmp0 (data->extractFormat, "png")) {
+    options.png = TRUE;
+  } else if (data->extractFormat && g_strcmp0 (data->extractFormat, "jpeg")) {
+    LOGE ("Unknown --extract-format %s, expected jpeg or png", data->extractFormat);
+    goto Exit;
+  }
+  if (data->extractTimes) {
+    options.times = g_array_new (FALSE, FALSE, sizeof (gint64));
+    times = g_strsplit (data->extractTimes, ",", -1);
+    for (i = 0; times[i]; i++) {
+      gdouble seconds = g_ascii_strtod (times[i], &end);
+
+      if (end == times[i] || *end || seconds < 0) {
+        LOGE ("Bad --extract-times entry \"%s\", expected seconds", times[i]);
+        goto Exit;
+      }
+      position = (gint64)(seconds * GST_SECOND);
+      g_array_append_val (options.times, position);
+    }
+  }
+
+  for (i = 0; i < playlist_length (data->playlist); i++) {
+    input = playlist_get_input (data->playlist, i);
+    uri = uri_resolver_lookup (data->resolver, input);
+    if (uri) {
+      g_ptr_array_add (uris, uri);
+    } else {
+      LOGW ("Skipping %s, it is not resolved yet", input);
+    }
+  }
+  ret = frame_extract_run ((const char * const *)uris->pdata, uris->len, &options);
+
+Exit:
+  g_strfreev (times);
+  if (options.times)
+    g_array_free (options.times, TRUE);
+  g_ptr_array_free (uris, TRUE);
+  return ret;
+}
+
+/* Parses our own command line options; leaves the input uri in argv[1] */
+static gboolean parse_options (CustomData *data, int *argc, char ***argv) {
+  GOptionContext *context;
+  GError *err = NULL;
+  gboolean ret;
+  gchar *seekMode = NULL;
+  gchar *loop = NULL;
+  gdouble loopStart, loopStop;
+  GOptionEntry entries[] = {
+    { "headless", 0, 0, G_OPTION_ARG_NONE, &data->headless, "Play without a window, into fakesinks", NULL },
+    { "bench", 0, 0, G_OPTION_ARG_NONE, &data->benchEnabled, "Print a JSON throughput report at end of stream", NULL },
+    { "bench-seeks", 0, 0, G_OPTION_ARG_INT, &data->benchSeeks, "With --bench, measure N seeks instead of playing", "N" },
+    { "bench-rates", 0, 0, G_OPTION_ARG_NONE, &data->benchRates, "With --bench, measure fps and CPU at each playback rate instead of playing", NULL },
+    { "loop", 0, 0, G_OPTION_ARG_STRING, &loop, "Loop between two positions, in seconds", "START:END" },
+    { "bench-loops", 0, 0, G_OPTION_ARG_INT, &data->benchLoops, "With --bench and --loop, measure N loop wraps instead of playing", "N" },
+    { "sub-file", 0, 0, G_OPTION_ARG_FILENAME, &data->subFile, "Subtitle file (or uri) shown over the video", "FILE" },
+    { "no-cached-subtitles", 0, G_OPTION_FLAG_REVERSE, G_OPTION_ARG_NONE, &data->cachedSubtitles, "Render subtitles with playsink's text overlay on every frame", NULL },
+    { "metrics-socket", 0, 0, G_OPTION_ARG_FILENAME, &data->metricsSocket, "Serve Prometheus metrics on this Unix socket", "PATH" },
+    { "record", 0, 0, G_OPTION_ARG_FILENAME, &data->recordFile, "Append key, click and slider events to FILE", "FILE" },
+    { "replay", 0, 0, G_OPTION_ARG_FILENAME, &data->replayFile, "Replay the events of FILE, print input latency percentiles and exit", "FILE" },
+    { "av-sync", 0, 0, G_OPTION_ARG_NONE, &data->avSyncEnabled, "Measure A/V drift, seek recovery and sync mark offsets; headless runs play in real time", NULL },
+    { "av-offset", 0, 0, G_OPTION_ARG_INT, &data->avOffset, "Delay audio by MS against video, negative delays video", "MS" },
+    { "pool", 0, 0, G_OPTION_ARG_INT, &data->poolSize, "Keep N inputs prerolled for instant switching (Page Up/Down, 1-9)", "N" },
+    { "bench-switches", 0, 0, G_OPTION_ARG_INT, &data->benchSwitches, "With --bench and --pool, measure N input switches instead of playing", "N" },
+    { "seek-mode", 0, 0, G_OPTION_ARG_STRING, &seekMode, "Seek flags: indexed (default), snap, key or accurate", "MODE" },
+    { "thumbnail-cache", 0, 0, G_OPTION_ARG_INT, &data->thumbnailCacheKb, "Slider preview cache size in KB, 0 disables previews", "KB" },
+    { "resolver", 0, 0, G_OPTION_ARG_STRING, &data->resolverCommand, "Command turning links into playable uris, the link is appended", "COMMAND" },
+    { "mosaic", 0, 0, G_OPTION_ARG_NONE, &data->mosaicEnabled, "Show all inputs at once in a grid", NULL },
+    { "video-sink", 0, 0, G_OPTION_ARG_STRING, &data->videoSinkName, "Video output: auto (default), xv, x or gtk", "SINK" },
+    { "simd-convert", 0, 0, G_OPTION_ARG_NONE, &data->simdConvert, "Convert and scale to the window size with the built-in SIMD converter", NULL },
+    { "bench-convert", 0, 0, G_OPTION_ARG_NONE, &data->benchConvert, "Check and benchmark the SIMD converter kernels, then exit", NULL },
+    { "startup-trace", 0, 0, G_OPTION_ARG_NONE, &data->startupTrace, "Print the time of each startup phase up to the first frame as JSON", NULL },
+    { "serial-startup", 0, 0, G_OPTION_ARG_NONE, &data->serialStartup, "Build the window before starting the pipeline, for comparing start up times", NULL },
+    { "extract-frames", 0, 0, G_OPTION_ARG_FILENAME, &data->extractDir, "Write stills of every input to DIR and print files/s and frames/s, then exit", "DIR" },
+    { "extract-interval", 0, 0, G_OPTION_ARG_DOUBLE, &data->extractInterval, "With --extract-frames, one frame every SECONDS (10 by default)", "SECONDS" },
+    { "extract-times", 0, 0, G_OPTION_ARG_STRING, &data->extractTimes, "With --extract-frames, frames at these positions instead", "T1,T2,..." },
+    { "extract-format", 0, 0, G_OPTION_ARG_STRING, &data->extractFormat, "With --extract-frames, jpeg (default) or png", "FORMAT" },
+    { "extract-accurate", 0, 0, G_OPTION_ARG_NONE, &data->extractAccurate, "With --extract-frames, seek frame accurately instead of to the nearest keyframe", NULL },
+    { "extract-workers", 0, 0, G_OPTION_ARG_INT, &data->extractWorkers, "With --extract-frames, inputs decoded at once, one per core by default", "N" },
+    { "bench-log", 0, 0, G_OPTION_ARG_NONE, &data->benchLog, "Measure ns per log call against plain printf, then exit", NULL },
+    { "bench-cpu-load", 0, 0, G_OPTION_ARG_INT, &data->cpuLoad, "With --bench, keep N busy loop threads running as CPU pressure", "N" },
+    { "no-qos", 0, G_OPTION_FLAG_REVERSE, G_OPTION_ARG_NONE, &data->qosEnabled, "Never degrade decoding or scaling when frames are late", NULL },
+    { "no-buffering", 0, G_OPTION_FLAG_REVERSE, G_OPTION_ARG_NONE, &data->bufferingEnabled, "Don't download ahead or pause to refill network streams", NULL },
+    { "no-mmap", 0, G_OPTION_FLAG_REVERSE, G_OPTION_ARG_NONE, &data->mmapEnabled, "Read local files with filesrc instead of mapping them", NULL },
+    { "profile", 0, 0, G_OPTION_ARG_STRING, &data->profileName, "Element tuning preset: throughput, low-latency, low-latency-audio or low-memory", "NAME" },
+    { "profile-file", 0, 0, G_OPTION_ARG_FILENAME, &data->profileFile, "Key file of element properties by factory name, applied after --profile", "FILE" },
+    { "memory-budget", 0, 0, G_OPTION_ARG_INT, &data->memoryBudgetMb, "Fit queues, decoded frames and decoder threads in MB, implies --memory-trace", "MB" },
+    { "memory-trace", 0, 0, G_OPTION_ARG_NONE, &data->memoryTrace, "Count live GstMemory bytes per element; headless runs play in real time", NULL },
+    { NULL }
+  };
+
+  context = g_option_context_new ("URI|FILE|PLAYLIST.m3u... - play videos back to back");
+  g_option_context_add_main_entries (context, entries, NULL);
+  /* GTK and GStreamer options are parsed by gtk_init and gst_init */
+  g_option_context_set_ignore_unknown_options (context, TRUE);
+  ret = g_option_context_parse (context, argc, argv, &err);
+  if (!ret) {
+    LOGE ("Option parsing failed: %s", err->message);
+    g_clear_error (&err);
+  } else if (*argc < 2 && !data->benchConvert && !data->benchLog) {
+    gchar *help = g_option_context_get_help (context, TRUE, NULL);
+    printf ("%s", help);
+    g_free (help);
+    ret = FALSE;
+  }
+  g_option_context_free (context);
+
+  if (!g_strcmp0 (seekMode, "key")) {
+    data->seekMode = SEEK_MODE_KEY;
+  } else if (!g_strcmp0 (seekMode, "accurate")) {
+    data->seekMode = SEEK_MODE_ACCURATE;
+  } else if (!g_strcmp0 (seekMode, "snap")) {
+    data->seekMode = SEEK_MODE_SNAP;
+  } else if (seekMode && g_strcmp0 (seekMode, "indexed")) {
+    LOGD ("Unknown seek mode %s, using indexed", seekMode);
   }
-  LOGD("Exiting");
+  g_free (seekMode);
+
+  if (loop && (2 != sscanf (loop, "%lf:%lf", &loopStart, &loopStop) || loopStart < 0 || loopStop <= loopStart)) {
+    LOGE ("Bad --loop %s, expected START:END in seconds", loop);
+    ret = FALSE;
+  } else if (loop) {
+    data->loopStart = (gint64)(loopStart * GST_SECOND);
+    data->loopStop = (gint64)(loopStop * GST_SECOND);
+  }
+  g_free (loop);
+  return ret;
 }
 
 int main(int argc, char *argv[]) {
   CustomData data;
-  GstStateChangeReturn ret;
   GstBus *bus;
-  DBusError dbusError;
-  char *fileUri = NULL;
-
-  /* Initialize GTK */
-  gtk_init (&argc, &argv);
+  const char *input;
+  int i;
 
-  /* Initialize GStreamer */
-  gst_init (&argc, &argv);
-  LOGD("Going to play:%s", argv[1]);
+  /* Log records are written out by a background thread from here on */
+  log_init ();
 
   /* Initialize our data structure */
   memset (&data, 0, sizeof (data));
+  data.startTime = g_get_monotonic_time ();
+  data.mainThread = g_thread_self ();
+  g_mutex_init (&data.windowLock);
+  g_cond_init (&data.windowCond);
   data.duration = GST_CLOCK_TIME_NONE;
+  data.loopStart = -1;
+  data.cachedSubtitles = TRUE;
+  data.thumbnailCacheKb = THUMBNAIL_DEFAULT_BUDGET / 1024;
+  data.qosEnabled = TRUE;
+  data.bufferingEnabled = TRUE;
+  data.mmapEnabled = TRUE;
+  data.poolSize = -1;
+
+  if (!parse_options (&data, &argc, &argv)) {
+    return -1;
+  }
+  if (data.benchLog) {
+    return log_bench_run ();
+  }
+  data.startup = startup_trace_new (data.startTime, data.startupTrace);
+  startup_trace_mark (data.startup, "options");
+
+  /* Initialize GTK. Headless runs must work without a display */
+  if (!data.headless && !data.benchConvert && !data.extractDir) {
+    gtk_init (&argc, &argv);
+    startup_trace_mark (data.startup, "gtk_init");
+  }
+
+  /* Initialize GStreamer */
+  gst_init (&argc, &argv);
+  vd_convert_register ();
+  if (data.mmapEnabled) {
+    vd_mmap_src_register ();
+  }
+  if (data.memoryBudgetMb > 0) {
+    data.memoryBudget = memory_budget_new ((gsize)data.memoryBudgetMb * 1024 * 1024);
+    data.memoryTrace = TRUE;
+  }
+  if (data.memoryTrace) {
+    /* Before any element allocates */
+    data.memTracer = vd_mem_tracer_new ();
+  }
+  startup_trace_mark (data.startup, "gst_init");
+  if (data.benchConvert) {
+    return convert_bench_run ();
+  }
+
+  /* Every remaining argument is a playlist item */
+  data.resolver = uri_resolver_new (data.resolverCommand);
+  data.playlist = playlist_new (data.resolver);
+  for (i = 1; i < argc; i++) {
+    playlist_add (data.playlist, argv[i]);
+  }
+  if (0 == playlist_length (data.playlist)) {
+    LOGE ("Nothing to play");
+    return -1;
+  }
+  input = playlist_get_input (data.playlist, 0);
+  LOGD("Going to play:%s (%u items)", input, playlist_length (data.playlist));
+
+  if (data.poolSize >= 0 && (data.mosaicEnabled || !g_strcmp0 (data.videoSinkName, "gtk"))) {
+    /* The mosaic plays every input at once; gtksink brings a widget per pipeline */
+    LOGE ("--pool can't be used with --mosaic or --video-sink=gtk");
+    return -1;
+  }
+  if (data.poolSize >= 0 && (data.avSyncEnabled || data.replayFile || data.subFile || data.simdConvert)) {
+    /* These watch or change the first pipeline's sinks and filters only */
+    LOGE ("--pool can't be used with --av-sync, --replay, --sub-file or --simd-convert");
+    return -1;
+  }
+
+  if (data.extractDir) {
+    return run_frame_extract (&data);
+  }
+
+  if ((data.profileName || data.profileFile) &&
+      NULL == (data.profile = profile_new (data.profileName, data.profileFile))) {
+    return -1;
+  }
+
+  data.copyStats = copy_stats_new ();
+  if (data.benchEnabled) {
+    data.bench = bench_new (input);
+    bench_add_section (data.bench, "copies", (BenchSectionFunc)copy_stats_append_json, data.copyStats);
+    bench_add_section (data.bench, "startup_ms", (BenchSectionFunc)startup_trace_append_json, data.startup);
+    if (data.memoryBudget) {
+      bench_add_section (data.bench, "memory_budget", (BenchSectionFunc)memory_budget_append_json, data.memoryBudget);
+    }
+    if (data.memTracer) {
+      bench_add_section (data.bench, "memory", (BenchSectionFunc)vd_mem_tracer_append_json, data.memTracer);
+    }
+  }
 
   /* Create the elements */
-  data.playbin = gst_element_factory_make ("playbin", "playbin");
+  if (data.mosaicEnabled) {
+    if (!create_mosaic (&data)) {
+      LOGE ("Could not build the mosaic");
+      return -1;
+    }
+  } else {
+    data.playbin = gst_element_factory_make ("playbin", "playbin");
+    data.overlay = data.playbin;
+  }
 
   if (!data.playbin) {
-    LOGD ("Not all elements could be created.");
+    LOGE ("Not all elements could be created.");
     return -1;
   }
 
-  get_video_uri(argv[1], &fileUri);
-  LOGD("Got Video URI: %s", fileUri);
-  /* Set the URI to play */
-  g_object_set (data.playbin, "uri", fileUri, NULL);
+  data.seeker = seek_scheduler_new (data.playbin, (SeekFlagsFunc)seek_flags_cb, &data);
+  data.abLoop = ab_loop_new (data.playbin, data.seeker);
+  if (data.avSyncEnabled) {
+    data.avSync = av_sync_new ();
+  }
+  if (data.recordFile && NULL == (data.recorder = input_recorder_new (data.recordFile))) {
+    return -1;
+  }
+  if (data.replayFile && NULL == (data.replay = input_replay_new (data.replayFile, (InputDispatchFunc)replay_input_cb,
+      (InputReplayDoneFunc)replay_done_cb, &data))) {
+    return -1;
+  }
+  /* Pooled pipelines keep playsink's own text overlay */
+  if (NULL == data.mosaic && data.cachedSubtitles && data.poolSize < 0) {
+    data.subtitles = subtitle_overlay_new (data.playbin);
+  }
+
+  if (data.mosaic) {
+    /* No playbin signals; the sinks are already in place */
+    g_signal_connect (G_OBJECT (data.playbin), "deep-element-added", (GCallback) mosaic_element_added_cb, &data);
+  } else if (data.headless) {
+    GstElement *videoSink = make_headless_sink (&data, "videosink");
+    GstElement *audioSink = make_headless_sink (&data, "audiosink");
+
+    g_object_set (data.playbin, "video-sink", videoSink, "audio-sink", audioSink, NULL);
+    video_sink_added (&data, videoSink);
+    ab_loop_watch_sink (data.abLoop, audioSink, "audio");
+    av_sync_watch_sink (data.avSync, audioSink, TRUE);
+  } else {
+    /* Pooled pipelines are handed over with their sinks */
+    GstElement *videoSink = make_video_sink (&data, data.poolSize < 0);
 
-  /* Connect to interesting signals in playbin */
-  g_signal_connect (G_OBJECT (data.playbin), "video-tags-changed", (GCallback) tags_cb, &data);
-  g_signal_connect (G_OBJECT (data.playbin), "audio-tags-changed", (GCallback) tags_cb, &data);
-  g_signal_connect (G_OBJECT (data.playbin), "text-tags-changed", (GCallback) tags_cb, &data);
-  g_signal_connect (G_OBJECT (data.playbin), "element-setup", (GCallback) element_setup_cb, &data);
+    if (videoSink) {
+      g_object_set (data.playbin, "video-sink", videoSink, NULL);
+      video_sink_added (&data, videoSink);
+    }
+    if (videoSink && !g_strcmp0 (data.videoSinkName, "xv") && !data.simdConvert) {
+      /* Xv takes the decoders' YUV formats as they are. Without converters in
+       * between, the ALLOCATION query reaches the sink and decoders write straight
+       * into its shared memory XvImage pool */
+      set_play_flag (&data, PLAY_FLAG_NATIVE_VIDEO);
+    }
+  }
 
-  /* Create the GUI */
-  create_ui (&data);
+  if (NULL == data.mosaic && data.simdConvert) {
+    GstElement *filter = make_convert_filter (&data);
 
-  /* initiate a dbus connection to session bus */
-  data.sessionBus = dbus_bus_get (DBUS_BUS_SESSION, &dbusError);
-  if (dbus_error_is_set (&dbusError) || !(data.sessionBus)) {
-    print_dbus_error("error in Dbus connection", dbusError);
-  } else {
-    inhibit_cpu_sleep(&data, True);
+    if (filter) {
+      g_object_set (data.playbin, "video-filter", filter, NULL);
+      copy_stats_watch_element (data.copyStats, data.convertFilter);
+      /* BGRx in the window size is what the X and GTK sinks take as is; leave out
+       * playsink's generic converters. Others still get them */
+      if (data.headless || !g_strcmp0 (data.videoSinkName, "x") || !g_strcmp0 (data.videoSinkName, "gtk")) {
+        set_play_flag (&data, PLAY_FLAG_NATIVE_VIDEO);
+      }
+    }
   }
 
+  if (NULL == data.mosaic && data.avOffset) {
+    /* playsink turns it into a ts-offset on the sink that has to wait */
+    g_object_set (data.playbin, "av-offset", (gint64)data.avOffset * GST_MSECOND, NULL);
+  }
+
+  if (NULL == data.mosaic) {
+    /* Connect to interesting signals in playbin */
+    g_signal_connect (G_OBJECT (data.playbin), "video-tags-changed", (GCallback) tags_cb, &data);
+    g_signal_connect (G_OBJECT (data.playbin), "audio-tags-changed", (GCallback) tags_cb, &data);
+    g_signal_connect (G_OBJECT (data.playbin), "text-tags-changed", (GCallback) tags_cb, &data);
+    g_signal_connect (G_OBJECT (data.playbin), "element-setup", (GCallback) element_setup_cb, &data);
+    g_signal_connect (G_OBJECT (data.playbin), "source-setup", (GCallback) source_setup_cb, &data);
+    if (playlist_length (data.playlist) > 1 && data.poolSize < 0) {
+      g_signal_connect (G_OBJECT (data.playbin), "about-to-finish", (GCallback) about_to_finish_cb, &data);
+    }
+  }
 
   /* Instruct the bus to emit signals for each received message, and connect to the interesting signals */
   bus = gst_element_get_bus (data.playbin);
   gst_bus_add_signal_watch (bus);
   g_signal_connect (G_OBJECT (bus), "message::error", (GCallback)error_cb, &data);
   g_signal_connect (G_OBJECT (bus), "message::eos", (GCallback)eos_cb, &data);
+  g_signal_connect (G_OBJECT (bus), "message::segment-done", (GCallback)segment_done_cb, &data);
   g_signal_connect (G_OBJECT (bus), "message::state-changed", (GCallback)state_changed_cb, &data);
   g_signal_connect (G_OBJECT (bus), "message::application", (GCallback)application_cb, &data);
+  g_signal_connect (G_OBJECT (bus), "message::async-done", (GCallback)async_done_cb, &data);
+  g_signal_connect (G_OBJECT (bus), "message::stream-start", (GCallback)stream_start_cb, &data);
+  gst_bus_enable_sync_message_emission (bus);
+  g_signal_connect (G_OBJECT (bus), "sync-message::element", (GCallback)prepare_window_handle_cb, &data);
+  g_signal_connect (G_OBJECT (bus), "sync-message::state-changed", (GCallback)sync_state_changed_cb, &data);
+  if (data.bench) {
+    bench_watch_bus (data.bench, bus);
+  }
+  if (data.qosEnabled) {
+    data.qos = qos_controller_new (data.playbin, bus, data.seeker);
+    if (data.bench) {
+      bench_add_section (data.bench, "qos", (BenchSectionFunc)qos_controller_append_json, data.qos);
+    }
+  }
+  if (data.poolSize >= 0) {
+    /* Every pipeline posts on this bus, the handlers above only follow data.playbin */
+    data.pool = pipeline_pool_new ((guint)data.poolSize, bus, (PipelineMakeFunc)make_pool_pipeline, &data);
+    if (data.bench) {
+      bench_add_section (data.bench, "switches", (BenchSectionFunc)pipeline_pool_append_json, data.pool);
+    }
+  }
+  /* Buffering pauses and resumes one pipeline; pooled switches would leave it behind */
+  if (NULL == data.mosaic && data.bufferingEnabled && NULL == data.pool) {
+    data.buffering = buffering_new (data.playbin, bus);
+    if (data.bench) {
+      bench_add_section (data.bench, "buffering", (BenchSectionFunc)buffering_append_json, data.buffering);
+    }
+  }
+  if (data.bench && data.benchRates) {
+    data.rateSweep = rate_sweep_new (data.playbin, data.seeker, data.bench, (RateSweepDoneFunc)rate_sweep_done_cb, &data);
+    bench_add_section (data.bench, "rates", (BenchSectionFunc)rate_sweep_append_json, data.rateSweep);
+  }
+  if (data.bench && data.subtitles) {
+    bench_add_section (data.bench, "subtitles", (BenchSectionFunc)subtitle_overlay_append_json, data.subtitles);
+  }
+  if (data.bench && data.loopStop > 0) {
+    bench_add_section (data.bench, "loop", (BenchSectionFunc)ab_loop_append_json, data.abLoop);
+  }
+  if (data.bench && data.avSync) {
+    bench_add_section (data.bench, "av_sync", (BenchSectionFunc)av_sync_append_json, data.avSync);
+  }
+  if (data.metricsSocket) {
+    if (NULL == (data.metrics = metrics_new (data.playbin, bus, data.metricsSocket))) {
+      gst_object_unref (bus);
+      return -1;
+    }
+    /* Sinks set up front were added before there were metrics */
+    if (data.videoSink) {
+      metrics_watch_video_sink (data.metrics, data.videoSink);
+    }
+  }
+  if (data.bench && data.cpuLoad > 0) {
+    bench_start_cpu_load (data.bench, (guint)data.cpuLoad);
+  }
   gst_object_unref (bus);
 
-  /* Start playing */
-  ret = gst_element_set_state (data.playbin, GST_STATE_PLAYING);
-  if (ret == GST_STATE_CHANGE_FAILURE) {
-    LOGD ("Unable to set the pipeline to the playing state.");
+  startup_trace_mark (data.startup, "pipeline");
+
+  /* The pipeline prerolls in its own threads while the window is being built; the
+   * video sink waits for the window handle in prepare_window_handle_cb */
+  if (!data.serialStartup && !start_input (&data)) {
+    gst_object_unref (data.playbin);
+    mosaic_free (data.mosaic);
+    return -1;
+  }
+
+  if (data.headless) {
+    data.loop = g_main_loop_new (NULL, FALSE);
+  } else {
+    /* Create the GUI */
+    create_ui (&data);
+    startup_trace_mark (data.startup, "ui");
+
+    /* initiate a dbus connection to session bus; sleep gets inhibited once we play */
+    data.powerManager = power_manager_new (APPLICATION_NAME);
+    startup_trace_mark (data.startup, "session_bus");
+  }
+
+  if (data.serialStartup && !start_input (&data)) {
     gst_object_unref (data.playbin);
+    mosaic_free (data.mosaic);
     return -1;
   }
 
-  /* Register a function that GLib will call every second */
-  g_timeout_add_seconds (1, (GSourceFunc)refresh_ui, &data);
+  if (data.headless) {
+    g_main_loop_run (data.loop);
+    g_main_loop_unref (data.loop);
+  } else {
+    /* Register a function that GLib will call every second */
+    g_timeout_add_seconds (1, (GSourceFunc)refresh_ui, &data);
 
-  /* Start the GTK main loop. We will not regain control until gtk_main_quit is called. */
-  gtk_main ();
+    /* Start the GTK main loop. We will not regain control until gtk_main_quit is called. */
+    gtk_main ();
+  }
 
   /* remove dbus coneciton to session bus */
-  dbus_connection_flush (data.sessionBus);
+  power_manager_free (data.powerManager);
 
   /* Free resources */
   gst_element_set_state (data.playbin, GST_STATE_NULL);
+  if (data.benchSwitchTimer) {
+    g_source_remove (data.benchSwitchTimer);
+  }
+  pipeline_pool_free (data.pool);
+  metrics_free (data.metrics);
+  qos_controller_free (data.qos);
+  buffering_free (data.buffering);
+  rate_sweep_free (data.rateSweep);
+  ab_loop_free (data.abLoop);
+  av_sync_free (data.avSync);
+  subtitle_overlay_free (data.subtitles);
+  input_replay_free (data.replay);
+  input_recorder_free (data.recorder);
+  seek_scheduler_free (data.seeker);
+  thumbnailer_free (data.thumbnailer);
   gst_object_unref (data.playbin);
-  return 0;
+  mosaic_free (data.mosaic);
+  copy_stats_free (data.copyStats);
+  if (data.convertFilter) {
+    gst_object_unref (data.convertFilter);
+  }
+  keyframe_index_free (data.kfIndex);
+  bench_free (data.bench);
+  startup_trace_free (data.startup);
+  playlist_free (data.playlist);
+  uri_resolver_free (data.resolver);
+  profile_free (data.profile);
+  memory_budget_free (data.memoryBudget);
+  if (data.videoSink) {
+    gst_object_unref (data.videoSink);
+  }
+  g_free (data.resolverCommand);
+  g_free (data.videoSinkName);
+  g_free (data.profileName);
+  g_free (data.profileFile);
+  g_free (data.subFile);
+  g_free (data.metricsSocket);
+  g_free (data.recordFile);
+  g_free (data.replayFile);
+  g_free (data.uri);
+  if (data.benchRand) {
+    g_rand_free (data.benchRand);
+  }
+  g_mutex_clear (&data.windowLock);
+  g_cond_clear (&data.windowCond);
+  return data.exitCode;
 }